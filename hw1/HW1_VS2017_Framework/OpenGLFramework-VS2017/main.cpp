@@ -2,10 +2,14 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <chrono>
 #include<math.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include "textfile.h"
+#include "meshcache.h"
+#include "meshindex.h"
+#include "meshbounds.h"
 
 #include "Vectors.h"
 #include "Matrices.h"
@@ -91,6 +95,7 @@ typedef struct
 	GLuint p_normal;
 	int materialId;
 	int indexCount;
+	GLenum indexType;
 	GLuint m_texture;
 } Shape;
 Shape quad;
@@ -416,7 +421,7 @@ void RenderScene(void) {
 	// use uniform to send mvp to vertex shader
 	glUniformMatrix4fv(iLocMVP, 1, GL_FALSE, mvp);
 	glBindVertexArray(m_shape_list[cur_idx].vao);
-	glDrawArrays(GL_TRIANGLES, 0, m_shape_list[cur_idx].vertex_count);
+	glDrawElements(GL_TRIANGLES, m_shape_list[cur_idx].indexCount, m_shape_list[cur_idx].indexType, 0);
 	drawPlane();
 
 }
@@ -631,101 +636,19 @@ void setShaders()
     }
 }
 
-void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<GLfloat>& colors, tinyobj::shape_t* shape)
+// Per-model stage: centre the model at the origin and scale its largest axis
+// to [-1, 1]. Runs once per model, before the shape is expanded.
+void normalization(tinyobj::attrib_t* attrib)
 {
-	vector<float> xVector, yVector, zVector;
-	float minX = 10000, maxX = -10000, minY = 10000, maxY = -10000, minZ = 10000, maxZ = -10000;
-
-	// find out min and max value of X, Y and Z axis
-	for (int i = 0; i < attrib->vertices.size(); i++)
-	{
-		//maxs = max(maxs, attrib->vertices.at(i));
-		if (i % 3 == 0)
-		{
-
-			xVector.push_back(attrib->vertices.at(i));
-
-			if (attrib->vertices.at(i) < minX)
-			{
-				minX = attrib->vertices.at(i);
-			}
-
-			if (attrib->vertices.at(i) > maxX)
-			{
-				maxX = attrib->vertices.at(i);
-			}
-		}
-		else if (i % 3 == 1)
-		{
-			yVector.push_back(attrib->vertices.at(i));
-
-			if (attrib->vertices.at(i) < minY)
-			{
-				minY = attrib->vertices.at(i);
-			}
-
-			if (attrib->vertices.at(i) > maxY)
-			{
-				maxY = attrib->vertices.at(i);
-			}
-		}
-		else if (i % 3 == 2)
-		{
-			zVector.push_back(attrib->vertices.at(i));
-
-			if (attrib->vertices.at(i) < minZ)
-			{
-				minZ = attrib->vertices.at(i);
-			}
-
-			if (attrib->vertices.at(i) > maxZ)
-			{
-				maxZ = attrib->vertices.at(i);
-			}
-		}
-	}
-
-	float offsetX = (maxX + minX) / 2;
-	float offsetY = (maxY + minY) / 2;
-	float offsetZ = (maxZ + minZ) / 2;
-
-	for (int i = 0; i < attrib->vertices.size(); i++)
-	{
-		if (offsetX != 0 && i % 3 == 0)
-		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetX;
-		}
-		else if (offsetY != 0 && i % 3 == 1)
-		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetY;
-		}
-		else if (offsetZ != 0 && i % 3 == 2)
-		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetZ;
-		}
-	}
-
-	float greatestAxis = maxX - minX;
-	float distanceOfYAxis = maxY - minY;
-	float distanceOfZAxis = maxZ - minZ;
-
-	if (distanceOfYAxis > greatestAxis)
-	{
-		greatestAxis = distanceOfYAxis;
-	}
-
-	if (distanceOfZAxis > greatestAxis)
-	{
-		greatestAxis = distanceOfZAxis;
-	}
-
-	float scale = greatestAxis / 2;
+	size_t vertex_count = attrib->vertices.size() / 3;
+	MeshBounds bounds = meshComputeBounds(attrib->vertices.data(), vertex_count);
+	meshNormalizePositions(attrib->vertices.data(), vertex_count, bounds);
+}
 
-	for (int i = 0; i < attrib->vertices.size(); i++)
-	{
-		//std::cout << i << " = " << (double)(attrib.vertices.at(i) / greatestAxis) << std::endl;
-		attrib->vertices.at(i) = attrib->vertices.at(i)/ scale;
-	}
+// Expand a shape of the normalized model into a triangle soup, one vertex
+// per face corner
+void ExpandShape(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<GLfloat>& colors, tinyobj::shape_t* shape)
+{
 	size_t index_offset = 0;
 	vertices.reserve(shape->mesh.num_face_vertices.size() * 3);
 	colors.reserve(shape->mesh.num_face_vertices.size() * 3);
@@ -748,34 +671,100 @@ void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<
 	}
 }
 
-void LoadModels(string model_path)
+// Returns true if the model was served from its mesh cache
+bool LoadModels(string model_path)
 {
-	vector<tinyobj::shape_t> shapes;
-	vector<tinyobj::material_t> materials;
-	tinyobj::attrib_t attrib;
 	vector<GLfloat> vertices;
 	vector<GLfloat> colors;
+	vector<uint32_t> indices;
+	vector<uint16_t> shortIndices;
+
+	// final geometry either comes straight from the mapped cache or from the .obj
+	string cache_path = model_path + ".meshcache";
+	MeshCacheFile cache;
+	bool from_cache = meshCacheOpen(model_path.c_str(), cache_path.c_str(), &cache);
+	// HW1 draws positions and colors, a cache without either is rebuilt
+	if (from_cache && (cache.data.positions == NULL || cache.data.colors == NULL))
+	{
+		meshCacheClose(&cache);
+		from_cache = false;
+	}
 
-	string err;
-	string warn;
+	MeshCacheData data;
+	if (from_cache)
+	{
+		data = cache.data;
+		printf("Load Models from mesh cache ! Vertices size %u\n", data.vertex_count);
+	}
+	else
+	{
+		vector<tinyobj::shape_t> shapes;
+		vector<tinyobj::material_t> materials;
+		tinyobj::attrib_t attrib;
 
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, model_path.c_str());
+		string err;
+		string warn;
 
-	if (!warn.empty()) {
-		cout << warn << std::endl;
-	}
+		// what the cache will be checked against, taken before the parse
+		MeshCacheSources sources;
+		bool cacheable = meshCacheSnapshot(model_path.c_str(), "", &sources);
+		bool ret = tinyobj::LoadObjMapped(&attrib, &shapes, &materials, &warn, &err, model_path.c_str());
 
-	if (!err.empty()) {
-		cerr << err << std::endl;
-	}
+		if (!warn.empty()) {
+			cout << warn << std::endl;
+		}
 
-	if (!ret) {
-		exit(1);
-	}
+		if (!err.empty()) {
+			cerr << err << std::endl;
+		}
 
-	printf("Load Models Success ! Shapes size %d Maerial size %d\n", shapes.size(), materials.size());
-	
-	normalization(&attrib, vertices, colors, &shapes[0]);
+		if (!ret) {
+			exit(1);
+		}
+
+		printf("Load Models Success ! Shapes size %zu Maerial size %zu\n", shapes.size(), materials.size());
+
+		normalization(&attrib);
+		ExpandShape(&attrib, vertices, colors, &shapes[0]);
+
+		shapes.clear();
+		materials.clear();
+
+		// weld the triangle soup into unique vertices and an index buffer
+		uint32_t corner_count = vertices.size() / 3;
+		MeshStream streams[2] = { { vertices.data(), 3 }, { colors.data(), 3 } };
+		indices.resize(corner_count);
+		uint32_t vertex_count = meshWeldVertices(corner_count, streams, 2, indices.data());
+		vertices.resize(vertex_count * 3);
+		colors.resize(vertex_count * 3);
+
+		memset(&data, 0, sizeof(data));
+		data.vertex_count = vertex_count;
+		data.positions = vertices.data();
+		data.colors = colors.data();
+		data.index_count = corner_count;
+		if (meshIndicesFit16(vertex_count))
+		{
+			shortIndices.resize(corner_count);
+			meshNarrowIndices(indices.data(), corner_count, shortIndices.data());
+			data.index_size = sizeof(uint16_t);
+			data.indices = shortIndices.data();
+		}
+		else
+		{
+			data.index_size = sizeof(uint32_t);
+			data.indices = indices.data();
+		}
+
+		size_t soup_bytes = corner_count * 6 * sizeof(GLfloat);
+		size_t indexed_bytes = vertex_count * 6 * sizeof(GLfloat) + corner_count * data.index_size;
+		printf("Indexed geometry ! %u corners -> %u vertices (up to %.1f%% fewer vertex shader runs), %.1f KB -> %.1f KB\n",
+			corner_count, vertex_count, corner_count ? 100.0 * (corner_count - vertex_count) / corner_count : 0.0,
+			soup_bytes / 1024.0, indexed_bytes / 1024.0);
+
+		if (!cacheable || !meshCacheWrite(sources, cache_path.c_str(), data))
+			cout << "LoadModels: Cannot write mesh cache " << cache_path << endl;
+	}
 
 	Shape tmp_shape;
 	glGenVertexArrays(1, &tmp_shape.vao);
@@ -783,25 +772,31 @@ void LoadModels(string model_path)
 
 	glGenBuffers(1, &tmp_shape.vbo);
 	glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.vbo);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GL_FLOAT), &vertices.at(0), GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, data.vertex_count * 3 * sizeof(GL_FLOAT), data.positions, GL_STATIC_DRAW);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	tmp_shape.vertex_count = vertices.size() / 3;
+	tmp_shape.vertex_count = data.vertex_count;
 
 	glGenBuffers(1, &tmp_shape.p_color);
 	glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_color);
-	glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(GL_FLOAT), &colors.at(0), GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, data.vertex_count * 3 * sizeof(GL_FLOAT), data.colors, GL_STATIC_DRAW);
 	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
+	// the element buffer binding is part of the VAO
+	glGenBuffers(1, &tmp_shape.ebo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tmp_shape.ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.index_count * data.index_size, data.indices, GL_STATIC_DRAW);
+	tmp_shape.indexCount = data.index_count;
+	tmp_shape.indexType = data.index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
 	m_shape_list.push_back(tmp_shape);
 	model tmp_model;
 	models.push_back(tmp_model);
-
-
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
 
-	shapes.clear();
-	materials.clear();
+	if (from_cache)
+		meshCacheClose(&cache);
+	return from_cache;
 }
 
 void initParameter()
@@ -833,8 +828,13 @@ void setupRC()
 	glClearColor(0.2, 0.2, 0.2, 1.0);
 	vector<string> model_list{ "../ColorModels/bunny5KC.obj", "../ColorModels/dragon10KC.obj", "../ColorModels/lucy25KC.obj", "../ColorModels/teapot4KC.obj", "../ColorModels/dolphinC.obj"};
 	// [TODO] Load five model at here
+	chrono::steady_clock::time_point load_start = chrono::steady_clock::now();
+	int cache_hits = 0;
 	for (int i = 0; i < model_list.size(); ++i)
-		LoadModels(model_list[i]);
+		if (LoadModels(model_list[i]))
+			cache_hits++;
+	double load_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - load_start).count();
+	printf("Loaded %d models in %.1f ms (%s start, %d from mesh cache)\n", (int)model_list.size(), load_ms, cache_hits == model_list.size() ? "warm" : "cold", cache_hits);
 
 	glGenVertexArrays(1, &quad.vao);
 	glGenBuffers(1, &quad.vbo);
@@ -0,0 +1,120 @@
+#include "meshbounds.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define MESH_BOUNDS_SSE
+#include <emmintrin.h>
+#endif
+
+MeshBounds meshComputeBoundsScalar(const float *positions, size_t vertex_count)
+{
+	MeshBounds bounds = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f } };
+	if (vertex_count == 0)
+		return bounds;
+
+	for (int c = 0; c < 3; c++)
+		bounds.min[c] = bounds.max[c] = positions[c];
+	for (size_t v = 1; v < vertex_count; v++) {
+		for (int c = 0; c < 3; c++) {
+			float p = positions[v * 3 + c];
+			bounds.min[c] = p < bounds.min[c] ? p : bounds.min[c];
+			bounds.max[c] = p > bounds.max[c] ? p : bounds.max[c];
+		}
+	}
+	return bounds;
+}
+
+static void CentreAndScale(const MeshBounds &bounds, float centre[3], float *scale)
+{
+	float greatest = 0.0f;
+	for (int c = 0; c < 3; c++) {
+		centre[c] = (bounds.max[c] + bounds.min[c]) / 2;
+		float extent = bounds.max[c] - bounds.min[c];
+		greatest = extent > greatest ? extent : greatest;
+	}
+	*scale = greatest / 2;
+}
+
+void meshNormalizePositionsScalar(float *positions, size_t vertex_count, const MeshBounds &bounds)
+{
+	float centre[3], scale;
+	CentreAndScale(bounds, centre, &scale);
+	for (size_t i = 0; i < vertex_count * 3; i++)
+		positions[i] = (positions[i] - centre[i % 3]) / scale;
+}
+
+#ifdef MESH_BOUNDS_SSE
+
+// Four xyz vertices are three registers: xyzx yzxy zxyz. Each lane always
+// holds the same component, so the reductions stay per lane and are only
+// folded per component at the end.
+
+MeshBounds meshComputeBounds(const float *positions, size_t vertex_count)
+{
+	if (vertex_count < 4)
+		return meshComputeBoundsScalar(positions, vertex_count);
+
+	__m128 min0 = _mm_loadu_ps(positions), max0 = min0;
+	__m128 min1 = _mm_loadu_ps(positions + 4), max1 = min1;
+	__m128 min2 = _mm_loadu_ps(positions + 8), max2 = min2;
+	size_t v = 4;
+	for (; v + 4 <= vertex_count; v += 4) {
+		const float *p = positions + v * 3;
+		__m128 a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4), c = _mm_loadu_ps(p + 8);
+		min0 = _mm_min_ps(min0, a); max0 = _mm_max_ps(max0, a);
+		min1 = _mm_min_ps(min1, b); max1 = _mm_max_ps(max1, b);
+		min2 = _mm_min_ps(min2, c); max2 = _mm_max_ps(max2, c);
+	}
+
+	float lo[12], hi[12];
+	_mm_storeu_ps(lo, min0); _mm_storeu_ps(lo + 4, min1); _mm_storeu_ps(lo + 8, min2);
+	_mm_storeu_ps(hi, max0); _mm_storeu_ps(hi + 4, max1); _mm_storeu_ps(hi + 8, max2);
+
+	// the per-lane results are laid out like 4 vertices, fold them and the tail
+	MeshBounds bounds = meshComputeBoundsScalar(lo, 4);
+	MeshBounds upper = meshComputeBoundsScalar(hi, 4);
+	for (int c = 0; c < 3; c++)
+		bounds.max[c] = upper.max[c];
+	for (; v < vertex_count; v++) {
+		for (int c = 0; c < 3; c++) {
+			float p = positions[v * 3 + c];
+			bounds.min[c] = p < bounds.min[c] ? p : bounds.min[c];
+			bounds.max[c] = p > bounds.max[c] ? p : bounds.max[c];
+		}
+	}
+	return bounds;
+}
+
+void meshNormalizePositions(float *positions, size_t vertex_count, const MeshBounds &bounds)
+{
+	float centre[3], scale;
+	CentreAndScale(bounds, centre, &scale);
+
+	__m128 centre0 = _mm_setr_ps(centre[0], centre[1], centre[2], centre[0]);
+	__m128 centre1 = _mm_setr_ps(centre[1], centre[2], centre[0], centre[1]);
+	__m128 centre2 = _mm_setr_ps(centre[2], centre[0], centre[1], centre[2]);
+	__m128 scale4 = _mm_set1_ps(scale);
+
+	size_t v = 0;
+	for (; v + 4 <= vertex_count; v += 4) {
+		float *p = positions + v * 3;
+		_mm_storeu_ps(p, _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(p), centre0), scale4));
+		_mm_storeu_ps(p + 4, _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(p + 4), centre1), scale4));
+		_mm_storeu_ps(p + 8, _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(p + 8), centre2), scale4));
+	}
+	for (size_t i = v * 3; i < vertex_count * 3; i++)
+		positions[i] = (positions[i] - centre[i % 3]) / scale;
+}
+
+#else
+
+MeshBounds meshComputeBounds(const float *positions, size_t vertex_count)
+{
+	return meshComputeBoundsScalar(positions, vertex_count);
+}
+
+void meshNormalizePositions(float *positions, size_t vertex_count, const MeshBounds &bounds)
+{
+	meshNormalizePositionsScalar(positions, vertex_count, bounds);
+}
+
+#endif
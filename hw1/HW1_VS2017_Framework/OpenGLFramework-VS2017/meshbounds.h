@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+
+// Axis aligned bounding box of a position stream
+struct MeshBounds
+{
+	float min[3];
+	float max[3];
+};
+
+// Bounds of vertex_count xyz positions, SSE min/max reduction where available.
+// An empty stream gives a zero box.
+MeshBounds meshComputeBounds(const float *positions, size_t vertex_count);
+
+// Move the box centre to the origin and scale its largest extent to [-1, 1],
+// in place and in one pass. The result is identical to the scalar
+// (p - centre) / (extent / 2).
+void meshNormalizePositions(float *positions, size_t vertex_count, const MeshBounds &bounds);
+
+// Plain scalar versions, the reference for the SIMD kernels
+MeshBounds meshComputeBoundsScalar(const float *positions, size_t vertex_count);
+void meshNormalizePositionsScalar(float *positions, size_t vertex_count, const MeshBounds &bounds);
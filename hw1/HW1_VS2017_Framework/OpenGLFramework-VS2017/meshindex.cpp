@@ -0,0 +1,79 @@
+#include "meshindex.h"
+
+#include <string.h>
+#include <unordered_map>
+
+using namespace std;
+
+// Hashes and compares vertices by the bits of all their attributes
+struct VertexKey
+{
+	const MeshStream *streams;
+	int stream_count;
+
+	size_t operator()(uint32_t v) const
+	{
+		// 64-bit FNV-1a over the attribute bytes
+		uint64_t hash = 14695981039346656037ULL;
+		for (int s = 0; s < stream_count; s++) {
+			if (streams[s].data == NULL)
+				continue;
+			const unsigned char *bytes = (const unsigned char *)(streams[s].data + (size_t)v * streams[s].components);
+			for (size_t i = 0; i < streams[s].components * sizeof(float); i++) {
+				hash ^= bytes[i];
+				hash *= 1099511628211ULL;
+			}
+		}
+		return (size_t)hash;
+	}
+
+	bool operator()(uint32_t a, uint32_t b) const
+	{
+		for (int s = 0; s < stream_count; s++) {
+			if (streams[s].data == NULL)
+				continue;
+			size_t n = streams[s].components;
+			if (memcmp(streams[s].data + a * n, streams[s].data + b * n, n * sizeof(float)) != 0)
+				return false;
+		}
+		return true;
+	}
+};
+
+uint32_t meshWeldVertices(uint32_t vertex_count, const MeshStream *streams, int stream_count, uint32_t *indices)
+{
+	VertexKey key = { streams, stream_count };
+	// keys are welded indices, i.e. slots of the compacted streams
+	unordered_map<uint32_t, uint32_t, VertexKey, VertexKey> unique(vertex_count, key, key);
+
+	uint32_t unique_count = 0;
+	for (uint32_t v = 0; v < vertex_count; v++) {
+		// Move the vertex to the next free slot first. Every slot from
+		// unique_count to v has been read already, so this is safe in place.
+		if (unique_count != v) {
+			for (int s = 0; s < stream_count; s++) {
+				if (streams[s].data == NULL)
+					continue;
+				size_t n = streams[s].components;
+				memcpy(streams[s].data + unique_count * n, streams[s].data + v * n, n * sizeof(float));
+			}
+		}
+
+		pair<unordered_map<uint32_t, uint32_t, VertexKey, VertexKey>::iterator, bool> found = unique.insert(make_pair(unique_count, unique_count));
+		indices[v] = found.first->second;
+		if (found.second)
+			unique_count++;
+	}
+	return unique_count;
+}
+
+bool meshIndicesFit16(uint32_t unique_vertex_count)
+{
+	return unique_vertex_count <= 65536;
+}
+
+void meshNarrowIndices(const uint32_t *indices, size_t count, uint16_t *out)
+{
+	for (size_t i = 0; i < count; i++)
+		out[i] = (uint16_t)indices[i];
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// One vertex attribute stream of a triangle soup, `components` floats per
+// vertex. A NULL stream is skipped.
+struct MeshStream
+{
+	float *data;
+	int components;
+};
+
+// Weld bit-identical vertices (equal in every stream) of a triangle soup.
+// The streams are compacted in place, keeping the first occurrence of each
+// vertex in its original order, and indices receives one entry per input
+// vertex. Returns the number of unique vertices.
+uint32_t meshWeldVertices(uint32_t vertex_count, const MeshStream *streams, int stream_count, uint32_t *indices);
+
+// Index buffers fit in 16 bits when every index is below 65536
+bool meshIndicesFit16(uint32_t unique_vertex_count);
+void meshNarrowIndices(const uint32_t *indices, size_t count, uint16_t *out);
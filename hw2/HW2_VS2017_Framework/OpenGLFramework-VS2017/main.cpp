@@ -3,9 +3,12 @@
 #include <string>
 #include <vector>
 #include <math.h>
+#include <stdio.h>
+#include <string.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include "textfile.h"
+#include "programcache.h"
 
 #include "Vectors.h"
 #include "Matrices.h"
@@ -91,11 +94,36 @@ struct Uniform
 	GLint iLocViewingMatrix;     // require V for transforming light position from world space to view space
 	GLint iLocLightingMode;
 	GLint iLocIsPerPixel;
+	GLint iLocDualViewport;
 	UniformLightingAttrib iLocLightingAttrib[3];     // for directional, point, and spot lights
 	UniformPhongMaterial iLocPhongMaterial;
 	/* ------------------------------------ */
 };
-Uniform uniform;
+
+// Shading frequency of a shader variant, the values the shaders give SHADING
+enum Shading
+{
+	SHADE_PER_VERTEX = 0,
+	SHADE_PER_PIXEL = 1,
+	SHADE_SPLIT = 2,	// dual viewport, instance 0 per vertex and instance 1 per pixel
+	SHADING_COUNT
+};
+
+// A linked program and the locations of its uniforms, -1 where a variant
+// compiled them out
+struct ShaderProgram
+{
+	GLuint program = 0;
+	Uniform uniform;
+};
+
+// The shaders as written, branching on uniforms, and their variants with
+// the light type and shading compiled in; RenderScene draws with the exact
+// variant, or with the uber-shader for --uber-shader and variants that
+// failed to build
+ShaderProgram uber_shader;
+ShaderProgram shader_variants[3][SHADING_COUNT];	// [light type][shading]
+bool use_shader_variants = true;
 
 vector<string> filenames; // .obj filename list
 
@@ -154,6 +182,13 @@ Matrix4 project_matrix;
 
 int cur_idx = 0; // represent which model should be rendered now
 
+// draw both halves of the window with one draw of two instances per shape
+// (see shader.vs), --per-viewport-draws draws each half on its own
+bool dual_viewport_draws = true;
+// halves drawn without dual_viewport_draws, bit 0 the left, per-vertex
+// lit one and bit 1 the right one; --bench-shader-variants times them apart
+int viewport_halves = 3;
+
 
 static GLvoid Normalize(GLfloat v[3])
 {
@@ -343,7 +378,7 @@ void ChangeSize(GLFWwindow* window, int width, int height)
 
 
 // [HW2] use glUniform to send lighting attributes to vertex shader
-void UpdateLighting()
+void UpdateLighting(const Uniform& uniform)
 {
 	// i = 0: directional light, i = 1: point light, i = 2: spot light
 	for (int i = 0; i < 3; ++i) {
@@ -369,6 +404,54 @@ void UpdateLighting()
 }
 
 
+// The program to draw with under the current lighting mode
+const ShaderProgram& PickShader(Shading shading)
+{
+	if (use_shader_variants)
+	{
+		const ShaderProgram& variant = shader_variants[cur_lighting_mode][shading];
+		if (variant.program != 0)
+			return variant;
+	}
+	return uber_shader;
+}
+
+// Draw the shapes of the current model into the current viewport, or both
+// halves for SHADE_SPLIT, with the program picked for shading
+void DrawShapes(Shading shading, GLfloat* mvp, GLfloat* mv, GLfloat* v)
+{
+	const ShaderProgram& shader = PickShader(shading);
+	const Uniform& uniform = shader.uniform;
+	glUseProgram(shader.program);
+
+	// [HW2] use glUniform to send mvp, mv, and lighting attrib to vertex shader
+	glUniformMatrix4fv(uniform.iLocMVP, 1, GL_FALSE, mvp);
+	glUniformMatrix4fv(uniform.iLocMV, 1, GL_FALSE, mv);
+	glUniformMatrix4fv(uniform.iLocViewingMatrix, 1, GL_FALSE, v);
+	// what the variants have compiled in
+	glUniform1i(uniform.iLocLightingMode, cur_lighting_mode);
+	glUniform1i(uniform.iLocIsPerPixel, shading == SHADE_PER_PIXEL ? 1 : 0);
+	glUniform1i(uniform.iLocDualViewport, shading == SHADE_SPLIT ? 1 : 0);
+	UpdateLighting(uniform);
+
+	for (int i = 0; i < models[cur_idx].shapes.size(); i++)
+	{
+		// [HW2] use glUniform to send material info (Ka, Kd, Ks) to vertex shader
+		glUniform3f(uniform.iLocPhongMaterial.Ka, models[cur_idx].shapes[i].material.Ka.x, models[cur_idx].shapes[i].material.Ka.y, models[cur_idx].shapes[i].material.Ka.z);
+		glUniform3f(uniform.iLocPhongMaterial.Kd, models[cur_idx].shapes[i].material.Kd.x, models[cur_idx].shapes[i].material.Kd.y, models[cur_idx].shapes[i].material.Kd.z);
+		glUniform3f(uniform.iLocPhongMaterial.Ks, models[cur_idx].shapes[i].material.Ks.x, models[cur_idx].shapes[i].material.Ks.y, models[cur_idx].shapes[i].material.Ks.z);
+
+		glBindVertexArray(models[cur_idx].shapes[i].vao);
+		if (shading == SHADE_SPLIT)
+		{
+			// instance 0 is the left half, instance 1 the right one
+			glDrawArraysInstanced(GL_TRIANGLES, 0, models[cur_idx].shapes[i].vertex_count, 2);
+			continue;
+		}
+		glDrawArrays(GL_TRIANGLES, 0, models[cur_idx].shapes[i].vertex_count);
+	}
+}
+
 // Render function for display rendering
 void RenderScene(void) {
 	// clear canvas
@@ -392,31 +475,25 @@ void RenderScene(void) {
 	setGLMatrix(mv, MV);
 	setGLMatrix(v, view_matrix);
 
-	// [HW2] use glUniform to send mvp, mv, and lighting attrib to vertex shader
-	glUniformMatrix4fv(uniform.iLocMVP, 1, GL_FALSE, mvp);
-	glUniformMatrix4fv(uniform.iLocMV, 1, GL_FALSE, mv);
-	glUniformMatrix4fv(uniform.iLocViewingMatrix, 1, GL_FALSE, v);
-	glUniform1i(uniform.iLocLightingMode, cur_lighting_mode);
-	UpdateLighting();
-
-	for (int i = 0; i < models[cur_idx].shapes.size(); i++)
+	if (dual_viewport_draws)
 	{
-		// [HW2] use glUniform to send material info (Ka, Kd, Ks) to vertex shader
-		glUniform3f(uniform.iLocPhongMaterial.Ka, models[cur_idx].shapes[i].material.Ka.x, models[cur_idx].shapes[i].material.Ka.y, models[cur_idx].shapes[i].material.Ka.z);
-		glUniform3f(uniform.iLocPhongMaterial.Kd, models[cur_idx].shapes[i].material.Kd.x, models[cur_idx].shapes[i].material.Kd.y, models[cur_idx].shapes[i].material.Kd.z);
-		glUniform3f(uniform.iLocPhongMaterial.Ks, models[cur_idx].shapes[i].material.Ks.x, models[cur_idx].shapes[i].material.Ks.y, models[cur_idx].shapes[i].material.Ks.z);
+		// one full-window viewport, the vertex shader places each instance in its half
+		glViewport(0, 0, cur_window_width, cur_window_height);
+		DrawShapes(SHADE_SPLIT, mvp, mv, v);
+		return;
+	}
 
-		// [HW2] set glViewport and draw twice (side-by-side)
-		glUniform1i(uniform.iLocIsPerPixel, 0);
+	// [HW2] set glViewport and draw twice (side-by-side)
+	if (viewport_halves & 1)
+	{
 		glViewport(0, 0, cur_window_width / 2, cur_window_height);
-		glBindVertexArray(models[cur_idx].shapes[i].vao);
-		glDrawArrays(GL_TRIANGLES, 0, models[cur_idx].shapes[i].vertex_count);
-
-		glUniform1i(uniform.iLocIsPerPixel, 1);
+		DrawShapes(SHADE_PER_VERTEX, mvp, mv, v);
+	}
+	if (viewport_halves & 2)
+	{
 		glViewport(cur_window_width / 2, 0, cur_window_width / 2, cur_window_height);
-		glDrawArrays(GL_TRIANGLES, 0, models[cur_idx].shapes[i].vertex_count);
+		DrawShapes(SHADE_PER_PIXEL, mvp, mv, v);
 	}
-
 }
 
 
@@ -533,65 +610,9 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 	starting_press_y = ypos;
 }
 
-void setShaders()
+// Look up the locations of the uniforms of program p
+void setUniformLocations(GLuint p, Uniform& uniform)
 {
-	GLuint v, f, p;
-	char *vs = NULL;
-	char *fs = NULL;
-
-	v = glCreateShader(GL_VERTEX_SHADER);
-	f = glCreateShader(GL_FRAGMENT_SHADER);
-
-	vs = textFileRead("shader.vs");
-	fs = textFileRead("shader.fs");
-
-	glShaderSource(v, 1, (const GLchar**)&vs, NULL);
-	glShaderSource(f, 1, (const GLchar**)&fs, NULL);
-
-	free(vs);
-	free(fs);
-
-	GLint success;
-	char infoLog[1000];
-	// compile vertex shader
-	glCompileShader(v);
-	// check for shader compile errors
-	glGetShaderiv(v, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(v, 1000, NULL, infoLog);
-		std::cout << "ERROR: VERTEX SHADER COMPILATION FAILED\n" << infoLog << std::endl;
-	}
-
-	// compile fragment shader
-	glCompileShader(f);
-	// check for shader compile errors
-	glGetShaderiv(f, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(f, 1000, NULL, infoLog);
-		std::cout << "ERROR: FRAGMENT SHADER COMPILATION FAILED\n" << infoLog << std::endl;
-	}
-
-	// create program object
-	p = glCreateProgram();
-
-	// attach shaders to program object
-	glAttachShader(p, f);
-	glAttachShader(p, v);
-
-	// link program
-	glLinkProgram(p);
-	// check for linking errors
-	glGetProgramiv(p, GL_LINK_STATUS, &success);
-	if (!success) {
-		glGetProgramInfoLog(p, 1000, NULL, infoLog);
-		std::cout << "ERROR: SHADER PROGRAM LINKING FAILED\n" << infoLog << std::endl;
-	}
-
-	glDeleteShader(v);
-	glDeleteShader(f);
-
 	uniform.iLocMVP = glGetUniformLocation(p, "mvp");
 
 	/* ---------- [HW2] Query the locations (in shader) of uniform variables needed for lighting ---------- */
@@ -599,6 +620,7 @@ void setShaders()
 	uniform.iLocViewingMatrix = glGetUniformLocation(p, "viewing_matrix");
 	uniform.iLocLightingMode = glGetUniformLocation(p, "lighting_mode");
 	uniform.iLocIsPerPixel = glGetUniformLocation(p, "is_perpixel");
+	uniform.iLocDualViewport = glGetUniformLocation(p, "dual_viewport");
 
 	uniform.iLocPhongMaterial.Ka = glGetUniformLocation(p, "material.Ka");
 	uniform.iLocPhongMaterial.Kd = glGetUniformLocation(p, "material.Kd");
@@ -631,14 +653,41 @@ void setShaders()
 	uniform.iLocLightingAttrib[2].spot_exponent = glGetUniformLocation(p, "lighting_attrib[2].spot_exponent");
 	uniform.iLocLightingAttrib[2].spot_cutoff = glGetUniformLocation(p, "lighting_attrib[2].spot_cutoff");
 	/* ---------------------------------------------------------------------------------------- */
+}
+
+// Link the program for defines, or take it from the program cache. Returns
+// false if it does not compile or link.
+bool BuildShaderProgram(const string& defines, ShaderProgram& shader)
+{
+	bool created;
+	shader.program = programCacheGet(defines, &created);
+	if (shader.program == 0)
+		return false;
+	if (created)
+		setUniformLocations(shader.program, shader.uniform);
+	return true;
+}
 
-	if (success)
-		glUseProgram(p);
-	else
+// The uber-shader and every variant RenderScene picks from
+void setShaders()
+{
+	if (!programCacheSetSources("shader.vs", "shader.fs") || !BuildShaderProgram("", uber_shader))
 	{
 		system("pause");
 		exit(123);
 	}
+
+	// one that fails is drawn with the uber-shader
+	for (int light = 0; light < 3; light++)
+	{
+		for (int shading = 0; shading < SHADING_COUNT; shading++)
+		{
+			string defines = "#define LIGHT_TYPE " + to_string(light) + "\n#define SHADING " + to_string(shading) + "\n";
+			BuildShaderProgram(defines, shader_variants[light][shading]);
+		}
+	}
+	ProgramCacheStats stats = programCacheStats();
+	cout << "Shaders: " << stats.programs << " programs linked in " << stats.build_ms << " ms" << endl;
 }
 
 void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, tinyobj::shape_t* shape)
@@ -914,10 +963,72 @@ void setupRC()
 
 	// OpenGL States and Values
 	glClearColor(0.2, 0.2, 0.2, 1.0);
+	// the boundary between the halves of a dual-viewport draw
+	glEnable(GL_CLIP_DISTANCE0);
 	vector<string> model_list{ "../NormalModels/bunny5KN.obj", "../NormalModels/dragon10KN.obj", "../NormalModels/lucy25KN.obj", "../NormalModels/teapot4KN.obj", "../NormalModels/dolphinN.obj" };
 	// [TODO] Load five model at here
 	for (int i = 0; i < model_list.size(); ++i)
 		LoadModels(model_list[i]);
+	filenames = model_list;
+}
+
+// --bench-shader-variants: GPU time per frame, from a timer query around
+// the frames, of each light type and shading frequency drawn with the
+// uber-shader and then with its variant. The per-vertex and per-pixel
+// variants draw only their own half of the window, the split ones both
+// halves in one instanced draw.
+void BenchmarkShaderVariants()
+{
+	const int warmup_frames = 10;
+	const int timed_frames = 100;
+	const char* light_names[3] = { "directional", "point", "spot" };
+
+	GLuint query;
+	glGenQueries(1, &query);
+	vector<double> gpu_ms[3][SHADING_COUNT][2];	// [light][shading][uber-shader, variant], per model
+	for (int i = 0; i < models.size(); i++)
+	{
+		cur_idx = i;
+		for (int light = 0; light < 3; light++)
+		{
+			cur_lighting_mode = light;
+			for (int shading = 0; shading < SHADING_COUNT; shading++)
+			{
+				dual_viewport_draws = shading == SHADE_SPLIT;
+				viewport_halves = shading == SHADE_PER_PIXEL ? 2 : 1;
+				for (int pass = 0; pass < 2; pass++)
+				{
+					use_shader_variants = pass == 1;
+					for (int f = 0; f < warmup_frames + timed_frames; f++)
+					{
+						if (f == warmup_frames)
+							glBeginQuery(GL_TIME_ELAPSED, query);
+						RenderScene();
+					}
+					glEndQuery(GL_TIME_ELAPSED);
+					GLuint64 elapsed_ns = 0;
+					glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed_ns);
+					gpu_ms[light][shading][pass].push_back(elapsed_ns / 1e6 / timed_frames);
+					glfwPollEvents();
+				}
+			}
+		}
+	}
+	glDeleteQueries(1, &query);
+
+	printf("\nShader variant benchmark, GPU ms per frame over %d frames (uber-shader / variant)\n", timed_frames);
+	printf("  %-16s %-12s %21s %21s %21s\n", "model", "light", "per vertex", "per pixel", "split");
+	for (int i = 0; i < models.size(); i++)
+	{
+		for (int light = 0; light < 3; light++)
+		{
+			printf("  %-16s %-12s", light == 0 ? filenames[i].substr(filenames[i].find_last_of("/\\") + 1).c_str() : "", light_names[light]);
+			for (int shading = 0; shading < SHADING_COUNT; shading++)
+				printf(" %10.3f %10.3f", gpu_ms[light][shading][0][i], gpu_ms[light][shading][1][i]);
+			printf("\n");
+		}
+	}
+	printf("  per vertex and per pixel draw one half of the window each, split draws both\n");
 }
 
 void glPrintContextInfo(bool printExtension)
@@ -941,6 +1052,23 @@ void glPrintContextInfo(bool printExtension)
 
 int main(int argc, char **argv)
 {
+	bool bench_shader_variants = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--per-viewport-draws") == 0)
+		{
+			dual_viewport_draws = false;
+		}
+		else if (strcmp(argv[i], "--uber-shader") == 0)
+		{
+			use_shader_variants = false;
+		}
+		else if (strcmp(argv[i], "--bench-shader-variants") == 0)
+		{
+			bench_shader_variants = true;
+		}
+	}
+
 	// initial glfw
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -981,6 +1109,12 @@ int main(int argc, char **argv)
 	// Setup render context
 	setupRC();
 
+	if (bench_shader_variants)
+	{
+		BenchmarkShaderVariants();
+		return 0;
+	}
+
 	// main loop
 	while (!glfwWindowShouldClose(window))
 	{
@@ -1,9 +1,15 @@
 #version 330 core
 
+// LIGHT_TYPE and SHADING select a variant, see shader.vs
+#define SHADE_PER_VERTEX 0
+#define SHADE_PER_PIXEL 1
+#define SHADE_SPLIT 2
+
 out vec4 FragColor;
 in vec3 vertex_color;
 in vec3 vertex_normal;
 in vec3 frag_aPos;
+flat in int shade_perpixel;	// is_perpixel, or the half of a dual-viewport draw
 
 
 struct LightingAttrib
@@ -32,8 +38,17 @@ struct PhongMaterial
 uniform mat4 mvp;
 uniform mat4 mv;
 uniform mat4 viewing_matrix;
+#ifdef LIGHT_TYPE
+#define LIGHTING_MODE LIGHT_TYPE
+#else
 uniform int lighting_mode;
-uniform int is_perpixel;
+#define LIGHTING_MODE lighting_mode
+#endif
+#if defined(SHADING) && SHADING != SHADE_SPLIT
+#define LIGHT_PER_PIXEL (SHADING == SHADE_PER_PIXEL)
+#else
+#define LIGHT_PER_PIXEL (shade_perpixel == 1)
+#endif
 uniform LightingAttrib lighting_attrib[3];   // for directional, point, and spot lights
 uniform PhongMaterial material;
 
@@ -128,10 +143,10 @@ vec3 spot_light(vec3 v_normal)
 
 void main() {
 	// [TODO]
-	if (is_perpixel == 1) {
-		if (lighting_mode == 0)
+	if (LIGHT_PER_PIXEL) {
+		if (LIGHTING_MODE == 0)
 			FragColor = vec4(directional_light(vertex_normal), 1.0f);
-		else if (lighting_mode == 1)
+		else if (LIGHTING_MODE == 1)
 			FragColor = vec4(point_light(vertex_normal), 1.0f);
 		else
 			FragColor = vec4(spot_light(vertex_normal), 1.0f);
@@ -1,5 +1,12 @@
 #version 330 core
 
+// main.cpp builds variants of these shaders by defining LIGHT_TYPE (0-2,
+// as lighting_mode) and SHADING after the #version line, see setShaders;
+// without them they are the uber-shader that decides per draw from uniforms.
+#define SHADE_PER_VERTEX 0
+#define SHADE_PER_PIXEL 1
+#define SHADE_SPLIT 2	// dual viewport: instance 0 per vertex, instance 1 per pixel
+
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aColor;
 layout (location = 2) in vec3 aNormal;
@@ -7,6 +14,7 @@ layout (location = 2) in vec3 aNormal;
 out vec3 vertex_color;
 out vec3 vertex_normal;
 out vec3 frag_aPos;
+flat out int shade_perpixel;
 
 struct LightingAttrib
 {
@@ -34,8 +42,26 @@ struct PhongMaterial
 uniform mat4 mvp;
 uniform mat4 mv;
 uniform mat4 viewing_matrix;
+#ifdef LIGHT_TYPE
+#define LIGHTING_MODE LIGHT_TYPE
+#else
 uniform int lighting_mode;
+#define LIGHTING_MODE lighting_mode
+#endif
+#ifdef SHADING
+#define SPLIT_VIEWPORT (SHADING == SHADE_SPLIT)
+#define LIGHT_PER_VERTEX (SHADING == SHADE_PER_VERTEX || (SHADING == SHADE_SPLIT && gl_InstanceID == 0))
+#define IS_PERPIXEL (SHADING == SHADE_PER_PIXEL ? 1 : 0)
+#else
 uniform int is_perpixel;
+// 1: the draw has two instances in one full-window viewport, instance 0
+// goes to the left half with per-vertex lighting and instance 1 to the
+// right half with per-pixel lighting
+uniform int dual_viewport;
+#define SPLIT_VIEWPORT (dual_viewport == 1)
+#define LIGHT_PER_VERTEX true	// whether or not the fragment shader uses it
+#define IS_PERPIXEL is_perpixel
+#endif
 uniform LightingAttrib lighting_attrib[3];   // for directional, point, and spot lights
 uniform PhongMaterial material;
 
@@ -132,17 +158,34 @@ void main()
 {
 	// [TODO]
 	gl_Position = mvp * vec4(aPos.x, aPos.y, aPos.z, 1.0);
+
+	// squeeze x into the instance's half, as its own viewport would; the clip
+	// distance cuts what would spill over the centre line
+	shade_perpixel = IS_PERPIXEL;
+	gl_ClipDistance[0] = 1.0;
+	if (SPLIT_VIEWPORT)
+	{
+		float side = gl_InstanceID == 0 ? -1.0 : 1.0;
+		gl_Position.x = 0.5 * gl_Position.x + 0.5 * side * gl_Position.w;
+		gl_ClipDistance[0] = side * gl_Position.x;
+		shade_perpixel = gl_InstanceID;
+	}
 	
 	// Transform the normal vector from model space to view space
 	vec3 v_normal = vec3(transpose(inverse(mv)) * vec4(aNormal, 0.0));
 	vertex_normal = v_normal;
 	
-	if (lighting_mode == 0)
-		vertex_color = directional_light(v_normal);
-	else if (lighting_mode == 1)
-		vertex_color = point_light(v_normal);
-	else
-		vertex_color = spot_light(v_normal);
+	// a per-pixel variant leaves the lighting to the fragment shader
+	vertex_color = vec3(0.0);
+	if (LIGHT_PER_VERTEX)
+	{
+		if (LIGHTING_MODE == 0)
+			vertex_color = directional_light(v_normal);
+		else if (LIGHTING_MODE == 1)
+			vertex_color = point_light(v_normal);
+		else
+			vertex_color = spot_light(v_normal);
+	}
 
 	// Pass position to fragment shader
 	frag_aPos = aPos;
@@ -445,8 +445,11 @@ class MaterialReader {
 class MaterialFileReader : public MaterialReader {
  public:
   // Path could contain separator(';' in Windows, ':' in Posix)
-  explicit MaterialFileReader(const std::string &mtl_basedir)
-      : m_mtlBaseDir(mtl_basedir) {}
+  // `mapped`: read the .mtl through a read-only file mapping instead of
+  // std::ifstream.
+  explicit MaterialFileReader(const std::string &mtl_basedir,
+                              bool mapped = false)
+      : m_mtlBaseDir(mtl_basedir), m_mapped(mapped) {}
   virtual ~MaterialFileReader() TINYOBJ_OVERRIDE {}
   virtual bool operator()(const std::string &matId,
                           std::vector<material_t> *materials,
@@ -455,6 +458,7 @@ class MaterialFileReader : public MaterialReader {
 
  private:
   std::string m_mtlBaseDir;
+  bool m_mapped;
 };
 
 ///
@@ -575,6 +579,32 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
              const char *mtl_basedir = NULL, bool triangulate = true,
              bool default_vcols_fallback = true);
 
+/// Same as the file variant of LoadObj(), but reads the whole file at once
+/// and parses it in `num_threads` chunks split at line boundaries
+/// (0: std::thread::hardware_concurrency()). Vertex attributes are parsed
+/// and faces tokenized in parallel; the remaining commands and face index
+/// resolution are replayed in file order, so the result (including
+/// warnings and errors) is identical to LoadObj().
+bool LoadObjMultithreaded(attrib_t *attrib, std::vector<shape_t> *shapes,
+                          std::vector<material_t> *materials,
+                          std::string *warn, std::string *err,
+                          const char *filename, const char *mtl_basedir = NULL,
+                          bool triangulate = true,
+                          bool default_vcols_fallback = true,
+                          int num_threads = 0);
+
+/// Same as LoadObjMultithreaded(), but maps the .obj and .mtl files
+/// read-only and tokenizes straight out of the mapping (madvise(SEQUENTIAL)
+/// on POSIX): the file is never copied into a buffer or split into
+/// std::string lines. Only the rare non-geometry commands (usemtl, g, o,
+/// ...) are copied before they are replayed. Falls back to
+/// LoadObjMultithreaded() if the file cannot be mapped.
+bool LoadObjMapped(attrib_t *attrib, std::vector<shape_t> *shapes,
+                   std::vector<material_t> *materials, std::string *warn,
+                   std::string *err, const char *filename,
+                   const char *mtl_basedir = NULL, bool triangulate = true,
+                   bool default_vcols_fallback = true, int num_threads = 0);
+
 /// Loads .obj from a file with custom user callback.
 /// .mtl is loaded as usual and parsed material_t data will be passed to
 /// `callback.mtllib_cb`.
@@ -612,6 +642,24 @@ void LoadMtl(std::map<std::string, int> *material_map,
 bool ParseTextureNameAndOption(std::string *texname, texture_option_t *texopt,
                                const char *linebuf);
 
+///
+/// Number parsers of the .obj reader, exposed for tests and benchmarks.
+///
+/// ParseReal() parses a decimal number in `[s, s_end)` with the grammar of
+/// the reader; the text has to continue with a non-digit after s_end (a
+/// NUL-terminated string, for example). Plain numbers of up to 19 digits
+/// and a decimal exponent within +-22 take an exact fast path (one integer
+/// to double conversion and one multiplication or division by an exact
+/// power of ten, so the result is correctly rounded); everything else
+/// goes to ParseRealReference(), the original digit loop that accumulates
+/// in double. Both agree after the conversion to (float) real_t.
+///
+/// ParseIndex() is atoi() for `f` indices, without locale or errno
+/// handling.
+bool ParseReal(const char *s, const char *s_end, double *result);
+bool ParseRealReference(const char *s, const char *s_end, double *result);
+int ParseIndex(const char *s);
+
 /// =<<========== Legacy v1 API =============================================
 
 }  // namespace tinyobj
@@ -625,16 +673,105 @@ bool ParseTextureNameAndOption(std::string *texname, texture_option_t *texopt,
 #include <cstddef>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 #include <limits>
 #include <utility>
 
 #include <fstream>
 #include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace tinyobj {
 
 MaterialReader::~MaterialReader() {}
 
+// Read-only view of a whole file.
+struct obj_file_mapping_t {
+  const char *data;
+  size_t size;
+#ifdef _WIN32
+  HANDLE file_handle;
+  HANDLE mapping_handle;
+#endif
+};
+
+// Fails for missing and empty files (an empty file cannot be mapped).
+static bool MapObjFile(const char *filename, obj_file_mapping_t *mapping) {
+#ifdef _WIN32
+  HANDLE fh = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                          OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (fh == INVALID_HANDLE_VALUE) return false;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(fh, &size) || size.QuadPart == 0) {
+    CloseHandle(fh);
+    return false;
+  }
+
+  HANDLE mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+  void *base = mh ? MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0) : NULL;
+  if (base == NULL) {
+    if (mh) CloseHandle(mh);
+    CloseHandle(fh);
+    return false;
+  }
+
+  mapping->data = static_cast<const char *>(base);
+  mapping->size = static_cast<size_t>(size.QuadPart);
+  mapping->file_handle = fh;
+  mapping->mapping_handle = mh;
+#else
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  void *base = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ,
+                    MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return false;
+
+  // One front-to-back pass: aggressive read-ahead, pages can be dropped
+  // right behind the parser.
+  madvise(base, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+
+  mapping->data = static_cast<const char *>(base);
+  mapping->size = static_cast<size_t>(st.st_size);
+#endif
+  return true;
+}
+
+static void UnmapObjFile(obj_file_mapping_t *mapping) {
+#ifdef _WIN32
+  UnmapViewOfFile(mapping->data);
+  CloseHandle(mapping->mapping_handle);
+  CloseHandle(mapping->file_handle);
+#else
+  munmap(const_cast<char *>(mapping->data), mapping->size);
+#endif
+  mapping->data = NULL;
+  mapping->size = 0;
+}
+
 struct vertex_index_t {
   int v_idx, vt_idx, vn_idx;
   vertex_index_t() : v_idx(-1), vt_idx(-1), vn_idx(-1) {}
@@ -777,6 +914,22 @@ static inline std::string parseString(const char **token) {
   return s;
 }
 
+// atoi() for face indices: leading blanks, an optional sign and decimal
+// digits, with a single unsigned compare per digit.
+static inline int parseIndex(const char *s) {
+  s += strspn(s, " \t\v\f");
+  bool negative = (*s == '-');
+  if (negative || *s == '+') s++;
+
+  unsigned int value = 0;
+  unsigned int digit;
+  while ((digit = static_cast<unsigned int>(*s - '0')) < 10) {
+    value = value * 10 + digit;
+    s++;
+  }
+  return negative ? -static_cast<int>(value) : static_cast<int>(value);
+}
+
 static inline int parseInt(const char **token) {
   (*token) += strspn((*token), " \t");
   int i = atoi((*token));
@@ -811,7 +964,8 @@ static inline int parseInt(const char **token) {
 //  - s >= s_end.
 //  - parse failure.
 //
-static bool tryParseDouble(const char *s, const char *s_end, double *result) {
+static bool tryParseDoubleReference(const char *s, const char *s_end,
+                                    double *result) {
   if (s >= s_end) {
     return false;
   }
@@ -937,26 +1091,114 @@ fail:
   return false;
 }
 
-static inline real_t parseReal(const char **token, double default_value = 0.0) {
+// Clinger's fast path: numbers with an integer part, at most 19 digits and
+// a decimal exponent within +-22 are converted exactly. The digits fit a
+// uint64 below 2^53 and 10^22 is the largest power of ten a double holds
+// exactly, so a single rounding step gives the correctly rounded value.
+// Scans as far as the grammar of tryParseDoubleReference() allows (the
+// text has to end in a non-digit, e.g. NUL or a line break) and stores
+// where it stopped in `end`. Returns false for anything outside the fast
+// path; the caller then runs the digit loop.
+static inline bool tryParseDoubleFast(const char *s, const char **end,
+                                      double *result) {
+  static const double pow10_lut[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+
+  const char *curr = s;
+  bool negative = (*curr == '-');
+  if (negative || *curr == '+') curr++;
+
+  // The digits may overflow here; such numbers have more than 19 digits
+  // and are rejected below.
+  unsigned long long digits = 0;
+  unsigned int digit;
+  const char *int_begin = curr;
+  while ((digit = static_cast<unsigned int>(*curr - '0')) < 10) {
+    digits = digits * 10 + digit;
+    curr++;
+  }
+  ptrdiff_t num_digits = curr - int_begin;
+  if (num_digits == 0) return false;
+
+  int exponent = 0;
+  if (*curr == '.') {
+    const char *frac_begin = ++curr;
+    while ((digit = static_cast<unsigned int>(*curr - '0')) < 10) {
+      digits = digits * 10 + digit;
+      curr++;
+    }
+    num_digits += curr - frac_begin;
+    exponent = -static_cast<int>(curr - frac_begin);
+  }
+
+  if (*curr == 'e' || *curr == 'E') {
+    curr++;
+    bool exp_negative = (*curr == '-');
+    if (exp_negative || *curr == '+') curr++;
+    const char *exp_begin = curr;
+    int exp_value = 0;
+    while ((digit = static_cast<unsigned int>(*curr - '0')) < 10 &&
+           exp_value < 1000) {
+      exp_value = exp_value * 10 + static_cast<int>(digit);
+      curr++;
+    }
+    if (curr == exp_begin) return false;
+    exponent += exp_negative ? -exp_value : exp_value;
+  }
+
+  if (num_digits > 19 || digits > (1ULL << 53) || exponent < -22 ||
+      exponent > 22) {
+    return false;
+  }
+
+  double value = static_cast<double>(digits);
+  value = exponent < 0 ? value / pow10_lut[-exponent]
+                       : value * pow10_lut[exponent];
+  *result = negative ? -value : value;
+  *end = curr;
+  return true;
+}
+
+static bool tryParseDouble(const char *s, const char *s_end, double *result) {
+  const char *end;
+  if (s < s_end && tryParseDoubleFast(s, &end, result) && end == s_end) {
+    return true;
+  }
+  return tryParseDoubleReference(s, s_end, result);
+}
+
+// Converts the token while looking for its end: only a token that the
+// fast path does not take is scanned a second time.
+static inline bool parseRealToken(const char **token, double *result) {
   (*token) += strspn((*token), " \t");
-  const char *end = (*token) + strcspn((*token), " \t\r");
+  const char *end;
+  if (tryParseDoubleFast((*token), &end, result) &&
+      (IS_SPACE(*end) || IS_NEW_LINE(*end))) {
+    (*token) = end;
+    return true;
+  }
+  end = (*token) + strcspn((*token), " \t\r\n");
+  bool ret = tryParseDoubleReference((*token), end, result);
+  (*token) = end;
+  return ret;
+}
+
+static inline real_t parseReal(const char **token, double default_value = 0.0) {
   double val = default_value;
-  tryParseDouble((*token), end, &val);
+  parseRealToken(token, &val);
   real_t f = static_cast<real_t>(val);
-  (*token) = end;
   return f;
 }
 
 static inline bool parseReal(const char **token, real_t *out) {
-  (*token) += strspn((*token), " \t");
-  const char *end = (*token) + strcspn((*token), " \t\r");
   double val;
-  bool ret = tryParseDouble((*token), end, &val);
+  bool ret = parseRealToken(token, &val);
   if (ret) {
     real_t f = static_cast<real_t>(val);
     (*out) = f;
   }
-  (*token) = end;
   return ret;
 }
 
@@ -1083,7 +1325,7 @@ static bool parseTriple(const char **token, int vsize, int vnsize, int vtsize,
 
   vertex_index_t vi(-1);
 
-  if (!fixIndex(atoi((*token)), vsize, &(vi.v_idx))) {
+  if (!fixIndex(parseIndex((*token)), vsize, &(vi.v_idx))) {
     return false;
   }
 
@@ -1097,7 +1339,7 @@ static bool parseTriple(const char **token, int vsize, int vnsize, int vtsize,
   // i//k
   if ((*token)[0] == '/') {
     (*token)++;
-    if (!fixIndex(atoi((*token)), vnsize, &(vi.vn_idx))) {
+    if (!fixIndex(parseIndex((*token)), vnsize, &(vi.vn_idx))) {
       return false;
     }
     (*token) += strcspn((*token), "/ \t\r");
@@ -1106,7 +1348,7 @@ static bool parseTriple(const char **token, int vsize, int vnsize, int vtsize,
   }
 
   // i/j/k or i/j
-  if (!fixIndex(atoi((*token)), vtsize, &(vi.vt_idx))) {
+  if (!fixIndex(parseIndex((*token)), vtsize, &(vi.vt_idx))) {
     return false;
   }
 
@@ -1118,7 +1360,7 @@ static bool parseTriple(const char **token, int vsize, int vnsize, int vtsize,
 
   // i/j/k
   (*token)++;  // skip '/'
-  if (!fixIndex(atoi((*token)), vnsize, &(vi.vn_idx))) {
+  if (!fixIndex(parseIndex((*token)), vnsize, &(vi.vn_idx))) {
     return false;
   }
   (*token) += strcspn((*token), "/ \t\r");
@@ -1132,7 +1374,7 @@ static bool parseTriple(const char **token, int vsize, int vnsize, int vtsize,
 static vertex_index_t parseRawTriple(const char **token) {
   vertex_index_t vi(static_cast<int>(0));  // 0 is an invalid index in OBJ
 
-  vi.v_idx = atoi((*token));
+  vi.v_idx = parseIndex((*token));
   (*token) += strcspn((*token), "/ \t\r");
   if ((*token)[0] != '/') {
     return vi;
@@ -1142,13 +1384,13 @@ static vertex_index_t parseRawTriple(const char **token) {
   // i//k
   if ((*token)[0] == '/') {
     (*token)++;
-    vi.vn_idx = atoi((*token));
+    vi.vn_idx = parseIndex((*token));
     (*token) += strcspn((*token), "/ \t\r");
     return vi;
   }
 
   // i/j/k or i/j
-  vi.vt_idx = atoi((*token));
+  vi.vt_idx = parseIndex((*token));
   (*token) += strcspn((*token), "/ \t\r");
   if ((*token)[0] != '/') {
     return vi;
@@ -1156,11 +1398,21 @@ static vertex_index_t parseRawTriple(const char **token) {
 
   // i/j/k
   (*token)++;  // skip '/'
-  vi.vn_idx = atoi((*token));
+  vi.vn_idx = parseIndex((*token));
   (*token) += strcspn((*token), "/ \t\r");
   return vi;
 }
 
+bool ParseReal(const char *s, const char *s_end, double *result) {
+  return tryParseDouble(s, s_end, result);
+}
+
+bool ParseRealReference(const char *s, const char *s_end, double *result) {
+  return tryParseDoubleReference(s, s_end, result);
+}
+
+int ParseIndex(const char *s) { return parseIndex(s); }
+
 bool ParseTextureNameAndOption(std::string *texname, texture_option_t *texopt,
                                const char *linebuf) {
   // @todo { write more robust lexer and parser. }
@@ -1344,7 +1596,7 @@ static bool exportGroupsToShape(shape_t *shape, const PrimGroup &prim_group,
                                 const std::vector<tag_t> &tags,
                                 const int material_id, const std::string &name,
                                 bool triangulate,
-                                const std::vector<real_t> &v) {
+                                const real_t *v, size_t v_size) {
   if (prim_group.IsEmpty()) {
     return false;
   }
@@ -1379,8 +1631,8 @@ static bool exportGroupsToShape(shape_t *shape, const PrimGroup &prim_group,
           size_t vi1 = size_t(i1.v_idx);
           size_t vi2 = size_t(i2.v_idx);
 
-          if (((3 * vi0 + 2) >= v.size()) || ((3 * vi1 + 2) >= v.size()) ||
-              ((3 * vi2 + 2) >= v.size())) {
+          if (((3 * vi0 + 2) >= v_size) || ((3 * vi1 + 2) >= v_size) ||
+              ((3 * vi2 + 2) >= v_size)) {
             // Invalid triangle.
             // FIXME(syoyo): Is it ok to simply skip this invalid triangle?
             continue;
@@ -1421,10 +1673,10 @@ static bool exportGroupsToShape(shape_t *shape, const PrimGroup &prim_group,
           i1 = face.vertex_indices[(k + 1) % npolys];
           size_t vi0 = size_t(i0.v_idx);
           size_t vi1 = size_t(i1.v_idx);
-          if (((vi0 * 3 + axes[0]) >= v.size()) ||
-              ((vi0 * 3 + axes[1]) >= v.size()) ||
-              ((vi1 * 3 + axes[0]) >= v.size()) ||
-              ((vi1 * 3 + axes[1]) >= v.size())) {
+          if (((vi0 * 3 + axes[0]) >= v_size) ||
+              ((vi0 * 3 + axes[1]) >= v_size) ||
+              ((vi1 * 3 + axes[0]) >= v_size) ||
+              ((vi1 * 3 + axes[1]) >= v_size)) {
             // Invalid index.
             continue;
           }
@@ -1466,8 +1718,8 @@ static bool exportGroupsToShape(shape_t *shape, const PrimGroup &prim_group,
           for (size_t k = 0; k < 3; k++) {
             ind[k] = remainingFace.vertex_indices[(guess_vert + k) % npolys];
             size_t vi = size_t(ind[k].v_idx);
-            if (((vi * 3 + axes[0]) >= v.size()) ||
-                ((vi * 3 + axes[1]) >= v.size())) {
+            if (((vi * 3 + axes[0]) >= v_size) ||
+                ((vi * 3 + axes[1]) >= v_size)) {
               // ???
               vx[k] = static_cast<real_t>(0.0);
               vy[k] = static_cast<real_t>(0.0);
@@ -1499,8 +1751,8 @@ static bool exportGroupsToShape(shape_t *shape, const PrimGroup &prim_group,
 
             size_t ovi = size_t(remainingFace.vertex_indices[idx].v_idx);
 
-            if (((ovi * 3 + axes[0]) >= v.size()) ||
-                ((ovi * 3 + axes[1]) >= v.size())) {
+            if (((ovi * 3 + axes[0]) >= v_size) ||
+                ((ovi * 3 + axes[1]) >= v_size)) {
               // ???
               continue;
             }
@@ -2055,6 +2307,39 @@ void LoadMtl(std::map<std::string, int> *material_map,
   }
 }
 
+// Input of LoadMtl() straight out of a file mapping.
+class obj_membuf_t : public std::streambuf {
+ public:
+  obj_membuf_t(const char *data, size_t size) {
+    char *p = const_cast<char *>(data);
+    setg(p, p, p + size);
+  }
+};
+
+static bool LoadMtlFile(const std::string &filepath, bool mapped,
+                        std::map<std::string, int> *matMap,
+                        std::vector<material_t> *materials, std::string *warn,
+                        std::string *err) {
+  if (mapped) {
+    obj_file_mapping_t mapping;
+    if (MapObjFile(filepath.c_str(), &mapping)) {
+      obj_membuf_t buf(mapping.data, mapping.size);
+      std::istream matIStream(&buf);
+      LoadMtl(matMap, materials, &matIStream, warn, err);
+      UnmapObjFile(&mapping);
+      return true;
+    }
+    // empty or unmappable: fall through to the stream
+  }
+
+  std::ifstream matIStream(filepath.c_str());
+  if (!matIStream) {
+    return false;
+  }
+  LoadMtl(matMap, materials, &matIStream, warn, err);
+  return true;
+}
+
 bool MaterialFileReader::operator()(const std::string &matId,
                                     std::vector<material_t> *materials,
                                     std::map<std::string, int> *matMap,
@@ -2078,10 +2363,7 @@ bool MaterialFileReader::operator()(const std::string &matId,
     for (size_t i = 0; i < paths.size(); i++) {
       std::string filepath = JoinPath(paths[i], matId);
 
-      std::ifstream matIStream(filepath.c_str());
-      if (matIStream) {
-        LoadMtl(matMap, materials, &matIStream, warn, err);
-
+      if (LoadMtlFile(filepath, m_mapped, matMap, materials, warn, err)) {
         return true;
       }
     }
@@ -2096,10 +2378,7 @@ bool MaterialFileReader::operator()(const std::string &matId,
 
   } else {
     std::string filepath = matId;
-    std::ifstream matIStream(filepath.c_str());
-    if (matIStream) {
-      LoadMtl(matMap, materials, &matIStream, warn, err);
-
+    if (LoadMtlFile(filepath, m_mapped, matMap, materials, warn, err)) {
       return true;
     }
 
@@ -2134,6 +2413,19 @@ bool MaterialStreamReader::operator()(const std::string &matId,
   return true;
 }
 
+static std::string GetMtlBaseDir(const char *mtl_basedir) {
+  std::string baseDir = mtl_basedir ? mtl_basedir : "";
+  if (!baseDir.empty()) {
+#ifndef _WIN32
+    const char dirsep = '/';
+#else
+    const char dirsep = '\\';
+#endif
+    if (baseDir[baseDir.length() - 1] != dirsep) baseDir += dirsep;
+  }
+  return baseDir;
+}
+
 bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
              std::vector<material_t> *materials, std::string *warn,
              std::string *err, const char *filename, const char *mtl_basedir,
@@ -2155,520 +2447,461 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
     return false;
   }
 
-  std::string baseDir = mtl_basedir ? mtl_basedir : "";
-  if (!baseDir.empty()) {
-#ifndef _WIN32
-    const char dirsep = '/';
-#else
-    const char dirsep = '\\';
-#endif
-    if (baseDir[baseDir.length() - 1] != dirsep) baseDir += dirsep;
-  }
-  MaterialFileReader matFileReader(baseDir);
+  MaterialFileReader matFileReader(GetMtlBaseDir(mtl_basedir));
 
   return LoadObj(attrib, shapes, materials, warn, err, &ifs, &matFileReader,
                  trianglulate, default_vcols_fallback);
 }
 
-bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
-             std::vector<material_t> *materials, std::string *warn,
-             std::string *err, std::istream *inStream,
-             MaterialReader *readMatFn /*= NULL*/, bool triangulate,
-             bool default_vcols_fallback) {
-  std::stringstream errss;
+// Parser state for every .obj command other than the vertex attributes
+// (`v`, `vn`, `vt`). Shared by the serial and the multithreaded loader, so
+// both build exactly the same shapes.
+struct obj_command_state_t {
+  std::vector<shape_t> *shapes;
+  std::vector<material_t> *materials;
+  std::string *warn;
+  std::string *err;
+  MaterialReader *readMatFn;
+  bool triangulate;
+  const std::vector<real_t> *v;  // vertex positions, used for triangulation
 
-  std::vector<real_t> v;
-  std::vector<real_t> vn;
-  std::vector<real_t> vt;
-  std::vector<real_t> vc;
   std::vector<tag_t> tags;
   PrimGroup prim_group;
   std::string name;
 
   // material
   std::map<std::string, int> material_map;
-  int material = -1;
+  int material;
 
   // smoothing group id
-  unsigned int current_smoothing_id =
-      0;  // Initial value. 0 means no smoothing.
+  unsigned int current_smoothing_id;
 
-  int greatest_v_idx = -1;
-  int greatest_vn_idx = -1;
-  int greatest_vt_idx = -1;
+  int greatest_v_idx;
+  int greatest_vn_idx;
+  int greatest_vt_idx;
 
   shape_t shape;
 
-  bool found_all_colors = true;
-
-  size_t line_num = 0;
-  std::string linebuf;
-  while (inStream->peek() != -1) {
-    safeGetline(*inStream, linebuf);
+  obj_command_state_t()
+      : shapes(NULL),
+        materials(NULL),
+        warn(NULL),
+        err(NULL),
+        readMatFn(NULL),
+        triangulate(true),
+        v(NULL),
+        material(-1),
+        current_smoothing_id(0),  // Initial value. 0 means no smoothing.
+        greatest_v_idx(-1),
+        greatest_vn_idx(-1),
+        greatest_vt_idx(-1) {}
+
+  // `vsize` vertices are defined so far: only those take part in
+  // triangulation, as in a single pass over the file.
+  bool ExportGroups(int vsize) {
+    return exportGroupsToShape(&shape, prim_group, tags, material, name,
+                               triangulate, v->empty() ? NULL : &(*v)[0],
+                               static_cast<size_t>(vsize) * 3);
+  }
+};
 
-    line_num++;
+// Handles one command line. `vsize`, `vnsize` and `vtsize` are the numbers
+// of `v`, `vn` and `vt` entries defined before this line.
+// Returns false on a fatal parse error.
+static bool ProcessObjCommand(obj_command_state_t *st, const char *token,
+                              size_t line_num, int vsize, int vnsize,
+                              int vtsize) {
+  // line
+  if (token[0] == 'l' && IS_SPACE((token[1]))) {
+    token += 2;
 
-    // Trim newline '\r\n' or '\n'
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\n')
-        linebuf.erase(linebuf.size() - 1);
-    }
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\r')
-        linebuf.erase(linebuf.size() - 1);
-    }
+    __line_t line;
 
-    // Skip if empty line.
-    if (linebuf.empty()) {
-      continue;
-    }
+    while (!IS_NEW_LINE(token[0])) {
+      vertex_index_t vi;
+      if (!parseTriple(&token, vsize, vnsize, vtsize, &vi)) {
+        if (st->err) {
+          std::stringstream ss;
+          ss << "Failed parse `l' line(e.g. zero value for vertex index. "
+                "line "
+             << line_num << ".)\n";
+          (*st->err) += ss.str();
+        }
+        return false;
+      }
 
-    // Skip leading space.
-    const char *token = linebuf.c_str();
-    token += strspn(token, " \t");
+      line.vertex_indices.push_back(vi);
 
-    assert(token);
-    if (token[0] == '\0') continue;  // empty line
+      size_t n = strspn(token, " \t\r");
+      token += n;
+    }
 
-    if (token[0] == '#') continue;  // comment line
+    st->prim_group.lineGroup.push_back(line);
 
-    // vertex
-    if (token[0] == 'v' && IS_SPACE((token[1]))) {
-      token += 2;
-      real_t x, y, z;
-      real_t r, g, b;
+    return true;
+  }
 
-      found_all_colors &= parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
+  // points
+  if (token[0] == 'p' && IS_SPACE((token[1]))) {
+    token += 2;
 
-      v.push_back(x);
-      v.push_back(y);
-      v.push_back(z);
+    __points_t pts;
 
-      if (found_all_colors || default_vcols_fallback) {
-        vc.push_back(r);
-        vc.push_back(g);
-        vc.push_back(b);
+    while (!IS_NEW_LINE(token[0])) {
+      vertex_index_t vi;
+      if (!parseTriple(&token, vsize, vnsize, vtsize, &vi)) {
+        if (st->err) {
+          std::stringstream ss;
+          ss << "Failed parse `p' line(e.g. zero value for vertex index. "
+                "line "
+             << line_num << ".)\n";
+          (*st->err) += ss.str();
+        }
+        return false;
       }
 
-      continue;
-    }
+      pts.vertex_indices.push_back(vi);
 
-    // normal
-    if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
-      token += 3;
-      real_t x, y, z;
-      parseReal3(&x, &y, &z, &token);
-      vn.push_back(x);
-      vn.push_back(y);
-      vn.push_back(z);
-      continue;
+      size_t n = strspn(token, " \t\r");
+      token += n;
     }
 
-    // texcoord
-    if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
-      token += 3;
-      real_t x, y;
-      parseReal2(&x, &y, &token);
-      vt.push_back(x);
-      vt.push_back(y);
-      continue;
-    }
+    st->prim_group.pointsGroup.push_back(pts);
 
-    // line
-    if (token[0] == 'l' && IS_SPACE((token[1]))) {
-      token += 2;
+    return true;
+  }
 
-      __line_t line;
+  // face
+  if (token[0] == 'f' && IS_SPACE((token[1]))) {
+    token += 2;
+    token += strspn(token, " \t");
 
-      while (!IS_NEW_LINE(token[0])) {
-        vertex_index_t vi;
-        if (!parseTriple(&token, static_cast<int>(v.size() / 3),
-                         static_cast<int>(vn.size() / 3),
-                         static_cast<int>(vt.size() / 2), &vi)) {
-          if (err) {
-            std::stringstream ss;
-            ss << "Failed parse `l' line(e.g. zero value for vertex index. "
-                  "line "
-               << line_num << ".)\n";
-            (*err) += ss.str();
-          }
-          return false;
-        }
+    face_t face;
 
-        line.vertex_indices.push_back(vi);
+    face.smoothing_group_id = st->current_smoothing_id;
+    face.vertex_indices.reserve(3);
 
-        size_t n = strspn(token, " \t\r");
-        token += n;
+    while (!IS_NEW_LINE(token[0])) {
+      vertex_index_t vi;
+      if (!parseTriple(&token, vsize, vnsize, vtsize, &vi)) {
+        if (st->err) {
+          std::stringstream ss;
+          ss << "Failed parse `f' line(e.g. zero value for face index. line "
+             << line_num << ".)\n";
+          (*st->err) += ss.str();
+        }
+        return false;
       }
 
-      prim_group.lineGroup.push_back(line);
+      st->greatest_v_idx =
+          st->greatest_v_idx > vi.v_idx ? st->greatest_v_idx : vi.v_idx;
+      st->greatest_vn_idx =
+          st->greatest_vn_idx > vi.vn_idx ? st->greatest_vn_idx : vi.vn_idx;
+      st->greatest_vt_idx =
+          st->greatest_vt_idx > vi.vt_idx ? st->greatest_vt_idx : vi.vt_idx;
 
-      continue;
+      face.vertex_indices.push_back(vi);
+      size_t n = strspn(token, " \t\r");
+      token += n;
     }
 
-    // points
-    if (token[0] == 'p' && IS_SPACE((token[1]))) {
-      token += 2;
-
-      __points_t pts;
+    // replace with emplace_back + std::move on C++11
+    st->prim_group.faceGroup.push_back(face);
 
-      while (!IS_NEW_LINE(token[0])) {
-        vertex_index_t vi;
-        if (!parseTriple(&token, static_cast<int>(v.size() / 3),
-                         static_cast<int>(vn.size() / 3),
-                         static_cast<int>(vt.size() / 2), &vi)) {
-          if (err) {
-            std::stringstream ss;
-            ss << "Failed parse `p' line(e.g. zero value for vertex index. "
-                  "line "
-               << line_num << ".)\n";
-            (*err) += ss.str();
-          }
-          return false;
-        }
+    return true;
+  }
 
-        pts.vertex_indices.push_back(vi);
+  // use mtl
+  if ((0 == strncmp(token, "usemtl", 6))) {
+    token += 6;
+    std::string namebuf = parseString(&token);
 
-        size_t n = strspn(token, " \t\r");
-        token += n;
+    int newMaterialId = -1;
+    std::map<std::string, int>::const_iterator it =
+        st->material_map.find(namebuf);
+    if (it != st->material_map.end()) {
+      newMaterialId = it->second;
+    } else {
+      // { error!! material not found }
+      if (st->warn) {
+        (*st->warn) += "material [ '" + namebuf + "' ] not found in .mtl\n";
       }
+    }
 
-      prim_group.pointsGroup.push_back(pts);
-
-      continue;
+    if (newMaterialId != st->material) {
+      // Create per-face material. Thus we don't add `shape` to `shapes` at
+      // this time.
+      // just clear `faceGroup` after `exportGroupsToShape()` call.
+      st->ExportGroups(vsize);
+      st->prim_group.faceGroup.clear();
+      st->material = newMaterialId;
     }
 
-    // face
-    if (token[0] == 'f' && IS_SPACE((token[1]))) {
-      token += 2;
-      token += strspn(token, " \t");
+    return true;
+  }
 
-      face_t face;
+  // load mtl
+  if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
+    if (st->readMatFn) {
+      token += 7;
 
-      face.smoothing_group_id = current_smoothing_id;
-      face.vertex_indices.reserve(3);
+      std::vector<std::string> filenames;
+      SplitString(std::string(token), ' ', filenames);
 
-      while (!IS_NEW_LINE(token[0])) {
-        vertex_index_t vi;
-        if (!parseTriple(&token, static_cast<int>(v.size() / 3),
-                         static_cast<int>(vn.size() / 3),
-                         static_cast<int>(vt.size() / 2), &vi)) {
-          if (err) {
-            std::stringstream ss;
-            ss << "Failed parse `f' line(e.g. zero value for face index. line "
-               << line_num << ".)\n";
-            (*err) += ss.str();
-          }
-          return false;
+      if (filenames.empty()) {
+        if (st->warn) {
+          std::stringstream ss;
+          ss << "Looks like empty filename for mtllib. Use default "
+                "material (line "
+             << line_num << ".)\n";
+
+          (*st->warn) += ss.str();
         }
+      } else {
+        bool found = false;
+        for (size_t s = 0; s < filenames.size(); s++) {
+          std::string warn_mtl;
+          std::string err_mtl;
+          bool ok = (*st->readMatFn)(filenames[s].c_str(), st->materials,
+                                     &st->material_map, &warn_mtl, &err_mtl);
+          if (st->warn && (!warn_mtl.empty())) {
+            (*st->warn) += warn_mtl;
+          }
 
-        greatest_v_idx = greatest_v_idx > vi.v_idx ? greatest_v_idx : vi.v_idx;
-        greatest_vn_idx =
-            greatest_vn_idx > vi.vn_idx ? greatest_vn_idx : vi.vn_idx;
-        greatest_vt_idx =
-            greatest_vt_idx > vi.vt_idx ? greatest_vt_idx : vi.vt_idx;
+          if (st->err && (!err_mtl.empty())) {
+            (*st->err) += err_mtl;
+          }
 
-        face.vertex_indices.push_back(vi);
-        size_t n = strspn(token, " \t\r");
-        token += n;
-      }
+          if (ok) {
+            found = true;
+            break;
+          }
+        }
 
-      // replace with emplace_back + std::move on C++11
-      prim_group.faceGroup.push_back(face);
+        if (!found) {
+          if (st->warn) {
+            (*st->warn) +=
+                "Failed to load material file(s). Use default "
+                "material.\n";
+          }
+        }
+      }
+    }
 
-      continue;
-    }
-
-    // use mtl
-    if ((0 == strncmp(token, "usemtl", 6))) {
-      token += 6;
-      std::string namebuf = parseString(&token);
-
-      int newMaterialId = -1;
-      std::map<std::string, int>::const_iterator it = material_map.find(namebuf);
-      if (it != material_map.end()) {
-        newMaterialId = it->second;
-      } else {
-        // { error!! material not found }
-        if (warn) {
-          (*warn) += "material [ '" + namebuf + "' ] not found in .mtl\n";
-        }
-      }
+    return true;
+  }
 
-      if (newMaterialId != material) {
-        // Create per-face material. Thus we don't add `shape` to `shapes` at
-        // this time.
-        // just clear `faceGroup` after `exportGroupsToShape()` call.
-        exportGroupsToShape(&shape, prim_group, tags, material, name,
-                            triangulate, v);
-        prim_group.faceGroup.clear();
-        material = newMaterialId;
-      }
+  // group name
+  if (token[0] == 'g' && IS_SPACE((token[1]))) {
+    // flush previous face group.
+    bool ret = st->ExportGroups(vsize);
+    (void)ret;  // return value not used.
 
-      continue;
+    if (st->shape.mesh.indices.size() > 0) {
+      st->shapes->push_back(st->shape);
     }
 
-    // load mtl
-    if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
-      if (readMatFn) {
-        token += 7;
+    st->shape = shape_t();
 
-        std::vector<std::string> filenames;
-        SplitString(std::string(token), ' ', filenames);
+    // material = -1;
+    st->prim_group.clear();
 
-        if (filenames.empty()) {
-          if (warn) {
-            std::stringstream ss;
-            ss << "Looks like empty filename for mtllib. Use default "
-                  "material (line "
-               << line_num << ".)\n";
+    std::vector<std::string> names;
 
-            (*warn) += ss.str();
-          }
-        } else {
-          bool found = false;
-          for (size_t s = 0; s < filenames.size(); s++) {
-            std::string warn_mtl;
-            std::string err_mtl;
-            bool ok = (*readMatFn)(filenames[s].c_str(), materials,
-                                   &material_map, &warn_mtl, &err_mtl);
-            if (warn && (!warn_mtl.empty())) {
-              (*warn) += warn_mtl;
-            }
-
-            if (err && (!err_mtl.empty())) {
-              (*err) += err_mtl;
-            }
-
-            if (ok) {
-              found = true;
-              break;
-            }
-          }
-
-          if (!found) {
-            if (warn) {
-              (*warn) +=
-                  "Failed to load material file(s). Use default "
-                  "material.\n";
-            }
-          }
-        }
-      }
-
-      continue;
+    while (!IS_NEW_LINE(token[0])) {
+      std::string str = parseString(&token);
+      names.push_back(str);
+      token += strspn(token, " \t\r");  // skip tag
     }
 
-    // group name
-    if (token[0] == 'g' && IS_SPACE((token[1]))) {
-      // flush previous face group.
-      bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
-                                     triangulate, v);
-      (void)ret;  // return value not used.
+    // names[0] must be 'g'
 
-      if (shape.mesh.indices.size() > 0) {
-        shapes->push_back(shape);
+    if (names.size() < 2) {
+      // 'g' with empty names
+      if (st->warn) {
+        std::stringstream ss;
+        ss << "Empty group name. line: " << line_num << "\n";
+        (*st->warn) += ss.str();
+        st->name = "";
       }
+    } else {
+      std::stringstream ss;
+      ss << names[1];
 
-      shape = shape_t();
-
-      // material = -1;
-      prim_group.clear();
-
-      std::vector<std::string> names;
+      // tinyobjloader does not support multiple groups for a primitive.
+      // Currently we concatinate multiple group names with a space to get
+      // single group name.
 
-      while (!IS_NEW_LINE(token[0])) {
-        std::string str = parseString(&token);
-        names.push_back(str);
-        token += strspn(token, " \t\r");  // skip tag
+      for (size_t i = 2; i < names.size(); i++) {
+        ss << " " << names[i];
       }
 
-      // names[0] must be 'g'
-
-      if (names.size() < 2) {
-        // 'g' with empty names
-        if (warn) {
-          std::stringstream ss;
-          ss << "Empty group name. line: " << line_num << "\n";
-          (*warn) += ss.str();
-          name = "";
-        }
-      } else {
-        std::stringstream ss;
-        ss << names[1];
-
-        // tinyobjloader does not support multiple groups for a primitive.
-        // Currently we concatinate multiple group names with a space to get
-        // single group name.
+      st->name = ss.str();
+    }
 
-        for (size_t i = 2; i < names.size(); i++) {
-          ss << " " << names[i];
-        }
+    return true;
+  }
 
-        name = ss.str();
-      }
+  // object name
+  if (token[0] == 'o' && IS_SPACE((token[1]))) {
+    // flush previous face group.
+    bool ret = st->ExportGroups(vsize);
+    (void)ret;  // return value not used.
 
-      continue;
+    if (st->shape.mesh.indices.size() > 0 ||
+        st->shape.lines.indices.size() > 0 ||
+        st->shape.points.indices.size() > 0) {
+      st->shapes->push_back(st->shape);
     }
 
-    // object name
-    if (token[0] == 'o' && IS_SPACE((token[1]))) {
-      // flush previous face group.
-      bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
-                                     triangulate, v);
-      (void)ret;  // return value not used.
-
-      if (shape.mesh.indices.size() > 0 || shape.lines.indices.size() > 0 ||
-          shape.points.indices.size() > 0) {
-        shapes->push_back(shape);
-      }
+    // material = -1;
+    st->prim_group.clear();
+    st->shape = shape_t();
 
-      // material = -1;
-      prim_group.clear();
-      shape = shape_t();
-
-      // @todo { multiple object name? }
-      token += 2;
-      std::stringstream ss;
-      ss << token;
-      name = ss.str();
+    // @todo { multiple object name? }
+    token += 2;
+    std::stringstream ss;
+    ss << token;
+    st->name = ss.str();
 
-      continue;
-    }
+    return true;
+  }
 
-    if (token[0] == 't' && IS_SPACE(token[1])) {
-      const int max_tag_nums = 8192;  // FIXME(syoyo): Parameterize.
-      tag_t tag;
+  if (token[0] == 't' && IS_SPACE(token[1])) {
+    const int max_tag_nums = 8192;  // FIXME(syoyo): Parameterize.
+    tag_t tag;
 
-      token += 2;
+    token += 2;
 
-      tag.name = parseString(&token);
+    tag.name = parseString(&token);
 
-      tag_sizes ts = parseTagTriple(&token);
+    tag_sizes ts = parseTagTriple(&token);
 
-      if (ts.num_ints < 0) {
-        ts.num_ints = 0;
-      }
-      if (ts.num_ints > max_tag_nums) {
-        ts.num_ints = max_tag_nums;
-      }
+    if (ts.num_ints < 0) {
+      ts.num_ints = 0;
+    }
+    if (ts.num_ints > max_tag_nums) {
+      ts.num_ints = max_tag_nums;
+    }
 
-      if (ts.num_reals < 0) {
-        ts.num_reals = 0;
-      }
-      if (ts.num_reals > max_tag_nums) {
-        ts.num_reals = max_tag_nums;
-      }
+    if (ts.num_reals < 0) {
+      ts.num_reals = 0;
+    }
+    if (ts.num_reals > max_tag_nums) {
+      ts.num_reals = max_tag_nums;
+    }
 
-      if (ts.num_strings < 0) {
-        ts.num_strings = 0;
-      }
-      if (ts.num_strings > max_tag_nums) {
-        ts.num_strings = max_tag_nums;
-      }
+    if (ts.num_strings < 0) {
+      ts.num_strings = 0;
+    }
+    if (ts.num_strings > max_tag_nums) {
+      ts.num_strings = max_tag_nums;
+    }
 
-      tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+    tag.intValues.resize(static_cast<size_t>(ts.num_ints));
 
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
-        tag.intValues[i] = parseInt(&token);
-      }
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
+      tag.intValues[i] = parseInt(&token);
+    }
 
-      tag.floatValues.resize(static_cast<size_t>(ts.num_reals));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_reals); ++i) {
-        tag.floatValues[i] = parseReal(&token);
-      }
+    tag.floatValues.resize(static_cast<size_t>(ts.num_reals));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_reals); ++i) {
+      tag.floatValues[i] = parseReal(&token);
+    }
 
-      tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
-        tag.stringValues[i] = parseString(&token);
-      }
+    tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
+      tag.stringValues[i] = parseString(&token);
+    }
 
-      tags.push_back(tag);
+    st->tags.push_back(tag);
 
-      continue;
-    }
+    return true;
+  }
 
-    if (token[0] == 's' && IS_SPACE(token[1])) {
-      // smoothing group id
-      token += 2;
+  if (token[0] == 's' && IS_SPACE(token[1])) {
+    // smoothing group id
+    token += 2;
 
-      // skip space.
-      token += strspn(token, " \t");  // skip space
+    // skip space.
+    token += strspn(token, " \t");  // skip space
 
-      if (token[0] == '\0') {
-        continue;
-      }
+    if (token[0] == '\0') {
+      return true;
+    }
 
-      if (token[0] == '\r' || token[1] == '\n') {
-        continue;
-      }
+    if (token[0] == '\r' || token[1] == '\n') {
+      return true;
+    }
 
-      if (strlen(token) >= 3 && token[0] == 'o' && token[1] == 'f' &&
-          token[2] == 'f') {
-        current_smoothing_id = 0;
+    if (strlen(token) >= 3 && token[0] == 'o' && token[1] == 'f' &&
+        token[2] == 'f') {
+      st->current_smoothing_id = 0;
+    } else {
+      // assume number
+      int smGroupId = parseInt(&token);
+      if (smGroupId < 0) {
+        // parse error. force set to 0.
+        // FIXME(syoyo): Report warning.
+        st->current_smoothing_id = 0;
       } else {
-        // assume number
-        int smGroupId = parseInt(&token);
-        if (smGroupId < 0) {
-          // parse error. force set to 0.
-          // FIXME(syoyo): Report warning.
-          current_smoothing_id = 0;
-        } else {
-          current_smoothing_id = static_cast<unsigned int>(smGroupId);
-        }
+        st->current_smoothing_id = static_cast<unsigned int>(smGroupId);
       }
+    }
 
-      continue;
-    }  // smoothing group id
+    return true;
+  }  // smoothing group id
 
-    // Ignore unknown command.
-  }
+  // Ignore unknown command.
+  return true;
+}
 
+// Flushes the last shape and moves the attributes into `attrib`.
+static void FinishObj(obj_command_state_t *st, attrib_t *attrib,
+                      std::vector<real_t> &v, std::vector<real_t> &vn,
+                      std::vector<real_t> &vt, std::vector<real_t> &vc,
+                      bool found_all_colors, bool default_vcols_fallback,
+                      size_t line_num) {
   // not all vertices have colors, no default colors desired? -> clear colors
   if (!found_all_colors && !default_vcols_fallback) {
     vc.clear();
   }
 
-  if (greatest_v_idx >= static_cast<int>(v.size() / 3)) {
-    if (warn) {
+  if (st->greatest_v_idx >= static_cast<int>(v.size() / 3)) {
+    if (st->warn) {
       std::stringstream ss;
       ss << "Vertex indices out of bounds (line " << line_num << ".)\n"
          << std::endl;
-      (*warn) += ss.str();
+      (*st->warn) += ss.str();
     }
   }
-  if (greatest_vn_idx >= static_cast<int>(vn.size() / 3)) {
-    if (warn) {
+  if (st->greatest_vn_idx >= static_cast<int>(vn.size() / 3)) {
+    if (st->warn) {
       std::stringstream ss;
       ss << "Vertex normal indices out of bounds (line " << line_num << ".)\n"
          << std::endl;
-      (*warn) += ss.str();
+      (*st->warn) += ss.str();
     }
   }
-  if (greatest_vt_idx >= static_cast<int>(vt.size() / 2)) {
-    if (warn) {
+  if (st->greatest_vt_idx >= static_cast<int>(vt.size() / 2)) {
+    if (st->warn) {
       std::stringstream ss;
       ss << "Vertex texcoord indices out of bounds (line " << line_num << ".)\n"
          << std::endl;
-      (*warn) += ss.str();
+      (*st->warn) += ss.str();
     }
   }
 
-  bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
-                                 triangulate, v);
+  bool ret = st->ExportGroups(static_cast<int>(v.size() / 3));
   // exportGroupsToShape return false when `usemtl` is called in the last
   // line.
   // we also add `shape` to `shapes` when `shape.mesh` has already some
   // faces(indices)
-  if (ret || shape.mesh.indices
+  if (ret || st->shape.mesh.indices
                  .size()) {  // FIXME(syoyo): Support other prims(e.g. lines)
-    shapes->push_back(shape);
-  }
-  prim_group.clear();  // for safety
-
-  if (err) {
-    (*err) += errss.str();
+    st->shapes->push_back(st->shape);
   }
+  st->prim_group.clear();  // for safety
 
   attrib->vertices.swap(v);
   attrib->vertex_weights.swap(v);
@@ -2676,10 +2909,542 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
   attrib->texcoords.swap(vt);
   attrib->texcoord_ws.swap(vt);
   attrib->colors.swap(vc);
+}
+
+bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
+             std::vector<material_t> *materials, std::string *warn,
+             std::string *err, std::istream *inStream,
+             MaterialReader *readMatFn /*= NULL*/, bool triangulate,
+             bool default_vcols_fallback) {
+  std::vector<real_t> v;
+  std::vector<real_t> vn;
+  std::vector<real_t> vt;
+  std::vector<real_t> vc;
+
+  obj_command_state_t state;
+  state.shapes = shapes;
+  state.materials = materials;
+  state.warn = warn;
+  state.err = err;
+  state.readMatFn = readMatFn;
+  state.triangulate = triangulate;
+  state.v = &v;
+
+  bool found_all_colors = true;
+
+  size_t line_num = 0;
+  std::string linebuf;
+  while (inStream->peek() != -1) {
+    safeGetline(*inStream, linebuf);
+
+    line_num++;
+
+    // Trim newline '\r\n' or '\n'
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\n')
+        linebuf.erase(linebuf.size() - 1);
+    }
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\r')
+        linebuf.erase(linebuf.size() - 1);
+    }
+
+    // Skip if empty line.
+    if (linebuf.empty()) {
+      continue;
+    }
+
+    // Skip leading space.
+    const char *token = linebuf.c_str();
+    token += strspn(token, " \t");
+
+    assert(token);
+    if (token[0] == '\0') continue;  // empty line
+
+    if (token[0] == '#') continue;  // comment line
+
+    // vertex
+    if (token[0] == 'v' && IS_SPACE((token[1]))) {
+      token += 2;
+      real_t x, y, z;
+      real_t r, g, b;
+
+      found_all_colors &= parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
+
+      v.push_back(x);
+      v.push_back(y);
+      v.push_back(z);
+
+      if (found_all_colors || default_vcols_fallback) {
+        vc.push_back(r);
+        vc.push_back(g);
+        vc.push_back(b);
+      }
+
+      continue;
+    }
+
+    // normal
+    if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+      token += 3;
+      real_t x, y, z;
+      parseReal3(&x, &y, &z, &token);
+      vn.push_back(x);
+      vn.push_back(y);
+      vn.push_back(z);
+      continue;
+    }
+
+    // texcoord
+    if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+      token += 3;
+      real_t x, y;
+      parseReal2(&x, &y, &token);
+      vt.push_back(x);
+      vt.push_back(y);
+      continue;
+    }
+
+    if (!ProcessObjCommand(&state, token, line_num,
+                           static_cast<int>(v.size() / 3),
+                           static_cast<int>(vn.size() / 3),
+                           static_cast<int>(vt.size() / 2))) {
+      return false;
+    }
+  }
+
+  FinishObj(&state, attrib, v, vn, vt, vc, found_all_colors,
+            default_vcols_fallback, line_num);
+
+  return true;
+}
+
+// `f` index triple as written in the file, before fixIndex().
+struct obj_raw_index_t {
+  int v_idx, vt_idx, vn_idx;
+  bool has_vt, has_vn;
+};
+
+// A line of a chunk that is replayed serially after the parallel pass.
+// There is one per face, so it is kept small: the triples of a face follow
+// those of the previous face in obj_chunk_t::face_indices.
+struct obj_chunk_command_t {
+  size_t line_num;     // line number inside the chunk
+  size_t text_offset;  // other commands: line in obj_chunk_t::command_text
+  int vsize, vnsize, vtsize;  // attributes defined before it in the chunk
+  int face_size;              // triples of a pre-tokenized `f` line, or -1
+};
+
+struct obj_chunk_t {
+  const char *begin;
+  const char *end;
+
+  std::vector<real_t> v;
+  std::vector<real_t> vn;
+  std::vector<real_t> vt;
+  std::vector<real_t> vc;  // always filled, dropped on merge if incomplete
+  bool found_all_colors;
+
+  size_t num_lines;
+  std::vector<obj_chunk_command_t> commands;
+  std::vector<obj_raw_index_t> face_indices;
+  std::string command_text;  // NUL-separated copies, from the first token on
+
+  obj_chunk_t() : begin(NULL), end(NULL), found_all_colors(true), num_lines(0) {}
+};
+
+// Same token walk as parseTriple(), without resolving the indices.
+static obj_raw_index_t parseRawFaceTriple(const char **token) {
+  obj_raw_index_t vi;
+  vi.v_idx = parseIndex((*token));
+  vi.vt_idx = 0;
+  vi.vn_idx = 0;
+  vi.has_vt = false;
+  vi.has_vn = false;
+
+  (*token) += strcspn((*token), "/ \t\r\n");
+  if ((*token)[0] != '/') {
+    return vi;
+  }
+  (*token)++;
+
+  // i//k
+  if ((*token)[0] == '/') {
+    (*token)++;
+    vi.vn_idx = parseIndex((*token));
+    vi.has_vn = true;
+    (*token) += strcspn((*token), "/ \t\r\n");
+    return vi;
+  }
+
+  // i/j/k or i/j
+  vi.vt_idx = parseIndex((*token));
+  vi.has_vt = true;
+  (*token) += strcspn((*token), "/ \t\r\n");
+  if ((*token)[0] != '/') {
+    return vi;
+  }
+
+  // i/j/k
+  (*token)++;  // skip '/'
+  vi.vn_idx = parseIndex((*token));
+  vi.has_vn = true;
+  (*token) += strcspn((*token), "/ \t\r\n");
+  return vi;
+}
+
+// Parallel pass over one chunk: split lines the way safeGetline() does,
+// parse the attributes and tokenize faces into chunk-local arrays. The
+// text is read-only (it may be a file mapping), so lines are not
+// NUL-terminated: every token scanner stops at '\r' and '\n' as well.
+// `text_end` is the end of the whole file; a last line without a line
+// break is copied so that no scanner runs past it.
+static void ParseObjChunk(obj_chunk_t *chunk, const char *text_end) {
+  const char *p = chunk->begin;
+  std::string last_line;
+  while (p < chunk->end) {
+    const char *e = p;
+    while (e < chunk->end && *e != '\n' && *e != '\r') e++;
+    const char *next = e + 1;
+    if (e < chunk->end && *e == '\r' && next < chunk->end && *next == '\n')
+      next++;
+
+    chunk->num_lines++;
+
+    const char *line = p;
+    const char *line_end = e;
+    if (e == text_end) {
+      last_line.assign(p, e);
+      line = last_line.c_str();
+      line_end = line + last_line.size();
+    }
+    p = next;
+
+    const char *token = line + strspn(line, " \t");
+
+    if (token == line_end) continue;  // empty line
+
+    if (token[0] == '#') continue;  // comment line
+
+    // vertex
+    if (token[0] == 'v' && IS_SPACE((token[1]))) {
+      token += 2;
+      real_t x, y, z;
+      real_t r, g, b;
+
+      chunk->found_all_colors &=
+          parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
+
+      chunk->v.push_back(x);
+      chunk->v.push_back(y);
+      chunk->v.push_back(z);
+
+      chunk->vc.push_back(r);
+      chunk->vc.push_back(g);
+      chunk->vc.push_back(b);
+
+      continue;
+    }
+
+    // normal
+    if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+      token += 3;
+      real_t x, y, z;
+      parseReal3(&x, &y, &z, &token);
+      chunk->vn.push_back(x);
+      chunk->vn.push_back(y);
+      chunk->vn.push_back(z);
+      continue;
+    }
+
+    // texcoord
+    if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+      token += 3;
+      real_t x, y;
+      parseReal2(&x, &y, &token);
+      chunk->vt.push_back(x);
+      chunk->vt.push_back(y);
+      continue;
+    }
+
+    chunk->commands.push_back(obj_chunk_command_t());
+    obj_chunk_command_t &command = chunk->commands.back();
+    command.line_num = chunk->num_lines;
+    command.vsize = static_cast<int>(chunk->v.size() / 3);
+    command.vnsize = static_cast<int>(chunk->vn.size() / 3);
+    command.vtsize = static_cast<int>(chunk->vt.size() / 2);
+    command.text_offset = 0;
+    command.face_size = -1;
+
+    // face
+    if (token[0] == 'f' && IS_SPACE((token[1]))) {
+      token += 2;
+      token += strspn(token, " \t");
+
+      size_t face_begin = chunk->face_indices.size();
+      while (!IS_NEW_LINE(token[0])) {
+        chunk->face_indices.push_back(parseRawFaceTriple(&token));
+        // not "\r": without in-place NUL it is the line break
+        size_t n = strspn(token, " \t");
+        token += n;
+      }
+      command.face_size =
+          static_cast<int>(chunk->face_indices.size() - face_begin);
+    } else {
+      command.text_offset = chunk->command_text.size();
+      chunk->command_text.append(token, line_end);
+      chunk->command_text.push_back('\0');
+    }
+  }
+}
+
+// Serial replay of a pre-tokenized `f` line with the global attribute counts.
+static bool AddChunkFace(obj_command_state_t *st,
+                         const obj_raw_index_t *triples, int face_size,
+                         size_t line_num, int vsize, int vnsize, int vtsize) {
+  face_t face;
+
+  face.smoothing_group_id = st->current_smoothing_id;
+  face.vertex_indices.reserve(static_cast<size_t>(face_size));
+
+  for (int i = 0; i < face_size; i++) {
+    const obj_raw_index_t &raw = triples[i];
+    vertex_index_t vi(-1);
+    if (!fixIndex(raw.v_idx, vsize, &vi.v_idx) ||
+        (raw.has_vt && !fixIndex(raw.vt_idx, vtsize, &vi.vt_idx)) ||
+        (raw.has_vn && !fixIndex(raw.vn_idx, vnsize, &vi.vn_idx))) {
+      if (st->err) {
+        std::stringstream ss;
+        ss << "Failed parse `f' line(e.g. zero value for face index. line "
+           << line_num << ".)\n";
+        (*st->err) += ss.str();
+      }
+      return false;
+    }
+
+    st->greatest_v_idx =
+        st->greatest_v_idx > vi.v_idx ? st->greatest_v_idx : vi.v_idx;
+    st->greatest_vn_idx =
+        st->greatest_vn_idx > vi.vn_idx ? st->greatest_vn_idx : vi.vn_idx;
+    st->greatest_vt_idx =
+        st->greatest_vt_idx > vi.vt_idx ? st->greatest_vt_idx : vi.vt_idx;
+
+    face.vertex_indices.push_back(vi);
+  }
 
+  st->prim_group.faceGroup.push_back(face);
   return true;
 }
 
+// Parallel pass over the whole .obj text `[text, text + size)`. The chunks
+// keep no pointer into the text, so it can be released before the merge.
+static void ParseObjText(const char *text, size_t size, int num_threads,
+                         std::vector<obj_chunk_t> *chunks) {
+  if (num_threads <= 0) {
+    num_threads = static_cast<int>(std::thread::hardware_concurrency());
+    if (num_threads <= 0) num_threads = 1;
+  }
+  // not worth a thread below a few KB per chunk
+  size_t num_chunks = (std::min)(static_cast<size_t>(num_threads),
+                               size / 4096 + 1);
+
+  // Split at '\n' so that a "\r\n" pair never straddles two chunks.
+  chunks->resize(num_chunks);
+  const char *text_end = text + size;
+  const char *chunk_begin = text;
+  for (size_t i = 0; i < num_chunks; i++) {
+    const char *chunk_end = text_end;
+    if (i + 1 < num_chunks) {
+      const char *split = text + size * (i + 1) / num_chunks;
+      if (split < chunk_begin) split = chunk_begin;
+      while (split < chunk_end && *split != '\n') split++;
+      if (split < chunk_end) chunk_end = split + 1;
+    }
+    (*chunks)[i].begin = chunk_begin;
+    (*chunks)[i].end = chunk_end;
+    chunk_begin = chunk_end;
+  }
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < num_chunks; i++) {
+    workers.push_back(std::thread(ParseObjChunk, &(*chunks)[i], text_end));
+  }
+  ParseObjChunk(&(*chunks)[0], text_end);
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+}
+
+// Append `src` to `dst` and release it. `dst` is only reserved when there
+// are several chunks; a single chunk is moved, not copied.
+static void MoveChunkArray(std::vector<real_t> *dst, std::vector<real_t> *src) {
+  if (dst->capacity() == 0) {
+    dst->swap(*src);
+  } else {
+    dst->insert(dst->end(), src->begin(), src->end());
+  }
+  std::vector<real_t>().swap(*src);
+}
+
+// Serial half of the chunked loader.
+static bool MergeObjChunks(attrib_t *attrib, std::vector<shape_t> *shapes,
+                           std::vector<material_t> *materials,
+                           std::string *warn, std::string *err,
+                           std::vector<obj_chunk_t> &chunks,
+                           MaterialReader *readMatFn, bool triangulate,
+                           bool default_vcols_fallback) {
+  size_t num_chunks = chunks.size();
+
+  // Merge the attributes in file order, remembering where each chunk
+  // starts for the replay.
+  size_t v_total = 0, vn_total = 0, vt_total = 0;
+  bool found_all_colors = true;
+  std::vector<int> v_bases(num_chunks), vn_bases(num_chunks),
+      vt_bases(num_chunks);
+  for (size_t i = 0; i < num_chunks; i++) {
+    v_bases[i] = static_cast<int>(v_total / 3);
+    vn_bases[i] = static_cast<int>(vn_total / 3);
+    vt_bases[i] = static_cast<int>(vt_total / 2);
+    v_total += chunks[i].v.size();
+    vn_total += chunks[i].vn.size();
+    vt_total += chunks[i].vt.size();
+    found_all_colors &= chunks[i].found_all_colors;
+  }
+
+  std::vector<real_t> v, vn, vt, vc;
+  if (num_chunks > 1) {
+    v.reserve(v_total);
+    vn.reserve(vn_total);
+    vt.reserve(vt_total);
+    if (found_all_colors || default_vcols_fallback) vc.reserve(v_total);
+  }
+  for (size_t i = 0; i < num_chunks; i++) {
+    MoveChunkArray(&v, &chunks[i].v);
+    MoveChunkArray(&vn, &chunks[i].vn);
+    MoveChunkArray(&vt, &chunks[i].vt);
+    if (found_all_colors || default_vcols_fallback) {
+      MoveChunkArray(&vc, &chunks[i].vc);
+    } else {
+      std::vector<real_t>().swap(chunks[i].vc);
+    }
+  }
+
+  obj_command_state_t state;
+  state.shapes = shapes;
+  state.materials = materials;
+  state.warn = warn;
+  state.err = err;
+  state.readMatFn = readMatFn;
+  state.triangulate = triangulate;
+  state.v = &v;
+
+  // Replay the remaining commands in file order, rebasing chunk-local
+  // line numbers and attribute counts.
+  size_t line_base = 0;
+  for (size_t i = 0; i < num_chunks; i++) {
+    obj_chunk_t &chunk = chunks[i];
+    size_t face_begin = 0;
+    for (size_t c = 0; c < chunk.commands.size(); c++) {
+      const obj_chunk_command_t &command = chunk.commands[c];
+      size_t line_num = line_base + command.line_num;
+      int vsize = v_bases[i] + command.vsize;
+      int vnsize = vn_bases[i] + command.vnsize;
+      int vtsize = vt_bases[i] + command.vtsize;
+
+      bool ok;
+      if (command.face_size >= 0) {
+        const obj_raw_index_t *triples =
+            chunk.face_indices.empty() ? NULL : &chunk.face_indices[face_begin];
+        ok = AddChunkFace(&state, triples, command.face_size, line_num, vsize,
+                          vnsize, vtsize);
+        face_begin += static_cast<size_t>(command.face_size);
+      } else {
+        ok = ProcessObjCommand(&state,
+                               chunk.command_text.c_str() + command.text_offset,
+                               line_num, vsize, vnsize, vtsize);
+      }
+      if (!ok) {
+        return false;
+      }
+    }
+    line_base += chunk.num_lines;
+    std::vector<obj_chunk_command_t>().swap(chunk.commands);
+    std::vector<obj_raw_index_t>().swap(chunk.face_indices);
+    std::string().swap(chunk.command_text);
+  }
+
+  FinishObj(&state, attrib, v, vn, vt, vc, found_all_colors,
+            default_vcols_fallback, line_base);
+
+  return true;
+}
+
+bool LoadObjMultithreaded(attrib_t *attrib, std::vector<shape_t> *shapes,
+                          std::vector<material_t> *materials,
+                          std::string *warn, std::string *err,
+                          const char *filename, const char *mtl_basedir,
+                          bool triangulate, bool default_vcols_fallback,
+                          int num_threads) {
+  attrib->vertices.clear();
+  attrib->normals.clear();
+  attrib->texcoords.clear();
+  attrib->colors.clear();
+  shapes->clear();
+
+  std::ifstream ifs(filename, std::ios::binary);
+  if (!ifs) {
+    if (err) {
+      std::stringstream errss;
+      errss << "Cannot open file [" << filename << "]" << std::endl;
+      (*err) = errss.str();
+    }
+    return false;
+  }
+
+  // Whole file plus a terminating NUL for the last line.
+  ifs.seekg(0, std::ios::end);
+  size_t size = static_cast<size_t>(ifs.tellg());
+  ifs.seekg(0, std::ios::beg);
+  std::vector<char> buf(size + 1, '\0');
+  ifs.read(&buf[0], static_cast<std::streamsize>(size));
+  size = static_cast<size_t>(ifs.gcount());
+
+  std::vector<obj_chunk_t> chunks;
+  ParseObjText(&buf[0], size, num_threads, &chunks);
+  std::vector<char>().swap(buf);
+
+  MaterialFileReader matFileReader(GetMtlBaseDir(mtl_basedir));
+  return MergeObjChunks(attrib, shapes, materials, warn, err, chunks,
+                        &matFileReader, triangulate, default_vcols_fallback);
+}
+
+bool LoadObjMapped(attrib_t *attrib, std::vector<shape_t> *shapes,
+                   std::vector<material_t> *materials, std::string *warn,
+                   std::string *err, const char *filename,
+                   const char *mtl_basedir, bool triangulate,
+                   bool default_vcols_fallback, int num_threads) {
+  obj_file_mapping_t mapping;
+  if (!MapObjFile(filename, &mapping)) {
+    return LoadObjMultithreaded(attrib, shapes, materials, warn, err,
+                                filename, mtl_basedir, triangulate,
+                                default_vcols_fallback, num_threads);
+  }
+
+  attrib->vertices.clear();
+  attrib->normals.clear();
+  attrib->texcoords.clear();
+  attrib->colors.clear();
+  shapes->clear();
+
+  std::vector<obj_chunk_t> chunks;
+  ParseObjText(mapping.data, mapping.size, num_threads, &chunks);
+  UnmapObjFile(&mapping);
+
+  MaterialFileReader matFileReader(GetMtlBaseDir(mtl_basedir), true);
+  return MergeObjChunks(attrib, shapes, materials, warn, err, chunks,
+                        &matFileReader, triangulate, default_vcols_fallback);
+}
+
 bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
                          void *user_data /*= NULL*/,
                          MaterialReader *readMatFn /*= NULL*/,
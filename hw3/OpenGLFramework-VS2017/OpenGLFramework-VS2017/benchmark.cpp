@@ -0,0 +1,1163 @@
+#include "benchmark.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tiny_obj_loader.h"
+#include "meshindex.h"
+#include "meshbounds.h"
+#include "texturecache.h"
+#include "texturecook.h"
+#include "mipchain.h"
+#include <GLFW/glfw3.h>
+#include <STB/stb_image.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#define popen _popen
+#define pclose _pclose
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char *BENCH_OBJ_MODELS[] = {
+	"../../../hw1/HW1_VS2017_Framework/ColorModels/buddha50KC.obj",
+	"../../../hw1/HW1_VS2017_Framework/ColorModels/lucy25KC.obj",
+	"../../../hw1/HW1_VS2017_Framework/ColorModels/Dino20KC.obj",
+	"../../../hw1/HW1_VS2017_Framework/ColorModels/armadillo12KC.obj",
+	"../../../hw1/HW1_VS2017_Framework/ColorModels/dragon10KC.obj",
+	"../../../hw1/HW1_VS2017_Framework/ColorModels/happy10KC.obj",
+	"../../../hw1/HW1_VS2017_Framework/ColorModels/al7KC.obj",
+	"../../../hw1/HW1_VS2017_Framework/ColorModels/bunny5KC.obj",
+	"../../../hw1/HW1_VS2017_Framework/ColorModels/horse5KC.obj",
+	"../../../hw1/HW1_VS2017_Framework/ColorModels/teapot4KC.obj",
+	"../../../hw1/HW1_VS2017_Framework/ColorModels/cow3KC.obj",
+	"../TextureModels/Dog.obj",
+	"../TextureModels/nanosuit.obj",
+	"../TextureModels/Dog2.obj",
+	"../TextureModels/teapot.obj",
+	"../TextureModels/ZEBRA.obj",
+	"../TextureModels/ball2.obj",
+	"../TextureModels/cyborg.obj",
+	"../TextureModels/teemo.obj",
+	"../TextureModels/texturedknot.obj",
+	"../TextureModels/Nala.obj",
+	"../TextureModels/laurana500.obj",
+};
+
+// best of BENCH_REPEAT runs
+#define BENCH_REPEAT 5
+
+// --bench-mmap defaults: a small, a multi-material and the largest model
+static const char *BENCH_MMAP_MODELS[] = {
+	"../TextureModels/Dog.obj",
+	"../TextureModels/nanosuit.obj",
+	"../../../hw1/HW1_VS2017_Framework/ColorModels/buddha50KC.obj",
+};
+
+// --bench-textures defaults: every textured model of TextureModels
+static const char *BENCH_TEXTURE_MODELS[] = {
+	"../TextureModels/Square.obj",
+	"../TextureModels/cubeT.obj",
+	"../TextureModels/ball.obj",
+	"../TextureModels/ball2.obj",
+	"../TextureModels/duck.obj",
+	"../TextureModels/teapot.obj",
+	"../TextureModels/Digda.obj",
+	"../TextureModels/Fushigidane.obj",
+	"../TextureModels/Golonya.obj",
+	"../TextureModels/Hitokage.obj",
+	"../TextureModels/laurana500.obj",
+	"../TextureModels/Mew.obj",
+	"../TextureModels/Nala.obj",
+	"../TextureModels/Nyarth.obj",
+	"../TextureModels/satellitetrap.obj",
+	"../TextureModels/teemo.obj",
+	"../TextureModels/texturedknot.obj",
+	"../TextureModels/Zenigame.obj",
+	"../TextureModels/ZEBRA.obj",
+	"../TextureModels/Dog.obj",
+	"../TextureModels/Dog2.obj",
+	"../TextureModels/rock.obj",
+	"../TextureModels/cyborg.obj",
+	"../TextureModels/nanosuit.obj",
+};
+
+// How --bench-mmap reads the file: LoadObj through std::ifstream and
+// std::string lines, LoadObjMultithreaded from a copy of the whole file,
+// LoadObjMapped from a read-only mapping
+enum ObjReadMode
+{
+	OBJ_READ_STREAM,
+	OBJ_READ_BUFFER,
+	OBJ_READ_MAPPED,
+	OBJ_READ_MODE_COUNT
+};
+static const char *OBJ_READ_MODE_NAMES[OBJ_READ_MODE_COUNT] = { "stream", "buffer", "mapped" };
+
+struct ObjResult
+{
+	bool ok;
+	string warn, err;
+	tinyobj::attrib_t attrib;
+	vector<tinyobj::shape_t> shapes;
+	vector<tinyobj::material_t> materials;
+};
+
+static string BaseDir(const string &path)
+{
+	size_t slash = path.find_last_of("/\\");
+	return slash == string::npos ? "" : path.substr(0, slash + 1);
+}
+
+// threads == 0 runs the serial loader
+static ObjResult LoadBenchObj(const string &path, int threads)
+{
+	ObjResult r;
+	string base_dir = BaseDir(path);
+	if (threads == 0)
+		r.ok = tinyobj::LoadObj(&r.attrib, &r.shapes, &r.materials, &r.warn, &r.err, path.c_str(), base_dir.c_str());
+	else
+		r.ok = tinyobj::LoadObjMultithreaded(&r.attrib, &r.shapes, &r.materials, &r.warn, &r.err, path.c_str(), base_dir.c_str(), true, true, threads);
+	return r;
+}
+
+// Parse threads are pinned to 1 so that only the way the file is read differs
+static ObjResult LoadBenchObjMode(const string &path, int mode)
+{
+	ObjResult r;
+	string base_dir = BaseDir(path);
+	switch (mode) {
+	case OBJ_READ_STREAM:
+		r.ok = tinyobj::LoadObj(&r.attrib, &r.shapes, &r.materials, &r.warn, &r.err, path.c_str(), base_dir.c_str());
+		break;
+	case OBJ_READ_BUFFER:
+		r.ok = tinyobj::LoadObjMultithreaded(&r.attrib, &r.shapes, &r.materials, &r.warn, &r.err, path.c_str(), base_dir.c_str(), true, true, 1);
+		break;
+	default:
+		r.ok = tinyobj::LoadObjMapped(&r.attrib, &r.shapes, &r.materials, &r.warn, &r.err, path.c_str(), base_dir.c_str(), true, true, 1);
+		break;
+	}
+	return r;
+}
+
+static bool SameIndices(const vector<tinyobj::index_t> &a, const vector<tinyobj::index_t> &b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); i++) {
+		if (a[i].vertex_index != b[i].vertex_index || a[i].normal_index != b[i].normal_index || a[i].texcoord_index != b[i].texcoord_index)
+			return false;
+	}
+	return true;
+}
+
+static bool SameResult(const ObjResult &a, const ObjResult &b)
+{
+	if (a.ok != b.ok || a.warn != b.warn || a.err != b.err)
+		return false;
+	if (a.attrib.vertices != b.attrib.vertices || a.attrib.normals != b.attrib.normals
+		|| a.attrib.texcoords != b.attrib.texcoords || a.attrib.colors != b.attrib.colors)
+		return false;
+	if (a.materials.size() != b.materials.size() || a.shapes.size() != b.shapes.size())
+		return false;
+	for (size_t i = 0; i < a.materials.size(); i++) {
+		if (a.materials[i].name != b.materials[i].name)
+			return false;
+	}
+	for (size_t i = 0; i < a.shapes.size(); i++) {
+		const tinyobj::shape_t &sa = a.shapes[i], &sb = b.shapes[i];
+		if (sa.name != sb.name
+			|| !SameIndices(sa.mesh.indices, sb.mesh.indices)
+			|| sa.mesh.num_face_vertices != sb.mesh.num_face_vertices
+			|| sa.mesh.material_ids != sb.mesh.material_ids
+			|| sa.mesh.smoothing_group_ids != sb.mesh.smoothing_group_ids
+			|| !SameIndices(sa.lines.indices, sb.lines.indices)
+			|| !SameIndices(sa.points.indices, sb.points.indices))
+			return false;
+	}
+	return true;
+}
+
+static long FileSize(const string &path)
+{
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (fp == NULL)
+		return -1;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fclose(fp);
+	return size;
+}
+
+// Parse every file once per repetition, returns the best total time in ms
+static double TimeObjParsing(const vector<string> &files, int threads)
+{
+	double best = 0.0;
+	for (int rep = 0; rep < BENCH_REPEAT; rep++) {
+		auto start = chrono::steady_clock::now();
+		for (size_t i = 0; i < files.size(); i++)
+			LoadBenchObj(files[i], threads);
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		if (rep == 0 || ms < best)
+			best = ms;
+	}
+	return best;
+}
+
+long PeakResidentKB()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return -1;
+	return (long)(counters.PeakWorkingSetSize / 1024);
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1;
+	return usage.ru_maxrss;  // KB on Linux
+#endif
+}
+
+long CurrentResidentKB()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return -1;
+	return (long)(counters.WorkingSetSize / 1024);
+#else
+	// Linux; elsewhere the high-water mark is the closest thing available
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (fp == NULL)
+		return PeakResidentKB();
+	long total_pages, resident_pages;
+	bool ok = fscanf(fp, "%ld %ld", &total_pages, &resident_pages) == 2;
+	fclose(fp);
+	return ok ? resident_pages * (sysconf(_SC_PAGESIZE) / 1024) : -1;
+#endif
+}
+
+static vector<string> BenchFiles(const vector<string> &args)
+{
+	if (!args.empty())
+		return args;
+
+	vector<string> files;
+	for (size_t i = 0; i < sizeof(BENCH_OBJ_MODELS) / sizeof(BENCH_OBJ_MODELS[0]); i++)
+		files.push_back(BENCH_OBJ_MODELS[i]);
+	return files;
+}
+
+static int BenchObj(const vector<string> &args)
+{
+	vector<string> files = BenchFiles(args);
+
+	// verify against the serial parser first
+	double total_mb = 0.0;
+	int mismatches = 0;
+	int max_threads = max(1, (int)thread::hardware_concurrency());
+	vector<string> found;
+	for (size_t i = 0; i < files.size(); i++) {
+		long size = FileSize(files[i]);
+		if (size < 0) {
+			printf("  skipping %s (not found)\n", files[i].c_str());
+			continue;
+		}
+		found.push_back(files[i]);
+		total_mb += size / (1024.0 * 1024.0);
+
+		ObjResult serial = LoadBenchObj(files[i], 0);
+		for (int t = 1; t <= max(max_threads, 4); t++) {
+			if (!SameResult(serial, LoadBenchObj(files[i], t))) {
+				printf("  MISMATCH %s at %d threads\n", files[i].c_str(), t);
+				mismatches++;
+			}
+		}
+	}
+	if (found.empty()) {
+		printf("No .obj files to benchmark\n");
+		return 1;
+	}
+
+	printf("OBJ parsing, %d files, %.2f MB, best of %d\n", (int)found.size(), total_mb, BENCH_REPEAT);
+	double serial_ms = TimeObjParsing(found, 0);
+	printf("  LoadObj (serial)   %8.1f ms %8.1f MB/s\n", serial_ms, total_mb / (serial_ms / 1000.0));
+	for (int t = 1; t <= max_threads; t++) {
+		double ms = TimeObjParsing(found, t);
+		printf("  %2d thread(s)       %8.1f ms %8.1f MB/s (x%.2f)\n", t, ms, total_mb / (ms / 1000.0), serial_ms / ms);
+	}
+	printf("Result check: %s\n", mismatches == 0 ? "identical to LoadObj" : "MISMATCH");
+	return mismatches == 0 ? 0 : 1;
+}
+
+// Vertex shader invocations of a triangle list with a FIFO post-transform
+// cache of the given size, a common model of the hardware cache
+static size_t VertexShaderRuns(const vector<uint32_t> &indices, size_t cache_size)
+{
+	vector<uint32_t> fifo(cache_size, 0xffffffff);
+	size_t head = 0, runs = 0;
+	for (size_t i = 0; i < indices.size(); i++) {
+		bool hit = false;
+		for (size_t c = 0; c < cache_size && !hit; c++)
+			hit = fifo[c] == indices[i];
+		if (hit)
+			continue;
+		fifo[head] = indices[i];
+		head = (head + 1) % cache_size;
+		runs++;
+	}
+	return runs;
+}
+
+static int BenchIndex(const vector<string> &args)
+{
+	vector<string> files = BenchFiles(args);
+
+	printf("Indexed geometry, FIFO vertex cache of 32 entries\n");
+	printf("  %-60s %9s %9s %10s %10s %9s %9s\n", "model", "corners", "vertices", "soup KB", "indexed KB", "VS soup", "VS index");
+	size_t total_soup = 0, total_indexed = 0, total_runs_soup = 0, total_runs_indexed = 0;
+	for (size_t f = 0; f < files.size(); f++) {
+		ObjResult obj = LoadBenchObj(files[f], 0);
+		if (!obj.ok) {
+			printf("  skipping %s (cannot load)\n", files[f].c_str());
+			continue;
+		}
+
+		// the triangle soup the loaders build: one vertex per face corner
+		const tinyobj::attrib_t &attrib = obj.attrib;
+		vector<float> positions, colors, normals, texcoords;
+		for (size_t s = 0; s < obj.shapes.size(); s++) {
+			const vector<tinyobj::index_t> &corners = obj.shapes[s].mesh.indices;
+			for (size_t i = 0; i < corners.size(); i++) {
+				int v = corners[i].vertex_index, n = corners[i].normal_index, t = corners[i].texcoord_index;
+				for (int c = 0; c < 3; c++) {
+					positions.push_back(attrib.vertices[3 * v + c]);
+					colors.push_back(attrib.colors[3 * v + c]);
+					normals.push_back(n >= 0 ? attrib.normals[3 * n + c] : 0.0f);
+				}
+				for (int c = 0; c < 2; c++)
+					texcoords.push_back(t >= 0 ? attrib.texcoords[2 * t + c] : 0.0f);
+			}
+		}
+
+		uint32_t corner_count = (uint32_t)(positions.size() / 3);
+		MeshStream streams[4] = { { positions.data(), 3 }, { colors.data(), 3 }, { normals.data(), 3 }, { texcoords.data(), 2 } };
+		vector<uint32_t> indices(corner_count);
+		uint32_t vertex_count = meshWeldVertices(corner_count, streams, 4, indices.data());
+
+		size_t index_size = meshIndicesFit16(vertex_count) ? 2 : 4;
+		size_t soup_bytes = (size_t)corner_count * 11 * sizeof(float);
+		size_t indexed_bytes = (size_t)vertex_count * 11 * sizeof(float) + (size_t)corner_count * index_size;
+		size_t runs_indexed = VertexShaderRuns(indices, 32);
+
+		printf("  %-60s %9u %9u %10.1f %10.1f %9u %9u\n", files[f].c_str(), corner_count, vertex_count,
+			soup_bytes / 1024.0, indexed_bytes / 1024.0, corner_count, (unsigned)runs_indexed);
+		total_soup += soup_bytes;
+		total_indexed += indexed_bytes;
+		total_runs_soup += corner_count;
+		total_runs_indexed += runs_indexed;
+	}
+	if (total_soup == 0) {
+		printf("No .obj files to benchmark\n");
+		return 1;
+	}
+
+	printf("Total: %.1f MB -> %.1f MB (%.1f%% saved), %u -> %u vertex shader runs (%.1f%% fewer)\n",
+		total_soup / (1024.0 * 1024.0), total_indexed / (1024.0 * 1024.0), 100.0 * (total_soup - total_indexed) / total_soup,
+		(unsigned)total_runs_soup, (unsigned)total_runs_indexed, 100.0 * (total_runs_soup - total_runs_indexed) / total_runs_soup);
+	return 0;
+}
+
+static int BenchNormalize(const vector<string> &args)
+{
+	vector<string> files = BenchFiles(args);
+
+	int failures = 0;
+	vector<float> all_positions;
+	printf("Model normalization check\n");
+	for (size_t f = 0; f < files.size(); f++) {
+		ObjResult obj = LoadBenchObj(files[f], 0);
+		if (!obj.ok || obj.attrib.vertices.empty()) {
+			printf("  skipping %s (cannot load)\n", files[f].c_str());
+			continue;
+		}
+
+		vector<float> &positions = obj.attrib.vertices;
+		size_t vertex_count = positions.size() / 3;
+		vector<float> reference = positions;
+		all_positions.insert(all_positions.end(), positions.begin(), positions.end());
+
+		MeshBounds bounds = meshComputeBounds(positions.data(), vertex_count);
+		MeshBounds reference_bounds = meshComputeBoundsScalar(reference.data(), vertex_count);
+		meshNormalizePositions(positions.data(), vertex_count, bounds);
+		meshNormalizePositionsScalar(reference.data(), vertex_count, reference_bounds);
+
+		// unit-sized: the largest axis spans [-1, 1] and the box is centred
+		MeshBounds unit = meshComputeBoundsScalar(positions.data(), vertex_count);
+		float greatest = 0.0f, off_centre = 0.0f;
+		for (int c = 0; c < 3; c++) {
+			greatest = max(greatest, unit.max[c] - unit.min[c]);
+			off_centre = max(off_centre, fabsf(unit.max[c] + unit.min[c]));
+		}
+		bool same = positions == reference;
+		bool ok = same && fabsf(greatest - 2.0f) < 1e-5f && off_centre < 1e-5f;
+		printf("  %-60s %2d shapes  extent %.6f  %s\n", files[f].c_str(), (int)obj.shapes.size(), greatest,
+			ok ? "ok" : (same ? "NOT UNIT-SIZED" : "SSE/SCALAR MISMATCH"));
+		failures += ok ? 0 : 1;
+	}
+	if (all_positions.empty()) {
+		printf("No .obj files to benchmark\n");
+		return 1;
+	}
+
+	// kernels over every model's positions back to back
+	size_t vertex_count = all_positions.size() / 3;
+	vector<float> work(all_positions.size());
+	double best[4] = { 0.0, 0.0, 0.0, 0.0 };
+	for (int rep = 0; rep < BENCH_REPEAT * 4; rep++) {
+		for (int k = 0; k < 4; k++) {
+			work = all_positions;
+			MeshBounds bounds = meshComputeBoundsScalar(work.data(), vertex_count);
+			auto start = chrono::steady_clock::now();
+			switch (k) {
+			case 0: bounds = meshComputeBoundsScalar(work.data(), vertex_count); break;
+			case 1: bounds = meshComputeBounds(work.data(), vertex_count); break;
+			case 2: meshNormalizePositionsScalar(work.data(), vertex_count, bounds); break;
+			case 3: meshNormalizePositions(work.data(), vertex_count, bounds); break;
+			}
+			double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			if (rep == 0 || ms < best[k])
+				best[k] = ms;
+			// keep the result alive
+			if (bounds.min[0] > bounds.max[0])
+				printf("!");
+		}
+	}
+	const char *names[4] = { "bounds scalar", "bounds SSE", "normalize scalar", "normalize SSE" };
+	printf("Kernels over %u vertices, best of %d\n", (unsigned)vertex_count, BENCH_REPEAT * 4);
+	for (int k = 0; k < 4; k++)
+		printf("  %-18s %8.3f ms %8.1f Mvertices/s\n", names[k], best[k], vertex_count / (best[k] * 1000.0));
+	return failures == 0 ? 0 : 1;
+}
+
+// Numeric fields of the bundled files, each NUL-terminated in one buffer
+struct ObjNumbers
+{
+	string text;
+	vector<size_t> reals;     // v/vn/vt components
+	vector<size_t> indices;   // f index fields
+	size_t real_bytes, index_bytes;
+};
+
+static void CollectObjNumbers(const string &path, ObjNumbers &numbers)
+{
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (fp == NULL)
+		return;
+
+	char line[4096];
+	while (fgets(line, sizeof(line), fp)) {
+		bool is_face = line[0] == 'f' && line[1] == ' ';
+		bool is_attrib = line[0] == 'v' && (line[1] == ' ' || ((line[1] == 'n' || line[1] == 't') && line[2] == ' '));
+		if (!is_face && !is_attrib)
+			continue;
+
+		// fields after the keyword; faces are split further at '/'
+		const char *separators = is_face ? " \t\r\n/" : " \t\r\n";
+		char *p = line + strcspn(line, " ");
+		while (*p) {
+			p += strspn(p, separators);
+			size_t length = strcspn(p, separators);
+			if (length == 0)
+				break;
+			(is_face ? numbers.indices : numbers.reals).push_back(numbers.text.size());
+			(is_face ? numbers.index_bytes : numbers.real_bytes) += length;
+			numbers.text.append(p, length);
+			numbers.text.push_back('\0');
+			p += length;
+		}
+	}
+	fclose(fp);
+}
+
+static int BenchParse(const vector<string> &args)
+{
+	vector<string> files = BenchFiles(args);
+
+	ObjNumbers numbers;
+	numbers.real_bytes = numbers.index_bytes = 0;
+	for (size_t f = 0; f < files.size(); f++)
+		CollectObjNumbers(files[f], numbers);
+	if (numbers.reals.empty()) {
+		printf("No .obj files to benchmark\n");
+		return 1;
+	}
+	const char *text = numbers.text.c_str();
+
+	// differential check: what the loader stores (real_t) has to be bit-identical
+	size_t real_mismatches = 0, double_differences = 0, index_mismatches = 0;
+	for (size_t i = 0; i < numbers.reals.size(); i++) {
+		const char *s = text + numbers.reals[i];
+		const char *s_end = s + strlen(s);
+		double fast = 0.0, reference = 0.0;
+		bool fast_ok = tinyobj::ParseReal(s, s_end, &fast);
+		bool reference_ok = tinyobj::ParseRealReference(s, s_end, &reference);
+		tinyobj::real_t fast_real = (tinyobj::real_t)fast, reference_real = (tinyobj::real_t)reference;
+		if (fast_ok != reference_ok || memcmp(&fast_real, &reference_real, sizeof(tinyobj::real_t)) != 0) {
+			if (real_mismatches++ < 10)
+				printf("  MISMATCH \"%s\": %.9g vs %.9g\n", s, (double)fast_real, (double)reference_real);
+		}
+		double_differences += memcmp(&fast, &reference, sizeof(double)) != 0;
+	}
+	for (size_t i = 0; i < numbers.indices.size(); i++) {
+		const char *s = text + numbers.indices[i];
+		if (tinyobj::ParseIndex(s) != atoi(s) && index_mismatches++ < 10)
+			printf("  MISMATCH index \"%s\"\n", s);
+	}
+
+	printf("Number parsing over %d files: %u reals (%.2f MB), %u face indices (%.2f MB), best of %d\n",
+		(int)files.size(), (unsigned)numbers.reals.size(), numbers.real_bytes / (1024.0 * 1024.0),
+		(unsigned)numbers.indices.size(), numbers.index_bytes / (1024.0 * 1024.0), BENCH_REPEAT);
+
+	const char *names[4] = { "reals, reference", "reals, fast path", "indices, atoi", "indices, ParseIndex" };
+	for (int k = 0; k < 4; k++) {
+		const vector<size_t> &fields = k < 2 ? numbers.reals : numbers.indices;
+		double best = 0.0, sum = 0.0;
+		for (int rep = 0; rep < BENCH_REPEAT; rep++) {
+			auto start = chrono::steady_clock::now();
+			for (size_t i = 0; i < fields.size(); i++) {
+				const char *s = text + fields[i];
+				double value = 0.0;
+				switch (k) {
+				case 0: tinyobj::ParseRealReference(s, s + strlen(s), &value); break;
+				case 1: tinyobj::ParseReal(s, s + strlen(s), &value); break;
+				case 2: value = atoi(s); break;
+				case 3: value = tinyobj::ParseIndex(s); break;
+				}
+				sum += value;
+			}
+			double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			if (rep == 0 || ms < best)
+				best = ms;
+		}
+		size_t bytes = k < 2 ? numbers.real_bytes : numbers.index_bytes;
+		printf("  %-20s %8.2f ms %8.1f Mfields/s %8.1f MB/s  (sum %g)\n", names[k], best,
+			fields.size() / (best * 1000.0), bytes / (1024.0 * 1024.0) / (best / 1000.0), sum);
+	}
+
+	// the fast path is correctly rounded, the digit loop is not always
+	printf("  %u reals differ from the reference in the double, before rounding to real_t\n", (unsigned)double_differences);
+	bool ok = real_mismatches == 0 && index_mismatches == 0;
+	printf("Result check: %s\n", ok ? "bit-identical to the reference parsers" : "MISMATCH");
+	return ok ? 0 : 1;
+}
+
+// Request every image, then wait for all of them; returns the wall clock
+static double TimeTextureDecode(const vector<string> &images, vector<TextureHandle> &handles)
+{
+	auto start = chrono::steady_clock::now();
+	for (size_t i = 0; i < images.size(); i++) {
+		TextureHandle handle = textureCacheRequest(images[i]);
+		if (handle != NULL)
+			handles.push_back(handle);
+	}
+	for (size_t i = 0; i < handles.size(); i++)
+		textureCacheWait(handles[i]);
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+static void ReleaseTextures(vector<TextureHandle> &handles)
+{
+	for (size_t i = 0; i < handles.size(); i++)
+		textureCacheRelease(handles[i]);
+	handles.clear();
+}
+
+// The diffuse image of every material of the models (default: the
+// textured TextureModels), per model and all together
+static void CollectMaterialImages(vector<string> files, vector<string> &found, vector<vector<string> > &model_images, vector<string> &images)
+{
+	if (files.empty())
+		files.assign(BENCH_TEXTURE_MODELS, BENCH_TEXTURE_MODELS + sizeof(BENCH_TEXTURE_MODELS) / sizeof(BENCH_TEXTURE_MODELS[0]));
+
+	for (size_t f = 0; f < files.size(); f++) {
+		ObjResult r = LoadBenchObj(files[f], 1);
+		if (!r.ok) {
+			printf("  %s: %s\n", files[f].c_str(), r.err.c_str());
+			continue;
+		}
+		found.push_back(files[f]);
+		model_images.push_back(vector<string>());
+		for (size_t m = 0; m < r.materials.size(); m++) {
+			if (r.materials[m].diffuse_texname.empty())
+				continue;
+			images.push_back(BaseDir(files[f]) + r.materials[m].diffuse_texname);
+			model_images.back().push_back(images.back());
+		}
+	}
+}
+
+// Every image of CollectMaterialImages once
+static void DistinctMaterialImages(const vector<string> &files, vector<string> &found, vector<string> &images)
+{
+	vector<string> all_images;
+	vector<vector<string> > model_images;
+	CollectMaterialImages(files, found, model_images, all_images);
+	for (size_t i = 0; i < all_images.size(); i++) {
+		if (find(images.begin(), images.end(), all_images[i]) == images.end())
+			images.push_back(all_images[i]);
+	}
+}
+
+// Decode the diffuse texture of every material once per material (what
+// loading did before the texture cache) and through the cache's decode
+// pool at 1..N threads, then parse each model with its textures decoding
+// behind the parse vs one after the other.
+static int BenchTextures(const vector<string> &args)
+{
+	vector<string> images;
+	vector<vector<string> > model_images;
+	vector<string> found;
+	CollectMaterialImages(args, found, model_images, images);
+
+	int failures = 0;
+	size_t bytes = 0;
+	auto start = chrono::steady_clock::now();
+	for (size_t i = 0; i < images.size(); i++) {
+		int width, height, channels;
+		stbi_uc *pixels = stbi_load(images[i].c_str(), &width, &height, &channels, 4);
+		if (pixels == NULL) {
+			failures++;
+			continue;
+		}
+		bytes += textureBytes(width, height);
+		stbi_image_free(pixels);
+	}
+	double per_material_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	printf("Texture decoding over %d models, %d material textures\n", (int)found.size(), (int)images.size());
+	printf("  %-22s %8s %10s %12s\n", "", "decodes", "ms", "GPU MB");
+	printf("  %-22s %8d %10.1f %12.1f\n", "per material, serial", (int)images.size() - failures, per_material_ms, bytes / (1024.0 * 1024.0));
+
+	// every run starts from an empty cache: the handles of the previous one
+	// are all released
+	bool ok = true;
+	int max_threads = max(max(1, (int)thread::hardware_concurrency()), 4);
+	vector<TextureHandle> handles;
+	TextureCacheStats first;
+	for (int t = 1; t <= max_threads; t++) {
+		textureCacheSetDecodeThreads(t);
+		TextureCacheStats before = textureCacheStats();
+		double ms = TimeTextureDecode(images, handles);
+		TextureCacheStats after = textureCacheStats();
+		ReleaseTextures(handles);
+
+		int requests = after.requests - before.requests, decodes = after.decodes - before.decodes;
+		size_t saved = after.saved_bytes - before.saved_bytes;
+		if (t == 1) {
+			first = after;
+			first.requests = requests;
+			first.decodes = decodes;
+			first.saved_bytes = saved;
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "cache, %d thread(s)", t);
+		printf("  %-22s %8d %10.1f %12.1f (x%.2f)\n", name, decodes, ms, (bytes - saved) / (1024.0 * 1024.0), per_material_ms / ms);
+		ok = ok && requests == (int)images.size() - failures && decodes == first.decodes;
+	}
+	printf("  %d decodes avoided, %.1f MB of textures not uploaded again\n", first.requests - first.decodes, first.saved_bytes / (1024.0 * 1024.0));
+	textureCacheSetDecodeThreads(0);
+
+	// a model load: parse, then decode, or decode while parsing. The image
+	// names are known up front here, the viewer reads them from the .mtl
+	// before parsing.
+	double serial_ms = 0.0, overlapped_ms = 0.0;
+	for (size_t f = 0; f < found.size(); f++) {
+		start = chrono::steady_clock::now();
+		ObjResult serial = LoadBenchObjMode(found[f], OBJ_READ_MAPPED);
+		TimeTextureDecode(model_images[f], handles);
+		serial_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		ReleaseTextures(handles);
+
+		start = chrono::steady_clock::now();
+		for (size_t i = 0; i < model_images[f].size(); i++) {
+			TextureHandle handle = textureCacheRequest(model_images[f][i]);
+			if (handle != NULL)
+				handles.push_back(handle);
+		}
+		ObjResult overlapped = LoadBenchObjMode(found[f], OBJ_READ_MAPPED);
+		for (size_t i = 0; i < handles.size(); i++)
+			textureCacheWait(handles[i]);
+		overlapped_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		ReleaseTextures(handles);
+	}
+	printf("  model loads, parse then decode   %10.1f ms\n", serial_ms);
+	printf("  model loads, decode during parse %10.1f ms (x%.2f)\n", overlapped_ms, serial_ms / overlapped_ms);
+
+	printf("Result check: %s\n", ok ? "every texture resolved through the cache" : "MISMATCH");
+	return ok ? 0 : 1;
+}
+
+// --cook-textures: cook every distinct material image, then compare the
+// VRAM and the CPU side of loading it against the source image
+static int CookTextures(const vector<string> &args)
+{
+	int format = -1;
+	int threads = max(1, (int)thread::hardware_concurrency());
+	vector<string> files;
+	for (size_t i = 0; i < args.size(); i++) {
+		if (args[i] == "--format" && i + 1 < args.size()) {
+			string name = args[++i];
+			format = COOKED_FORMAT_COUNT;
+			for (int f = 0; f < COOKED_FORMAT_COUNT; f++) {
+				if (name == COOKED_FORMAT_NAMES[f])
+					format = f;
+			}
+			if (format == COOKED_FORMAT_COUNT && name != "auto") {
+				printf("Unknown format %s, use auto, bc1, bc3 or bc7\n", name.c_str());
+				return 1;
+			}
+			if (name == "auto")
+				format = -1;
+		}
+		else if (args[i] == "--threads" && i + 1 < args.size()) {
+			threads = max(1, atoi(args[++i].c_str()));
+		}
+		else {
+			files.push_back(args[i]);
+		}
+	}
+
+	vector<string> found, images;
+	DistinctMaterialImages(files, found, images);
+
+	// rows bottom-up, the way the viewer decodes and uploads them
+	stbi_set_flip_vertically_on_load(true);
+
+	printf("Cooking %d images from %d models, %d encode thread(s)\n", (int)images.size(), (int)found.size(), threads);
+	printf("  %-44s %11s %6s %6s %9s %9s %8s %8s %9s\n", "image", "size", "format", "levels", "RGBA8 MB", "cooked MB", "PSNR", "mip PSNR", "encode ms");
+	int failures = 0;
+	size_t source_bytes = 0, cooked_bytes = 0;
+	double encode_ms = 0.0, worst_psnr = 99.0;
+	vector<string> cooked;
+	for (size_t i = 0; i < images.size(); i++) {
+		CookResult r;
+		if (!cookTexture(images[i].c_str(), (images[i] + ".dds").c_str(), format, threads, &r)) {
+			printf("  %-44s cannot be cooked\n", images[i].c_str());
+			failures++;
+			continue;
+		}
+		cooked.push_back(images[i]);
+		char size[32];
+		snprintf(size, sizeof(size), "%dx%d", r.width, r.height);
+		printf("  %-44s %11s %6s %6d %9.2f %9.2f %8.2f %8.2f %9.1f\n", images[i].c_str(), size, COOKED_FORMAT_NAMES[r.format], r.level_count,
+			textureBytes(r.width, r.height) / (1024.0 * 1024.0), r.cooked_bytes / (1024.0 * 1024.0), r.psnr, r.chain_psnr, r.encode_ms);
+		source_bytes += textureBytes(r.width, r.height);
+		cooked_bytes += r.cooked_bytes;
+		encode_ms += r.encode_ms;
+		worst_psnr = min(worst_psnr, min(r.psnr, r.chain_psnr));
+	}
+	if (cooked.empty()) {
+		printf("No images to cook\n");
+		return 1;
+	}
+	printf("  VRAM with mips: %.1f MB as RGBA8, %.1f MB cooked (%.1f MB saved, x%.1f), encoding took %.1f ms\n",
+		source_bytes / (1024.0 * 1024.0), cooked_bytes / (1024.0 * 1024.0), (source_bytes - cooked_bytes) / (1024.0 * 1024.0),
+		(double)source_bytes / cooked_bytes, encode_ms);
+
+	// CPU side of a load: decoding the source (glGenerateMipmap then runs
+	// on the GPU) vs mapping the cooked file and reading every level once
+	double decode_best = 0.0, mapped_best = 0.0;
+	for (int rep = 0; rep < BENCH_REPEAT; rep++) {
+		auto start = chrono::steady_clock::now();
+		for (size_t i = 0; i < cooked.size(); i++) {
+			int width, height, channels;
+			stbi_image_free(stbi_load(cooked[i].c_str(), &width, &height, &channels, 4));
+		}
+		double decode_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+		start = chrono::steady_clock::now();
+		unsigned sum = 0;
+		for (size_t i = 0; i < cooked.size(); i++) {
+			CookedTexture texture;
+			if (!cookedTextureOpen(cooked[i].c_str(), (cooked[i] + ".dds").c_str(), &texture))
+				continue;
+			for (int level = 0; level < texture.level_count; level++) {
+				for (size_t b = 0; b < texture.level_sizes[level]; b += 64)
+					sum += texture.levels[level][b];
+			}
+			cookedTextureClose(&texture);
+		}
+		double mapped_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		if (rep == 0 || decode_ms < decode_best)
+			decode_best = decode_ms;
+		if (rep == 0 || mapped_ms < mapped_best)
+			mapped_best = mapped_ms;
+		if (sum == 1)
+			printf(" ");
+	}
+	printf("  load, best of %d: decode sources %.1f ms, map cooked %.1f ms (x%.1f)\n", BENCH_REPEAT, decode_best, mapped_best, decode_best / mapped_best);
+
+	// BC1 dips below 30 dB on noisy images (pattern-1.jpg), a broken
+	// encoder or a block layout mistake lands far below 25
+	bool ok = failures == 0 && worst_psnr >= 25.0;
+	printf("Result check: %s (worst PSNR %.2f dB)\n", ok ? "every image cooked" : "FAILED", worst_psnr);
+	return ok ? 0 : 1;
+}
+
+struct BenchImage
+{
+	string path;
+	int width, height;
+	stbi_uc *pixels;
+	MipChain mips;
+};
+
+static float SrgbToLinear(float c)
+{
+	return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float LinearToSrgb(float c)
+{
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+// How far the 1x1 level is from the mean of the base level, in 8-bit steps.
+// An exact box filter keeps the mean of every level (colour in linear
+// light), dropping the odd row or column of a non-power-of-two level does not.
+static float MeanDrift(const BenchImage &image)
+{
+	if (image.mips.levels.empty())
+		return 0.0f;
+	double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+	size_t count = (size_t)image.width * image.height;
+	for (size_t i = 0; i < count; i++) {
+		for (int c = 0; c < 3; c++)
+			sum[c] += SrgbToLinear(image.pixels[i * 4 + c] / 255.0f);
+		sum[3] += image.pixels[i * 4 + 3] / 255.0f;
+	}
+	const unsigned char *last = image.mips.levels.back().data();
+	float drift = 0.0f;
+	for (int c = 0; c < 4; c++) {
+		float mean = (float)(sum[c] / count);
+		float expected = 255.0f * (c < 3 ? LinearToSrgb(mean) : mean);
+		drift = max(drift, fabsf(expected - last[c]));
+	}
+	return drift;
+}
+
+// All the chains, each built over `threads` threads, or with `threads`
+// workers taking one image at a time
+static double TimeMipChains(vector<BenchImage> &images, int threads, bool per_image)
+{
+	auto start = chrono::steady_clock::now();
+	if (!per_image) {
+		for (size_t i = 0; i < images.size(); i++)
+			buildMipChain(images[i].pixels, images[i].width, images[i].height, images[i].mips, threads);
+	}
+	else {
+		atomic<int> next(0);
+		auto work = [&]() {
+			for (int i = next++; i < (int)images.size(); i = next++)
+				buildMipChain(images[i].pixels, images[i].width, images[i].height, images[i].mips);
+		};
+		vector<thread> workers;
+		for (int t = 1; t < threads; t++)
+			workers.push_back(thread(work));
+		work();
+		for (size_t t = 0; t < workers.size(); t++)
+			workers[t].join();
+	}
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Upload every image, with glGenerateMipmap or its CPU chain, and wait for
+// the GL to finish
+static double TimeMipUploads(const vector<BenchImage> &images, bool generate)
+{
+	vector<GLuint> textures(images.size());
+	auto start = chrono::steady_clock::now();
+	glGenTextures((GLsizei)textures.size(), textures.data());
+	for (size_t i = 0; i < images.size(); i++) {
+		const BenchImage &image = images[i];
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels);
+		if (generate) {
+			glGenerateMipmap(GL_TEXTURE_2D);
+			continue;
+		}
+		for (size_t level = 0; level < image.mips.levels.size(); level++)
+			glTexImage2D(GL_TEXTURE_2D, (GLint)level + 1, GL_RGBA, image.mips.widths[level], image.mips.heights[level], 0, GL_RGBA, GL_UNSIGNED_BYTE, image.mips.levels[level].data());
+	}
+	glFinish();
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	glDeleteTextures((GLsizei)textures.size(), textures.data());
+	return ms;
+}
+
+// --bench-mipmaps: check the SSE mip chain against the scalar one and the
+// mean of every chain, time it over 1..N threads split per level or per
+// image, then against glGenerateMipmap in a hidden window
+static int BenchMipmaps(const vector<string> &args)
+{
+	int max_threads = max(max(1, (int)thread::hardware_concurrency()), 4);
+	vector<string> files;
+	for (size_t i = 0; i < args.size(); i++) {
+		if (args[i] == "--threads" && i + 1 < args.size())
+			max_threads = max(1, atoi(args[++i].c_str()));
+		else
+			files.push_back(args[i]);
+	}
+
+	vector<string> found, paths;
+	DistinctMaterialImages(files, found, paths);
+	stbi_set_flip_vertically_on_load(true);
+	vector<BenchImage> images;
+	size_t texels = 0;
+	for (size_t i = 0; i < paths.size(); i++) {
+		BenchImage image;
+		int channels;
+		image.path = paths[i];
+		image.pixels = stbi_load(paths[i].c_str(), &image.width, &image.height, &channels, 4);
+		if (image.pixels == NULL) {
+			printf("  skipping %s (cannot load)\n", paths[i].c_str());
+			continue;
+		}
+		texels += (size_t)image.width * image.height;
+		images.push_back(image);
+	}
+	if (images.empty()) {
+		printf("No images to benchmark\n");
+		return 1;
+	}
+
+	printf("Mip chains of %d images from %d models, %.1f Mtexels\n", (int)images.size(), (int)found.size(), texels / 1e6);
+	printf("  %-44s %11s %6s %10s %10s %8s %8s\n", "image", "size", "levels", "scalar ms", "SSE ms", "speedup", "drift");
+	int mismatches = 0;
+	float worst_drift = 0.0f;
+	double scalar_total = 0.0, sse_total = 0.0;
+	for (size_t i = 0; i < images.size(); i++) {
+		BenchImage &image = images[i];
+		MipChain reference;
+		double best[2] = { 0.0, 0.0 };
+		for (int rep = 0; rep < BENCH_REPEAT; rep++) {
+			auto start = chrono::steady_clock::now();
+			buildMipChainScalar(image.pixels, image.width, image.height, reference);
+			double scalar_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			start = chrono::steady_clock::now();
+			buildMipChain(image.pixels, image.width, image.height, image.mips);
+			double sse_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			if (rep == 0 || scalar_ms < best[0])
+				best[0] = scalar_ms;
+			if (rep == 0 || sse_ms < best[1])
+				best[1] = sse_ms;
+		}
+		bool same = reference.levels == image.mips.levels && (int)image.mips.levels.size() == mipLevelCount(image.width, image.height) - 1;
+		float drift = MeanDrift(image);
+		char size[32];
+		snprintf(size, sizeof(size), "%dx%d", image.width, image.height);
+		printf("  %-44s %11s %6d %10.2f %10.2f %7.2fx %8.2f%s\n", image.path.c_str(), size, (int)image.mips.levels.size() + 1,
+			best[0], best[1], best[0] / best[1], drift, same ? "" : "  SSE/SCALAR MISMATCH");
+		mismatches += same ? 0 : 1;
+		worst_drift = max(worst_drift, drift);
+		scalar_total += best[0];
+		sse_total += best[1];
+	}
+	printf("  %-44s %11s %6s %10.2f %10.2f %7.2fx %8.2f\n", "all", "", "", scalar_total, sse_total, scalar_total / sse_total, worst_drift);
+
+	printf("  %-8s %18s %18s\n", "threads", "rows split, ms", "image each, ms");
+	for (int t = 1; t <= max_threads; t *= 2) {
+		double best[2] = { 0.0, 0.0 };
+		for (int rep = 0; rep < BENCH_REPEAT; rep++) {
+			for (int k = 0; k < 2; k++) {
+				double ms = TimeMipChains(images, t, k == 1);
+				if (rep == 0 || ms < best[k])
+					best[k] = ms;
+			}
+		}
+		printf("  %-8d %18.2f %18.2f\n", t, best[0], best[1]);
+	}
+
+	// against the driver, with level 0 uploaded either way
+	glfwInit();
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifdef __APPLE__
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+	GLFWwindow *window = glfwCreateWindow(64, 64, "bench-mipmaps", NULL, NULL);
+	if (window != NULL) {
+		glfwMakeContextCurrent(window);
+		if (gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+			printf("  GL uploads on %s, best of %d\n", (const char *)glGetString(GL_RENDERER), BENCH_REPEAT);
+			double best[3] = { 0.0, 0.0, 0.0 };
+			for (int rep = 0; rep < BENCH_REPEAT; rep++) {
+				double generate_ms = TimeMipUploads(images, true);
+				double chain_ms = TimeMipChains(images, max_threads, true);
+				double upload_ms = TimeMipUploads(images, false);
+				if (rep == 0 || generate_ms < best[0])
+					best[0] = generate_ms;
+				if (rep == 0 || chain_ms + upload_ms < best[1])
+					best[1] = chain_ms + upload_ms;
+				if (rep == 0 || upload_ms < best[2])
+					best[2] = upload_ms;
+			}
+			printf("  %-44s %10.2f ms\n", "level 0 + glGenerateMipmap", best[0]);
+			printf("  %-44s %10.2f ms (x%.2f)\n", "CPU chains + every level", best[1], best[0] / best[1]);
+			printf("  %-44s %10.2f ms (x%.2f), the GL thread's share\n", "every level, chains built on the decoders", best[2], best[0] / best[2]);
+		}
+		glfwDestroyWindow(window);
+	}
+	else {
+		printf("  no GL context, glGenerateMipmap not compared\n");
+	}
+	glfwTerminate();
+
+	for (size_t i = 0; i < images.size(); i++)
+		stbi_image_free(images[i].pixels);
+
+	// the rounding to 8 bits at the end gives up to half a step
+	bool ok = mismatches == 0 && worst_drift <= 1.0f;
+	printf("Result check: %s (worst mean drift %.2f steps)\n", ok ? "SSE identical to scalar, every chain keeps its mean" : "FAILED", worst_drift);
+	return ok ? 0 : 1;
+}
+
+// Child side of --bench-mmap: a fresh process per measurement, since the
+// peak RSS of a process never goes down. Mode -1 loads nothing and gives the
+// baseline of the executable itself. Prints "<best ms> <peak KB>".
+static int BenchMmapChild(int mode, const string &file)
+{
+	double best = 0.0;
+	bool ok = true;
+	for (int rep = 0; mode >= 0 && rep < BENCH_REPEAT; rep++) {
+		auto start = chrono::steady_clock::now();
+		ok = LoadBenchObjMode(file, mode).ok;
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		if (rep == 0 || ms < best)
+			best = ms;
+	}
+	printf("%f %ld\n", best, PeakResidentKB());
+	return ok ? 0 : 1;
+}
+
+static bool RunMmapChild(const char *exe, int mode, const string &file, double *ms, long *peak_kb)
+{
+	string command = string("\"") + exe + "\" --bench-mmap-child " + to_string(mode) + " \"" + file + "\"";
+#ifdef _WIN32
+	// cmd.exe strips the outer quotes of the whole command line
+	command = "\"" + command + "\"";
+#endif
+	FILE *child = popen(command.c_str(), "r");
+	if (child == NULL)
+		return false;
+	bool ok = fscanf(child, "%lf %ld", ms, peak_kb) == 2;
+	return pclose(child) == 0 && ok;
+}
+
+static int BenchMmap(const char *exe, const vector<string> &args)
+{
+	vector<string> files = args;
+	if (files.empty())
+		files.assign(BENCH_MMAP_MODELS, BENCH_MMAP_MODELS + sizeof(BENCH_MMAP_MODELS) / sizeof(BENCH_MMAP_MODELS[0]));
+
+	double ms;
+	long baseline_kb;
+	if (!RunMmapChild(exe, -1, "", &ms, &baseline_kb)) {
+		printf("Cannot run %s as a child process\n", exe);
+		return 1;
+	}
+
+	printf("OBJ reading, 1 parse thread, best of %d; RSS is the peak of a fresh process over its %ld KB baseline\n",
+		BENCH_REPEAT, baseline_kb);
+	printf("  %-60s %7s", "model", "MB");
+	for (int m = 0; m < OBJ_READ_MODE_COUNT; m++)
+		printf(" %8s MB/s %6s KB", OBJ_READ_MODE_NAMES[m], "RSS");
+	printf("\n");
+
+	int failures = 0;
+	for (size_t f = 0; f < files.size(); f++) {
+		long size = FileSize(files[f]);
+		if (size < 0) {
+			printf("  skipping %s (not found)\n", files[f].c_str());
+			continue;
+		}
+
+		// the mapped loader has to produce exactly what LoadObj does
+		bool same = SameResult(LoadBenchObjMode(files[f], OBJ_READ_STREAM), LoadBenchObjMode(files[f], OBJ_READ_MAPPED));
+
+		double mb = size / (1024.0 * 1024.0);
+		printf("  %-60s %7.2f", files[f].c_str(), mb);
+		for (int m = 0; m < OBJ_READ_MODE_COUNT; m++) {
+			long peak_kb;
+			if (RunMmapChild(exe, m, files[f], &ms, &peak_kb))
+				printf(" %13.1f %9ld", mb / (ms / 1000.0), peak_kb - baseline_kb);
+			else
+				printf(" %13s %9s", "failed", "-");
+		}
+		printf("  %s\n", same ? "identical" : "MISMATCH");
+		failures += same ? 0 : 1;
+	}
+	return failures == 0 ? 0 : 1;
+}
+
+bool RunBenchmarks(int argc, char **argv, int *status)
+{
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--bench-mmap-child") == 0 && i + 2 < argc) {
+			*status = BenchMmapChild(atoi(argv[i + 1]), argv[i + 2]);
+			return true;
+		}
+		if (strcmp(argv[i], "--bench-mmap") == 0) {
+			*status = BenchMmap(argv[0], vector<string>(argv + i + 1, argv + argc));
+			return true;
+		}
+		if (strcmp(argv[i], "--bench-obj") == 0) {
+			*status = BenchObj(vector<string>(argv + i + 1, argv + argc));
+			return true;
+		}
+		if (strcmp(argv[i], "--bench-parse") == 0) {
+			*status = BenchParse(vector<string>(argv + i + 1, argv + argc));
+			return true;
+		}
+		if (strcmp(argv[i], "--bench-normalize") == 0) {
+			*status = BenchNormalize(vector<string>(argv + i + 1, argv + argc));
+			return true;
+		}
+		if (strcmp(argv[i], "--cook-textures") == 0) {
+			*status = CookTextures(vector<string>(argv + i + 1, argv + argc));
+			return true;
+		}
+		if (strcmp(argv[i], "--bench-mipmaps") == 0) {
+			*status = BenchMipmaps(vector<string>(argv + i + 1, argv + argc));
+			return true;
+		}
+		if (strcmp(argv[i], "--bench-textures") == 0) {
+			*status = BenchTextures(vector<string>(argv + i + 1, argv + argc));
+			return true;
+		}
+		if (strcmp(argv[i], "--bench-index") == 0) {
+			*status = BenchIndex(vector<string>(argv + i + 1, argv + argc));
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+// Command line benchmarks, run instead of the viewer:
+//   --bench-obj [file.obj ...]   OBJ parsing throughput, serial LoadObj vs
+//                                LoadObjMultithreaded at 1..N threads
+//   --bench-parse [file.obj ...] check the fast number parsers against the
+//                                reference ones on every v/vn/vt/f field
+//                                and time both
+//   --bench-index [file.obj ...] memory and vertex shader invocations of the
+//                                triangle soup vs the welded, indexed mesh
+//   --bench-normalize [file.obj ...] check that every model (multi-shape ones
+//                                included) comes out centred and unit-sized,
+//                                and time the SSE bounds/normalize kernels
+//   --bench-mmap [file.obj ...]  parse throughput and peak RSS of reading
+//                                the .obj through std::ifstream, a buffer
+//                                copy and a read-only mapping; every
+//                                measurement runs in a child process
+//                                (--bench-mmap-child, internal); defaults
+//                                to Dog, nanosuit and buddha50KC
+//   --bench-textures [file.obj ...] decodes and GPU bytes of loading every
+//                                material's texture on its own vs through
+//                                the shared texture cache; defaults to
+//                                every textured model of TextureModels
+//   --bench-mipmaps [--threads N] [file.obj ...] check the SSE mip chain
+//                                builder against the scalar one, time it
+//                                over threads and against glGenerateMipmap
+//                                in a hidden window
+//   --cook-textures [--format auto|bc1|bc3|bc7] [--threads N] [file.obj ...]
+//                                write image.dds next to every material
+//                                image (see texturecook.h) and report the
+//                                VRAM saved, load time and PSNR; auto is
+//                                BC1 for opaque images, BC3 otherwise
+// Without files the ColorModels (HW1) and TextureModels directories are used.
+// Returns false if no benchmark was requested, otherwise the process exit
+// code (0 when every check passed) is stored in status.
+bool RunBenchmarks(int argc, char **argv, int *status);
+
+// Resident set of this process in KB, now and at its high-water mark;
+// -1 if unavailable.
+long CurrentResidentKB();
+long PeakResidentKB();
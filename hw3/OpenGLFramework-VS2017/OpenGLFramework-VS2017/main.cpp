@@ -1,11 +1,31 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
+#include <map>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <algorithm>
 #include<math.h>
+#include <stddef.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
-#include "textfile.h"
+#include "meshcache.h"
+#include "meshindex.h"
+#include "vertexlayout.h"
+#include "meshbounds.h"
+#include "benchmark.h"
+#include "texturecache.h"
+#include "texturecook.h"
+#include "texturearray.h"
+#include "statecache.h"
+#include "textureupload.h"
+#include "programcache.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include <STB/stb_image.h>
 
@@ -62,35 +82,49 @@ struct LightingAttrib
 };
 LightingAttrib lighting_attrib[3];   // for directional, point, and spot lights
 
-struct UniformLightingAttrib
-{
-	GLuint position;
-	GLuint ambient;
-	GLuint diffuse;
-	GLuint specular;
-	GLuint spot_direction;
-	GLuint spot_exponent;
-	GLuint spot_cutoff;
-	GLuint shininess;
-	GLuint constant_attenuation;
-	GLuint linear_attenuation;
-	GLuint quadratic_attenuation;
+// One light of the shaders' std140 Lights block, where a float after a
+// vec3 fills its last 4 bytes
+struct LightBlockEntry
+{
+	GLfloat position[3];	// view space; towards the light for the directional one
+	GLfloat shininess;
+	GLfloat ambient[3];
+	GLfloat spot_exponent;
+	GLfloat diffuse[3];
+	GLfloat spot_cos_cutoff;	// cosine of spot_cutoff
+	GLfloat specular[3];
+	GLfloat constant_attenuation;
+	GLfloat spot_direction[3];
+	GLfloat linear_attenuation;
+	GLfloat quadratic_attenuation;
+	GLfloat padding[3];	// a struct takes a multiple of 16 bytes
 };
 
-struct UniformPhongMaterial
+// std140 Material block
+struct MaterialBlock
 {
-	GLuint Ka;
-	GLuint Kd;
-	GLuint Ks;
+	GLfloat Ka[3], padding0;
+	GLfloat Kd[3], padding1;
+	GLfloat Ks[3], padding2;
 };
 
+// uniform buffer binding points of the blocks
+#define LIGHTS_BINDING 0
+#define MATERIAL_BINDING 1
+#define TRANSFORM_BINDING 2
+
 int cur_lighting_mode = 0;     // 0: directional, 1: point, 2: spot
 
-// uniforms location
-GLuint iLocLightingMode;
-GLuint iLocIsPerPixel;
-UniformLightingAttrib iLocLightingAttrib[3];     // for directional, point, and spot lights
-UniformPhongMaterial iLocPhongMaterial;
+// Lights block of all three lights, uploaded by UpdateLighting when
+// lighting_attrib or the view matrix changed
+GLuint light_buffer;
+bool lights_dirty = true;
+// MaterialBlock rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, the
+// distance between the shapes' blocks in a model's material buffer
+GLsizeiptr material_stride = sizeof(MaterialBlock);
+// glBufferSubData calls for the blocks, see --gl-stats
+unsigned long uniform_block_uploads = 0;
+
 /* ------------------------------------ */
 
 
@@ -105,6 +139,11 @@ typedef struct _Offset {
 	};
 } Offset;
 
+// texture coordinate offsets of the frames of an eye texture, see
+// cur_eye_offset_idx
+const int EYE_OFFSET_COUNT = 7;
+const Offset EYE_OFFSETS[EYE_OFFSET_COUNT] = { Offset(0.0, 0.0), Offset(0.0, 0.75), Offset(0.0, 0.5), Offset(0.0, 0.25), Offset(0.5, 0.0), Offset(0.5, 0.75), Offset(0.5, 0.5) };
+
 typedef struct
 {
 	Vector3 Ka;
@@ -112,6 +151,7 @@ typedef struct
 	Vector3 Ks;
 
 	GLuint diffuseTexture;
+	GLint textureLayer;	// layer of the model's texture array, -1 for diffuseTexture
 
 	// eye texture coordinate 
 	GLint isEye;
@@ -130,9 +170,35 @@ typedef struct
 	GLuint p_normal;
 	GLuint p_texCoord;
 	PhongMaterial material;
+	GLuint materialBuffer;	// MaterialBlock of each shape of the model, see UploadMaterials
+	GLintptr materialOffset;
 	int indexCount;
+	GLenum indexType;
+	size_t indexOffset;	// in bytes, into ebo
 } Shape;
 
+// std140 Transform block of the vertex shader, matrices column-major
+struct TransformBlock
+{
+	GLfloat model[16];
+	GLfloat model_view[16];
+	GLfloat mvp[16];
+	GLfloat normal[12];	// mat3, each column padded to 16 bytes
+};
+
+// One copy of a crowd draw, the per-instance inputs of shader.vs.glsl
+struct InstanceData
+{
+	GLfloat model[16];	// placement inside the model's space, column-major
+	GLubyte tint[4];	// unorm8 RGBA the shaded color is multiplied by
+	GLint eye_offset;	// into EYE_OFFSETS for eye textures, -1 for the model's own
+};
+
+// their vertex attribute locations, the model matrix takes one per column
+#define INSTANCE_MODEL_LOCATION 4
+#define INSTANCE_TINT_LOCATION 8
+#define INSTANCE_EYE_OFFSET_LOCATION 9
+
 struct model
 {
 	Vector3 position = Vector3(0, 0, 0);
@@ -140,12 +206,28 @@ struct model
 	Vector3 rotation = Vector3(0, 0, 0);	// Euler form
 
 	vector<Shape> shapes;
+	bool resident = false;	// shapes are uploaded, see UpdateModelLoader
+	size_t gpu_bytes = 0;	// vertex and index data and the texture array, shared textures are counted by the texture cache
+	vector<TextureHandle> textures;	// held while resident, NULL for images that failed
+	TextureArray texture_array;	// --texture-arrays, replaces the textures
+	unsigned long last_displayed = 0;	// frame it was last drawn in, 0 for never; the least recent is evicted first
+	int uploads = 0;	// more than one after it was evicted and loaded again
+
+	// derived from position, rotation, scale and the camera by UpdateTransform,
+	// recomputed when one of them changed
+	TransformBlock transform;
+	Vector3 transform_position, transform_rotation, transform_scale;
+	unsigned long transform_camera = 0;	// camera_version it was computed for, 0 for never
 
 	bool hasEye;
 	GLint max_eye_offset = 7;
 	GLint cur_eye_offset_idx = 0;
 };
-vector<model> models;
+vector<model> models;	// one per model_list entry
+void PrintResidency(bool per_model);	// M key, next to the model loader
+
+// Drawn in place of a model that is still loading
+vector<Shape> placeholder_shapes;
 
 struct camera
 {
@@ -174,29 +256,125 @@ TransMode cur_trans_mode = GeoTranslation;
 
 Matrix4 view_matrix;
 Matrix4 project_matrix;
+unsigned long camera_version = 1;	// bumped when view_matrix or project_matrix change
+
+// Transform block of the drawn model, see UpdateTransform
+GLuint transform_buffer;
+int transform_buffer_model = -1;	// model whose transform it holds
 
 Shape m_shpae;
 
 int cur_idx = 0; // represent which model should be rendered now
 vector<string> model_list{ "../TextureModels/Fushigidane.obj", "../TextureModels/Mew.obj","../TextureModels/Nyarth.obj","../TextureModels/Zenigame.obj", "../TextureModels/laurana500.obj", "../TextureModels/Nala.obj", "../TextureModels/Square.obj" };
 
-GLuint program;
+// Shading frequency and texture source of a shader variant, the values the
+// shaders give SHADING and TEXTURE_SOURCE
+enum Shading
+{
+	SHADE_PER_VERTEX = 0,
+	SHADE_PER_PIXEL = 1,
+	SHADE_SPLIT = 2,	// dual viewport, instance 0 per vertex and instance 1 per pixel
+	SHADING_COUNT
+};
+enum TextureSource
+{
+	TEXTURE_NONE = 0,
+	TEXTURE_2D = 1,
+	TEXTURE_ARRAY = 2,
+	TEXTURE_SOURCE_COUNT
+};
+
+// A linked program and the uniforms RenderScene sets, -1 where a variant
+// compiled them out
+struct ShaderProgram
+{
+	GLuint program = 0;
+	// uniforms location
+	GLuint iLocLightingMode;
+	GLuint iLocIsPerPixel;
+	GLuint iLocDualViewport;
+	GLuint iLocXOffset;
+	GLuint iLocYOffset;
+	GLuint iLocTextureIsEye;
+	GLuint iLocTextureLayer;
+};
+
+// The shaders as written, branching on uniforms, and their variants with
+// the light type, shading and texture source compiled in; RenderScene draws
+// each shape with its exact variant, or with the uber-shader for
+// --uber-shader and variants that failed to build or are not built yet
+ShaderProgram uber_shader;
+ShaderProgram shader_variants[3][SHADING_COUNT][TEXTURE_SOURCE_COUNT];	// [light type][shading][texture source]
+bool use_shader_variants = true;
+
+// keep linked programs as binaries under shadercache/ so later runs skip
+// compiling them, off with --no-program-binaries
+bool use_program_binaries = true;
+
+// setShaders only requests the uber-shader, UpdateShaders requests the
+// variants and takes each program up once the driver has built it, so the
+// first frames draw with whichever is ready; --sync-shaders builds them
+// all before the first frame
+bool async_shaders = true;
+bool shaders_pending = false;
+const int VARIANT_COUNT = 3 * SHADING_COUNT * TEXTURE_SOURCE_COUNT;
+int variants_requested = 0;
+bool variant_requested[VARIANT_COUNT];	// by the variant numbers of VariantDefines
+const double shader_request_budget_ms = 4.0;	// per frame
+chrono::steady_clock::time_point shaders_requested;
+
+// sampled by the uber-shader for shapes without a texture, which the
+// variants draw untextured
+GLuint white_texture;
+
+// vertex format of the model buffers, see vertexlayout.cpp
+const VertexLayout* vertex_layout = findVertexLayout("compact");
+
+// load the cooked .dds of a texture when there is one (--cook-textures),
+// --no-cooked-textures always decodes the source images
+bool use_cooked_textures = true;
+
+// pack the diffuse textures of each model into one texture array
+// (--texture-arrays), the whole model then draws without a texture bind
+bool use_texture_arrays = false;
+
+// stream decoded textures to the GPU a frame budget at a time through a
+// pixel buffer ring, --sync-texture-uploads uploads each one whole on first use
+bool stream_texture_uploads = true;
 
 /* ---------- [HW3] Texture ---------- */
 int texture_mag_mode = 0;     // 0: nearest, 1: linear
 int texture_min_mode = 0;     // 0: nearest, 1: linear_mipmap_linear
 
-GLuint iLocXOffset;
-GLuint iLocYOffset;
-
-GLuint iLocTextureIsEye;
-GLuint iLocTextureFromMain;
+// glBindTexture calls of RenderScene, see --bench-texture-arrays
+unsigned long texture_binds = 0;
+// draw calls of RenderScene, see --bench-dual-viewport
+unsigned long draw_calls = 0;
+// instances those drew, each shape drawn once counting one; see --bench-crowd
+unsigned long long drawn_instances = 0;
+
+// draw both halves of the window with one draw of two instances per shape
+// (see shader.vs.glsl), --per-viewport-draws draws each half on its own
+bool dual_viewport_draws = true;
+// halves drawn without dual_viewport_draws, bit 0 the left, per-vertex
+// lit one and bit 1 the right one; --bench-shader-variants times them apart
+int viewport_halves = 3;
+
+// --crowd N: draw N copies of the model, each shape with one instanced draw
+// fed per copy from crowd_buffer (see BuildCrowd); 0 draws the model once
+int crowd_size = 0;
+GLuint crowd_buffer = 0;
+// the vertex array whose instance inputs read crowd_buffer, 0 for none,
+// and how many instances each copy takes there
+GLuint crowd_vao = 0;
+GLuint crowd_divisor = 1;
+
+// filtering and wrapping of both texture units, [texture_mag_mode][texture_min_mode]
+GLuint texture_samplers[2][2];
+// --gl-stats: print the GL calls issued and elided by the state cache per frame
+bool print_gl_stats = false;
 /* ----------------------------------- */
 
-// uniforms location
-GLuint iLocP;
-GLuint iLocV;
-GLuint iLocM;
 
 static GLvoid Normalize(GLfloat v[3])
 {
@@ -320,6 +498,9 @@ void setViewingMatrix()
 	view_matrix[15] = 1;
 
 	view_matrix = view_matrix * translate(-main_camera.position);
+	// the lights are uploaded in view space
+	lights_dirty = true;
+	camera_version++;
 }
 
 void setOrthogonal()
@@ -344,6 +525,7 @@ void setOrthogonal()
 	project_matrix[13] = 0;
 	project_matrix[14] = 0;
 	project_matrix[15] = 1;
+	camera_version++;
 }
 
 void setPerspective()
@@ -367,6 +549,7 @@ void setPerspective()
 	project_matrix[13] = 0;
 	project_matrix[14] = -1;
 	project_matrix[15] = 0;
+	camera_version++;
 }
 
 // Call back function for window reshape
@@ -391,130 +574,298 @@ void Vector3ToFloat4(Vector3 v, GLfloat res[4])
 }
 
 
-// [HW2] use glUniform to send lighting attributes to vertex shader
+void Vector3ToFloat3(Vector3 v, GLfloat res[3])
+{
+	res[0] = v.x;
+	res[1] = v.y;
+	res[2] = v.z;
+}
+
+// [HW2] send the lighting attributes to the shaders' Lights block, once
+// after they or the view changed
 void UpdateLighting()
 {
+	if (!lights_dirty)
+		return;
 	// i = 0: directional light, i = 1: point light, i = 2: spot light
+	LightBlockEntry lights[3];
+	memset(lights, 0, sizeof(lights));
 	for (int i = 0; i < 3; ++i) {
-		// for 3 light sources
-		glUniform3f(iLocLightingAttrib[i].position, lighting_attrib[i].position.x, lighting_attrib[i].position.y, lighting_attrib[i].position.z);
-		glUniform3f(iLocLightingAttrib[i].ambient, lighting_attrib[i].ambient.x, lighting_attrib[i].ambient.y, lighting_attrib[i].ambient.z);
-		glUniform3f(iLocLightingAttrib[i].diffuse, lighting_attrib[i].diffuse.x, lighting_attrib[i].diffuse.y, lighting_attrib[i].diffuse.z);
-		glUniform3f(iLocLightingAttrib[i].specular, lighting_attrib[i].specular.x, lighting_attrib[i].specular.y, lighting_attrib[i].specular.z);
-		glUniform1f(iLocLightingAttrib[i].shininess, lighting_attrib[i].shininess);
-		// for point & spot lights
-		if (i != 0) {
-			glUniform1f(iLocLightingAttrib[i].constant_attenuation, lighting_attrib[i].constant_attenuation);
-			glUniform1f(iLocLightingAttrib[i].linear_attenuation, lighting_attrib[i].linear_attenuation);
-			glUniform1f(iLocLightingAttrib[i].quadratic_attenuation, lighting_attrib[i].quadratic_attenuation);
+		// the shaders light in view space; the directional light keeps
+		// only the direction from the origin, which the view rotates
+		Vector3 position = lighting_attrib[i].position;
+		if (i == 0)
+			position = view_matrix * position;
+		else {
+			Vector4 view_position = view_matrix * Vector4(position.x, position.y, position.z, 1.0f);
+			position = Vector3(view_position.x, view_position.y, view_position.z);
 		}
+		Vector3ToFloat3(position, lights[i].position);
+		Vector3ToFloat3(lighting_attrib[i].ambient, lights[i].ambient);
+		Vector3ToFloat3(lighting_attrib[i].diffuse, lights[i].diffuse);
+		Vector3ToFloat3(lighting_attrib[i].specular, lights[i].specular);
+		lights[i].shininess = lighting_attrib[i].shininess;
+		// for point & spot lights
+		lights[i].constant_attenuation = lighting_attrib[i].constant_attenuation;
+		lights[i].linear_attenuation = lighting_attrib[i].linear_attenuation;
+		lights[i].quadratic_attenuation = lighting_attrib[i].quadratic_attenuation;
 		// for spot light only
-		if (i == 2) {
-			glUniform3f(iLocLightingAttrib[i].spot_direction, lighting_attrib[i].spot_direction.x, lighting_attrib[i].spot_direction.y, lighting_attrib[i].spot_direction.z);
-			glUniform1f(iLocLightingAttrib[i].spot_exponent, lighting_attrib[i].spot_exponent);
-			glUniform1f(iLocLightingAttrib[i].spot_cutoff, lighting_attrib[i].spot_cutoff);
+		Vector3ToFloat3(lighting_attrib[i].spot_direction, lights[i].spot_direction);
+		lights[i].spot_exponent = lighting_attrib[i].spot_exponent;
+		lights[i].spot_cos_cutoff = cosf(lighting_attrib[i].spot_cutoff * acosf(-1.0f) / 180.0f);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, light_buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(lights), lights);
+	uniform_block_uploads++;
+	lights_dirty = false;
+}
+
+
+// Bring the Transform block of model i up to date and into transform_buffer:
+// its matrices are only rebuilt after the model moved or the camera
+// changed, and uploaded at most once per frame
+void UpdateTransform(int i)
+{
+	model& m = models[i];
+	bool moved = m.transform_camera != camera_version || !(m.transform_position == m.position)
+		|| !(m.transform_rotation == m.rotation) || !(m.transform_scale == m.scale);
+	if (moved)
+	{
+		Matrix4 model_matrix = translate(m.position) * rotate(m.rotation) * scaling(m.scale);
+		Matrix4 model_view = view_matrix * model_matrix;
+		Matrix4 mvp = project_matrix * model_view;
+		memcpy(m.transform.model, model_matrix.getTranspose(), sizeof(m.transform.model));
+		memcpy(m.transform.model_view, model_view.getTranspose(), sizeof(m.transform.model_view));
+		memcpy(m.transform.mvp, mvp.getTranspose(), sizeof(m.transform.mvp));
+		// the normal matrix is the transposed inverse, so its columns are
+		// the rows of the inverse
+		Matrix4 inverse = model_view;
+		inverse.invertAffine();
+		for (int c = 0; c < 3; c++)
+		{
+			for (int r = 0; r < 3; r++)
+				m.transform.normal[c * 4 + r] = inverse[c * 4 + r];
+			m.transform.normal[c * 4 + 3] = 0;
 		}
+		m.transform_position = m.position;
+		m.transform_rotation = m.rotation;
+		m.transform_scale = m.scale;
+		m.transform_camera = camera_version;
+	}
+	if (moved || transform_buffer_model != i)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, transform_buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(TransformBlock), &m.transform);
+		uniform_block_uploads++;
+		transform_buffer_model = i;
 	}
 }
 
+// crowd_size copies of the model in a square grid filling its [-1, 1] box,
+// each scaled down to its cell and turned about y by a hashed angle, with a
+// hashed tint and eye texture frame; uploaded to crowd_buffer
+void BuildCrowd()
+{
+	int side = (int)ceil(sqrt((double)crowd_size));
+	float cell = 2.0f / side;
+	vector<InstanceData> instances(crowd_size);
+	for (int k = 0; k < crowd_size; k++)
+	{
+		unsigned hash = (unsigned)k * 2654435761u;
+		float yaw = (float)(hash >> 16 & 1023) / 1024.0f * 2.0f * acosf(-1.0f);
+		Vector3 center(-1.0f + cell * (k % side + 0.5f), 1.0f - cell * (k / side + 0.5f), 0.0f);
+		Matrix4 placement = translate(center) * rotateY(k == 0 ? 0.0f : yaw) * scaling(Vector3(0.45f * cell, 0.45f * cell, 0.45f * cell));
+		memcpy(instances[k].model, placement.getTranspose(), sizeof(instances[k].model));
+		// the first copy keeps the model's own look
+		for (int c = 0; c < 3; c++)
+			instances[k].tint[c] = k == 0 ? 255 : (GLubyte)(128 + (hash >> (c * 5) & 127));
+		instances[k].tint[3] = 255;
+		instances[k].eye_offset = k == 0 ? -1 : k % EYE_OFFSET_COUNT;
+	}
+	if (crowd_buffer == 0)
+		glGenBuffers(1, &crowd_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, crowd_buffer);
+	glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData), instances.data(), GL_STATIC_DRAW);
+}
 
-// Render function for display rendering
-void RenderScene(int per_vertex_or_per_pixel) {	
-	Vector3 modelPos = models[cur_idx].position;
+// Point the instance inputs of vao at crowd_buffer, advancing one copy
+// every divisor instances, and disable them again in the vertex array they
+// were wired into before; with vao 0 only the latter. Disabled they read
+// the current values setupRC gave them.
+void WireCrowd(GLuint vao, GLuint divisor)
+{
+	if (vao == crowd_vao && (vao == 0 || divisor == crowd_divisor))
+		return;
+	if (crowd_vao != 0 && crowd_vao != vao)
+	{
+		stateCacheBindVertexArray(crowd_vao);
+		for (int location = INSTANCE_MODEL_LOCATION; location <= INSTANCE_EYE_OFFSET_LOCATION; location++)
+			glDisableVertexAttribArray(location);
+	}
+	crowd_vao = vao;
+	crowd_divisor = divisor;
+	if (vao == 0)
+		return;
+
+	stateCacheBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, crowd_buffer);
+	for (int column = 0; column < 4; column++)
+		glVertexAttribPointer(INSTANCE_MODEL_LOCATION + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (const void*)(offsetof(InstanceData, model) + column * 4 * sizeof(GLfloat)));
+	glVertexAttribPointer(INSTANCE_TINT_LOCATION, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(InstanceData), (const void*)offsetof(InstanceData, tint));
+	glVertexAttribIPointer(INSTANCE_EYE_OFFSET_LOCATION, 1, GL_INT, sizeof(InstanceData), (const void*)offsetof(InstanceData, eye_offset));
+	for (int location = INSTANCE_MODEL_LOCATION; location <= INSTANCE_EYE_OFFSET_LOCATION; location++)
+	{
+		glVertexAttribDivisor(location, divisor);
+		glEnableVertexAttribArray(location);
+	}
+}
 
-	Matrix4 T, R, S;
-	T = translate(models[cur_idx].position);
-	R = rotate(models[cur_idx].rotation);
-	S = scaling(models[cur_idx].scale);
+// The program to draw with under the current lighting mode
+const ShaderProgram& PickShader(Shading shading, TextureSource texture_source)
+{
+	if (use_shader_variants)
+	{
+		const ShaderProgram& variant = shader_variants[cur_lighting_mode][shading][texture_source];
+		if (variant.program != 0)
+			return variant;
+	}
+	return uber_shader;
+}
 
-	// render object
-	Matrix4 model_matrix = T * R * S;
-	glUniformMatrix4fv(iLocM, 1, GL_FALSE, model_matrix.getTranspose());
-	glUniformMatrix4fv(iLocV, 1, GL_FALSE, view_matrix.getTranspose());
-	glUniformMatrix4fv(iLocP, 1, GL_FALSE, project_matrix.getTranspose());
+TextureSource ShapeTextureSource(const Shape& shape)
+{
+	if (shape.material.textureLayer >= 0)
+		return TEXTURE_ARRAY;
+	return shape.material.diffuseTexture == (GLuint)-1 ? TEXTURE_NONE : TEXTURE_2D;
+}
 
-	glUniform1i(iLocLightingMode, cur_lighting_mode);
-	UpdateLighting();
+// Draw a shape into the current viewport, or both halves for SHADE_SPLIT;
+// its vertex array and material are bound
+void DrawShape(const Shape& shape, Shading shading)
+{
+	TextureSource texture_source = ShapeTextureSource(shape);
+	const ShaderProgram& shader = PickShader(shading, texture_source);
+	if (shader.program == 0)
+		return;	// none built yet, see UpdateShaders
+	stateCacheUseProgram(shader.program);
+	// what the variants have compiled in
+	stateCacheUniform1i(shader.iLocLightingMode, cur_lighting_mode);
+	stateCacheUniform1i(shader.iLocDualViewport, shading == SHADE_SPLIT ? 1 : 0);
+	stateCacheUniform1i(shader.iLocIsPerPixel, shading == SHADE_PER_PIXEL ? 1 : 0);
+
+	// [TODO] Bind texture and modify texture filtering & wrapping mode
+	// Hint: glActiveTexture, glBindTexture, glTexParameteri; filtering
+	// and wrapping are the samplers bound by RenderScene
+	// 1. texture coordinate offset & whether it is Eye
+	stateCacheUniform1i(shader.iLocTextureIsEye, shape.material.isEye);
+
+	GLfloat x_offset = shape.material.offsets[models[cur_idx].cur_eye_offset_idx].x;
+	GLfloat y_offset = shape.material.offsets[models[cur_idx].cur_eye_offset_idx].y;
+	stateCacheUniform1f(shader.iLocXOffset, x_offset);
+	stateCacheUniform1f(shader.iLocYOffset, y_offset);
+
+	// 2. bind texture, unless it is a layer of the array RenderScene bound
+	stateCacheUniform1i(shader.iLocTextureLayer, shape.material.textureLayer);
+	if (texture_source == TEXTURE_2D || (texture_source == TEXTURE_NONE && &shader == &uber_shader))
+	{
+		stateCacheBindTexture(0, GL_TEXTURE_2D, texture_source == TEXTURE_2D ? shape.material.diffuseTexture : white_texture);
+		texture_binds++;
+	}
 
-	for (int i = 0; i < models[cur_idx].shapes.size(); i++) 
+	GLsizei copies = crowd_size > 0 ? crowd_size : 1;
+	if (shading == SHADE_SPLIT)
 	{
-		// [HW2] use glUniform to send material info (Ka, Kd, Ks) to vertex shader
-		glUniform3f(iLocPhongMaterial.Ka, models[cur_idx].shapes[i].material.Ka.x, models[cur_idx].shapes[i].material.Ka.y, models[cur_idx].shapes[i].material.Ka.z);
-		glUniform3f(iLocPhongMaterial.Kd, models[cur_idx].shapes[i].material.Kd.x, models[cur_idx].shapes[i].material.Kd.y, models[cur_idx].shapes[i].material.Kd.z);
-		glUniform3f(iLocPhongMaterial.Ks, models[cur_idx].shapes[i].material.Ks.x, models[cur_idx].shapes[i].material.Ks.y, models[cur_idx].shapes[i].material.Ks.z);
+		// instance 2k is the left half of copy k, instance 2k + 1 the right one
+		glDrawElementsInstanced(GL_TRIANGLES, shape.indexCount, shape.indexType, (const void*)shape.indexOffset, 2 * copies);
+		draw_calls++;
+		drawn_instances += 2 * copies;
+		return;
+	}
+	if (crowd_size > 0)
+		glDrawElementsInstanced(GL_TRIANGLES, shape.indexCount, shape.indexType, (const void*)shape.indexOffset, copies);
+	else
+		glDrawElements(GL_TRIANGLES, shape.indexCount, shape.indexType, (const void*)shape.indexOffset);
+	draw_calls++;
+	drawn_instances += copies;
+}
 
-		glBindVertexArray(models[cur_idx].shapes[i].vao);
+// Render function for display rendering
+void RenderScene(int per_vertex_or_per_pixel) {	
+	// render object
+	UpdateTransform(cur_idx);
+	stateCacheBindUniformBuffer(TRANSFORM_BINDING, transform_buffer, 0, sizeof(TransformBlock));
 
-		/* ---------- Set glViewport and draw the left-half window ---------- */
-		glUniform1i(iLocIsPerPixel, 0);
-		glViewport(0, 0, screenWidth / 2, screenHeight);
-
-		// [TODO] Bind texture and modify texture filtering & wrapping mode
-		// Hint: glActiveTexture, glBindTexture, glTexParameteri
-		// 1. texture coordinate offset & whether it is Eye
-		glUniform1i(iLocTextureIsEye, models[cur_idx].shapes[i].material.isEye);
-
-		GLfloat x_offset = models[cur_idx].shapes[i].material.offsets[models[cur_idx].cur_eye_offset_idx].x;
-		GLfloat y_offset = models[cur_idx].shapes[i].material.offsets[models[cur_idx].cur_eye_offset_idx].y;
-		glUniform1f(iLocXOffset, x_offset);
-		glUniform1f(iLocYOffset, y_offset);
-		
-		// 2. bind texture
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, models[cur_idx].shapes[i].material.diffuseTexture);
+	UpdateLighting();
+	stateCacheBindUniformBuffer(LIGHTS_BINDING, light_buffer, 0, 3 * sizeof(LightBlockEntry));
 
-		// 3. texture filtering
-		if (texture_mag_mode == 0)
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		else
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// filtering and wrapping come from the sampler objects, which override
+	// the parameters of whatever texture is bound to the unit
+	GLuint sampler = texture_samplers[texture_mag_mode != 0][texture_min_mode != 0];
+	stateCacheBindSampler(0, sampler);
+	stateCacheBindSampler(1, sampler);
 
-		if (texture_min_mode == 0)
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		else
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	// the transform stays the model's own while its placeholder is shown
+	const vector<Shape>& shapes = models[cur_idx].resident ? models[cur_idx].shapes : placeholder_shapes;
 
-		// 4. texture wrapping
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// one full-window viewport, the vertex shader places each instance in its half
+	if (dual_viewport_draws)
+		stateCacheViewport(0, 0, screenWidth, screenHeight);
 
-		glDrawArrays(GL_TRIANGLES, 0, models[cur_idx].shapes[i].vertex_count);
+	// with --texture-arrays the textures of the model are one array, bound
+	// once for all of its shapes
+	const TextureArray& texture_array = models[cur_idx].texture_array;
+	if (models[cur_idx].resident && texture_array.texture != 0)
+	{
+		stateCacheBindTexture(1, GL_TEXTURE_2D_ARRAY, texture_array.texture);
+		texture_binds++;
+	}
+	for (int i = 0; i < shapes.size(); i++) 
+	{
+		// [HW2] material info (Ka, Kd, Ks) is the shape's range of the model's material buffer
+		stateCacheBindUniformBuffer(MATERIAL_BINDING, shapes[i].materialBuffer, shapes[i].materialOffset, sizeof(MaterialBlock));
 
-		/* ---------- Set glViewport and draw the right-half window ---------- */
-		glUniform1i(iLocIsPerPixel, 1);
-		glViewport(screenWidth / 2, 0, screenWidth / 2, screenHeight);
-
-		// [TODO] Bind texture and modify texture filtering & wrapping mode
-		// Hint: glActiveTexture, glBindTexture, glTexParameteri
-		// 1. texture coordinate offset & whether it is Eye
-		glUniform1i(iLocTextureIsEye, models[cur_idx].shapes[i].material.isEye);
-
-		x_offset = models[cur_idx].shapes[i].material.offsets[models[cur_idx].cur_eye_offset_idx].x;
-		y_offset = models[cur_idx].shapes[i].material.offsets[models[cur_idx].cur_eye_offset_idx].y;
-		glUniform1f(iLocXOffset, x_offset);
-		glUniform1f(iLocYOffset, y_offset);
-		
-		// 2. bind texture
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, models[cur_idx].shapes[i].material.diffuseTexture);
+		// the copies of a crowd come from the instance buffer
+		if (crowd_size > 0 || crowd_vao != 0)
+			WireCrowd(crowd_size > 0 ? shapes[i].vao : 0, dual_viewport_draws ? 2 : 1);
+		stateCacheBindVertexArray(shapes[i].vao);
 
-		// 3. texture filtering
-		if (texture_mag_mode == 0)
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		else
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		if (dual_viewport_draws)
+		{
+			DrawShape(shapes[i], SHADE_SPLIT);
+			continue;
+		}
 
-		if (texture_min_mode == 0)
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		else
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		/* ---------- Set glViewport and draw the left-half window ---------- */
+		if (viewport_halves & 1)
+		{
+			stateCacheViewport(0, 0, screenWidth / 2, screenHeight);
+			DrawShape(shapes[i], SHADE_PER_VERTEX);
+		}
 
-		// 4. texture wrapping
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		/* ---------- Set glViewport and draw the right-half window ---------- */
+		if (viewport_halves & 2)
+		{
+			stateCacheViewport(screenWidth / 2, 0, screenWidth / 2, screenHeight);
+			DrawShape(shapes[i], SHADE_PER_PIXEL);
+		}
+	}
+}
 
-		glDrawArrays(GL_TRIANGLES, 0, models[cur_idx].shapes[i].vertex_count);
+// Both halves of the window, per-vertex lighting on the left and per-pixel
+// on the right
+void RenderFrame()
+{
+	if (dual_viewport_draws)
+	{
+		RenderScene(0);
+		return;
 	}
+	// render left view
+	stateCacheViewport(0, 0, screenWidth / 2, screenHeight);
+	RenderScene(1);
+	// render right view
+	stateCacheViewport(screenWidth / 2, 0, screenWidth / 2, screenHeight);
+	RenderScene(0);
 }
 
 // Call back function for keyboard
@@ -569,6 +920,9 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		case GLFW_KEY_I:
 			cout << endl;
 			break;
+		case GLFW_KEY_M:
+			PrintResidency(true);
+			break;
 		/* -------------------- [HW2] Lighting -------------------- */
 		case GLFW_KEY_L:
 			cur_lighting_mode = (cur_lighting_mode + 1) % 3;
@@ -650,6 +1004,7 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 			// clamp spotlight's cutoff angle into the range [0.0, 180.0]
 			lighting_attrib[cur_lighting_mode].spot_cutoff = min(max(lighting_attrib[cur_lighting_mode].spot_cutoff, 0.0), 180.0);
 		}
+		lights_dirty = true;
 		break;
 	case ShininessEdit:
 		// apply to all lighting modes
@@ -658,6 +1013,7 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 			// make sure shininess >= 0
 			lighting_attrib[i].shininess = max(lighting_attrib[i].shininess, 0);
 		}
+		lights_dirty = true;
 		break;
 	/* -------------------------------------------------------- */
 	}
@@ -723,6 +1079,7 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 			case LightEdit:
 				lighting_attrib[cur_lighting_mode].position.x -= diff_x * 0.002;
 				lighting_attrib[cur_lighting_mode].position.y += diff_y * 0.002;
+				lights_dirty = true;
 				break;
 			/* -------------------------------------------------------- */
 			}
@@ -730,171 +1087,158 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 	}
 }
 
-void setShaders()
-{
-	GLuint v, f, p;
-	char *vs = NULL;
-	char *fs = NULL;
-
-	v = glCreateShader(GL_VERTEX_SHADER);
-	f = glCreateShader(GL_FRAGMENT_SHADER);
-
-	vs = textFileRead("shader.vs.glsl");
-	fs = textFileRead("shader.fs.glsl");
-
-	glShaderSource(v, 1, (const GLchar**)&vs, NULL);
-	glShaderSource(f, 1, (const GLchar**)&fs, NULL);
-
-	free(vs);
-	free(fs);
-
-	GLint success;
-	char infoLog[1000];
-	// compile vertex shader
-	glCompileShader(v);
-	// check for shader compile errors
-	glGetShaderiv(v, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(v, 1000, NULL, infoLog);
-		std::cout << "ERROR: VERTEX SHADER COMPILATION FAILED\n" << infoLog << std::endl;
-	}
-
-	// compile fragment shader
-	glCompileShader(f);
-	// check for shader compile errors
-	glGetShaderiv(f, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(f, 1000, NULL, infoLog);
-		std::cout << "ERROR: FRAGMENT SHADER COMPILATION FAILED\n" << infoLog << std::endl;
-	}
-
-	// create program object
-	p = glCreateProgram();
-
-	// attach shaders to program object
-	glAttachShader(p,f);
-	glAttachShader(p,v);
-
-	// link program
-	glLinkProgram(p);
-	// check for linking errors
-	glGetProgramiv(p, GL_LINK_STATUS, &success);
-	if (!success) {
-		glGetProgramInfoLog(p, 1000, NULL, infoLog);
-		std::cout << "ERROR: SHADER PROGRAM LINKING FAILED\n" << infoLog << std::endl;
-	}
-
-	glDeleteShader(v);
-	glDeleteShader(f);
+void setUniformVariables(ShaderProgram& shader);	// next to setupRC
 
-	if (success)
-		glUseProgram(p);
-    else
-    {
-        system("pause");
-        exit(123);
-    }
-
-	program = p;
+// Link a program for the shaders with defines and look up its uniforms;
+// without wait, one requested but not built yet is left 0 for now.
+// Returns whether a program was taken up.
+bool BuildShaderProgram(const string& defines, ShaderProgram& shader, bool wait)
+{
+	bool created;
+	shader.program = wait ? programCacheGet(defines, &created) : programCachePoll(defines, &created);
+	if (created)
+		setUniformVariables(shader);
+	return created;
 }
 
-void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, tinyobj::shape_t* shape)
+// The defines of shader_variants[light][shading][texture] for variant
+// = (light * SHADING_COUNT + shading) * TEXTURE_SOURCE_COUNT + texture
+string VariantDefines(int variant)
 {
-	vector<float> xVector, yVector, zVector;
-	float minX = 10000, maxX = -10000, minY = 10000, maxY = -10000, minZ = 10000, maxZ = -10000;
+	int light = variant / (SHADING_COUNT * TEXTURE_SOURCE_COUNT);
+	int shading = variant / TEXTURE_SOURCE_COUNT % SHADING_COUNT;
+	int texture = variant % TEXTURE_SOURCE_COUNT;
+	char defines[128];
+	snprintf(defines, sizeof(defines), "#define LIGHT_TYPE %d\n#define SHADING %d\n#define TEXTURE_SOURCE %d\n", light, shading, texture);
+	return defines;
+}
 
-	// find out min and max value of X, Y and Z axis
-	for (int i = 0; i < attrib->vertices.size(); i++)
+// The next variant to request, those of the current lighting mode and
+// shading first so that the frames drawn meanwhile need the fewest
+// stand-ins; -1 once all are requested
+int NextVariantRequest()
+{
+	for (int l = 0; l < 3; l++)
 	{
-		//maxs = max(maxs, attrib->vertices.at(i));
-		if (i % 3 == 0)
+		int light = (cur_lighting_mode + l) % 3;
+		for (int s = 0; s < SHADING_COUNT; s++)
 		{
-
-			xVector.push_back(attrib->vertices.at(i));
-
-			if (attrib->vertices.at(i) < minX)
+			// split first while it draws both halves, last otherwise
+			int shading = dual_viewport_draws ? (s + SHADE_SPLIT) % SHADING_COUNT : s;
+			for (int texture = 0; texture < TEXTURE_SOURCE_COUNT; texture++)
 			{
-				minX = attrib->vertices.at(i);
-			}
-
-			if (attrib->vertices.at(i) > maxX)
-			{
-				maxX = attrib->vertices.at(i);
+				int variant = (light * SHADING_COUNT + shading) * TEXTURE_SOURCE_COUNT + texture;
+				if (!variant_requested[variant])
+					return variant;
 			}
 		}
-		else if (i % 3 == 1)
-		{
-			yVector.push_back(attrib->vertices.at(i));
-
-			if (attrib->vertices.at(i) < minY)
-			{
-				minY = attrib->vertices.at(i);
-			}
+	}
+	return -1;
+}
 
-			if (attrib->vertices.at(i) > maxY)
-			{
-				maxY = attrib->vertices.at(i);
-			}
-		}
-		else if (i % 3 == 2)
-		{
-			zVector.push_back(attrib->vertices.at(i));
+void ReportShaders()
+{
+	ProgramCacheStats stats = programCacheStats();
+	double ready_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - shaders_requested).count();
+	printf("Shaders: %d programs ready after %.1f ms, %.1f ms of it in compile and link calls", stats.programs, ready_ms, stats.build_ms);
+	if (stats.binaries_loaded > 0 || stats.binaries_rejected > 0)
+		printf(", %d loaded from binaries (%d rejected), %.1f ms of linking saved", stats.binaries_loaded, stats.binaries_rejected, stats.saved_ms);
+	printf("\n");
+}
 
-			if (attrib->vertices.at(i) < minZ)
-			{
-				minZ = attrib->vertices.at(i);
-			}
+// Request the variants not requested yet and take up the programs the
+// driver has built, or wait for all of them. Until its variant is ready a
+// shape is drawn with the uber-shader, and not at all before that is.
+void UpdateShaders(bool wait)
+{
+	if (!shaders_pending)
+		return;
+	// as many requests as fit in the budget: a driver compiling on threads
+	// of its own takes them all at once, one compiling in the calls a few
+	// per frame
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	while (variants_requested < VARIANT_COUNT && (wait || chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() < shader_request_budget_ms))
+	{
+		int variant = NextVariantRequest();
+		programCacheRequest(VariantDefines(variant));
+		variant_requested[variant] = true;
+		variants_requested++;
+	}
 
-			if (attrib->vertices.at(i) > maxZ)
-			{
-				maxZ = attrib->vertices.at(i);
-			}
-		}
+	bool created = false;
+	if (uber_shader.program == 0)
+		created |= BuildShaderProgram("", uber_shader, wait);
+	ShaderProgram* variants = &shader_variants[0][0][0];
+	for (int v = 0; v < VARIANT_COUNT; v++)
+	{
+		if (variant_requested[v] && variants[v].program == 0)
+			created |= BuildShaderProgram(VariantDefines(v), variants[v], wait);
 	}
-	
-	float offsetX = (maxX + minX) / 2;
-	float offsetY = (maxY + minY) / 2;
-	float offsetZ = (maxZ + minZ) / 2;
+	// setUniformVariables went around the state cache
+	if (created)
+		stateCacheInvalidate();
+	if (variants_requested < VARIANT_COUNT || programCachePending() > 0)
+		return;
+	shaders_pending = false;
+	if (uber_shader.program == 0)
+	{
+		system("pause");
+		exit(123);
+	}
+	ReportShaders();
+}
 
-	for (int i = 0; i < attrib->vertices.size(); i++)
+void setShaders()
+{
+	if (use_program_binaries)
 	{
-		if (offsetX != 0 && i % 3 == 0)
-		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetX;
-		}
-		else if (offsetY != 0 && i % 3 == 1)
+		// core since 4.1; glad only loads the extension's entry points with
+		// the version, so a 3.3 context offering it needs them by hand
+		if (!GLAD_GL_VERSION_4_1 && glfwExtensionSupported("GL_ARB_get_program_binary"))
 		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetY;
-		}
-		else if (offsetZ != 0 && i % 3 == 2)
-		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetZ;
+			glad_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)glfwGetProcAddress("glGetProgramBinary");
+			glad_glProgramBinary = (PFNGLPROGRAMBINARYPROC)glfwGetProcAddress("glProgramBinary");
+			glad_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)glfwGetProcAddress("glProgramParameteri");
 		}
+		if (!programCacheUseBinaries("shadercache"))
+			printf("Shaders: no program binary formats, compiling every run\n");
 	}
-
-	float greatestAxis = maxX - minX;
-	float distanceOfYAxis = maxY - minY;
-	float distanceOfZAxis = maxZ - minZ;
-
-	if (distanceOfYAxis > greatestAxis)
+	if (async_shaders && (glfwExtensionSupported("GL_KHR_parallel_shader_compile") || glfwExtensionSupported("GL_ARB_parallel_shader_compile")))
 	{
-		greatestAxis = distanceOfYAxis;
+		// as many compiler threads as the driver likes
+		PFNGLMAXSHADERCOMPILERTHREADSKHRPROC max_threads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress(
+			glfwExtensionSupported("GL_KHR_parallel_shader_compile") ? "glMaxShaderCompilerThreadsKHR" : "glMaxShaderCompilerThreadsARB");
+		if (max_threads != NULL)
+			max_threads(0xFFFFFFFF);
+		programCacheUseCompletionStatus(true);
 	}
-
-	if (distanceOfZAxis > greatestAxis)
+	if (!programCacheSetSources("shader.vs.glsl", "shader.fs.glsl"))
 	{
-		greatestAxis = distanceOfZAxis;
+		system("pause");
+		exit(123);
 	}
 
-	float scale = greatestAxis / 2;
+	// the uber-shader first, UpdateShaders requests every variant
+	// RenderScene picks from; one that fails is drawn with the uber-shader
+	shaders_requested = chrono::steady_clock::now();
+	programCacheRequest("");
+	shaders_pending = true;
+	UpdateShaders(!async_shaders);
+}
 
-	for (int i = 0; i < attrib->vertices.size(); i++)
-	{
-		//std::cout << i << " = " << (double)(attrib.vertices.at(i) / greatestAxis) << std::endl;
-		attrib->vertices.at(i) = attrib->vertices.at(i)/ scale;
-	}
+// Per-model stage: centre the model at the origin and scale its largest axis
+// to [-1, 1]. Runs once per model, before the shapes are expanded.
+void normalization(tinyobj::attrib_t* attrib)
+{
+	size_t vertex_count = attrib->vertices.size() / 3;
+	MeshBounds bounds = meshComputeBounds(attrib->vertices.data(), vertex_count);
+	meshNormalizePositions(attrib->vertices.data(), vertex_count, bounds);
+}
+
+// Expand a shape of the normalized model into a triangle soup, one vertex
+// per face corner
+void ExpandShape(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, tinyobj::shape_t* shape)
+{
 	size_t index_offset = 0;
 	for (size_t f = 0; f < shape->mesh.num_face_vertices.size(); f++) {
 		int fv = shape->mesh.num_face_vertices[f];
@@ -930,191 +1274,928 @@ static string GetBaseDir(const string& filepath) {
 	return "";
 }
 
-GLuint LoadTextureImage(string image_path)
+// CPU-side geometry of a model. Every shape split by material is the
+// [first, first + count) range of the index buffer.
+struct ModelGeometry
 {
-	int channel, width, height;
-	int require_channel = 4;
-	stbi_set_flip_vertically_on_load(true);
-	stbi_uc *data = stbi_load(image_path.c_str(), &width, &height, &channel, require_channel);
-	if (data != NULL)
+	vector<GLfloat> vertices;
+	vector<GLfloat> colors;
+	vector<GLfloat> normals;
+	vector<GLfloat> textureCoords;
+	vector<uint32_t> indices;
+	vector<uint16_t> shortIndices;	// used instead of indices when they fit
+	vector<MeshCacheRange> ranges;
+};
+
+// Reorder the triangle soup of a model by material with a counting sort: one
+// pass counts the corners of every material, a prefix sum gives each material
+// its [first, first + count) range and a second pass scatters the corners
+// straight into place. Corners without a valid material are dropped.
+void SplitShapeByMaterial(vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, int material_count, ModelGeometry& geometry)
+{
+	vector<uint32_t> first(material_count + 1, 0);
+	for (int v = 0; v < material_id.size(); v++)
 	{
-		GLuint tex = 0;
+		if (material_id[v] >= 0 && material_id[v] < material_count)
+			first[material_id[v] + 1]++;
+	}
+	for (int m = 0; m < material_count; m++)
+		first[m + 1] += first[m];
 
-		// [TODO] Bind the image to texture
-		// Hint: glGenTextures, glBindTexture, glTexImage2D, glGenerateMipmap
-		glGenTextures(1, &tex);
-		glBindTexture(GL_TEXTURE_2D, tex);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
+	uint32_t base = geometry.vertices.size() / 3;
+	uint32_t corner_count = first[material_count];
+	geometry.vertices.resize((base + corner_count) * 3);
+	geometry.colors.resize((base + corner_count) * 3);
+	geometry.normals.resize((base + corner_count) * 3);
+	geometry.textureCoords.resize((base + corner_count) * 2);
 
-		// free the image from memory after binding to texture
-		stbi_image_free(data);
-		return tex;
+	for (int m = 0; m < material_count; m++)
+	{
+		if (first[m + 1] == first[m])
+			continue;
+		MeshCacheRange range;
+		range.first = base + first[m];
+		range.count = first[m + 1] - first[m];
+		range.material = m;
+		geometry.ranges.push_back(range);
 	}
-	else
+
+	// first[m] is the next free slot of material m from here on
+	for (int v = 0; v < material_id.size(); v++)
 	{
-		cout << "LoadTextureImage: Cannot load image from " << image_path << endl;
-		return -1;
+		int m = material_id[v];
+		if (m < 0 || m >= material_count)
+			continue;
+		uint32_t dst = base + first[m]++;
+
+		memcpy(&geometry.vertices[dst * 3], &vertices[v * 3], 3 * sizeof(GLfloat));
+		memcpy(&geometry.colors[dst * 3], &colors[v * 3], 3 * sizeof(GLfloat));
+		memcpy(&geometry.normals[dst * 3], &normals[v * 3], 3 * sizeof(GLfloat));
+		memcpy(&geometry.textureCoords[dst * 2], &textureCoords[v * 2], 2 * sizeof(GLfloat));
 	}
 }
 
-vector<Shape> SplitShapeByMaterial(vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, vector<PhongMaterial>& materials)
+// Weld the triangle soup built by ExpandShape/SplitShapeByMaterial into
+// unique vertices and an index buffer. The material ranges keep their
+// numbers: they now address the index buffer.
+void IndexModelGeometry(ModelGeometry& geometry)
 {
-	vector<Shape> res;
-	for (int m = 0; m < materials.size(); m++)
+	uint32_t corner_count = geometry.vertices.size() / 3;
+	MeshStream streams[4] = {
+		{ geometry.vertices.data(), 3 },
+		{ geometry.colors.data(), 3 },
+		{ geometry.normals.data(), 3 },
+		{ geometry.textureCoords.data(), 2 },
+	};
+	geometry.indices.resize(corner_count);
+	uint32_t vertex_count = meshWeldVertices(corner_count, streams, 4, geometry.indices.data());
+
+	geometry.vertices.resize(vertex_count * 3);
+	geometry.colors.resize(vertex_count * 3);
+	geometry.normals.resize(vertex_count * 3);
+	geometry.textureCoords.resize(vertex_count * 2);
+	geometry.vertices.shrink_to_fit();
+	geometry.colors.shrink_to_fit();
+	geometry.normals.shrink_to_fit();
+	geometry.textureCoords.shrink_to_fit();
+
+	size_t index_size = 4;
+	if (meshIndicesFit16(vertex_count))
 	{
-		vector<GLfloat> m_vertices, m_colors, m_normals, m_textureCoords;
-		for (int v = 0; v < material_id.size(); v++) 
-		{
-			// extract all vertices with same material id and create a new shape for it.
-			if (material_id[v] == m)
-			{
-				m_vertices.push_back(vertices[v * 3 + 0]);
-				m_vertices.push_back(vertices[v * 3 + 1]);
-				m_vertices.push_back(vertices[v * 3 + 2]);
+		geometry.shortIndices.resize(corner_count);
+		meshNarrowIndices(geometry.indices.data(), corner_count, geometry.shortIndices.data());
+		geometry.indices = vector<uint32_t>();
+		index_size = 2;
+	}
 
-				m_colors.push_back(colors[v * 3 + 0]);
-				m_colors.push_back(colors[v * 3 + 1]);
-				m_colors.push_back(colors[v * 3 + 2]);
+	size_t soup_bytes = corner_count * 11 * sizeof(GLfloat);
+	size_t indexed_bytes = vertex_count * 11 * sizeof(GLfloat) + corner_count * index_size;
+	printf("Indexed geometry ! %u corners -> %u vertices (up to %.1f%% fewer vertex shader runs), %.1f KB -> %.1f KB\n",
+		corner_count, vertex_count, corner_count ? 100.0 * (corner_count - vertex_count) / corner_count : 0.0,
+		soup_bytes / 1024.0, indexed_bytes / 1024.0);
+}
 
-				m_normals.push_back(normals[v * 3 + 0]);
-				m_normals.push_back(normals[v * 3 + 1]);
-				m_normals.push_back(normals[v * 3 + 2]);
+// Upload a model into one interleaved vertex buffer in the given layout plus
+// its index buffer. All material ranges share one VAO and only differ in the
+// slice of indices they draw.
+vector<Shape> CreateShapes(const MeshCacheData& data, const VertexLayout& layout, const vector<unsigned char>& packed)
+{
+	Shape model_shape;
+	glGenVertexArrays(1, &model_shape.vao);
+	glBindVertexArray(model_shape.vao);
+
+	glGenBuffers(1, &model_shape.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, model_shape.vbo);
+	glBufferData(GL_ARRAY_BUFFER, packed.size(), packed.data(), GL_STATIC_DRAW);
+	setupVertexAttribs(layout);
+
+	// the element buffer binding is part of the VAO
+	glGenBuffers(1, &model_shape.ebo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model_shape.ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.index_count * data.index_size, data.indices, GL_STATIC_DRAW);
+	glBindVertexArray(0);
+
+	model_shape.p_color = model_shape.p_normal = model_shape.p_texCoord = model_shape.vbo;
+	model_shape.materialBuffer = 0;
+	model_shape.materialOffset = 0;
+	model_shape.vertex_count = data.vertex_count;
+	model_shape.indexType = data.index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
 
-				m_textureCoords.push_back(textureCoords[v * 2 + 0]);
-				m_textureCoords.push_back(textureCoords[v * 2 + 1]);
-			}
-		}
+	vector<Shape> shapes;
+	for (int i = 0; i < data.range_count; i++)
+	{
+		Shape tmp_shape = model_shape;
+		tmp_shape.indexCount = data.ranges[i].count;
+		tmp_shape.indexOffset = (size_t)data.ranges[i].first * data.index_size;
+		shapes.push_back(tmp_shape);
+	}
 
-		if (!m_vertices.empty())
-		{
-			Shape tmp_shape;
-			glGenVertexArrays(1, &tmp_shape.vao);
-			glBindVertexArray(tmp_shape.vao);
-
-			glGenBuffers(1, &tmp_shape.vbo);
-			glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.vbo);
-			glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(GL_FLOAT), &m_vertices.at(0), GL_STATIC_DRAW);
-			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-			tmp_shape.vertex_count = m_vertices.size() / 3;
-
-			glGenBuffers(1, &tmp_shape.p_color);
-			glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_color);
-			glBufferData(GL_ARRAY_BUFFER, m_colors.size() * sizeof(GL_FLOAT), &m_colors.at(0), GL_STATIC_DRAW);
-			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-			glGenBuffers(1, &tmp_shape.p_normal);
-			glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_normal);
-			glBufferData(GL_ARRAY_BUFFER, m_normals.size() * sizeof(GL_FLOAT), &m_normals.at(0), GL_STATIC_DRAW);
-			glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-			glGenBuffers(1, &tmp_shape.p_texCoord);
-			glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_texCoord);
-			glBufferData(GL_ARRAY_BUFFER, m_textureCoords.size() * sizeof(GL_FLOAT), &m_textureCoords.at(0), GL_STATIC_DRAW);
-			glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-			glEnableVertexAttribArray(0);
-			glEnableVertexAttribArray(1);
-			glEnableVertexAttribArray(2);
-			glEnableVertexAttribArray(3);
-
-			tmp_shape.material = materials[m];
-			res.push_back(tmp_shape);
-		}
+	return shapes;
+}
+
+// The shapes of a model share their VAO and buffers
+void DeleteShapes(vector<Shape>& shapes)
+{
+	if (shapes.empty())
+		return;
+	if (shapes[0].vao == crowd_vao)
+		crowd_vao = 0;
+	glDeleteVertexArrays(1, &shapes[0].vao);
+	glDeleteBuffers(1, &shapes[0].vbo);
+	glDeleteBuffers(1, &shapes[0].ebo);
+	if (shapes[0].materialBuffer != 0)
+		glDeleteBuffers(1, &shapes[0].materialBuffer);
+	shapes.clear();
+}
+
+// Upload the materials of a model's shapes into one uniform buffer, a
+// MaterialBlock every material_stride bytes, once they are set; shapes with
+// equal materials share a block, so drawing them rebinds nothing. The
+// materials do not change after that. Returns the buffer size.
+size_t UploadMaterials(vector<Shape>& shapes)
+{
+	if (shapes.empty())
+		return 0;
+	vector<MaterialBlock> materials;
+	vector<int> block_of_shape(shapes.size());
+	for (int i = 0; i < shapes.size(); i++)
+	{
+		MaterialBlock block;
+		memset(&block, 0, sizeof(block));
+		Vector3ToFloat3(shapes[i].material.Ka, block.Ka);
+		Vector3ToFloat3(shapes[i].material.Kd, block.Kd);
+		Vector3ToFloat3(shapes[i].material.Ks, block.Ks);
+		int b = 0;
+		while (b < materials.size() && memcmp(&materials[b], &block, sizeof(block)) != 0)
+			b++;
+		if (b == materials.size())
+			materials.push_back(block);
+		block_of_shape[i] = b;
+	}
+	vector<unsigned char> blocks(materials.size() * material_stride, 0);
+	for (int b = 0; b < materials.size(); b++)
+		memcpy(&blocks[b * material_stride], &materials[b], sizeof(MaterialBlock));
+
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, blocks.size(), blocks.data(), GL_STATIC_DRAW);
+	uniform_block_uploads++;
+	for (int i = 0; i < shapes.size(); i++)
+	{
+		shapes[i].materialBuffer = buffer;
+		shapes[i].materialOffset = block_of_shape[i] * material_stride;
+	}
+	return blocks.size();
+}
+
+// Pack the vertices for the requested layout, falling back to the next
+// layout when the data does not fit (texcoords outside [0, 1] for unorm16)
+const VertexLayout* PackModelVertices(const MeshCacheData& data, const VertexLayout* layout, vector<unsigned char>& packed)
+{
+	while (!packVertices(*layout, data, packed))
+	{
+		const VertexLayout* fallback = layout == findVertexLayout("compact-unorm-uv") ? findVertexLayout("compact") : findVertexLayout("float");
+		printf("Vertex layout %s does not fit, using %s\n", layout->name, fallback->name);
+		layout = fallback;
+	}
+	return layout;
+}
+
+// Everything LoadTexturedModel prepares off the GL thread for one model
+struct ModelLoad
+{
+	string model_path;
+	string base_dir;
+
+	bool ok = false;
+	bool from_cache = false;
+	MeshCacheFile cache;
+	ModelGeometry geometry;
+	vector<MeshCacheMaterial> cachedMaterials;
+	MeshCacheData data;
+	const VertexLayout* layout = NULL;
+	vector<unsigned char> packed;	// interleaved vertices in layout
+	vector<TextureHandle> textures;	// one per material, NULL if it failed to load
+	vector<TextureHandle> unused_textures;	// requested ahead for materials the model does not use
+};
+
+PhongMaterial LoadMaterial(const MeshCacheMaterial& cached, GLuint texture, int i)
+{
+	PhongMaterial material;
+	material.Ka = Vector3(cached.Ka[0], cached.Ka[1], cached.Ka[2]);
+	material.Kd = Vector3(cached.Kd[0], cached.Kd[1], cached.Kd[2]);
+	material.Ks = Vector3(cached.Ks[0], cached.Ks[1], cached.Ks[2]);
+
+	material.diffuseTexture = texture;
+	material.textureLayer = -1;
+	if (material.diffuseTexture == -1)
+	{
+		cout << "LoadTexturedModels: Fail to load model's material " << i << endl;
+		system("pause");
+		
+	}
+	
+	/* -------------------- [HW3] Check whether the texture is Eye -------------------- */
+	if (strstr(cached.diffuse_texname, "Eye") != NULL) {
+		material.isEye = 1;
+		material.offsets.assign(EYE_OFFSETS, EYE_OFFSETS + EYE_OFFSET_COUNT);
 	}
+	else {
+		material.isEye = 0;
+		material.offsets = { Offset(0.0, 0.0), Offset(0.0, 0.0), Offset(0.0, 0.0), Offset(0.0, 0.0), Offset(0.0, 0.0), Offset(0.0, 0.0), Offset(0.0, 0.0) };
+	}
+	/* -------------------------------------------------------------------------------- */
 
-	return res;
+	return material;
 }
 
-void LoadTexturedModels(string model_path)
+// Start decoding the textures of a model before its OBJ is parsed. The
+// mtllib statements sit at the top of the file, so only its head is read;
+// libraries declared further down are requested after the parse as usual.
+static void RequestMtlTextures(const string& model_path, const string& base_dir, map<string, TextureHandle>& requested)
 {
-	vector<tinyobj::shape_t> shapes;
+	FILE* fp = fopen(model_path.c_str(), "rb");
+	if (fp == NULL)
+		return;
+	static const size_t head_size = 64 * 1024;
+	vector<char> head(head_size);
+	size_t size = fread(head.data(), 1, head_size, fp);
+	fclose(fp);
+
 	vector<tinyobj::material_t> materials;
-	tinyobj::attrib_t attrib;
-	vector<GLfloat> vertices;
-	vector<GLfloat> colors;
-	vector<GLfloat> normals;
-	vector<GLfloat> textureCoords;
-	vector<int> material_id;
+	map<string, int> material_map;
+	tinyobj::MaterialFileReader reader(base_dir, true);
+	string warn, err;	// reported again by the OBJ parse
+	size_t i = 0;
+	while (i < size)
+	{
+		size_t end = i;
+		while (end < size && head[end] != '\n')
+			end++;
+		if (end < size && end - i > 7 && strncmp(&head[i], "mtllib", 6) == 0 && (head[i + 6] == ' ' || head[i + 6] == '\t'))
+		{
+			istringstream names(string(&head[i + 7], end - i - 7));
+			string name;
+			while (names >> name)
+				reader(name, &materials, &material_map, &warn, &err);
+		}
+		i = end + 1;
+	}
 
-	string err;
-	string warn;
+	for (int m = 0; m < materials.size(); m++)
+	{
+		if (materials[m].diffuse_texname.empty())
+			continue;
+		string path = base_dir + materials[m].diffuse_texname;
+		if (requested.find(path) != requested.end())
+			continue;
+		TextureHandle handle = textureCacheRequest(path);
+		if (handle != NULL)
+			requested[path] = handle;
+	}
+}
 
+// CPU-side part of loading a model: mesh cache or OBJ parse, normalization,
+// material split and texture decode. Touches no GL state, so it can run on
+// a worker thread. The textures decode on the texture cache's pool, for an
+// .obj while it is being parsed.
+void PrepareTexturedModel(ModelLoad& load, int parse_threads)
+{
+	string model_path = load.model_path;
 	string base_dir = GetBaseDir(model_path); // handle .mtl with relative path
+	load.ok = false;	// a reload after an eviction reuses the load
 
 #ifdef _WIN32
 	base_dir += "\\";
 #else
 	base_dir += "/";
 #endif
+	load.base_dir = base_dir;
 
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, model_path.c_str(), base_dir.c_str());
+	// final geometry either comes straight from the mapped cache or from the .obj
+	string cache_path = model_path + ".meshcache";
+	load.from_cache = meshCacheOpen(model_path.c_str(), cache_path.c_str(), &load.cache);
 
-	if (!warn.empty()) {
-		cout << warn << std::endl;
-	}
+	ModelGeometry& geometry = load.geometry;
+	vector<MeshCacheMaterial>& cachedMaterials = load.cachedMaterials;
+	MeshCacheData& data = load.data;
+	map<string, TextureHandle> requested;
 
-	if (!err.empty()) {
-		cerr << err << std::endl;
+	if (load.from_cache)
+	{
+		data = load.cache.data;
+		printf("Load Models from mesh cache ! Ranges size %u Material size %u\n", data.range_count, data.material_count);
 	}
+	else
+	{
+		vector<tinyobj::shape_t> shapes;
+		vector<tinyobj::material_t> materials;
+		tinyobj::attrib_t attrib;
+		vector<GLfloat> vertices;
+		vector<GLfloat> colors;
+		vector<GLfloat> normals;
+		vector<GLfloat> textureCoords;
+		vector<int> material_id;
+
+		string err;
+		string warn;
+
+		RequestMtlTextures(model_path, base_dir, requested);
+		// what the cache will be checked against, taken before the parse
+		MeshCacheSources sources;
+		bool cacheable = meshCacheSnapshot(model_path.c_str(), base_dir.c_str(), &sources);
+		bool ret = tinyobj::LoadObjMapped(&attrib, &shapes, &materials, &warn, &err, model_path.c_str(), base_dir.c_str(), true, true, parse_threads);
+
+		if (!warn.empty()) {
+			cout << warn << std::endl;
+		}
 
-	if (!ret) {
-		exit(1);
-	}
+		if (!err.empty()) {
+			cerr << err << std::endl;
+		}
 
-	printf("Load Models Success ! Shapes size %d Material size %d\n", shapes.size(), materials.size());
-	model tmp_model;
+		if (!ret) {
+			for (map<string, TextureHandle>::iterator r = requested.begin(); r != requested.end(); r++)
+				load.unused_textures.push_back(r->second);
+			return;
+		}
 
-	vector<PhongMaterial> allMaterial;
-	for (int i = 0; i < materials.size(); i++)
-	{
-		PhongMaterial material;
-		material.Ka = Vector3(materials[i].ambient[0], materials[i].ambient[1], materials[i].ambient[2]);
-		material.Kd = Vector3(materials[i].diffuse[0], materials[i].diffuse[1], materials[i].diffuse[2]);
-		material.Ks = Vector3(materials[i].specular[0], materials[i].specular[1], materials[i].specular[2]);
+		printf("Load Models Success ! Shapes size %zu Material size %zu\n", shapes.size(), materials.size());
 
-		material.diffuseTexture = LoadTextureImage(base_dir + string(materials[i].diffuse_texname));
-		if (material.diffuseTexture == -1)
+		for (int i = 0; i < materials.size(); i++)
 		{
-			cout << "LoadTexturedModels: Fail to load model's material " << i << endl;
-			system("pause");
-			
-		}
-		
-		/* -------------------- [HW3] Check whether the texture is Eye -------------------- */
-		if (strstr(string(materials[i].diffuse_texname).c_str(), "Eye") != NULL) {
-			material.isEye = 1;
-			material.offsets = { Offset(0.0, 0.0), Offset(0.0, 0.75), Offset(0.0, 0.5), Offset(0.0, 0.25), Offset(0.5, 0.0), Offset(0.5, 0.75), Offset(0.5, 0.5) };
-		}
-		else {
-			material.isEye = 0;
-			material.offsets = { Offset(0.0, 0.0), Offset(0.0, 0.0), Offset(0.0, 0.0), Offset(0.0, 0.0), Offset(0.0, 0.0), Offset(0.0, 0.0), Offset(0.0, 0.0) };
+			MeshCacheMaterial material;
+			memset(&material, 0, sizeof(material));
+			for (int c = 0; c < 3; c++)
+			{
+				material.Ka[c] = materials[i].ambient[c];
+				material.Kd[c] = materials[i].diffuse[c];
+				material.Ks[c] = materials[i].specular[c];
+			}
+			strncpy(material.diffuse_texname, materials[i].diffuse_texname.c_str(), MESH_CACHE_PATH_LENGTH - 1);
+			cacheable = cacheable && materials[i].diffuse_texname.size() < MESH_CACHE_PATH_LENGTH;
+			cachedMaterials.push_back(material);
 		}
-		/* -------------------------------------------------------------------------------- */
 
-		allMaterial.push_back(material);
-	}
-	
-	for (int i = 0; i < shapes.size(); i++)
-	{
-		vertices.clear();
-		colors.clear();
-		normals.clear();
-		textureCoords.clear();
-		material_id.clear();
+		normalization(&attrib);
 
-		normalization(&attrib, vertices, colors, normals, textureCoords, material_id, &shapes[i]);
-		// printf("Vertices size: %d", vertices.size() / 3);
+		// append every shape to one soup for the whole model
+		for (int i = 0; i < shapes.size(); i++)
+			ExpandShape(&attrib, vertices, colors, normals, textureCoords, material_id, &shapes[i]);
 
-		// split current shape into multiple shapes base on material_id.
-		vector<Shape> splitedShapeByMaterial = SplitShapeByMaterial(vertices, colors, normals, textureCoords, material_id, allMaterial);
+		// split the model into one range per material.
+		SplitShapeByMaterial(vertices, colors, normals, textureCoords, material_id, materials.size(), geometry);
+		shapes.clear();
+		materials.clear();
 
-		// concatenate splited shape to model's shape list
-		tmp_model.shapes.insert(tmp_model.shapes.end(), splitedShapeByMaterial.begin(), splitedShapeByMaterial.end());
-	}
-	shapes.clear();
-	materials.clear();
-	models.push_back(tmp_model);
+		IndexModelGeometry(geometry);
+
+		data.vertex_count = geometry.vertices.size() / 3;
+		data.positions = geometry.vertices.data();
+		data.colors = geometry.colors.data();
+		data.normals = geometry.normals.data();
+		data.texcoords = geometry.textureCoords.data();
+		if (geometry.shortIndices.empty())
+		{
+			data.index_count = geometry.indices.size();
+			data.index_size = sizeof(uint32_t);
+			data.indices = geometry.indices.data();
+		}
+		else
+		{
+			data.index_count = geometry.shortIndices.size();
+			data.index_size = sizeof(uint16_t);
+			data.indices = geometry.shortIndices.data();
+		}
+		data.range_count = geometry.ranges.size();
+		data.ranges = geometry.ranges.data();
+		data.material_count = cachedMaterials.size();
+		data.materials = cachedMaterials.data();
+
+		if (!cacheable || !meshCacheWrite(sources, cache_path.c_str(), data))
+			cout << "LoadTexturedModels: Cannot write mesh cache " << cache_path << endl;
+	}
+
+	for (int i = 0; i < data.material_count; i++)
+	{
+		string path = base_dir + string(data.materials[i].diffuse_texname);
+		map<string, TextureHandle>::iterator early = requested.find(path);
+		if (early != requested.end())
+		{
+			load.textures.push_back(early->second);
+			requested.erase(early);
+		}
+		else
+		{
+			load.textures.push_back(textureCacheRequest(path));
+		}
+	}
+	// released on the GL thread, they may have been uploaded already
+	for (map<string, TextureHandle>::iterator r = requested.begin(); r != requested.end(); r++)
+		load.unused_textures.push_back(r->second);
+
+	load.layout = PackModelVertices(data, vertex_layout, load.packed);
+
+	for (int i = 0; i < load.textures.size(); i++)
+	{
+		if (load.textures[i] != NULL && !textureCacheWait(load.textures[i]))
+		{
+			// never decoded, so there is no texture to delete
+			textureCacheRelease(load.textures[i]);
+			load.textures[i] = NULL;
+		}
+	}
+
+	load.ok = true;
+}
+
+// Copy the diffuse textures of a resident model's shapes into one texture
+// array and drop the model's references to the 2D textures. Returns false
+// and leaves the model as it was if they cannot be packed, e.g. when some
+// of them are cooked.
+bool PackModelTextures(model& m)
+{
+	vector<GLuint> textures;
+	for (int i = 0; i < m.shapes.size(); i++)
+	{
+		// the blits copy every level, they have to be there
+		textureUploadFinish(m.shapes[i].material.diffuseTexture);
+		textures.push_back(m.shapes[i].material.diffuseTexture);
+	}
+	vector<int> layers;
+	if (!textureArrayCreate(textures, layers, &m.texture_array))
+		return false;
+
+	for (int i = 0; i < m.shapes.size(); i++)
+	{
+		m.shapes[i].material.textureLayer = layers[i];
+		m.shapes[i].material.diffuseTexture = 0;
+	}
+	for (int i = 0; i < m.textures.size(); i++)
+		textureCacheRelease(m.textures[i]);
+	m.textures.clear();
+	m.gpu_bytes += m.texture_array.gpu_bytes;
+	return true;
+}
+
+// GL part of loading a model into its slot, on the context thread. Returns
+// true if the model was served from its mesh cache.
+bool UploadTexturedModel(ModelLoad& load, model& dst)
+{
+	const MeshCacheData& data = load.data;
+
+	dst.gpu_bytes = load.packed.size() + (size_t)data.index_count * data.index_size;
+	vector<PhongMaterial> allMaterial;
+	for (int i = 0; i < data.material_count; i++)
+	{
+		GLuint texture = load.textures[i] != NULL ? textureCacheTexture(load.textures[i]) : -1;
+		allMaterial.push_back(LoadMaterial(data.materials[i], texture, i));
+	}
+	// the model keeps the texture references from here on
+	dst.textures.swap(load.textures);
+
+	dst.shapes = CreateShapes(data, *load.layout, load.packed);
+	for (int i = 0; i < data.range_count; i++)
+		dst.shapes[i].material = allMaterial[data.ranges[i].material];
+	dst.gpu_bytes += UploadMaterials(dst.shapes);
+	if (use_texture_arrays && !PackModelTextures(dst))
+		cout << "LoadTexturedModels: " << load.model_path << " keeps one texture per material" << endl;
+
+	dst.resident = true;
+	dst.uploads++;
+	return load.from_cache;
+}
+
+// Free the CPU-side copy of a model once it is on the GPU
+void ReleaseModelLoad(ModelLoad& load)
+{
+	if (load.from_cache)
+		meshCacheClose(&load.cache);
+	load.from_cache = false;
+	load.geometry = ModelGeometry();
+	load.cachedMaterials.clear();
+	load.packed = vector<unsigned char>();
+	for (int i = 0; i < load.textures.size(); i++)
+		textureCacheRelease(load.textures[i]);
+	load.textures.clear();
+	for (int i = 0; i < load.unused_textures.size(); i++)
+		textureCacheRelease(load.unused_textures[i]);
+	load.unused_textures.clear();
+}
+
+// Loads every model of model_list. The CPU-side work runs on a pool of
+// worker threads while this (GL) thread uploads the finished models in list
+// order, so models[i] always belongs to model_list[i].
+// Returns the number of models served from their mesh cache.
+int LoadTexturedModels(const vector<string>& paths)
+{
+	int count = (int)paths.size();
+	int hardware_threads = max(1, (int)thread::hardware_concurrency());
+	int worker_count = min(hardware_threads, count);
+	// split the remaining cores among the OBJ parsers
+	int parse_threads = max(1, hardware_threads / max(1, worker_count));
+
+	vector<ModelLoad> loads(count);
+	for (int i = 0; i < count; i++)
+		loads[i].model_path = paths[i];
+	models.resize(count);
+
+	stbi_set_flip_vertically_on_load(true);
+
+	vector<char> done(count, 0);
+	mutex done_mutex;
+	condition_variable done_cond;
+	atomic<int> next_model(0);
+
+	vector<thread> workers;
+	for (int w = 0; w < worker_count; w++)
+	{
+		workers.push_back(thread([&]() {
+			for (int i = next_model++; i < count; i = next_model++)
+			{
+				PrepareTexturedModel(loads[i], parse_threads);
+
+				lock_guard<mutex> lock(done_mutex);
+				done[i] = 1;
+				done_cond.notify_all();
+			}
+		}));
+	}
+
+	int cache_hits = 0;
+	for (int i = 0; i < count; i++)
+	{
+		while (true)
+		{
+			{
+				unique_lock<mutex> lock(done_mutex);
+				if (done_cond.wait_for(lock, chrono::milliseconds(2), [&]() { return done[i] != 0; }))
+					break;
+			}
+			// textures finish ahead of their models, upload them while waiting
+			textureCacheUploadDecoded();
+		}
+
+		if (!loads[i].ok) {
+			cerr << "LoadTexturedModels: Cannot load " << loads[i].model_path << endl;
+			exit(1);
+		}
+		if (UploadTexturedModel(loads[i], models[i]))
+			cache_hits++;
+		ReleaseModelLoad(loads[i]);
+	}
+
+	for (int w = 0; w < worker_count; w++)
+		workers[w].join();
+	return cache_hits;
+}
+
+// Lazy loading (the default, --eager-load turns it off): a model is loaded
+// the first time cur_idx selects it and the Z/X neighbours of the current
+// model are prefetched, all on one background thread. The GL thread uploads
+// whatever is ready once per frame.
+enum ModelState
+{
+	MODEL_UNLOADED,
+	MODEL_QUEUED,
+	MODEL_LOADING,	// taken off the queue by the loader
+	MODEL_PREPARED,	// CPU side done, waiting for the upload
+	MODEL_RESIDENT,
+	MODEL_FAILED,
+};
+
+bool lazy_loading = true;
+vector<ModelLoad> model_loads;
+vector<ModelState> model_states;	// guarded by model_load_mutex
+deque<int> model_load_queue;
+mutex model_load_mutex;
+condition_variable model_load_cond;
+bool model_loader_quit = false;
+thread model_loader;
+
+void ModelLoaderThread()
+{
+	// the loader has the cores to itself
+	int parse_threads = max(1, (int)thread::hardware_concurrency());
+
+	unique_lock<mutex> lock(model_load_mutex);
+	while (true)
+	{
+		model_load_cond.wait(lock, []() { return model_loader_quit || !model_load_queue.empty(); });
+		if (model_loader_quit)
+			return;
+		int i = model_load_queue.front();
+		model_load_queue.pop_front();
+		model_states[i] = MODEL_LOADING;
+
+		lock.unlock();
+		PrepareTexturedModel(model_loads[i], parse_threads);
+		if (!model_loads[i].ok)
+			cerr << "LoadTexturedModels: Cannot load " << model_loads[i].model_path << endl;
+		lock.lock();
+		model_states[i] = model_loads[i].ok ? MODEL_PREPARED : MODEL_FAILED;
+	}
+}
+
+void StopModelLoader()
+{
+	{
+		lock_guard<mutex> lock(model_load_mutex);
+		model_loader_quit = true;
+	}
+	model_load_cond.notify_all();
+	if (model_loader.joinable())
+		model_loader.join();
+}
+
+void StartModelLoader(const vector<string>& paths)
+{
+	models.resize(paths.size());
+	model_loads.resize(paths.size());
+	for (int i = 0; i < paths.size(); i++)
+		model_loads[i].model_path = paths[i];
+	model_states.assign(paths.size(), MODEL_UNLOADED);
+
+	stbi_set_flip_vertically_on_load(true);
+	model_loader = thread(ModelLoaderThread);
+	// ESC leaves through exit()
+	atexit(StopModelLoader);
+}
+
+// Queue a model for loading; the current model goes ahead of prefetches.
+// Returns true if the queue changed. Call with model_load_mutex held.
+static bool QueueModel(int i, bool urgent)
+{
+	if (model_states[i] == MODEL_QUEUED && urgent && model_load_queue.front() != i)
+		model_load_queue.erase(find(model_load_queue.begin(), model_load_queue.end(), i));
+	else if (model_states[i] != MODEL_UNLOADED)
+		return false;
+
+	model_states[i] = MODEL_QUEUED;
+	if (urgent)
+		model_load_queue.push_front(i);
+	else
+		model_load_queue.push_back(i);
+	return true;
+}
+
+// --residency-budget: GPU bytes the models and their textures may take
+// before the least recently displayed ones are evicted, 0 for no limit.
+// Only with lazy loading, whose loader brings an evicted model back when
+// it is requested again.
+size_t residency_budget = (size_t)256 << 20;
+unsigned long frame_count = 1;	// frames are counted from 1
+int model_evictions = 0;
+
+// GPU bytes of a model, each of its textures included even where shared
+size_t ModelGpuBytes(const model& m)
+{
+	size_t bytes = m.gpu_bytes;
+	for (int t = 0; t < m.textures.size(); t++)
+		bytes += textureCacheGpuBytes(m.textures[t]);
+	return bytes;
+}
+
+// GPU bytes of every model, a shared texture counted once
+size_t ResidentGpuBytes()
+{
+	size_t bytes = textureCacheStats().resident_bytes;
+	for (int i = 0; i < models.size(); i++)
+		bytes += models[i].gpu_bytes;
+	return bytes;
+}
+
+// Residency log line; per_model adds a line per model (M key)
+void PrintResidency(bool per_model)
+{
+	int resident = 0, reloads = 0;
+	for (int i = 0; i < models.size(); i++)
+	{
+		resident += models[i].resident ? 1 : 0;
+		reloads += max(0, models[i].uploads - 1);
+	}
+	char budget[32];
+	snprintf(budget, sizeof(budget), residency_budget != 0 && lazy_loading ? "%.1f MB" : "none", residency_budget / (1024.0 * 1024.0));
+	printf("Residency: %d/%d models resident, %.1f MB on the GPU (budget %s), %d evictions, %d reloads\n",
+		resident, (int)models.size(), ResidentGpuBytes() / (1024.0 * 1024.0), budget, model_evictions, reloads);
+	if (!per_model)
+		return;
+	for (int i = 0; i < models.size(); i++)
+	{
+		const char* name = model_list[i].c_str() + model_list[i].find_last_of("/\\") + 1;
+		if (models[i].resident && models[i].last_displayed != 0)
+			printf("  %-20s %8.1f MB, displayed %lu frames ago\n", name, ModelGpuBytes(models[i]) / (1024.0 * 1024.0), frame_count - models[i].last_displayed);
+		else if (models[i].resident)
+			printf("  %-20s %8.1f MB, prefetched, not displayed yet\n", name, ModelGpuBytes(models[i]) / (1024.0 * 1024.0));
+		else
+			printf("  %-20s %11s\n", name, models[i].uploads > 0 ? "evicted" : "not loaded");
+	}
+}
+
+// Free a model's buffers and its texture references; it is loaded again,
+// from its mesh cache, the next time it is requested
+void EvictModel(int i)
+{
+	model& m = models[i];
+	DeleteShapes(m.shapes);
+	textureArrayDelete(&m.texture_array);
+	for (int t = 0; t < m.textures.size(); t++)
+		textureCacheRelease(m.textures[t]);
+	m.textures.clear();
+	m.gpu_bytes = 0;
+	m.resident = false;
+	model_evictions++;
+	{
+		lock_guard<mutex> lock(model_load_mutex);
+		model_states[i] = MODEL_UNLOADED;
+	}
+	// the names of the deleted objects come back for the next ones
+	stateCacheInvalidate();
+}
+
+// Evict the least recently displayed models while over the budget. The
+// current model and the neighbours prefetched with it stay, even if they
+// alone take more than the budget.
+void EnforceResidencyBudget()
+{
+	if (residency_budget == 0)
+		return;
+	int count = (int)models.size();
+	size_t bytes = ResidentGpuBytes();
+	while (bytes > residency_budget)
+	{
+		int victim = -1;
+		for (int i = 0; i < count; i++)
+		{
+			bool kept = i == cur_idx || i == (cur_idx + 1) % count || i == (cur_idx - 1 + count) % count;
+			if (models[i].resident && !kept && (victim < 0 || models[i].last_displayed < models[victim].last_displayed))
+				victim = i;
+		}
+		if (victim < 0)
+			break;
+		EvictModel(victim);
+		size_t freed = bytes - ResidentGpuBytes();
+		bytes -= freed;
+		printf("Residency: evicted %s, %.1f MB freed\n", model_list[victim].c_str(), freed / (1024.0 * 1024.0));
+	}
+}
+
+// Once per frame on the GL thread: request the current model and its
+// neighbours, then upload the models the loader has finished.
+void UpdateModelLoader()
+{
+	int count = (int)model_list.size();
+	bool queued = false;
+	vector<int> prepared;
+	{
+		lock_guard<mutex> lock(model_load_mutex);
+		queued |= QueueModel(cur_idx, true);
+		queued |= QueueModel((cur_idx + 1) % count, false);
+		queued |= QueueModel((cur_idx - 1 + count) % count, false);
+		for (int i = 0; i < count; i++)
+		{
+			if (model_states[i] == MODEL_PREPARED)
+				prepared.push_back(i);
+		}
+	}
+	if (queued)
+		model_load_cond.notify_one();
+
+	// textures arrive ahead of their models
+	int uploaded = textureCacheUploadDecoded();
+
+	for (int p = 0; p < prepared.size(); p++)
+	{
+		int i = prepared[p];
+		UploadTexturedModel(model_loads[i], models[i]);
+		ReleaseModelLoad(model_loads[i]);
+
+		lock_guard<mutex> lock(model_load_mutex);
+		model_states[i] = MODEL_RESIDENT;
+	}
+	// the uploads bound textures and vertex arrays, and released textures
+	// free names the next ones may reuse
+	if (uploaded > 0 || !prepared.empty())
+		stateCacheInvalidate();
+	if (!prepared.empty())
+	{
+		EnforceResidencyBudget();
+		PrintResidency(false);
+	}
+}
+
+// A grey cube of the size of a normalized model
+void CreatePlaceholder()
+{
+	vector<GLfloat> positions, colors, normals, texcoords;
+	vector<uint16_t> indices;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (int side = -1; side <= 1; side += 2)
+		{
+			uint16_t first = positions.size() / 3;
+			static const GLfloat corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+			for (int c = 0; c < 4; c++)
+			{
+				GLfloat position[3], normal[3] = { 0, 0, 0 };
+				position[axis] = 0.5f * side;
+				position[(axis + 1) % 3] = 0.5f * corners[c][0];
+				position[(axis + 2) % 3] = 0.5f * corners[c][1];
+				normal[axis] = (GLfloat)side;
+				positions.insert(positions.end(), position, position + 3);
+				normals.insert(normals.end(), normal, normal + 3);
+				colors.insert(colors.end(), 3, 1.0f);
+				texcoords.push_back(0.5f * (corners[c][0] + 1));
+				texcoords.push_back(0.5f * (corners[c][1] + 1));
+			}
+			// counter-clockwise seen from outside
+			uint16_t quad[2][6] = { { 0, 1, 2, 0, 2, 3 }, { 0, 2, 1, 0, 3, 2 } };
+			for (int k = 0; k < 6; k++)
+				indices.push_back(first + quad[side < 0][k]);
+		}
+	}
+
+	MeshCacheMaterial material;
+	memset(&material, 0, sizeof(material));
+	for (int c = 0; c < 3; c++)
+	{
+		material.Ka[c] = 0.2f;
+		material.Kd[c] = 0.5f;
+		material.Ks[c] = 0.1f;
+	}
+	MeshCacheRange range = { 0, (uint32_t)indices.size(), 0 };
+
+	MeshCacheData data;
+	memset(&data, 0, sizeof(data));
+	data.vertex_count = positions.size() / 3;
+	data.positions = positions.data();
+	data.colors = colors.data();
+	data.normals = normals.data();
+	data.texcoords = texcoords.data();
+	data.index_count = indices.size();
+	data.index_size = sizeof(uint16_t);
+	data.indices = indices.data();
+	data.range_count = 1;
+	data.ranges = &range;
+	data.material_count = 1;
+	data.materials = &material;
+
+	// a white texel, freed by createTexture like a decoded image
+	TextureImage white;
+	white.width = white.height = 1;
+	white.pixels = (stbi_uc*)malloc(4);
+	memset(white.pixels, 255, 4);
+
+	vector<unsigned char> packed;
+	const VertexLayout* layout = PackModelVertices(data, vertex_layout, packed);
+	placeholder_shapes = CreateShapes(data, *layout, packed);
+	white_texture = createTexture(white);
+	placeholder_shapes[0].material = LoadMaterial(material, white_texture, 0);
+	placeholder_shapes[0].material.diffuseTexture = -1;	// drawn untextured
+	UploadMaterials(placeholder_shapes);
+}
+
+// Time to the first frame and to the first frame that shows the current
+// model itself, with what is resident at that point
+void ReportStartup(chrono::steady_clock::time_point start, double first_frame_ms)
+{
+	double model_frame_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	int resident = 0;
+	size_t gpu_bytes = 0;
+	for (int i = 0; i < models.size(); i++)
+	{
+		resident += models[i].resident ? 1 : 0;
+		gpu_bytes += models[i].gpu_bytes;
+	}
+	printf("Startup (%s loading): first frame after %.1f ms, first frame of the model after %.1f ms\n",
+		lazy_loading ? "lazy" : "eager", first_frame_ms, model_frame_ms);
+	TextureCacheStats textures = textureCacheStats();
+	gpu_bytes += textures.resident_bytes;
+	printf("  %d/%d models resident, %.1f MB of model buffers and textures, resident set %.1f MB\n",
+		resident, (int)models.size(), gpu_bytes / (1024.0 * 1024.0), CurrentResidentKB() / 1024.0);
+	printf("  %d texture requests, %d decoded, %d cooked (%d decodes avoided, %.1f MB of textures shared), %.1f ms building mips\n",
+		textures.requests, textures.decodes, textures.cooked, textures.requests - textures.decodes, textures.saved_bytes / (1024.0 * 1024.0), textures.mip_ms);
 }
 
 void initParameter()
@@ -1164,52 +2245,50 @@ void initParameter()
 	/* ------------------------------------------------------------- */
 }
 
-void setUniformVariables()
+void setUniformVariables(ShaderProgram& shader)
 {
-	iLocP = glGetUniformLocation(program, "um4p");
-	iLocV = glGetUniformLocation(program, "um4v");
-	iLocM = glGetUniformLocation(program, "um4m");
-
+	GLuint program = shader.program;
 	// [HW2] Get uniform location of lighting attribs
-	iLocLightingMode = glGetUniformLocation(program, "lighting_mode");
-	iLocIsPerPixel = glGetUniformLocation(program, "is_perpixel");
-
-	iLocPhongMaterial.Ka = glGetUniformLocation(program, "material.Ka");
-	iLocPhongMaterial.Kd = glGetUniformLocation(program, "material.Kd");
-	iLocPhongMaterial.Ks = glGetUniformLocation(program, "material.Ks");
-
-	iLocLightingAttrib[0].position = glGetUniformLocation(program, "lighting_attrib[0].position");
-	iLocLightingAttrib[0].ambient = glGetUniformLocation(program, "lighting_attrib[0].ambient");
-	iLocLightingAttrib[0].diffuse = glGetUniformLocation(program, "lighting_attrib[0].diffuse");
-	iLocLightingAttrib[0].specular = glGetUniformLocation(program, "lighting_attrib[0].specular");
-	iLocLightingAttrib[0].shininess = glGetUniformLocation(program, "lighting_attrib[0].shininess");
-
-	iLocLightingAttrib[1].position = glGetUniformLocation(program, "lighting_attrib[1].position");
-	iLocLightingAttrib[1].ambient = glGetUniformLocation(program, "lighting_attrib[1].ambient");
-	iLocLightingAttrib[1].diffuse = glGetUniformLocation(program, "lighting_attrib[1].diffuse");
-	iLocLightingAttrib[1].specular = glGetUniformLocation(program, "lighting_attrib[1].specular");
-	iLocLightingAttrib[1].shininess = glGetUniformLocation(program, "lighting_attrib[1].shininess");
-	iLocLightingAttrib[1].constant_attenuation = glGetUniformLocation(program, "lighting_attrib[1].constant_attenuation");
-	iLocLightingAttrib[1].linear_attenuation = glGetUniformLocation(program, "lighting_attrib[1].linear_attenuation");
-	iLocLightingAttrib[1].quadratic_attenuation = glGetUniformLocation(program, "lighting_attrib[1].quadratic_attenuation");
-
-	iLocLightingAttrib[2].position = glGetUniformLocation(program, "lighting_attrib[2].position");
-	iLocLightingAttrib[2].ambient = glGetUniformLocation(program, "lighting_attrib[2].ambient");
-	iLocLightingAttrib[2].diffuse = glGetUniformLocation(program, "lighting_attrib[2].diffuse");
-	iLocLightingAttrib[2].specular = glGetUniformLocation(program, "lighting_attrib[2].specular");
-	iLocLightingAttrib[2].shininess = glGetUniformLocation(program, "lighting_attrib[2].shininess");
-	iLocLightingAttrib[2].constant_attenuation = glGetUniformLocation(program, "lighting_attrib[2].constant_attenuation");
-	iLocLightingAttrib[2].linear_attenuation = glGetUniformLocation(program, "lighting_attrib[2].linear_attenuation");
-	iLocLightingAttrib[2].quadratic_attenuation = glGetUniformLocation(program, "lighting_attrib[2].quadratic_attenuation");
-	iLocLightingAttrib[2].spot_direction = glGetUniformLocation(program, "lighting_attrib[2].spot_direction");
-	iLocLightingAttrib[2].spot_exponent = glGetUniformLocation(program, "lighting_attrib[2].spot_exponent");
-	iLocLightingAttrib[2].spot_cutoff = glGetUniformLocation(program, "lighting_attrib[2].spot_cutoff");
+	shader.iLocLightingMode = glGetUniformLocation(program, "lighting_mode");
+	shader.iLocIsPerPixel = glGetUniformLocation(program, "is_perpixel");
+
+	// the lights, materials and transforms are uniform blocks, see
+	// UpdateLighting, UploadMaterials and UpdateTransform
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Lights"), LIGHTS_BINDING);
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Material"), MATERIAL_BINDING);
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Transform"), TRANSFORM_BINDING);
 
 	// [TODO] Get uniform location of texture
-	iLocXOffset = glGetUniformLocation(program, "x_offset");
-	iLocYOffset = glGetUniformLocation(program, "y_offset");
-	iLocTextureIsEye = glGetUniformLocation(program, "texture_is_eye");
-	iLocTextureFromMain = glGetUniformLocation(program, "texture_from_main");
+	shader.iLocXOffset = glGetUniformLocation(program, "x_offset");
+	shader.iLocYOffset = glGetUniformLocation(program, "y_offset");
+	shader.iLocTextureIsEye = glGetUniformLocation(program, "texture_is_eye");
+	shader.iLocTextureLayer = glGetUniformLocation(program, "texture_layer");
+	shader.iLocDualViewport = glGetUniformLocation(program, "dual_viewport");
+	// texture arrays sit on their own unit, a unit cannot serve two sampler types
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "texture_from_main"), 0);
+	glUniform1i(glGetUniformLocation(program, "texture_array"), 1);
+	// the frames the copies of a crowd pick from
+	glUniform2fv(glGetUniformLocation(program, "eye_offsets"), EYE_OFFSET_COUNT, &EYE_OFFSETS[0].x);
+}
+
+// Bit per CookedFormat the context can sample
+unsigned DetectCookedFormats()
+{
+	unsigned formats = 0;
+	GLint count;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+			formats |= (1u << COOKED_BC1) | (1u << COOKED_BC3);
+		else if (strcmp(name, "GL_ARB_texture_compression_bptc") == 0)
+			formats |= 1u << COOKED_BC7;
+	}
+	if (GLAD_GL_VERSION_4_2)
+		formats |= 1u << COOKED_BC7;
+	return formats;
 }
 
 void setupRC()
@@ -1217,14 +2296,450 @@ void setupRC()
 	// setup shaders
 	setShaders();
 	initParameter();
-	setUniformVariables();
 
 	// OpenGL States and Values
 	glClearColor(0.2, 0.2, 0.2, 1.0);
+	// the boundary between the halves of a dual-viewport draw
+	glEnable(GL_CLIP_DISTANCE0);
 
-	for (string model_path : model_list){
-		LoadTexturedModels(model_path);
+	if (use_cooked_textures)
+		textureCacheUseCooked(DetectCookedFormats());
+	textureCacheUseStreaming(stream_texture_uploads);
+
+	// texture filtering and wrapping, bound by RenderScene
+	glGenSamplers(4, &texture_samplers[0][0]);
+	for (int mag = 0; mag < 2; mag++)
+	{
+		for (int min = 0; min < 2; min++)
+		{
+			GLuint sampler = texture_samplers[mag][min];
+			glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, mag == 0 ? GL_NEAREST : GL_LINEAR);
+			glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, min == 0 ? GL_NEAREST : GL_LINEAR_MIPMAP_LINEAR);
+			glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		}
 	}
+
+	// the lights are uploaded on the first frame
+	glGenBuffers(1, &light_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, light_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, 3 * sizeof(LightBlockEntry), NULL, GL_DYNAMIC_DRAW);
+	lights_dirty = true;
+	glGenBuffers(1, &transform_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, transform_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(TransformBlock), NULL, GL_DYNAMIC_DRAW);
+	transform_buffer_model = -1;
+	GLint alignment = 1;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	material_stride = (sizeof(MaterialBlock) + alignment - 1) / alignment * alignment;
+
+	// what the per-instance inputs of shader.vs.glsl read outside crowd
+	// draws: the identity, white and the model's own eye texture frame
+	for (int column = 0; column < 4; column++)
+		glVertexAttrib4f(INSTANCE_MODEL_LOCATION + column, column == 0, column == 1, column == 2, column == 3);
+	glVertexAttrib4f(INSTANCE_TINT_LOCATION, 1.0f, 1.0f, 1.0f, 1.0f);
+	glVertexAttribI1i(INSTANCE_EYE_OFFSET_LOCATION, -1);
+	if (crowd_size > 0)
+		BuildCrowd();
+
+	CreatePlaceholder();
+	// setShaders and the uploads below went around the state cache
+	stateCacheInvalidate();
+	if (lazy_loading)
+	{
+		StartModelLoader(model_list);
+		return;
+	}
+
+	chrono::steady_clock::time_point load_start = chrono::steady_clock::now();
+	int cache_hits = LoadTexturedModels(model_list);
+	stateCacheInvalidate();
+	double load_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - load_start).count();
+	printf("Loaded %d models in %.1f ms (%s start, %d from mesh cache)\n", (int)model_list.size(), load_ms, cache_hits == model_list.size() ? "warm" : "cold", cache_hits);
+	PrintResidency(false);
+}
+
+// --bench-layout: bytes per vertex and frame time of every vertex layout,
+// drawing the largest TextureModels. Frames end with glFinish instead of a
+// vsync'ed swap so that the GPU time is measured.
+void BenchmarkVertexLayouts()
+{
+	const int warmup_frames = 10;
+	const int timed_frames = 200;
+
+	vector<size_t> vertex_bytes(VERTEX_LAYOUT_COUNT, 0);
+	vector<vector<double> > frame_ms(VERTEX_LAYOUT_COUNT);
+	textureUploadFinish(0);
+	for (int l = 0; l < VERTEX_LAYOUT_COUNT; l++)
+	{
+		for (int i = 0; i < models.size(); i++)
+		{
+			// the mesh cache written by setupRC makes this cheap
+			ModelLoad load;
+			load.model_path = model_list[i];
+			PrepareTexturedModel(load, 1);
+
+			const VertexLayout* layout = PackModelVertices(load.data, &VERTEX_LAYOUTS[l], load.packed);
+			vector<Shape> shapes = CreateShapes(load.data, *layout, load.packed);
+			for (int s = 0; s < shapes.size(); s++)
+				shapes[s].material = models[i].shapes[s].material;
+			UploadMaterials(shapes);
+			DeleteShapes(models[i].shapes);
+			models[i].shapes = shapes;
+			stateCacheInvalidate();
+			vertex_bytes[l] += load.packed.size();
+			ReleaseModelLoad(load);
+
+			cur_idx = i;
+			chrono::steady_clock::time_point start;
+			for (int f = 0; f < warmup_frames + timed_frames; f++)
+			{
+				if (f == warmup_frames)
+					start = chrono::steady_clock::now();
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+				RenderFrame();
+				glFinish();
+			}
+			frame_ms[l].push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / timed_frames);
+			glfwPollEvents();
+		}
+	}
+
+	printf("\nVertex layout benchmark, ms per frame over %d frames\n", timed_frames);
+	printf("  %-18s %8s %10s", "layout", "B/vertex", "vertex KB");
+	for (int i = 0; i < model_list.size(); i++)
+		printf(" %14s", model_list[i].substr(model_list[i].find_last_of("/\\") + 1).c_str());
+	printf("\n");
+	for (int l = 0; l < VERTEX_LAYOUT_COUNT; l++)
+	{
+		printf("  %-18s %8d %10.1f", VERTEX_LAYOUTS[l].name, VERTEX_LAYOUTS[l].stride, vertex_bytes[l] / 1024.0);
+		for (int i = 0; i < frame_ms[l].size(); i++)
+			printf(" %14.3f", frame_ms[l][i]);
+		printf("\n");
+	}
+}
+
+// --bench-texture-arrays: texture binds and CPU submit time per frame of the
+// multi-material models, one texture per material and then packed into
+// texture arrays. Submit time is the RenderScene calls alone, the frame
+// adds the glFinish.
+void BenchmarkTextureArrays()
+{
+	const int warmup_frames = 10;
+	const int timed_frames = 200;
+
+	size_t separate_bytes = textureCacheStats().resident_bytes, array_bytes = 0;
+	vector<bool> packed(models.size(), false);
+	vector<double> binds[2], submit_ms[2], frame_ms[2];
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (int i = 0; i < models.size(); i++)
+		{
+			if (pass == 1)
+			{
+				packed[i] = PackModelTextures(models[i]);
+				array_bytes += models[i].texture_array.gpu_bytes;
+				stateCacheInvalidate();
+			}
+
+			cur_idx = i;
+			double submit = 0.0;
+			chrono::steady_clock::time_point start;
+			for (int f = 0; f < warmup_frames + timed_frames; f++)
+			{
+				if (f == warmup_frames)
+				{
+					start = chrono::steady_clock::now();
+					texture_binds = 0;
+					submit = 0.0;
+				}
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+				chrono::steady_clock::time_point submit_start = chrono::steady_clock::now();
+				RenderFrame();
+				submit += chrono::duration<double, milli>(chrono::steady_clock::now() - submit_start).count();
+				glFinish();
+			}
+			binds[pass].push_back((double)texture_binds / timed_frames);
+			submit_ms[pass].push_back(submit / timed_frames);
+			frame_ms[pass].push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / timed_frames);
+			glfwPollEvents();
+		}
+	}
+	// the 2D textures the arrays replaced are gone by now
+	size_t remaining_bytes = textureCacheStats().resident_bytes;
+
+	printf("\nTexture array benchmark, per frame over %d frames\n", timed_frames);
+	printf("  %-16s %6s %8s %17s %21s %21s\n", "model", "shapes", "layers", "binds 2D/array", "submit ms 2D/array", "frame ms 2D/array");
+	for (int i = 0; i < models.size(); i++)
+	{
+		char layers[16];
+		snprintf(layers, sizeof(layers), packed[i] ? "%d" : "not packed", models[i].texture_array.layer_count);
+		printf("  %-16s %6d %8s %8.0f %8.0f %10.3f %10.3f %10.3f %10.3f\n",
+			model_list[i].substr(model_list[i].find_last_of("/\\") + 1).c_str(), (int)models[i].shapes.size(), layers,
+			binds[0][i], binds[1][i], submit_ms[0][i], submit_ms[1][i], frame_ms[0][i], frame_ms[1][i]);
+	}
+	printf("  textures: %.1f MB as 2D textures, %.1f MB as arrays (every layer takes the size of the largest texture of its model)\n",
+		separate_bytes / (1024.0 * 1024.0), (array_bytes + remaining_bytes) / (1024.0 * 1024.0));
+}
+
+// --bench-dual-viewport: draw calls, GL calls and CPU submit time per frame
+// of the largest TextureModels, each half drawn on its own (two RenderScene
+// passes of two draws per shape) and then both halves in one instanced
+// draw per shape. Frames end with glFinish.
+void BenchmarkDualViewport()
+{
+	const int warmup_frames = 10;
+	const int timed_frames = 200;
+	const char* pass_names[2] = { "per viewport", "dual viewport" };
+
+	vector<double> draws[2], calls[2], submit_ms[2], frame_ms[2];
+	for (int pass = 0; pass < 2; pass++)
+	{
+		dual_viewport_draws = pass == 1;
+		for (int i = 0; i < models.size(); i++)
+		{
+			cur_idx = i;
+			double submit = 0.0;
+			chrono::steady_clock::time_point start;
+			for (int f = 0; f < warmup_frames + timed_frames; f++)
+			{
+				if (f == warmup_frames)
+				{
+					start = chrono::steady_clock::now();
+					draw_calls = 0;
+					stateCacheResetCounters();
+					submit = 0.0;
+				}
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+				chrono::steady_clock::time_point submit_start = chrono::steady_clock::now();
+				RenderFrame();
+				submit += chrono::duration<double, milli>(chrono::steady_clock::now() - submit_start).count();
+				glFinish();
+			}
+			draws[pass].push_back((double)draw_calls / timed_frames);
+			calls[pass].push_back((double)stateCacheCounters().issued / timed_frames);
+			submit_ms[pass].push_back(submit / timed_frames);
+			frame_ms[pass].push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / timed_frames);
+			glfwPollEvents();
+		}
+	}
+
+	printf("\nDual viewport benchmark, per frame over %d frames (%s / %s)\n", timed_frames, pass_names[0], pass_names[1]);
+	printf("  %-16s %6s %15s %19s %21s %21s\n", "model", "shapes", "draws", "state calls", "submit ms", "frame ms");
+	for (int i = 0; i < models.size(); i++)
+	{
+		printf("  %-16s %6d %7.0f %7.0f %9.1f %9.1f %10.3f %10.3f %10.3f %10.3f\n",
+			model_list[i].substr(model_list[i].find_last_of("/\\") + 1).c_str(), (int)models[i].shapes.size(),
+			draws[0][i], draws[1][i], calls[0][i], calls[1][i], submit_ms[0][i], submit_ms[1][i], frame_ms[0][i], frame_ms[1][i]);
+	}
+	printf("  state calls are the binds, viewports and uniforms the state cache passed on to GL\n");
+}
+
+// --bench-shader-variants: GPU time per frame, from a timer query around
+// the frames, of each light type and shading frequency drawn with the
+// uber-shader and then with its variant. The per-vertex and per-pixel
+// variants draw only their own half of the window, the split ones both
+// halves in one instanced draw.
+void BenchmarkShaderVariants()
+{
+	const int warmup_frames = 10;
+	const int timed_frames = 100;
+	const char* light_names[3] = { "directional", "point", "spot" };
+
+	GLuint query;
+	glGenQueries(1, &query);
+	vector<double> gpu_ms[3][SHADING_COUNT][2];	// [light][shading][uber-shader, variant], per model
+	for (int i = 0; i < models.size(); i++)
+	{
+		cur_idx = i;
+		for (int light = 0; light < 3; light++)
+		{
+			cur_lighting_mode = light;
+			for (int shading = 0; shading < SHADING_COUNT; shading++)
+			{
+				dual_viewport_draws = shading == SHADE_SPLIT;
+				viewport_halves = shading == SHADE_PER_PIXEL ? 2 : 1;
+				for (int pass = 0; pass < 2; pass++)
+				{
+					use_shader_variants = pass == 1;
+					for (int f = 0; f < warmup_frames + timed_frames; f++)
+					{
+						if (f == warmup_frames)
+							glBeginQuery(GL_TIME_ELAPSED, query);
+						glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+						RenderFrame();
+					}
+					glEndQuery(GL_TIME_ELAPSED);
+					GLuint64 elapsed_ns = 0;
+					glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed_ns);
+					gpu_ms[light][shading][pass].push_back(elapsed_ns / 1e6 / timed_frames);
+					glfwPollEvents();
+				}
+			}
+		}
+	}
+	glDeleteQueries(1, &query);
+	viewport_halves = 3;
+
+	printf("\nShader variant benchmark, GPU ms per frame over %d frames (uber-shader / variant)\n", timed_frames);
+	printf("  %-16s %-12s %21s %21s %21s\n", "model", "light", "per vertex", "per pixel", "split");
+	for (int i = 0; i < models.size(); i++)
+	{
+		for (int light = 0; light < 3; light++)
+		{
+			printf("  %-16s %-12s", light == 0 ? model_list[i].substr(model_list[i].find_last_of("/\\") + 1).c_str() : "", light_names[light]);
+			for (int shading = 0; shading < SHADING_COUNT; shading++)
+				printf(" %10.3f %10.3f", gpu_ms[light][shading][0][i], gpu_ms[light][shading][1][i]);
+			printf("\n");
+		}
+	}
+	printf("  per vertex and per pixel draw one half of the window each, split draws both\n");
+}
+
+// --bench-texture-uploads: frame times around a burst of texture uploads,
+// the decoded textures of several large models all handed to GL in one
+// frame, first each uploaded whole on first use and then streamed through
+// the pixel buffer ring. The frames draw the same small model throughout
+// and end with glFinish, so the upload work shows in the frame it lands in.
+void BenchmarkTextureUploads()
+{
+	const int warmup_frames = 10;
+	const int trace_frames = 60;
+	const string base_dir = "../TextureModels/";
+	const char* burst_models[] = { "nanosuit.obj", "cyborg.obj", "ZEBRA.obj", "Dog.obj", "Nala.obj" };
+	const char* pass_names[2] = { "on first use", "streamed" };
+
+	vector<double> trace[2];
+	int complete_frame[2] = { -1, -1 };
+	int texture_count = 0;
+	size_t burst_bytes = 0;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		// decoded before the timing; the first pass released them, so the
+		// second decodes and uploads them again
+		map<string, TextureHandle> requested;
+		for (int m = 0; m < sizeof(burst_models) / sizeof(burst_models[0]); m++)
+			RequestMtlTextures(base_dir + burst_models[m], base_dir, requested);
+		vector<TextureHandle> handles;
+		for (map<string, TextureHandle>::iterator it = requested.begin(); it != requested.end(); ++it)
+		{
+			if (textureCacheWait(it->second))
+				handles.push_back(it->second);
+			else
+				textureCacheRelease(it->second);
+		}
+		texture_count = (int)handles.size();
+		textureCacheUseStreaming(pass == 1);
+
+		size_t resident_before = textureCacheStats().resident_bytes;
+		for (int f = 0; f < warmup_frames + trace_frames; f++)
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			if (f == warmup_frames)
+			{
+				for (int h = 0; h < handles.size(); h++)
+					textureCacheTexture(handles[h]);
+			}
+			textureUploadUpdate();
+			stateCacheInvalidate();
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+			RenderFrame();
+			glFinish();
+			if (f < warmup_frames)
+				continue;
+			trace[pass].push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+			if (complete_frame[pass] < 0 && textureUploadPending() == 0)
+				complete_frame[pass] = f - warmup_frames;
+			glfwPollEvents();
+		}
+		burst_bytes = textureCacheStats().resident_bytes - resident_before;
+
+		textureUploadFinish(0);
+		for (int h = 0; h < handles.size(); h++)
+			textureCacheRelease(handles[h]);
+	}
+
+	printf("\nTexture upload benchmark, %d textures (%.1f MB with mips) handed to GL in frame 0\n", texture_count, burst_bytes / (1024.0 * 1024.0));
+	printf("  %-14s %9s %9s %9s %18s\n", "uploads", "worst ms", "mean ms", "last ms", "complete in frame");
+	for (int pass = 0; pass < 2; pass++)
+	{
+		double worst = 0.0, sum = 0.0;
+		for (int f = 0; f < trace[pass].size(); f++)
+		{
+			worst = max(worst, trace[pass][f]);
+			sum += trace[pass][f];
+		}
+		// the last frame, long after the burst, for scale
+		printf("  %-14s %9.3f %9.3f %9.3f %18d\n", pass_names[pass], worst, sum / trace[pass].size(), trace[pass].back(), complete_frame[pass]);
+	}
+	printf("  trace, ms per frame:\n  %5s %14s %14s\n", "frame", pass_names[0], pass_names[1]);
+	int last = min(trace_frames, max(complete_frame[0], complete_frame[1]) + 5);
+	for (int f = 0; f < last; f++)
+		printf("  %5d %14.3f %14.3f\n", f, trace[0][f], trace[1][f]);
+}
+
+// --bench-crowd: frame time and vertex rate of crowds of 1 to 100000 copies
+// of each model, every shape one instanced draw whatever the count. The
+// vertex rate takes the instances the frames drew, so a copy counts once
+// per time it is drawn: twice in the dual-viewport split, once per half and
+// RenderScene call with --per-viewport-draws. Frames end with glFinish,
+// each count is timed over a second and at least 3 frames.
+void BenchmarkCrowd()
+{
+	const int counts[] = { 1, 10, 100, 1000, 10000, 100000 };
+	const int count_count = sizeof(counts) / sizeof(counts[0]);
+	const double min_timed_ms = 1000.0;
+	const int min_timed_frames = 3;
+
+	vector<double> frame_ms[count_count], draws[count_count], instances[count_count];
+	for (int i = 0; i < models.size(); i++)
+	{
+		cur_idx = i;
+		for (int c = 0; c < count_count; c++)
+		{
+			crowd_size = counts[c];
+			BuildCrowd();
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+			RenderFrame();
+			glFinish();
+
+			draw_calls = 0;
+			drawn_instances = 0;
+			int frames = 0;
+			double elapsed_ms = 0.0;
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			while (frames < min_timed_frames || elapsed_ms < min_timed_ms)
+			{
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+				RenderFrame();
+				glFinish();
+				frames++;
+				elapsed_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			}
+			frame_ms[c].push_back(elapsed_ms / frames);
+			draws[c].push_back((double)draw_calls / frames);
+			// of the whole model, every shape draws as many
+			instances[c].push_back((double)drawn_instances / frames / models[i].shapes.size());
+			glfwPollEvents();
+		}
+	}
+
+	printf("\nCrowd benchmark, per frame over at least %d frames and %.0f ms\n", min_timed_frames, min_timed_ms);
+	printf("  %-16s %9s %9s %6s %12s %14s %14s\n", "model", "vertices", "copies", "draws", "frame ms", "M vertices/s", "M triangles/s");
+	for (int i = 0; i < models.size(); i++)
+	{
+		int triangles = 0;
+		for (int s = 0; s < models[i].shapes.size(); s++)
+			triangles += models[i].shapes[s].indexCount / 3;
+		int vertices = models[i].shapes[0].vertex_count;
+		for (int c = 0; c < count_count; c++)
+		{
+			double per_second = instances[c][i] * 1000.0 / frame_ms[c][i] / 1e6;
+			printf("  %-16s %9s %9d %6.0f %12.3f %14.1f %14.1f\n", c == 0 ? model_list[i].substr(model_list[i].find_last_of("/\\") + 1).c_str() : "",
+				c == 0 ? to_string(vertices).c_str() : "", counts[c], draws[c][i], frame_ms[c][i], vertices * per_second, triangles * per_second);
+		}
+	}
+	printf("  vertices are the model's unique ones, each shaded once per instance at best\n");
 }
 
 void glPrintContextInfo(bool printExtension)
@@ -1248,6 +2763,126 @@ void glPrintContextInfo(bool printExtension)
 
 int main(int argc, char **argv)
 {
+	chrono::steady_clock::time_point app_start = chrono::steady_clock::now();
+
+	int bench_status;
+	if (RunBenchmarks(argc, argv, &bench_status))
+		return bench_status;
+
+	bool bench_layout = false;
+	bool bench_texture_arrays = false;
+	bool bench_texture_uploads = false;
+	bool bench_dual_viewport = false;
+	bool bench_shader_variants = false;
+	bool bench_crowd = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--vertex-layout") == 0 && i + 1 < argc)
+		{
+			vertex_layout = findVertexLayout(argv[++i]);
+			if (vertex_layout == NULL)
+			{
+				cout << "Unknown vertex layout " << argv[i] << endl;
+				return -1;
+			}
+		}
+		else if (strcmp(argv[i], "--eager-load") == 0)
+		{
+			lazy_loading = false;
+		}
+		else if (strcmp(argv[i], "--no-cooked-textures") == 0)
+		{
+			use_cooked_textures = false;
+		}
+		else if (strcmp(argv[i], "--texture-arrays") == 0)
+		{
+			use_texture_arrays = true;
+		}
+		else if (strcmp(argv[i], "--gpu-mipmaps") == 0)
+		{
+			textureCacheUseCpuMips(false);
+		}
+		else if (strcmp(argv[i], "--residency-budget") == 0 && i + 1 < argc)
+		{
+			residency_budget = (size_t)(atof(argv[++i]) * 1024 * 1024);
+		}
+		else if (strcmp(argv[i], "--per-viewport-draws") == 0)
+		{
+			dual_viewport_draws = false;
+		}
+		else if (strcmp(argv[i], "--uber-shader") == 0)
+		{
+			use_shader_variants = false;
+		}
+		else if (strcmp(argv[i], "--no-program-binaries") == 0)
+		{
+			use_program_binaries = false;
+		}
+		else if (strcmp(argv[i], "--crowd") == 0 && i + 1 < argc)
+		{
+			crowd_size = atoi(argv[++i]);
+			if (crowd_size < 0)
+				crowd_size = 0;
+		}
+		else if (strcmp(argv[i], "--sync-shaders") == 0)
+		{
+			async_shaders = false;
+		}
+		else if (strcmp(argv[i], "--sync-texture-uploads") == 0)
+		{
+			stream_texture_uploads = false;
+		}
+		else if (strcmp(argv[i], "--no-state-cache") == 0)
+		{
+			stateCacheEnable(false);
+		}
+		else if (strcmp(argv[i], "--gl-stats") == 0)
+		{
+			print_gl_stats = true;
+		}
+		else if (strcmp(argv[i], "--bench-layout") == 0)
+		{
+			bench_layout = true;
+			lazy_loading = false;
+			model_list = { "../TextureModels/Dog.obj", "../TextureModels/nanosuit.obj", "../TextureModels/Dog2.obj", "../TextureModels/teapot.obj" };
+		}
+		else if (strcmp(argv[i], "--bench-texture-arrays") == 0)
+		{
+			// packed after the first pass; cooked textures cannot be packed
+			bench_texture_arrays = true;
+			lazy_loading = false;
+			use_texture_arrays = false;
+			use_cooked_textures = false;
+			model_list = { "../TextureModels/nanosuit.obj", "../TextureModels/Mew.obj", "../TextureModels/Nyarth.obj", "../TextureModels/Fushigidane.obj", "../TextureModels/cyborg.obj" };
+		}
+		else if (strcmp(argv[i], "--bench-dual-viewport") == 0)
+		{
+			bench_dual_viewport = true;
+			lazy_loading = false;
+			model_list = { "../TextureModels/Dog.obj", "../TextureModels/nanosuit.obj", "../TextureModels/Dog2.obj", "../TextureModels/teapot.obj" };
+		}
+		else if (strcmp(argv[i], "--bench-shader-variants") == 0)
+		{
+			bench_shader_variants = true;
+			lazy_loading = false;
+			model_list = { "../TextureModels/Dog.obj", "../TextureModels/nanosuit.obj", "../TextureModels/teapot.obj" };
+		}
+		else if (strcmp(argv[i], "--bench-crowd") == 0)
+		{
+			// textured, with eyes for the per-copy eye frames
+			bench_crowd = true;
+			lazy_loading = false;
+			model_list = { "../TextureModels/Dog.obj" };
+		}
+		else if (strcmp(argv[i], "--bench-texture-uploads") == 0)
+		{
+			// the burst has to decode to RGBA with CPU mips to be streamed
+			bench_texture_uploads = true;
+			lazy_loading = false;
+			use_cooked_textures = false;
+			model_list = { "../TextureModels/Square.obj" };
+		}
+	}
 
     // initial glfw
     glfwInit();
@@ -1291,23 +2926,91 @@ int main(int argc, char **argv)
 	// Setup render context
 	setupRC();
 
+	// the benchmarks draw with every program
+	if (bench_layout || bench_texture_arrays || bench_dual_viewport || bench_shader_variants || bench_texture_uploads || bench_crowd)
+		UpdateShaders(true);
+	if (bench_layout)
+	{
+		BenchmarkVertexLayouts();
+		return 0;
+	}
+	if (bench_texture_arrays)
+	{
+		BenchmarkTextureArrays();
+		return 0;
+	}
+	if (bench_dual_viewport)
+	{
+		BenchmarkDualViewport();
+		return 0;
+	}
+	if (bench_shader_variants)
+	{
+		BenchmarkShaderVariants();
+		return 0;
+	}
+	if (bench_texture_uploads)
+	{
+		BenchmarkTextureUploads();
+		return 0;
+	}
+	if (bench_crowd)
+	{
+		BenchmarkCrowd();
+		return 0;
+	}
+
+	double first_frame_ms = -1.0;
+	bool startup_reported = false;
+	unsigned long stats_issued = 0, stats_elided = 0;
+	int stats_frames = 0;
+	chrono::steady_clock::time_point stats_start = chrono::steady_clock::now();
+
 	// main loop
     while (!glfwWindowShouldClose(window))
     {
+		if (lazy_loading)
+			UpdateModelLoader();
+		UpdateShaders(false);
+		// the next rows of the streamed textures
+		if (textureUploadUpdate())
+			stateCacheInvalidate();
+
         // render
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-		// render left view
-		glViewport(0, 0, screenWidth / 2, screenHeight);
-        RenderScene(1);
-		// render right view
-		glViewport(screenWidth / 2, 0, screenWidth / 2, screenHeight);
-		RenderScene(0);
+		RenderFrame();
         
         // swap buffer from back to front
         glfwSwapBuffers(window);
         
         // Poll input event
         glfwPollEvents();
+
+		if (models[cur_idx].resident)
+			models[cur_idx].last_displayed = frame_count;
+		frame_count++;
+
+		if (first_frame_ms < 0.0)
+			first_frame_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - app_start).count();
+		if (!startup_reported && models[cur_idx].resident)
+		{
+			ReportStartup(app_start, first_frame_ms);
+			startup_reported = true;
+		}
+
+		StateCacheCounters counters = stateCacheCounters();
+		stateCacheResetCounters();
+		stats_issued += counters.issued;
+		stats_elided += counters.elided;
+		stats_frames++;
+		if (print_gl_stats && chrono::steady_clock::now() - stats_start >= chrono::seconds(1))
+		{
+			printf("GL calls per frame: %.1f issued, %.1f elided, %.2f uniform block uploads\n", (double)stats_issued / stats_frames, (double)stats_elided / stats_frames, (double)uniform_block_uploads / stats_frames);
+			stats_issued = stats_elided = 0;
+			uniform_block_uploads = 0;
+			stats_frames = 0;
+			stats_start = chrono::steady_clock::now();
+		}
     }
 	
 	// just for compatibiliy purposes
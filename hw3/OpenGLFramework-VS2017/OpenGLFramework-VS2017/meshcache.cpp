@@ -0,0 +1,388 @@
+#include "meshcache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char MESH_CACHE_MAGIC[4] = { 'M', 'S', 'H', 'C' };
+
+struct MeshCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t file_size;
+
+	uint32_t dependency_count;
+	uint32_t vertex_count;
+	uint32_t range_count;
+	uint32_t material_count;
+	uint32_t index_count;
+	uint32_t index_size;
+
+	// byte offsets from the start of the file, 0 if the section is absent
+	uint64_t dependency_offset;
+	uint64_t positions_offset;
+	uint64_t colors_offset;
+	uint64_t normals_offset;
+	uint64_t texcoords_offset;
+	uint64_t index_offset;
+	uint64_t range_offset;
+	uint64_t material_offset;
+};
+
+static bool ReadWholeFile(const char *path, vector<char> &content)
+{
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL)
+		return false;
+
+	fseek(fp, 0, SEEK_END);
+	long count = ftell(fp);
+	rewind(fp);
+
+	content.resize(count > 0 ? count : 0);
+	size_t read = count > 0 ? fread(&content[0], 1, count, fp) : 0;
+	fclose(fp);
+	return read == content.size();
+}
+
+// 64-bit FNV-1a
+static uint64_t HashBytes(const char *data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static bool StatFile(const char *path, uint64_t *size, int64_t *mtime)
+{
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return false;
+	*size = (uint64_t)st.st_size;
+	*mtime = (int64_t)st.st_mtime;
+	return true;
+}
+
+static bool FillDependency(const string &path, const vector<char> &content, MeshCacheDependency *dep)
+{
+	if (path.size() >= MESH_CACHE_PATH_LENGTH)
+		return false;
+
+	memset(dep, 0, sizeof(*dep));
+	if (!StatFile(path.c_str(), &dep->size, &dep->mtime))
+		return false;
+	dep->hash = HashBytes(content.empty() ? NULL : &content[0], content.size());
+	strcpy(dep->path, path.c_str());
+	return true;
+}
+
+// The size has to match; an unchanged mtime is trusted, otherwise the content
+// hash decides (e.g. the file was touched or checked out again).
+static bool DependencyIsFresh(const MeshCacheDependency &dep)
+{
+	uint64_t size;
+	int64_t mtime;
+	if (!StatFile(dep.path, &size, &mtime) || size != dep.size)
+		return false;
+	if (mtime == dep.mtime)
+		return true;
+
+	vector<char> content;
+	if (!ReadWholeFile(dep.path, content))
+		return false;
+	return HashBytes(content.empty() ? NULL : &content[0], content.size()) == dep.hash;
+}
+
+// Collect the .mtl files referenced by "mtllib" statements of an .obj
+static void FindMaterialLibraries(const vector<char> &obj, const string &base_dir, vector<string> &paths)
+{
+	size_t i = 0;
+	while (i < obj.size()) {
+		size_t end = i;
+		while (end < obj.size() && obj[end] != '\n')
+			end++;
+
+		if (end - i > 7 && strncmp(&obj[i], "mtllib", 6) == 0 && (obj[i + 6] == ' ' || obj[i + 6] == '\t')) {
+			size_t p = i + 7;
+			while (p < end) {
+				while (p < end && (obj[p] == ' ' || obj[p] == '\t' || obj[p] == '\r'))
+					p++;
+				size_t q = p;
+				while (q < end && obj[q] != ' ' && obj[q] != '\t' && obj[q] != '\r')
+					q++;
+				if (q > p)
+					paths.push_back(base_dir + string(&obj[p], q - p));
+				p = q;
+			}
+		}
+		i = end + 1;
+	}
+}
+
+static uint64_t AlignOffset(uint64_t offset)
+{
+	return (offset + 15) & ~(uint64_t)15;
+}
+
+bool meshCacheSnapshot(const char *model_path, const char *mtl_base_dir, MeshCacheSources *sources)
+{
+	vector<MeshCacheDependency> &deps = sources->dependencies;
+	deps.clear();
+	vector<char> obj;
+	deps.resize(1);
+	if (!ReadWholeFile(model_path, obj) || !FillDependency(model_path, obj, &deps[0])) {
+		deps.clear();
+		return false;
+	}
+
+	vector<string> mtl_paths;
+	FindMaterialLibraries(obj, mtl_base_dir, mtl_paths);
+	for (size_t i = 0; i < mtl_paths.size(); i++) {
+		vector<char> mtl;
+		MeshCacheDependency dep;
+		// a missing .mtl is not fatal for loading, so it is not tracked either
+		if (ReadWholeFile(mtl_paths[i].c_str(), mtl) && FillDependency(mtl_paths[i], mtl, &dep))
+			deps.push_back(dep);
+	}
+	return true;
+}
+
+bool meshCacheWrite(const MeshCacheSources &sources, const char *cache_path, const MeshCacheData &data)
+{
+	// the geometry is from the sources as they were when parsed
+	const vector<MeshCacheDependency> &deps = sources.dependencies;
+	if (deps.empty())
+		return false;
+	for (size_t i = 0; i < deps.size(); i++) {
+		if (!DependencyIsFresh(deps[i]))
+			return false;
+	}
+
+	// lay out the sections
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+	header.version = MESH_CACHE_VERSION;
+	header.dependency_count = (uint32_t)deps.size();
+	header.vertex_count = data.vertex_count;
+	header.range_count = data.range_count;
+	header.material_count = data.material_count;
+	header.index_count = data.index_count;
+	header.index_size = data.index_size;
+
+	const void *section_data[8] = { &deps[0], data.positions, data.colors, data.normals, data.texcoords, data.indices, data.ranges, data.materials };
+	uint64_t sizes[8] = {
+		deps.size() * sizeof(MeshCacheDependency),
+		data.positions ? data.vertex_count * 3 * sizeof(float) : 0,
+		data.colors ? data.vertex_count * 3 * sizeof(float) : 0,
+		data.normals ? data.vertex_count * 3 * sizeof(float) : 0,
+		data.texcoords ? data.vertex_count * 2 * sizeof(float) : 0,
+		data.indices ? (uint64_t)data.index_count * data.index_size : 0,
+		data.range_count * sizeof(MeshCacheRange),
+		data.material_count * sizeof(MeshCacheMaterial),
+	};
+	uint64_t *offsets[8] = { &header.dependency_offset, &header.positions_offset, &header.colors_offset, &header.normals_offset,
+		&header.texcoords_offset, &header.index_offset, &header.range_offset, &header.material_offset };
+
+	uint64_t offset = AlignOffset(sizeof(header));
+	for (int s = 0; s < 8; s++) {
+		if (sizes[s] == 0)
+			continue;
+		*offsets[s] = offset;
+		offset = AlignOffset(offset + sizes[s]);
+	}
+	header.file_size = offset;
+
+	FILE *fp = fopen(cache_path, "wb");
+	if (fp == NULL)
+		return false;
+
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	uint64_t written = sizeof(header);
+	static const char padding[16] = { 0 };
+	for (int s = 0; s < 8 && ok; s++) {
+		if (sizes[s] == 0)
+			continue;
+		ok = fwrite(padding, 1, (size_t)(*offsets[s] - written), fp) == *offsets[s] - written
+			&& fwrite(section_data[s], 1, (size_t)sizes[s], fp) == sizes[s];
+		written = *offsets[s] + sizes[s];
+	}
+	ok = ok && fwrite(padding, 1, (size_t)(header.file_size - written), fp) == header.file_size - written;
+	fclose(fp);
+
+	if (!ok)
+		remove(cache_path);
+	return ok;
+}
+
+static bool MapFile(const char *path, MeshCacheFile *file)
+{
+#ifdef _WIN32
+	HANDLE fh = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fh == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(fh, &size) || size.QuadPart == 0) {
+		CloseHandle(fh);
+		return false;
+	}
+
+	HANDLE mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+	void *base = mh ? MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (base == NULL) {
+		if (mh)
+			CloseHandle(mh);
+		CloseHandle(fh);
+		return false;
+	}
+
+	file->base = base;
+	file->size = (size_t)size.QuadPart;
+	file->file_handle = fh;
+	file->mapping_handle = mh;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return false;
+
+	file->base = base;
+	file->size = (size_t)st.st_size;
+	file->file_handle = NULL;
+	file->mapping_handle = NULL;
+#endif
+	return true;
+}
+
+void meshCacheClose(MeshCacheFile *file)
+{
+	if (file->base == NULL)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(file->base);
+	CloseHandle((HANDLE)file->mapping_handle);
+	CloseHandle((HANDLE)file->file_handle);
+#else
+	munmap(file->base, file->size);
+#endif
+	memset(file, 0, sizeof(*file));
+}
+
+static const void *Section(const MeshCacheFile *file, uint64_t offset, uint64_t size)
+{
+	if (offset == 0 || offset + size > file->size)
+		return NULL;
+	return (const char *)file->base + offset;
+}
+
+// The sections are in bounds; their contents have to be too before the
+// loaders index with them or hand them to GL
+static bool ContentIsValid(const MeshCacheData &data)
+{
+	for (uint32_t i = 0; i < data.range_count; i++) {
+		const MeshCacheRange &range = data.ranges[i];
+		if (range.material >= data.material_count || (uint64_t)range.first + range.count > data.index_count)
+			return false;
+	}
+	for (uint32_t i = 0; i < data.material_count; i++) {
+		if (memchr(data.materials[i].diffuse_texname, '\0', MESH_CACHE_PATH_LENGTH) == NULL)
+			return false;
+	}
+
+	if (data.index_size == 2) {
+		const uint16_t *indices = (const uint16_t *)data.indices;
+		for (uint32_t i = 0; i < data.index_count; i++) {
+			if (indices[i] >= data.vertex_count)
+				return false;
+		}
+	}
+	else {
+		const uint32_t *indices = (const uint32_t *)data.indices;
+		for (uint32_t i = 0; i < data.index_count; i++) {
+			if (indices[i] >= data.vertex_count)
+				return false;
+		}
+	}
+	return true;
+}
+
+bool meshCacheOpen(const char *model_path, const char *cache_path, MeshCacheFile *file)
+{
+	memset(file, 0, sizeof(*file));
+	if (!MapFile(cache_path, file))
+		return false;
+
+	const MeshCacheHeader *header = (const MeshCacheHeader *)file->base;
+	bool ok = file->size >= sizeof(MeshCacheHeader)
+		&& memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(header->magic)) == 0
+		&& header->version == MESH_CACHE_VERSION
+		&& header->file_size == file->size;
+
+	const MeshCacheDependency *deps = NULL;
+	if (ok) {
+		deps = (const MeshCacheDependency *)Section(file, header->dependency_offset, (uint64_t)header->dependency_count * sizeof(MeshCacheDependency));
+		ok = deps != NULL && header->dependency_count > 0;
+	}
+	// the paths come from the file, a corrupt one may leave them unterminated
+	for (uint32_t i = 0; ok && i < header->dependency_count; i++)
+		ok = deps[i].path[MESH_CACHE_PATH_LENGTH - 1] == '\0';
+	if (ok)
+		ok = strcmp(deps[0].path, model_path) == 0;
+	for (uint32_t i = 0; ok && i < header->dependency_count; i++)
+		ok = DependencyIsFresh(deps[i]);
+
+	if (ok) {
+		MeshCacheData &data = file->data;
+		data.vertex_count = header->vertex_count;
+		data.positions = (const float *)Section(file, header->positions_offset, (uint64_t)header->vertex_count * 3 * sizeof(float));
+		data.colors = (const float *)Section(file, header->colors_offset, (uint64_t)header->vertex_count * 3 * sizeof(float));
+		data.normals = (const float *)Section(file, header->normals_offset, (uint64_t)header->vertex_count * 3 * sizeof(float));
+		data.texcoords = (const float *)Section(file, header->texcoords_offset, (uint64_t)header->vertex_count * 2 * sizeof(float));
+		data.index_count = header->index_count;
+		data.index_size = header->index_size;
+		data.indices = Section(file, header->index_offset, (uint64_t)header->index_count * header->index_size);
+		data.range_count = header->range_count;
+		data.ranges = (const MeshCacheRange *)Section(file, header->range_offset, (uint64_t)header->range_count * sizeof(MeshCacheRange));
+		data.material_count = header->material_count;
+		data.materials = (const MeshCacheMaterial *)Section(file, header->material_offset, (uint64_t)header->material_count * sizeof(MeshCacheMaterial));
+		ok = data.positions != NULL
+			&& data.indices != NULL && (data.index_size == 2 || data.index_size == 4)
+			&& (data.ranges != NULL || data.range_count == 0)
+			&& (data.materials != NULL || data.material_count == 0)
+			&& ContentIsValid(data);
+	}
+
+	if (!ok)
+		meshCacheClose(file);
+	return ok;
+}
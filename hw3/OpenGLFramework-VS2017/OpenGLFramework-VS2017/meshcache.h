@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Binary mesh cache: the final vertex streams, index buffer, draw ranges and
+// material table of a loaded model, packed into one file next to the .obj so that a
+// warm startup can skip OBJ parsing and normalization entirely.
+// Bump MESH_CACHE_VERSION whenever the packed layout changes, or what the
+// loaders pack into it (normalization, range split, ...).
+#define MESH_CACHE_VERSION 4
+#define MESH_CACHE_PATH_LENGTH 256
+
+struct MeshCacheRange
+{
+	uint32_t first;       // first index of the range
+	uint32_t count;       // number of indices in the range
+	uint32_t material;    // index into the material table
+};
+
+struct MeshCacheMaterial
+{
+	float Ka[3];
+	float Kd[3];
+	float Ks[3];
+	char diffuse_texname[MESH_CACHE_PATH_LENGTH];
+};
+
+// View of the cached content. When read back from a cache file every pointer
+// points straight into the mapping; streams that a model does not have are NULL.
+struct MeshCacheData
+{
+	uint32_t vertex_count;
+	const float *positions;    // 3 floats per vertex
+	const float *colors;       // 3 floats per vertex
+	const float *normals;      // 3 floats per vertex
+	const float *texcoords;    // 2 floats per vertex
+
+	uint32_t index_count;      // triangle list
+	uint32_t index_size;       // 2 or 4 bytes per index
+	const void *indices;
+
+	uint32_t range_count;
+	const MeshCacheRange *ranges;
+
+	uint32_t material_count;
+	const MeshCacheMaterial *materials;
+};
+
+// A source file the cache is built from
+struct MeshCacheDependency
+{
+	uint64_t size;
+	int64_t mtime;
+	uint64_t hash;
+	char path[MESH_CACHE_PATH_LENGTH];
+};
+
+// The sources of an .obj (the .obj and every mtllib it references) as they
+// were before it was parsed, see meshCacheSnapshot
+struct MeshCacheSources
+{
+	std::vector<MeshCacheDependency> dependencies;
+};
+
+struct MeshCacheFile
+{
+	void *base;
+	size_t size;
+	void *file_handle;      // platform handles of the mapping
+	void *mapping_handle;
+	MeshCacheData data;
+};
+
+// Map the cache of an .obj and validate it against its sources (the .obj and
+// every mtllib it references). Returns false if the cache is missing, from an
+// older version, stale or inconsistent (ranges, indices or texture names out
+// of bounds); the caller then loads from source and rewrites it.
+bool meshCacheOpen(const char *model_path, const char *cache_path, MeshCacheFile *file);
+void meshCacheClose(MeshCacheFile *file);
+
+// Record the size, time and hash of an .obj and its mtllibs, to be called
+// before parsing it. mtl_base_dir is the directory its mtllib statements are
+// relative to. Returns false if the .obj cannot be read.
+bool meshCacheSnapshot(const char *model_path, const char *mtl_base_dir, MeshCacheSources *sources);
+
+// Write the cache of an .obj from what was parsed after sources were taken.
+// Returns false, writing nothing, if a source has changed since, as the
+// cache would then pair the old geometry with the new file; or if the file
+// cannot be written.
+bool meshCacheWrite(const MeshCacheSources &sources, const char *cache_path, const MeshCacheData &data);
@@ -0,0 +1,269 @@
+#include "mipchain.h"
+
+#include <math.h>
+#include <algorithm>
+#include <thread>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define MIP_CHAIN_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// linear values are rounded to 1/LINEAR_STEPS before the sRGB lookup;
+// near black one step is 0.05 of an sRGB step
+#define LINEAR_STEPS 65535
+
+// Rows of a level below which starting another thread does not pay
+#define MIN_THREAD_ROWS 64
+
+struct SrgbTables
+{
+	float to_linear[256];
+	float alpha[256];
+	unsigned char to_srgb[LINEAR_STEPS + 1];
+
+	SrgbTables()
+	{
+		for (int i = 0; i < 256; i++) {
+			float c = i / 255.0f;
+			to_linear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+			alpha[i] = c;
+		}
+		for (int i = 0; i <= LINEAR_STEPS; i++) {
+			float c = (float)i / LINEAR_STEPS;
+			c = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+			to_srgb[i] = (unsigned char)max(0.0f, min(255.0f, c * 255.0f + 0.5f));
+		}
+	}
+};
+
+// built on first use, also from several decode threads at once
+static const SrgbTables &Tables()
+{
+	static SrgbTables tables;
+	return tables;
+}
+
+// The texels of the level above that make up one texel, along one axis
+struct MipTaps
+{
+	int first, count;
+	float weights[3];
+};
+
+static void AxisTaps(int size, int dst_size, vector<MipTaps> &taps)
+{
+	taps.resize(dst_size);
+	for (int i = 0; i < dst_size; i++) {
+		MipTaps &t = taps[i];
+		t.first = 2 * i;
+		if (size == 1) {
+			t.count = 1;
+			t.weights[0] = 1.0f;
+		}
+		else if (size % 2 == 0) {
+			t.count = 2;
+			t.weights[0] = t.weights[1] = 0.5f;
+		}
+		else {
+			// size = 2 * dst_size + 1: texel i covers the source span
+			// [i * size / dst_size, (i + 1) * size / dst_size)
+			t.count = 3;
+			t.weights[0] = (float)(dst_size - i) / size;
+			t.weights[1] = (float)dst_size / size;
+			t.weights[2] = (float)(i + 1) / size;
+		}
+	}
+}
+
+// One level to filter from the one above. The base level is read as sRGB
+// bytes and converted a row at a time, the others are linear floats.
+struct MipLevelJob
+{
+	const unsigned char *base;  // the level above if it is the base level
+	const float *above;         // the level above otherwise
+	int width;                  // of the level above
+	const MipTaps *x_taps, *y_taps;
+	int dst_width;
+	float *linear;              // the filtered level, NULL for the last one
+	unsigned char *out;         // ... rounded to sRGB bytes
+};
+
+// Row y of the level above in linear floats, scratch holds width * 4 floats
+static const float *SourceRow(const MipLevelJob &job, int y, float *scratch)
+{
+	if (job.base == NULL)
+		return job.above + (size_t)y * job.width * 4;
+	const SrgbTables &tables = Tables();
+	const unsigned char *row = job.base + (size_t)y * job.width * 4;
+	for (int i = 0; i < job.width * 4; i += 4) {
+		scratch[i] = tables.to_linear[row[i]];
+		scratch[i + 1] = tables.to_linear[row[i + 1]];
+		scratch[i + 2] = tables.to_linear[row[i + 2]];
+		scratch[i + 3] = tables.alpha[row[i + 3]];
+	}
+	return scratch;
+}
+
+static void FilterRowsScalar(const MipLevelJob &job, int first, int last)
+{
+	const SrgbTables &tables = Tables();
+	vector<float> scratch(job.base != NULL ? (size_t)job.width * 4 * 3 : 0);
+	for (int y = first; y < last; y++) {
+		const MipTaps &ty = job.y_taps[y];
+		const float *rows[3];
+		for (int k = 0; k < ty.count; k++)
+			rows[k] = SourceRow(job, ty.first + k, scratch.data() + (size_t)k * job.width * 4);
+
+		for (int x = 0; x < job.dst_width; x++) {
+			const MipTaps &tx = job.x_taps[x];
+			float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int k = 0; k < ty.count; k++) {
+				float across[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+				for (int j = 0; j < tx.count; j++) {
+					const float *texel = rows[k] + (tx.first + j) * 4;
+					for (int c = 0; c < 4; c++)
+						across[c] += tx.weights[j] * texel[c];
+				}
+				for (int c = 0; c < 4; c++)
+					sum[c] += ty.weights[k] * across[c];
+			}
+
+			size_t i = ((size_t)y * job.dst_width + x) * 4;
+			for (int c = 0; c < 4; c++) {
+				if (job.linear != NULL)
+					job.linear[i + c] = sum[c];
+				float v = min(max(sum[c], 0.0f), 1.0f);
+				int q = (int)(v * (c < 3 ? (float)LINEAR_STEPS : 255.0f) + 0.5f);
+				job.out[i + c] = c < 3 ? tables.to_srgb[q] : (unsigned char)q;
+			}
+		}
+	}
+}
+
+#ifdef MIP_CHAIN_SSE
+
+// A texel is one register, RGBA in the four lanes. The arithmetic is the
+// scalar kernel's, lane for lane and in the same order: the 2x2 case adds
+// the pairs first and scales by 0.25 once, which is exact against the
+// scalar 0.5 * (0.5 * a + 0.5 * b) + ... because the weights are powers of 2.
+static void FilterRowsSse(const MipLevelJob &job, int first, int last)
+{
+	const SrgbTables &tables = Tables();
+	vector<float> scratch(job.base != NULL ? (size_t)job.width * 4 * 3 : 0);
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f), quarter = _mm_set1_ps(0.25f);
+	const __m128 steps = _mm_set_ps(255.0f, (float)LINEAR_STEPS, (float)LINEAR_STEPS, (float)LINEAR_STEPS);
+	bool pairs_x = job.width % 2 == 0;
+
+	for (int y = first; y < last; y++) {
+		const MipTaps &ty = job.y_taps[y];
+		const float *rows[3];
+		for (int k = 0; k < ty.count; k++)
+			rows[k] = SourceRow(job, ty.first + k, scratch.data() + (size_t)k * job.width * 4);
+		float *linear = job.linear != NULL ? job.linear + (size_t)y * job.dst_width * 4 : NULL;
+		unsigned char *out = job.out + (size_t)y * job.dst_width * 4;
+
+		for (int x = 0; x < job.dst_width; x++) {
+			__m128 sum;
+			if (pairs_x && ty.count == 2) {
+				const float *a = rows[0] + x * 8, *b = rows[1] + x * 8;
+				__m128 top = _mm_add_ps(_mm_loadu_ps(a), _mm_loadu_ps(a + 4));
+				__m128 bottom = _mm_add_ps(_mm_loadu_ps(b), _mm_loadu_ps(b + 4));
+				sum = _mm_mul_ps(quarter, _mm_add_ps(top, bottom));
+			}
+			else {
+				const MipTaps &tx = job.x_taps[x];
+				sum = zero;
+				for (int k = 0; k < ty.count; k++) {
+					__m128 across = zero;
+					for (int j = 0; j < tx.count; j++)
+						across = _mm_add_ps(across, _mm_mul_ps(_mm_set1_ps(tx.weights[j]), _mm_loadu_ps(rows[k] + (tx.first + j) * 4)));
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(ty.weights[k]), across));
+				}
+			}
+
+			if (linear != NULL)
+				_mm_storeu_ps(linear + x * 4, sum);
+			__m128 v = _mm_min_ps(_mm_max_ps(sum, zero), one);
+			int q[4];
+			_mm_storeu_si128((__m128i *)q, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, steps), half)));
+			out[x * 4] = tables.to_srgb[q[0]];
+			out[x * 4 + 1] = tables.to_srgb[q[1]];
+			out[x * 4 + 2] = tables.to_srgb[q[2]];
+			out[x * 4 + 3] = (unsigned char)q[3];
+		}
+	}
+}
+
+#endif
+
+typedef void (*FilterRows)(const MipLevelJob &job, int first, int last);
+
+static void BuildChain(FilterRows filter, const unsigned char *pixels, int width, int height, MipChain &chain, int threads)
+{
+	chain.widths.clear();
+	chain.heights.clear();
+	chain.levels.clear();
+	vector<float> above, below;
+	vector<MipTaps> x_taps, y_taps;
+
+	while (width > 1 || height > 1) {
+		int dst_width = max(1, width / 2), dst_height = max(1, height / 2);
+		bool last = dst_width == 1 && dst_height == 1;
+		AxisTaps(width, dst_width, x_taps);
+		AxisTaps(height, dst_height, y_taps);
+		below.resize(last ? 0 : (size_t)dst_width * dst_height * 4);
+		chain.widths.push_back(dst_width);
+		chain.heights.push_back(dst_height);
+		chain.levels.push_back(vector<unsigned char>((size_t)dst_width * dst_height * 4));
+
+		MipLevelJob job;
+		job.base = chain.levels.size() == 1 ? pixels : NULL;
+		job.above = above.data();
+		job.width = width;
+		job.x_taps = x_taps.data();
+		job.y_taps = y_taps.data();
+		job.dst_width = dst_width;
+		job.linear = last ? NULL : below.data();
+		job.out = chain.levels.back().data();
+
+		int level_threads = max(1, min(threads, dst_height / MIN_THREAD_ROWS));
+		vector<thread> workers;
+		for (int t = 1; t < level_threads; t++)
+			workers.push_back(thread(filter, job, dst_height * t / level_threads, dst_height * (t + 1) / level_threads));
+		filter(job, 0, dst_height / level_threads);
+		for (size_t t = 0; t < workers.size(); t++)
+			workers[t].join();
+
+		above.swap(below);
+		width = dst_width;
+		height = dst_height;
+	}
+}
+
+int mipLevelCount(int width, int height)
+{
+	int count = 1;
+	while (width > 1 || height > 1) {
+		width = max(1, width / 2);
+		height = max(1, height / 2);
+		count++;
+	}
+	return count;
+}
+
+void buildMipChainScalar(const unsigned char *pixels, int width, int height, MipChain &chain)
+{
+	BuildChain(FilterRowsScalar, pixels, width, height, chain, 1);
+}
+
+void buildMipChain(const unsigned char *pixels, int width, int height, MipChain &chain, int threads)
+{
+#ifdef MIP_CHAIN_SSE
+	BuildChain(FilterRowsSse, pixels, width, height, chain, threads);
+#else
+	BuildChain(FilterRowsScalar, pixels, width, height, chain, threads);
+#endif
+}
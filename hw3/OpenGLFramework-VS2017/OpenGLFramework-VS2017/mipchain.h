@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+
+// The mip levels of an RGBA8 image below its base level, level 1 first and
+// down to 1x1. The base level stays with the caller.
+struct MipChain
+{
+	std::vector<int> widths, heights;
+	std::vector<std::vector<unsigned char> > levels;
+};
+
+// Levels of a full chain down to 1x1, the base level included
+int mipLevelCount(int width, int height);
+
+// Box-filter every level from the one above in linear light: the colour
+// channels are sRGB-encoded, alpha is linear. An odd size takes three
+// source texels per texel, weighted by how much of each it covers, so
+// non-power-of-two images lose no row or column. Levels are filtered from
+// the float result of the one above rather than from its 8-bit rounding.
+// The rows of each level are split over threads; SSE where available.
+void buildMipChain(const unsigned char *pixels, int width, int height, MipChain &chain, int threads = 1);
+
+// Plain scalar version, the reference for the SIMD kernel; the result is
+// identical
+void buildMipChainScalar(const unsigned char *pixels, int width, int height, MipChain &chain);
@@ -0,0 +1,359 @@
+#include "programcache.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "textfile.h"
+
+using namespace std;
+
+static const char PROGRAM_BINARY_MAGIC[4] = { 'P', 'B', 'I', 'N' };
+static const uint32_t PROGRAM_BINARY_VERSION = 1;
+
+// Followed by the key text and then the binary
+struct ProgramBinaryHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t key_size;
+	uint32_t format;        // binaryFormat of glGetProgramBinary
+	uint64_t binary_size;
+	double build_ms;        // compiling and linking it took
+};
+
+static string vertex_source;
+static string fragment_source;
+static map<string, GLuint> programs;    // 0 for those that failed
+static ProgramCacheStats stats = { 0, 0.0, 0, 0, 0.0 };
+
+static string binary_dir;   // "" while binaries are off
+static string context_key;  // GL vendor, renderer and version
+
+bool programCacheSetSources(const char *vertex_path, const char *fragment_path)
+{
+	char *vs = textFileRead(vertex_path);
+	char *fs = textFileRead(fragment_path);
+	bool ok = vs != NULL && fs != NULL;
+	if (ok)
+	{
+		vertex_source = vs;
+		fragment_source = fs;
+	}
+	free(vs);
+	free(fs);
+	return ok;
+}
+
+bool programCacheUseBinaries(const string &dir)
+{
+	binary_dir.clear();
+	if (dir.empty())
+		return true;
+	if (glGetProgramBinary == NULL || glProgramBinary == NULL || glProgramParameteri == NULL)
+		return false;
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (formats <= 0)
+		return false;
+
+#ifdef _WIN32
+	_mkdir(dir.c_str());
+#else
+	mkdir(dir.c_str(), 0755);
+#endif
+	binary_dir = dir;
+	if (binary_dir[binary_dir.size() - 1] != '/' && binary_dir[binary_dir.size() - 1] != '\\')
+		binary_dir += '/';
+	context_key = string((const char *)glGetString(GL_VENDOR)) + "\n" + (const char *)glGetString(GL_RENDERER) + "\n" + (const char *)glGetString(GL_VERSION) + "\n";
+	return true;
+}
+
+// 64-bit FNV-1a
+static uint64_t HashBytes(const char *data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// What a binary has to match: the context, the defines and a hash of the
+// sources. Stored in the file, its hash names it.
+static string BinaryKey(const string &defines)
+{
+	uint64_t hash = HashBytes(vertex_source.data(), vertex_source.size());
+	hash = HashBytes(fragment_source.data(), fragment_source.size(), hash);
+	char source_hash[32];
+	snprintf(source_hash, sizeof(source_hash), "%016llx\n", (unsigned long long)hash);
+	return context_key + source_hash + defines;
+}
+
+static string BinaryPath(const string &key)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "program.%016llx.bin", (unsigned long long)HashBytes(key.data(), key.size()));
+	return binary_dir + name;
+}
+
+// Start loading the binary saved for key into a new program, 0 if there
+// is none. build_ms is what compiling it took.
+static GLuint IssueBinaryLoad(const string &key, double *build_ms)
+{
+	FILE *fp = fopen(BinaryPath(key).c_str(), "rb");
+	if (fp == NULL)
+		return 0;
+	fseek(fp, 0, SEEK_END);
+	long file_size = ftell(fp);
+	rewind(fp);
+
+	// the sizes come from the file, a corrupt or truncated one must not make
+	// us allocate more than it holds
+	ProgramBinaryHeader header;
+	string stored_key;
+	vector<char> binary;
+	bool ok = file_size > 0 && fread(&header, sizeof(header), 1, fp) == 1
+		&& memcmp(header.magic, PROGRAM_BINARY_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == PROGRAM_BINARY_VERSION && header.key_size == key.size()
+		&& (uint64_t)file_size >= sizeof(header) + header.key_size
+		&& header.binary_size == (uint64_t)file_size - sizeof(header) - header.key_size;
+	if (ok)
+	{
+		stored_key.resize(header.key_size);
+		binary.resize((size_t)header.binary_size);
+		ok = fread(&stored_key[0], 1, stored_key.size(), fp) == stored_key.size() && stored_key == key
+			&& !binary.empty() && fread(binary.data(), 1, binary.size(), fp) == binary.size();
+	}
+	fclose(fp);
+	if (!ok)
+		return 0;
+
+	GLuint p = glCreateProgram();
+	glProgramBinary(p, header.format, binary.data(), (GLsizei)binary.size());
+	*build_ms = header.build_ms;
+	return p;
+}
+
+static void SaveBinary(GLuint p, const string &key, double build_ms)
+{
+	GLint length = 0;
+	glGetProgramiv(p, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	vector<char> binary(length);
+	GLenum format;
+	glGetProgramBinary(p, length, &length, &format, binary.data());
+
+	ProgramBinaryHeader header;
+	memcpy(header.magic, PROGRAM_BINARY_MAGIC, sizeof(header.magic));
+	header.version = PROGRAM_BINARY_VERSION;
+	header.key_size = (uint32_t)key.size();
+	header.format = format;
+	header.binary_size = (uint64_t)length;
+	header.build_ms = build_ms;
+
+	string path = BinaryPath(key);
+	FILE *fp = fopen(path.c_str(), "wb");
+	if (fp == NULL)
+		return;
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+		&& fwrite(key.data(), 1, key.size(), fp) == key.size()
+		&& fwrite(binary.data(), 1, length, fp) == (size_t)length;
+	if (fclose(fp) != 0 || !ok)
+		remove(path.c_str());
+}
+
+// The source with defines after its #version line, which has to come first
+static string Specialize(const string &source, const string &defines)
+{
+	size_t version = source.find("#version");
+	size_t line_end = version == string::npos ? string::npos : source.find('\n', version);
+	if (line_end == string::npos)
+		return defines + source;
+	return source.substr(0, line_end + 1) + defines + source.substr(line_end + 1);
+}
+
+static GLuint IssueCompile(GLenum type, const string &source, const string &defines)
+{
+	GLuint shader = glCreateShader(type);
+	string text = Specialize(source, defines);
+	const GLchar *text_ptr = text.c_str();
+	glShaderSource(shader, 1, &text_ptr, NULL);
+	glCompileShader(shader);
+	return shader;
+}
+
+// A program whose compile and link calls, or binary load, are made but not
+// looked at yet
+struct PendingProgram
+{
+	GLuint program;
+	GLuint shaders[2];      // vertex and fragment, 0 when loading a binary
+	string key;             // of its binary, "" while binaries are off
+	double call_ms;         // spent in its calls so far
+	double saved_build_ms;  // for a binary, what compiling it took
+};
+
+static map<string, PendingProgram> pending;
+static bool use_completion_status = false;
+
+static void IssueBuild(const string &defines, PendingProgram &build, bool try_binary)
+{
+	build.shaders[0] = build.shaders[1] = 0;
+	if (try_binary && !build.key.empty())
+	{
+		build.program = IssueBinaryLoad(build.key, &build.saved_build_ms);
+		if (build.program != 0)
+			return;
+	}
+	build.shaders[0] = IssueCompile(GL_VERTEX_SHADER, vertex_source, defines);
+	build.shaders[1] = IssueCompile(GL_FRAGMENT_SHADER, fragment_source, defines);
+	build.program = glCreateProgram();
+	glAttachShader(build.program, build.shaders[1]);
+	glAttachShader(build.program, build.shaders[0]);
+	if (!build.key.empty())
+		glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(build.program);
+}
+
+void programCacheRequest(const string &defines)
+{
+	if (programs.find(defines) != programs.end() || pending.find(defines) != pending.end())
+		return;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	PendingProgram &build = pending[defines];
+	build.key = binary_dir.empty() ? string() : BinaryKey(defines);
+	build.saved_build_ms = 0.0;
+	IssueBuild(defines, build, true);
+	build.call_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Look at the outcome of a build, waiting for it if the driver is not done.
+// Returns false if it has to go on: a rejected binary is compiled instead.
+static bool FinishBuild(const string &defines, PendingProgram &build)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	GLuint p = build.program;
+	GLint success;
+	glGetProgramiv(p, GL_LINK_STATUS, &success);
+	if (build.shaders[0] == 0)
+	{
+		if (!success)
+		{
+			// a driver may refuse binaries of its own after all, e.g. when
+			// something it depends on changed without the version string
+			glDeleteProgram(p);
+			stats.binaries_rejected++;
+			IssueBuild(defines, build, false);
+			build.call_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			return false;
+		}
+		build.call_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		stats.binaries_loaded++;
+		stats.saved_ms += build.saved_build_ms - build.call_ms;
+	}
+	else
+	{
+		if (!success)
+		{
+			char infoLog[1000];
+			bool compiled = true;
+			for (int i = 0; i < 2; i++)
+			{
+				GLint shader_success;
+				glGetShaderiv(build.shaders[i], GL_COMPILE_STATUS, &shader_success);
+				if (!shader_success)
+				{
+					glGetShaderInfoLog(build.shaders[i], 1000, NULL, infoLog);
+					printf("ERROR: %s SHADER COMPILATION FAILED\n%s%s\n", i == 0 ? "VERTEX" : "FRAGMENT", defines.c_str(), infoLog);
+					compiled = false;
+				}
+			}
+			if (compiled)
+			{
+				glGetProgramInfoLog(p, 1000, NULL, infoLog);
+				printf("ERROR: SHADER PROGRAM LINKING FAILED\n%s%s\n", defines.c_str(), infoLog);
+			}
+			glDeleteProgram(p);
+			p = 0;
+		}
+		glDeleteShader(build.shaders[0]);
+		glDeleteShader(build.shaders[1]);
+		build.call_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		if (p != 0 && !build.key.empty())
+			SaveBinary(p, build.key, build.call_ms);
+	}
+	stats.programs++;
+	stats.build_ms += build.call_ms;
+	programs[defines] = p;
+	return true;
+}
+
+GLuint programCacheGet(const string &defines, bool *created)
+{
+	*created = false;
+	map<string, GLuint>::iterator it = programs.find(defines);
+	if (it != programs.end())
+		return it->second;
+
+	programCacheRequest(defines);
+	map<string, PendingProgram>::iterator build = pending.find(defines);
+	while (!FinishBuild(defines, build->second))
+		;
+	pending.erase(build);
+	GLuint p = programs[defines];
+	*created = p != 0;
+	return p;
+}
+
+GLuint programCachePoll(const string &defines, bool *created)
+{
+	*created = false;
+	map<string, GLuint>::iterator it = programs.find(defines);
+	if (it != programs.end())
+		return it->second;
+	map<string, PendingProgram>::iterator build = pending.find(defines);
+	if (build == pending.end())
+		return programCacheGet(defines, created);
+
+	if (use_completion_status)
+	{
+		GLint done;
+		glGetProgramiv(build->second.program, GL_COMPLETION_STATUS_KHR, &done);
+		if (!done)
+			return 0;
+	}
+	if (!FinishBuild(defines, build->second))
+		return 0;
+	pending.erase(build);
+	GLuint p = programs[defines];
+	*created = p != 0;
+	return p;
+}
+
+int programCachePending()
+{
+	return (int)pending.size();
+}
+
+void programCacheUseCompletionStatus(bool on)
+{
+	use_completion_status = on;
+}
+
+ProgramCacheStats programCacheStats()
+{
+	return stats;
+}
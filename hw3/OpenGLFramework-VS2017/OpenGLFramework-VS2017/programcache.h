@@ -0,0 +1,73 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <string>
+
+// Shader programs built from one vertex and one fragment shader source,
+// specialized by #define lines put right after the #version line of both.
+// Each set of defines is compiled and linked on first use and kept, keyed
+// by its text, so asking again costs a map lookup. With binaries on, a
+// linked program is also saved with glGetProgramBinary and later runs load
+// it with glProgramBinary instead of compiling. Programs can also be
+// requested ahead and picked up once the driver has finished them, see
+// programCacheRequest. GL thread only.
+
+// GL_KHR_parallel_shader_compile, and GL_ARB_parallel_shader_compile with
+// the same values, which the glad here does not load
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+// Read the shader files the programs are built from; programs already
+// built are kept. Returns false if a file cannot be read.
+bool programCacheSetSources(const char *vertex_path, const char *fragment_path);
+
+// Save and load program binaries in the directory dir, created if need be;
+// "" turns them off, the default. A binary is keyed by a hash of both
+// sources, the defines and the GL vendor, renderer and version strings, so
+// editing a shader or updating the driver makes a new one. Returns false,
+// leaving them off, when the context has no binary formats (below GL 4.1
+// without GL_ARB_get_program_binary, or none offered).
+bool programCacheUseBinaries(const std::string &dir);
+
+// The program for a set of defines such as "#define LIGHT_TYPE 1\n", ""
+// for the sources as they are. created is set when this call linked or
+// loaded it, so the caller can look up its uniforms and set their values.
+// Returns 0, after printing the log, if it does not compile or link; that
+// is remembered too. Waits for the driver if it was requested.
+GLuint programCacheGet(const std::string &defines, bool *created);
+
+// Make the compile and link calls of the program for defines, or load its
+// binary, without looking at the outcome, which would wait for the driver;
+// programCachePoll or programCacheGet pick it up later. Does nothing for a
+// program already built or requested.
+void programCacheRequest(const std::string &defines);
+
+// The program for defines if it is built, without waiting for a requested
+// one the driver is still working on: 0 while it is, or if it failed,
+// otherwise as programCacheGet. A program not requested before is built
+// as by programCacheGet.
+GLuint programCachePoll(const std::string &defines, bool *created);
+
+// Requested programs not picked up yet
+int programCachePending();
+
+// With GL_KHR_parallel_shader_compile the driver compiles and links on
+// threads of its own; on, programCachePoll asks GL_COMPLETION_STATUS_KHR
+// whether a program is done. Off, the default, it takes every requested
+// program as done, since asking for a link status waits until it is.
+void programCacheUseCompletionStatus(bool on);
+
+struct ProgramCacheStats
+{
+	int programs;           // linked or loaded, failures included
+	double build_ms;        // spent in the calls compiling, linking and loading
+	                        // them; the work of a driver compiling on threads
+	                        // of its own is not in it
+	int binaries_loaded;    // programs loaded from a binary
+	int binaries_rejected;  // binaries the driver refused, compiled instead
+	double saved_ms;        // what compiling the loaded ones took when they were
+	                        // saved, less the time loading them took
+};
+ProgramCacheStats programCacheStats();
@@ -1,27 +1,39 @@
 #version 330
 
+// LIGHT_TYPE, SHADING and TEXTURE_SOURCE select a variant, see shader.vs.glsl
+#define SHADE_PER_VERTEX 0
+#define SHADE_PER_PIXEL 1
+#define SHADE_SPLIT 2
+#define TEXTURE_NONE 0
+#define TEXTURE_2D 1	// texture_from_main
+#define TEXTURE_ARRAY 2	// layer texture_layer of texture_array
+
 in vec2 texCoord;
+flat in vec4 tint;	// of the crowd copy, white otherwise
 
 /* ---------- [HW2] Lighting ---------- */
 in vec3 vertex_color;
 in vec3 vertex_normal;
-in vec3 frag_aPos;
+in vec3 view_pos;	// fragment position in view space
+flat in int shade_perpixel;	// is_perpixel, or the half of a dual-viewport draw
 /* ------------------------------------ */
 
 out vec4 fragColor;
 
 /* ---------- [HW2] Lighting ---------- */
+// std140, see LightBlockEntry in main.cpp; the positions are in view
+// space already, the directional light's is the direction towards it
 struct LightingAttrib
 {
 	vec3 position;
+	float shininess;
 	vec3 ambient;
+	float spot_exponent;
 	vec3 diffuse;
+	float spot_cos_cutoff;
 	vec3 specular;
-	vec3 spot_direction;
-	float spot_exponent;
-	float spot_cutoff;
-	float shininess;
 	float constant_attenuation;
+	vec3 spot_direction;
 	float linear_attenuation;
 	float quadratic_attenuation;
 };
@@ -34,31 +46,45 @@ struct PhongMaterial
 };
 
 // Use "uniform" to represent "constant" values in shaders (cannot be altered during a draw command)
-uniform mat4 um4p;     // projection
-uniform mat4 um4v;     // viewing transformation
-uniform mat4 um4m;     // model transformation
+#ifdef LIGHT_TYPE
+#define LIGHTING_MODE LIGHT_TYPE
+#else
 uniform int lighting_mode;
-uniform int is_perpixel;
-uniform LightingAttrib lighting_attrib[3];   // for directional, point, and spot lights
-uniform PhongMaterial material;
+#define LIGHTING_MODE lighting_mode
+#endif
+#if defined(SHADING) && SHADING != SHADE_SPLIT
+#define LIGHT_PER_PIXEL (SHADING == SHADE_PER_PIXEL)
+#else
+#define LIGHT_PER_PIXEL (shade_perpixel == 1)
+#endif
+layout (std140) uniform Lights
+{
+	LightingAttrib lighting_attrib[3];   // for directional, point, and spot lights
+};
+layout (std140) uniform Material
+{
+	PhongMaterial material;
+};
 /* ------------------------------------ */
 
 // [TODO] passing texture from main.cpp
 // Hint: sampler2D
 uniform sampler2D texture_from_main;
 
+// --texture-arrays: the model's textures are the layers of one array,
+// texture_layer < 0 samples texture_from_main instead
+uniform sampler2DArray texture_array;
+uniform int texture_layer;
+
 
 /* ---------- [HW2] Lighting Functions ---------- */
-vec3 directional_light(vec3 v_normal)
+vec3 directional_light(vec3 v_normal, vec3 view_vertex_pos)
 {
 	vec3 n = normalize(v_normal);
-	// Transform the light position from world space to view space
-	vec3 view_light_pos = (um4v * vec4(lighting_attrib[0].position, 1.0)).xyz;
-	vec3 view_origin_pos = (um4v * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
-	// Calculate the normalized light direction vector
-	vec3 L = normalize(view_light_pos - view_origin_pos);
+	// Calculate the normalized light direction vector, given in view space
+	vec3 L = normalize(lighting_attrib[0].position);
 	// Calculate the viewpoint direction vector
-	vec3 V = -(um4v * um4m * vec4(frag_aPos, 1.0)).xyz;
+	vec3 V = -view_vertex_pos;
 	// Calculate the unit halfway vector between light direction and viewpoint direction
 	vec3 H = normalize(L + V);
 	
@@ -69,13 +95,11 @@ vec3 directional_light(vec3 v_normal)
 	return clamp(ambient_term + diffuse_term + specular_term, 0.0, 1.0);
 }
 
-vec3 point_light(vec3 v_normal)
+vec3 point_light(vec3 v_normal, vec3 view_vertex_pos)
 {
 	vec3 n = normalize(v_normal);
-	// Transform the light position from world space to view space
-	vec3 view_light_pos = (um4v * vec4(lighting_attrib[1].position, 1.0)).xyz;
-	// Transform the vertex position from world space to view space
-	vec3 view_vertex_pos = (um4v * um4m * vec4(frag_aPos, 1.0)).xyz;
+	// The light position, given in view space
+	vec3 view_light_pos = lighting_attrib[1].position;
 	// Calculate the unit vector L that points from the vertex to light position
 	vec3 L = normalize(view_light_pos - view_vertex_pos);
 	// Calculate the viewpoint direction vector
@@ -96,13 +120,11 @@ vec3 point_light(vec3 v_normal)
 	return clamp(ambient_term + f_att * diffuse_term + f_att * specular_term, 0.0, 1.0);
 }
 
-vec3 spot_light(vec3 v_normal)
+vec3 spot_light(vec3 v_normal, vec3 view_vertex_pos)
 {
 	vec3 n = normalize(v_normal);
-	// Transform the light position from world space to view space
-	vec3 view_light_pos = (um4v * vec4(lighting_attrib[2].position, 1.0)).xyz;
-	// Transform the vertex position from world space to view space
-	vec3 view_vertex_pos = (um4v * um4m * vec4(frag_aPos, 1.0)).xyz;
+	// The light position, given in view space
+	vec3 view_light_pos = lighting_attrib[2].position;
 	// Calculate the unit vector L that points from the vertex to light position
 	vec3 L = normalize(view_light_pos - view_vertex_pos);
 	// Calculate the viewpoint direction vector
@@ -122,7 +144,7 @@ vec3 spot_light(vec3 v_normal)
 	float v_dot_d = dot(spot_to_vert, spot_dir);
 
 	float spot_effect;
-	if (v_dot_d >= cos(radians(lighting_attrib[2].spot_cutoff)))
+	if (v_dot_d >= lighting_attrib[2].spot_cos_cutoff)
 		spot_effect = pow(max(v_dot_d, 0), lighting_attrib[2].spot_exponent);
 	else
 		spot_effect = 0;
@@ -137,13 +159,13 @@ vec3 spot_light(vec3 v_normal)
 
 
 void main() {
-	if (is_perpixel == 1) {
-		if (lighting_mode == 0)
-			fragColor = vec4(directional_light(vertex_normal), 1.0f);
-		else if (lighting_mode == 1)
-			fragColor = vec4(point_light(vertex_normal), 1.0f);
+	if (LIGHT_PER_PIXEL) {
+		if (LIGHTING_MODE == 0)
+			fragColor = vec4(directional_light(vertex_normal, view_pos), 1.0f);
+		else if (LIGHTING_MODE == 1)
+			fragColor = vec4(point_light(vertex_normal, view_pos), 1.0f);
 		else
-			fragColor = vec4(spot_light(vertex_normal), 1.0f);
+			fragColor = vec4(spot_light(vertex_normal, view_pos), 1.0f);
 	}
 	else
 		fragColor = vec4(vertex_color, 1.0f);
@@ -152,5 +174,15 @@ void main() {
 
 	// [TODO] sampleing from texture
 	// Hint: texture
+#if !defined(TEXTURE_SOURCE)
+	if (texture_layer >= 0)
+		fragColor *= texture(texture_array, vec3(texCoord, texture_layer));
+	else
+		fragColor *= texture(texture_from_main, texCoord);
+#elif TEXTURE_SOURCE == TEXTURE_2D
 	fragColor *= texture(texture_from_main, texCoord);
+#elif TEXTURE_SOURCE == TEXTURE_ARRAY
+	fragColor *= texture(texture_array, vec3(texCoord, texture_layer));
+#endif
+	fragColor *= tint;
 }
@@ -1,28 +1,45 @@
 #version 330
 
+// main.cpp builds variants of these shaders by defining LIGHT_TYPE (0-2,
+// as lighting_mode), SHADING and TEXTURE_SOURCE after the #version line,
+// see setShaders; without them they are the uber-shader that decides per
+// draw from uniforms.
+#define SHADE_PER_VERTEX 0
+#define SHADE_PER_PIXEL 1
+#define SHADE_SPLIT 2	// dual viewport: even instances per vertex, odd ones per pixel
+
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aColor;
 layout (location = 2) in vec3 aNormal;
 layout (location = 3) in vec2 aTexCoord;
+// a copy of a crowd draw, see InstanceData in main.cpp; outside crowd draws
+// these are not enabled and read the identity, white and -1
+layout (location = 4) in mat4 aInstanceModel;	// placement in model space, rotation, uniform scale and translation
+layout (location = 8) in vec4 aInstanceTint;
+layout (location = 9) in int aInstanceEyeOffset;	// into eye_offsets, -1 for x_offset and y_offset
 
 out vec2 texCoord;
+flat out vec4 tint;
 
 /* ---------- [HW2] Lighting ---------- */
 out vec3 vertex_color;
 out vec3 vertex_normal;
-out vec3 frag_aPos;
+out vec3 view_pos;	// vertex position in view space
+flat out int shade_perpixel;
 
+// std140, see LightBlockEntry in main.cpp; the positions are in view
+// space already, the directional light's is the direction towards it
 struct LightingAttrib
 {
 	vec3 position;
+	float shininess;
 	vec3 ambient;
+	float spot_exponent;
 	vec3 diffuse;
+	float spot_cos_cutoff;
 	vec3 specular;
-	vec3 spot_direction;
-	float spot_exponent;
-	float spot_cutoff;
-	float shininess;
 	float constant_attenuation;
+	vec3 spot_direction;
 	float linear_attenuation;
 	float quadratic_attenuation;
 };
@@ -35,33 +52,61 @@ struct PhongMaterial
 };
 
 // Use "uniform" to represent "constant" values in shaders (cannot be altered during a draw command)
+#ifdef LIGHT_TYPE
+#define LIGHTING_MODE LIGHT_TYPE
+#else
 uniform int lighting_mode;
-uniform int is_perpixel;
-uniform LightingAttrib lighting_attrib[3];   // for directional, point, and spot lights
-uniform PhongMaterial material;
+#define LIGHTING_MODE lighting_mode
+#endif
+layout (std140) uniform Lights
+{
+	LightingAttrib lighting_attrib[3];   // for directional, point, and spot lights
+};
+layout (std140) uniform Material
+{
+	PhongMaterial material;
+};
 /* ------------------------------------ */
 
-uniform mat4 um4p;     // projection
-uniform mat4 um4v;     // viewing transformation
-uniform mat4 um4m;     // model transformation
+// std140, see TransformBlock in main.cpp; computed once per object on the CPU
+layout (std140) uniform Transform
+{
+	mat4 um4m;     // model transformation
+	mat4 um4mv;    // viewing * model
+	mat4 um4mvp;   // projection * viewing * model
+	mat3 um3n;     // normal matrix, transpose(inverse(um4mv))
+};
 
 // [TODO] passing uniform variable for texture coordinate offset
 uniform float x_offset;
 uniform float y_offset;
 uniform int texture_is_eye;
+uniform vec2 eye_offsets[7];	// EYE_OFFSETS in main.cpp
+
+#ifdef SHADING
+#define SPLIT_VIEWPORT (SHADING == SHADE_SPLIT)
+#define LIGHT_PER_VERTEX (SHADING == SHADE_PER_VERTEX || (SHADING == SHADE_SPLIT && (gl_InstanceID & 1) == 0))
+#define IS_PERPIXEL (SHADING == SHADE_PER_PIXEL ? 1 : 0)
+#else
+uniform int is_perpixel;
+// 1: the draw has two instances per copy in one full-window viewport, the
+// even one goes to the left half with per-vertex lighting and the odd one
+// to the right half with per-pixel lighting
+uniform int dual_viewport;
+#define SPLIT_VIEWPORT (dual_viewport == 1)
+#define LIGHT_PER_VERTEX true	// whether or not the fragment shader uses it
+#define IS_PERPIXEL is_perpixel
+#endif
 
 
 /* ---------- [HW2] Lighting Functions ---------- */
-vec3 directional_light(vec3 v_normal)
+vec3 directional_light(vec3 v_normal, vec3 view_vertex_pos)
 {
 	vec3 n = normalize(v_normal);
-	// Transform the light position from world space to view space
-	vec3 view_light_pos = (um4v * vec4(lighting_attrib[0].position, 1.0)).xyz;
-	vec3 view_origin_pos = (um4v * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
-	// Calculate the normalized light direction vector
-	vec3 L = normalize(view_light_pos - view_origin_pos);
+	// Calculate the normalized light direction vector, given in view space
+	vec3 L = normalize(lighting_attrib[0].position);
 	// Calculate the viewpoint direction vector
-	vec3 V = -(um4v * um4m * vec4(aPos, 1.0)).xyz;
+	vec3 V = -view_vertex_pos;
 	// Calculate the unit halfway vector between light direction and viewpoint direction
 	vec3 H = normalize(L + V);
 	
@@ -72,13 +117,11 @@ vec3 directional_light(vec3 v_normal)
 	return clamp(ambient_term + diffuse_term + specular_term, 0.0, 1.0);
 }
 
-vec3 point_light(vec3 v_normal)
+vec3 point_light(vec3 v_normal, vec3 view_vertex_pos)
 {
 	vec3 n = normalize(v_normal);
-	// Transform the light position from world space to view space
-	vec3 view_light_pos = (um4v * vec4(lighting_attrib[1].position, 1.0)).xyz;
-	// Transform the vertex position from world space to view space
-	vec3 view_vertex_pos = (um4v * um4m * vec4(aPos, 1.0)).xyz;
+	// The light position, given in view space
+	vec3 view_light_pos = lighting_attrib[1].position;
 	// Calculate the unit vector L that points from the vertex to light position
 	vec3 L = normalize(view_light_pos - view_vertex_pos);
 	// Calculate the viewpoint direction vector
@@ -99,13 +142,11 @@ vec3 point_light(vec3 v_normal)
 	return clamp(ambient_term + f_att * diffuse_term + f_att * specular_term, 0.0, 1.0);
 }
 
-vec3 spot_light(vec3 v_normal)
+vec3 spot_light(vec3 v_normal, vec3 view_vertex_pos)
 {
 	vec3 n = normalize(v_normal);
-	// Transform the light position from world space to view space
-	vec3 view_light_pos = (um4v * vec4(lighting_attrib[2].position, 1.0)).xyz;
-	// Transform the vertex position from world space to view space
-	vec3 view_vertex_pos = (um4v * um4m * vec4(aPos, 1.0)).xyz;
+	// The light position, given in view space
+	vec3 view_light_pos = lighting_attrib[2].position;
 	// Calculate the unit vector L that points from the vertex to light position
 	vec3 L = normalize(view_light_pos - view_vertex_pos);
 	// Calculate the viewpoint direction vector
@@ -125,7 +166,7 @@ vec3 spot_light(vec3 v_normal)
 	float v_dot_d = dot(spot_to_vert, spot_dir);
 
 	float spot_effect;
-	if (v_dot_d >= cos(radians(lighting_attrib[2].spot_cutoff)))
+	if (v_dot_d >= lighting_attrib[2].spot_cos_cutoff)
 		spot_effect = pow(max(v_dot_d, 0), lighting_attrib[2].spot_exponent);
 	else
 		spot_effect = 0;
@@ -143,23 +184,41 @@ void main()
 {
 	// [TODO]
 	if (texture_is_eye == 1)
-		texCoord = aTexCoord + vec2(x_offset, y_offset);
+		texCoord = aTexCoord + (aInstanceEyeOffset >= 0 ? eye_offsets[aInstanceEyeOffset] : vec2(x_offset, y_offset));
 	else
 		texCoord = aTexCoord;
-
-	gl_Position = um4p * um4v * um4m * vec4(aPos, 1.0);
-
-	// Transform the normal vector from model space to view space
-	vec3 v_normal = vec3(transpose(inverse(um4v * um4m)) * vec4(aNormal, 0.0));
+	tint = aInstanceTint;
+
+	vec4 model_pos = aInstanceModel * vec4(aPos, 1.0);
+	gl_Position = um4mvp * model_pos;
+	view_pos = (um4mv * model_pos).xyz;
+
+	// squeeze x into the instance's half, as its own viewport would; the clip
+	// distance cuts what would spill over the centre line
+	shade_perpixel = IS_PERPIXEL;
+	gl_ClipDistance[0] = 1.0;
+	if (SPLIT_VIEWPORT)
+	{
+		float side = (gl_InstanceID & 1) == 0 ? -1.0 : 1.0;
+		gl_Position.x = 0.5 * gl_Position.x + 0.5 * side * gl_Position.w;
+		gl_ClipDistance[0] = side * gl_Position.x;
+		shade_perpixel = gl_InstanceID & 1;
+	}
+
+	// Transform the normal vector from model space to view space; the
+	// placement only scales uniformly, so its own 3x3 part does for it
+	vec3 v_normal = um3n * (mat3(aInstanceModel) * aNormal);
 	vertex_normal = v_normal;
 	
-	if (lighting_mode == 0)
-		vertex_color = directional_light(v_normal);
-	else if (lighting_mode == 1)
-		vertex_color = point_light(v_normal);
-	else
-		vertex_color = spot_light(v_normal);
-
-	// Pass position to fragment shader
-	frag_aPos = aPos;
+	// a per-pixel variant leaves the lighting to the fragment shader
+	vertex_color = vec3(0.0);
+	if (LIGHT_PER_VERTEX)
+	{
+		if (LIGHTING_MODE == 0)
+			vertex_color = directional_light(v_normal, view_pos);
+		else if (LIGHTING_MODE == 1)
+			vertex_color = point_light(v_normal, view_pos);
+		else
+			vertex_color = spot_light(v_normal, view_pos);
+	}
 }
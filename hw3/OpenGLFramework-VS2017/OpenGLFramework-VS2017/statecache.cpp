@@ -0,0 +1,238 @@
+#include "statecache.h"
+
+#include <string.h>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+enum UniformKind
+{
+	UNIFORM_UNKNOWN,
+	UNIFORM_1I,
+	UNIFORM_1F,
+	UNIFORM_3F,
+	UNIFORM_MATRIX4,
+	UNIFORM_MATRIX4_TRANSPOSED,
+};
+
+// last value of a uniform, as raw 32-bit words
+struct UniformValue
+{
+	UniformKind kind = UNIFORM_UNKNOWN;
+	GLuint words[16];
+};
+
+enum TextureTarget
+{
+	TARGET_2D,
+	TARGET_2D_ARRAY,
+	TARGET_COUNT
+};
+
+struct UniformBufferRange
+{
+	GLuint buffer;
+	GLintptr offset;
+	GLsizeiptr size;
+};
+
+// every binding is unknown (known = false) until set through the cache
+struct StateCache
+{
+	bool enabled = true;
+
+	bool program_known = false;
+	GLuint program = 0;
+	bool vao_known = false;
+	GLuint vao = 0;
+	bool active_unit_known = false;
+	int active_unit = 0;
+	bool texture_known[STATE_CACHE_UNITS][TARGET_COUNT] = {};
+	GLuint textures[STATE_CACHE_UNITS][TARGET_COUNT] = {};
+	bool sampler_known[STATE_CACHE_UNITS] = {};
+	GLuint samplers[STATE_CACHE_UNITS] = {};
+	bool uniform_buffer_known[STATE_CACHE_UNIFORM_BUFFERS] = {};
+	UniformBufferRange uniform_buffers[STATE_CACHE_UNIFORM_BUFFERS] = {};
+	bool viewport_known = false;
+	GLint viewport[4] = {};
+
+	// per program, indexed by location
+	map<GLuint, vector<UniformValue> > uniforms;
+
+	StateCacheCounters counters = { 0, 0 };
+};
+
+static StateCache state;
+
+// Whether a call has to go to GL; counts it either way
+static bool Issue(bool redundant)
+{
+	if (redundant && state.enabled)
+	{
+		state.counters.elided++;
+		return false;
+	}
+	state.counters.issued++;
+	return true;
+}
+
+void stateCacheEnable(bool enabled)
+{
+	stateCacheInvalidate();
+	state.enabled = enabled;
+}
+
+void stateCacheInvalidate()
+{
+	StateCacheCounters counters = state.counters;
+	bool enabled = state.enabled;
+	state = StateCache();
+	state.counters = counters;
+	state.enabled = enabled;
+}
+
+void stateCacheUseProgram(GLuint program)
+{
+	if (!Issue(state.program_known && state.program == program))
+		return;
+	glUseProgram(program);
+	state.program_known = true;
+	state.program = program;
+}
+
+void stateCacheBindVertexArray(GLuint vao)
+{
+	if (!Issue(state.vao_known && state.vao == vao))
+		return;
+	glBindVertexArray(vao);
+	state.vao_known = true;
+	state.vao = vao;
+}
+
+static void ActiveTexture(int unit)
+{
+	if (!Issue(state.active_unit_known && state.active_unit == unit))
+		return;
+	glActiveTexture(GL_TEXTURE0 + unit);
+	state.active_unit_known = true;
+	state.active_unit = unit;
+}
+
+void stateCacheBindTexture(int unit, GLenum target, GLuint texture)
+{
+	int t = target == GL_TEXTURE_2D ? TARGET_2D : (target == GL_TEXTURE_2D_ARRAY ? TARGET_2D_ARRAY : TARGET_COUNT);
+	if (unit < 0 || unit >= STATE_CACHE_UNITS || t == TARGET_COUNT)
+	{
+		// not tracked: issue it, and the unit it left active is unknown
+		Issue(false);
+		glActiveTexture(GL_TEXTURE0 + unit);
+		Issue(false);
+		glBindTexture(target, texture);
+		state.active_unit_known = false;
+		return;
+	}
+	if (!Issue(state.texture_known[unit][t] && state.textures[unit][t] == texture))
+		return;
+	ActiveTexture(unit);
+	glBindTexture(target, texture);
+	state.texture_known[unit][t] = true;
+	state.textures[unit][t] = texture;
+}
+
+void stateCacheBindSampler(int unit, GLuint sampler)
+{
+	bool tracked = unit >= 0 && unit < STATE_CACHE_UNITS;
+	if (!Issue(tracked && state.sampler_known[unit] && state.samplers[unit] == sampler))
+		return;
+	glBindSampler(unit, sampler);
+	if (tracked)
+	{
+		state.sampler_known[unit] = true;
+		state.samplers[unit] = sampler;
+	}
+}
+
+void stateCacheBindUniformBuffer(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	bool tracked = index < STATE_CACHE_UNIFORM_BUFFERS;
+	UniformBufferRange range = { buffer, offset, size };
+	if (!Issue(tracked && state.uniform_buffer_known[index] && state.uniform_buffers[index].buffer == buffer
+		&& state.uniform_buffers[index].offset == offset && state.uniform_buffers[index].size == size))
+		return;
+	glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+	if (tracked)
+	{
+		state.uniform_buffer_known[index] = true;
+		state.uniform_buffers[index] = range;
+	}
+}
+
+void stateCacheViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	GLint viewport[4] = { x, y, width, height };
+	if (!Issue(state.viewport_known && memcmp(state.viewport, viewport, sizeof(viewport)) == 0))
+		return;
+	glViewport(x, y, width, height);
+	state.viewport_known = true;
+	memcpy(state.viewport, viewport, sizeof(viewport));
+}
+
+// Whether the uniform at location of the current program already holds
+// value; records it if not. Nothing is known about an unknown program.
+static bool SameUniform(GLint location, UniformKind kind, const void *value, int count)
+{
+	if (!state.program_known)
+		return false;
+	vector<UniformValue> &values = state.uniforms[state.program];
+	if (location >= (GLint)values.size())
+		values.resize(location + 1);
+	UniformValue &known = values[location];
+	if (known.kind == kind && memcmp(known.words, value, count * sizeof(GLuint)) == 0)
+		return true;
+	known.kind = kind;
+	memcpy(known.words, value, count * sizeof(GLuint));
+	return false;
+}
+
+// Whether a uniform call has to go to GL, counting it; GL ignores location -1
+static bool IssueUniform(GLint location, UniformKind kind, const void *value, int count)
+{
+	return Issue(location < 0 || SameUniform(location, kind, value, count));
+}
+
+void stateCacheUniform1i(GLint location, GLint value)
+{
+	if (IssueUniform(location, UNIFORM_1I, &value, 1))
+		glUniform1i(location, value);
+}
+
+void stateCacheUniform1f(GLint location, GLfloat value)
+{
+	if (IssueUniform(location, UNIFORM_1F, &value, 1))
+		glUniform1f(location, value);
+}
+
+void stateCacheUniform3f(GLint location, GLfloat x, GLfloat y, GLfloat z)
+{
+	GLfloat value[3] = { x, y, z };
+	if (IssueUniform(location, UNIFORM_3F, value, 3))
+		glUniform3f(location, x, y, z);
+}
+
+void stateCacheUniformMatrix4fv(GLint location, GLboolean transpose, const GLfloat *value)
+{
+	if (IssueUniform(location, transpose ? UNIFORM_MATRIX4_TRANSPOSED : UNIFORM_MATRIX4, value, 16))
+		glUniformMatrix4fv(location, 1, transpose, value);
+}
+
+StateCacheCounters stateCacheCounters()
+{
+	return state.counters;
+}
+
+void stateCacheResetCounters()
+{
+	state.counters.issued = 0;
+	state.counters.elided = 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// Shadow copy of the GL state the viewer sets while drawing: bound program,
+// vertex array, textures and samplers per unit, uniform buffer ranges,
+// viewport and the uniform values of each program by location. A call that
+// would set what is already set is dropped. The copy is only right while
+// every change of that state goes through here; after GL calls around it
+// (uploads that bind textures or vertex arrays, deleting objects whose
+// names may be reused, glUseProgram) call stateCacheInvalidate. GL thread
+// only.
+#define STATE_CACHE_UNITS 8
+#define STATE_CACHE_UNIFORM_BUFFERS 4
+
+struct StateCacheCounters
+{
+	unsigned long issued;   // calls passed on to GL, glActiveTexture included
+	unsigned long elided;   // calls dropped because they would change nothing
+};
+
+// false passes every call through, counted as issued, for comparison
+void stateCacheEnable(bool enabled);
+
+// Forget everything, the next call of each kind is issued
+void stateCacheInvalidate();
+
+void stateCacheUseProgram(GLuint program);
+void stateCacheBindVertexArray(GLuint vao);
+// GL_TEXTURE_2D and GL_TEXTURE_2D_ARRAY, on texture unit GL_TEXTURE0 + unit
+void stateCacheBindTexture(int unit, GLenum target, GLuint texture);
+void stateCacheBindSampler(int unit, GLuint sampler);
+// glBindBufferRange(GL_UNIFORM_BUFFER, index, ...); leaves the generic
+// GL_UNIFORM_BUFFER binding unknown, bind it before glBufferSubData
+void stateCacheBindUniformBuffer(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+void stateCacheViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+// Uniforms of the program bound through stateCacheUseProgram. Location -1
+// is dropped, as GL would ignore it.
+void stateCacheUniform1i(GLint location, GLint value);
+void stateCacheUniform1f(GLint location, GLfloat value);
+void stateCacheUniform3f(GLint location, GLfloat x, GLfloat y, GLfloat z);
+void stateCacheUniformMatrix4fv(GLint location, GLboolean transpose, const GLfloat *value);
+
+// Since the last reset; the viewer resets them every frame
+StateCacheCounters stateCacheCounters();
+void stateCacheResetCounters();
@@ -0,0 +1,122 @@
+#include "texturearray.h"
+#include "mipchain.h"
+
+#include <algorithm>
+
+using namespace std;
+
+struct ArraySource
+{
+	GLuint texture;
+	int width, height;
+	int level_count;
+};
+
+// Size and levels of a 2D texture; false if it is not one that can be blitted
+static bool DescribeSource(GLuint texture, ArraySource *source)
+{
+	if (texture == 0 || texture == (GLuint)-1 || !glIsTexture(texture))
+		return false;
+	GLint width = 0, height = 0, compressed = GL_FALSE, max_level = 1000;
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+	glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &max_level);
+	if (width <= 0 || height <= 0 || compressed == GL_TRUE)
+		return false;
+	source->texture = texture;
+	source->width = width;
+	source->height = height;
+	source->level_count = min(mipLevelCount(width, height), max_level + 1);
+	return true;
+}
+
+bool textureArrayCreate(const vector<GLuint> &textures, vector<int> &layers, TextureArray *array)
+{
+	*array = TextureArray();
+	GLint bound_texture;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound_texture);
+
+	vector<ArraySource> sources;
+	layers.assign(textures.size(), -1);
+	bool ok = !textures.empty();
+	for (size_t i = 0; ok && i < textures.size(); i++) {
+		for (size_t s = 0; s < sources.size() && layers[i] < 0; s++) {
+			if (sources[s].texture == textures[i])
+				layers[i] = (int)s;
+		}
+		if (layers[i] >= 0)
+			continue;
+		ArraySource source;
+		ok = DescribeSource(textures[i], &source);
+		layers[i] = (int)sources.size();
+		sources.push_back(source);
+		array->width = max(array->width, source.width);
+		array->height = max(array->height, source.height);
+	}
+	glBindTexture(GL_TEXTURE_2D, bound_texture);
+	GLint max_layers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+	if (!ok || (int)sources.size() > max_layers) {
+		*array = TextureArray();
+		return false;
+	}
+
+	array->layer_count = (int)sources.size();
+	int level_count = mipLevelCount(array->width, array->height);
+	glGenTextures(1, &array->texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, array->texture);
+	for (int level = 0; level < level_count; level++) {
+		int width = max(1, array->width >> level), height = max(1, array->height >> level);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, width, height, array->layer_count, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		array->gpu_bytes += (size_t)width * height * 4 * array->layer_count;
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+
+	GLint read_framebuffer, draw_framebuffer;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
+	GLuint framebuffers[2];
+	glGenFramebuffers(2, framebuffers);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+
+	for (int layer = 0; ok && layer < array->layer_count; layer++) {
+		const ArraySource &source = sources[layer];
+		for (int level = 0; ok && level < level_count; level++) {
+			int width = max(1, array->width >> level), height = max(1, array->height >> level);
+			// the smallest source level that still covers the target, the
+			// same level when the sizes match
+			int source_level = 0;
+			while (source_level + 1 < source.level_count
+				&& max(1, source.width >> (source_level + 1)) >= width && max(1, source.height >> (source_level + 1)) >= height)
+				source_level++;
+			int source_width = max(1, source.width >> source_level), source_height = max(1, source.height >> source_level);
+
+			glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, source.texture, source_level);
+			glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, array->texture, level, layer);
+			ok = glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE
+				&& glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+			if (ok) {
+				bool same = source_width == width && source_height == height;
+				glBlitFramebuffer(0, 0, source_width, source_height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, same ? GL_NEAREST : GL_LINEAR);
+			}
+		}
+	}
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_framebuffer);
+	glDeleteFramebuffers(2, framebuffers);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	if (!ok)
+		textureArrayDelete(array);
+	return ok;
+}
+
+void textureArrayDelete(TextureArray *array)
+{
+	if (array->texture != 0)
+		glDeleteTextures(1, &array->texture);
+	*array = TextureArray();
+}
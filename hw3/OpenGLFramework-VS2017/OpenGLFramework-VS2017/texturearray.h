@@ -0,0 +1,28 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <stddef.h>
+#include <vector>
+
+// The diffuse textures of a model as the layers of one GL_TEXTURE_2D_ARRAY,
+// so that the whole model draws with a single bind and a layer index per
+// draw
+struct TextureArray
+{
+	GLuint texture = 0;
+	int width = 0, height = 0;
+	int layer_count = 0;
+	size_t gpu_bytes = 0;   // every layer with its mips
+};
+
+// GL thread: copy 2D RGBA textures into a new array, level by level with
+// glBlitFramebuffer, so the mip chains come along as they are. Every layer
+// takes the largest width and height among the textures; a smaller texture
+// is resampled bilinearly from its nearest level. A texture that appears
+// more than once gets one layer; layers receives the layer of each entry.
+// Returns false, and creates nothing, if a texture is missing or
+// compressed (cooked textures cannot be attached to a framebuffer) or
+// there are more of them than GL_MAX_ARRAY_TEXTURE_LAYERS.
+bool textureArrayCreate(const std::vector<GLuint> &textures, std::vector<int> &layers, TextureArray *array);
+
+void textureArrayDelete(TextureArray *array);
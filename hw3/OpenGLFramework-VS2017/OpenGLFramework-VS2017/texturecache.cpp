@@ -0,0 +1,510 @@
+#include "texturecache.h"
+#include "texturecook.h"
+#include "textureupload.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <STB/stb_image.h>
+
+using namespace std;
+
+// EXT_texture_compression_s3tc, not in the generated loader
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+static const GLenum COOKED_GL_FORMATS[COOKED_FORMAT_COUNT] = { GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_COMPRESSED_RGBA_BPTC_UNORM };
+
+// key of an image: hash and size of its file content
+typedef pair<uint64_t, uint64_t> TextureKey;
+
+struct TextureEntry
+{
+	TextureKey key;
+	string path;	// canonical, as cooked lookups and the path memo see it
+	int refs = 0;
+	bool decoding = true;   // queued or being decoded
+	int shared_requests = 0;    // requests that found it still decoding
+	vector<unsigned char> content;  // file content until it is decoded
+	TextureImage image;     // pixels until the upload
+	CookedTexture cooked = CookedTexture();    // or the mapped cooked texture until the upload
+	int width = 0, height = 0;
+	size_t gpu_bytes = 0;
+	GLuint texture = 0;
+};
+
+// what a canonical path hashed to, valid while size and mtime match
+struct TexturePath
+{
+	uint64_t size;
+	int64_t mtime;
+	TextureKey key;
+};
+
+static mutex cache_mutex;
+static condition_variable cache_decoded;
+static map<TextureKey, TextureEntry *> entries;
+static map<string, TexturePath> paths;
+static TextureCacheStats stats;
+
+// decode pool; every queued entry holds a reference
+static deque<TextureEntry *> decode_queue;
+static vector<thread> decoders;
+static int decoder_count = 0;   // 0: one per core
+static bool decoders_quit = false;
+
+// bit per CookedFormat the context can sample, 0: always decode the source
+static unsigned cooked_formats = 0;
+
+// mip chains built by the decoders rather than glGenerateMipmap
+static bool cpu_mips = true;
+
+// uploads streamed through textureupload.h; GL thread only
+static bool stream_uploads = false;
+
+// decoded and not uploaded yet, in the order the decodes finished
+static deque<TextureEntry *> decoded;
+
+GLuint createTexture(TextureImage &image)
+{
+	if (image.pixels != NULL)
+	{
+		GLuint tex = 0;
+
+		// [TODO] Bind the image to texture
+		// Hint: glGenTextures, glBindTexture, glTexImage2D, glGenerateMipmap
+		glGenTextures(1, &tex);
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels);
+		if (image.mips.levels.empty())
+		{
+			glGenerateMipmap(GL_TEXTURE_2D);
+		}
+		else
+		{
+			for (int level = 0; level < (int)image.mips.levels.size(); level++)
+				glTexImage2D(GL_TEXTURE_2D, level + 1, GL_RGBA, image.mips.widths[level], image.mips.heights[level], 0, GL_RGBA, GL_UNSIGNED_BYTE, image.mips.levels[level].data());
+		}
+
+		// free the image from memory after binding to texture
+		stbi_image_free(image.pixels);
+		image.pixels = NULL;
+		image.mips = MipChain();
+		return tex;
+	}
+	else
+	{
+		return -1;
+	}
+}
+
+size_t textureBytes(int width, int height)
+{
+	return (size_t)width * height * 4 * 4 / 3;
+}
+
+static string CanonicalPath(const string &path)
+{
+#ifdef _WIN32
+	char *full = _fullpath(NULL, path.c_str(), 0);
+#else
+	char *full = realpath(path.c_str(), NULL);
+#endif
+	if (full == NULL)
+		return path;
+	string canonical = full;
+	free(full);
+	return canonical;
+}
+
+static bool StatFile(const string &path, uint64_t *size, int64_t *mtime)
+{
+	struct stat st;
+	// e.g. an empty map_Kd names the model's directory
+	if (stat(path.c_str(), &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG)
+		return false;
+	*size = (uint64_t)st.st_size;
+	*mtime = (int64_t)st.st_mtime;
+	return true;
+}
+
+static bool ReadWholeFile(const string &path, vector<unsigned char> &content)
+{
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (fp == NULL)
+		return false;
+
+	fseek(fp, 0, SEEK_END);
+	long count = ftell(fp);
+	rewind(fp);
+
+	content.resize(count > 0 ? count : 0);
+	size_t read = count > 0 ? fread(&content[0], 1, count, fp) : 0;
+	fclose(fp);
+	return read == content.size();
+}
+
+// Take a reference to a known image. Call with cache_mutex held.
+static void ReferenceEntry(TextureEntry *entry)
+{
+	entry->refs++;
+	if (entry->decoding)
+	{
+		entry->shared_requests++;
+	}
+	else if (entry->width != 0)
+	{
+		stats.requests++;
+		stats.saved_bytes += entry->gpu_bytes;
+	}
+}
+
+static void ReleaseEntry(TextureEntry *entry)
+{
+	if (--entry->refs > 0)
+		return;
+
+	if (entry->texture != 0)
+	{
+		textureUploadCancel(entry->texture);
+		glDeleteTextures(1, &entry->texture);
+		stats.resident_bytes -= entry->gpu_bytes;
+	}
+	if (entry->image.pixels != NULL)
+		stbi_image_free(entry->image.pixels);
+	cookedTextureClose(&entry->cooked);
+	if (entry->width != 0)
+		stats.textures--;
+	decoded.erase(remove(decoded.begin(), decoded.end(), entry), decoded.end());
+	entries.erase(entry->key);
+	delete entry;
+}
+
+static void DecodeThread()
+{
+	unique_lock<mutex> lock(cache_mutex);
+	while (true)
+	{
+		cache_decoded.wait(lock, []() { return decoders_quit || !decode_queue.empty(); });
+		// drain the queue before quitting so that no request waits forever
+		if (decode_queue.empty())
+			return;
+		TextureEntry *entry = decode_queue.front();
+		decode_queue.pop_front();
+		bool build_mips = cpu_mips;
+		lock.unlock();
+
+		int channel;
+		TextureImage image;
+		image.pixels = stbi_load_from_memory(entry->content.data(), (int)entry->content.size(), &image.width, &image.height, &channel, 4);
+		if (image.pixels == NULL)
+			printf("LoadTextureImage: Cannot load image from %s\n", entry->path.c_str());
+		vector<unsigned char>().swap(entry->content);
+		// the pool already keeps every core busy, one thread per chain
+		double mip_ms = 0.0;
+		if (image.pixels != NULL && build_mips)
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			buildMipChain(image.pixels, image.width, image.height, image.mips);
+			mip_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		}
+
+		lock.lock();
+		entry->decoding = false;
+		if (image.pixels != NULL)
+		{
+			entry->width = image.width;
+			entry->height = image.height;
+			entry->gpu_bytes = textureBytes(image.width, image.height);
+			swap(entry->image, image);
+			stats.requests += 1 + entry->shared_requests;
+			stats.saved_bytes += entry->shared_requests * entry->gpu_bytes;
+			stats.decodes++;
+			stats.textures++;
+			stats.decoded_bytes += (size_t)entry->width * entry->height * 4;
+			stats.mip_ms += mip_ms;
+			decoded.push_back(entry);
+		}
+		cache_decoded.notify_all();
+		ReleaseEntry(entry);
+	}
+}
+
+static void StopDecoders()
+{
+	{
+		lock_guard<mutex> lock(cache_mutex);
+		decoders_quit = true;
+	}
+	cache_decoded.notify_all();
+	for (size_t i = 0; i < decoders.size(); i++)
+		decoders[i].join();
+	decoders.clear();
+	decoders_quit = false;
+}
+
+void textureCacheUseCooked(unsigned formats)
+{
+	lock_guard<mutex> lock(cache_mutex);
+	cooked_formats = formats;
+}
+
+// A fresh cooked texture of the image in a format the context takes. The
+// entry is ready at once, there is nothing to decode. Call with
+// cache_mutex held; NULL if there is none.
+static TextureEntry *OpenCooked(unique_lock<mutex> &lock, const string &canonical, uint64_t size, int64_t mtime)
+{
+	if (cooked_formats == 0)
+		return NULL;
+	lock.unlock();
+	CookedTexture cooked;
+	bool ok = cookedTextureOpen(canonical.c_str(), (canonical + ".dds").c_str(), &cooked);
+	lock.lock();
+	if (!ok)
+		return NULL;
+	if ((cooked_formats & (1u << cooked.format)) == 0)
+	{
+		cookedTextureClose(&cooked);
+		return NULL;
+	}
+
+	TextureKey key(cooked.source_hash, cooked.source_size);
+	TexturePath &remembered = paths[canonical];
+	remembered.size = size;
+	remembered.mtime = mtime;
+	remembered.key = key;
+
+	map<TextureKey, TextureEntry *>::iterator found = entries.find(key);
+	if (found != entries.end())
+	{
+		cookedTextureClose(&cooked);
+		ReferenceEntry(found->second);
+		return found->second;
+	}
+
+	TextureEntry *entry = new TextureEntry;
+	entry->key = key;
+	entry->path = canonical;
+	entry->refs = 1;
+	entry->decoding = false;
+	entry->cooked = cooked;
+	entry->width = cooked.width;
+	entry->height = cooked.height;
+	for (int level = 0; level < cooked.level_count; level++)
+		entry->gpu_bytes += cooked.level_sizes[level];
+	entries[key] = entry;
+	decoded.push_back(entry);
+	stats.requests++;
+	stats.cooked++;
+	stats.textures++;
+	return entry;
+}
+
+void textureCacheSetDecodeThreads(int threads)
+{
+	StopDecoders();
+	decoder_count = threads;
+}
+
+void textureCacheUseCpuMips(bool enabled)
+{
+	StopDecoders();
+	cpu_mips = enabled;
+}
+
+// Call with cache_mutex held
+static void StartDecoders()
+{
+	if (!decoders.empty())
+		return;
+	static bool registered = false;
+	if (!registered)
+	{
+		// ESC leaves through exit()
+		atexit(StopDecoders);
+		registered = true;
+	}
+	int count = decoder_count > 0 ? decoder_count : max(1, (int)thread::hardware_concurrency());
+	for (int i = 0; i < count; i++)
+		decoders.push_back(thread(DecodeThread));
+}
+
+TextureHandle textureCacheRequest(const string &path)
+{
+	string canonical = CanonicalPath(path);
+	uint64_t size;
+	int64_t mtime;
+	if (!StatFile(canonical, &size, &mtime))
+	{
+		printf("LoadTextureImage: Cannot load image from %s\n", path.c_str());
+		return NULL;
+	}
+
+	unique_lock<mutex> lock(cache_mutex);
+	map<string, TexturePath>::iterator known = paths.find(canonical);
+	if (known != paths.end() && known->second.size == size && known->second.mtime == mtime)
+	{
+		map<TextureKey, TextureEntry *>::iterator found = entries.find(known->second.key);
+		if (found != entries.end())
+		{
+			ReferenceEntry(found->second);
+			return found->second;
+		}
+	}
+	TextureEntry *cooked = OpenCooked(lock, canonical, size, mtime);
+	if (cooked != NULL)
+		return cooked;
+	lock.unlock();
+
+	// unknown path or no longer referenced: hash the content, the decoder
+	// works from the same bytes if the image is new
+	vector<unsigned char> content;
+	if (!ReadWholeFile(canonical, content))
+	{
+		printf("LoadTextureImage: Cannot load image from %s\n", path.c_str());
+		return NULL;
+	}
+	TextureKey key(hashTextureContent(content.data(), content.size()), content.size());
+
+	lock.lock();
+	TexturePath &remembered = paths[canonical];
+	remembered.size = size;
+	remembered.mtime = mtime;
+	remembered.key = key;
+
+	map<TextureKey, TextureEntry *>::iterator found = entries.find(key);
+	if (found != entries.end())
+	{
+		ReferenceEntry(found->second);
+		return found->second;
+	}
+
+	TextureEntry *entry = new TextureEntry;
+	entry->key = key;
+	entry->path = canonical;
+	entry->refs = 2;	// the requester's and the decode queue's
+	entry->content.swap(content);
+	entries[key] = entry;
+	decode_queue.push_back(entry);
+	StartDecoders();
+	cache_decoded.notify_all();
+	return entry;
+}
+
+bool textureCacheWait(TextureHandle handle)
+{
+	unique_lock<mutex> lock(cache_mutex);
+	cache_decoded.wait(lock, [handle]() { return !handle->decoding; });
+	return handle->width != 0;
+}
+
+TextureHandle textureCacheAcquire(const string &path)
+{
+	TextureHandle handle = textureCacheRequest(path);
+	if (handle != NULL && !textureCacheWait(handle))
+	{
+		textureCacheRelease(handle);
+		handle = NULL;
+	}
+	return handle;
+}
+
+void textureCacheUseStreaming(bool enabled)
+{
+	stream_uploads = enabled;
+}
+
+GLuint textureCacheTexture(TextureHandle handle)
+{
+	if (handle->texture == 0)
+	{
+		TextureImage image;
+		CookedTexture cooked;
+		{
+			lock_guard<mutex> lock(cache_mutex);
+			swap(image, handle->image);
+			cooked = handle->cooked;
+			handle->cooked.base = NULL;
+			// uploaded ahead of its turn
+			decoded.erase(remove(decoded.begin(), decoded.end(), handle), decoded.end());
+		}
+		if (cooked.base != NULL)
+		{
+			// every level is in the file, straight from the mapping
+			glGenTextures(1, &handle->texture);
+			glBindTexture(GL_TEXTURE_2D, handle->texture);
+			int width = cooked.width, height = cooked.height;
+			for (int level = 0; level < cooked.level_count; level++)
+			{
+				glCompressedTexImage2D(GL_TEXTURE_2D, level, COOKED_GL_FORMATS[cooked.format], width, height, 0, (GLsizei)cooked.level_sizes[level], cooked.levels[level]);
+				width = max(1, width / 2);
+				height = max(1, height / 2);
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, cooked.level_count - 1);
+			cookedTextureClose(&cooked);
+		}
+		else
+		{
+			handle->texture = stream_uploads ? textureUploadStart(image) : createTexture(image);
+		}
+
+		lock_guard<mutex> lock(cache_mutex);
+		stats.resident_bytes += handle->gpu_bytes;
+	}
+	return handle->texture;
+}
+
+int textureCacheUploadDecoded()
+{
+	vector<TextureEntry *> arrived;
+	{
+		lock_guard<mutex> lock(cache_mutex);
+		arrived.assign(decoded.begin(), decoded.end());
+		decoded.clear();
+		// keep them alive while uploading outside the lock
+		for (size_t i = 0; i < arrived.size(); i++)
+			arrived[i]->refs++;
+	}
+	for (size_t i = 0; i < arrived.size(); i++)
+	{
+		textureCacheTexture(arrived[i]);
+		textureCacheRelease(arrived[i]);
+	}
+	return (int)arrived.size();
+}
+
+size_t textureCacheGpuBytes(TextureHandle handle)
+{
+	if (handle == NULL)
+		return 0;
+	lock_guard<mutex> lock(cache_mutex);
+	return handle->texture != 0 ? handle->gpu_bytes : 0;
+}
+
+void textureCacheRelease(TextureHandle handle)
+{
+	if (handle == NULL)
+		return;
+	lock_guard<mutex> lock(cache_mutex);
+	ReleaseEntry(handle);
+}
+
+TextureCacheStats textureCacheStats()
+{
+	lock_guard<mutex> lock(cache_mutex);
+	return stats;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <stddef.h>
+#include <string>
+
+#include "mipchain.h"
+
+// Decoded RGBA8 pixels of a texture, waiting to be uploaded on the GL thread
+struct TextureImage
+{
+	int width = 0, height = 0;
+	unsigned char *pixels = NULL;
+	MipChain mips;  // levels built on the CPU, empty for glGenerateMipmap
+};
+
+// Upload an image as a mipmapped GL_TEXTURE_2D and free its pixels and mips.
+// Returns -1 if the image has no pixels.
+GLuint createTexture(TextureImage &image);
+
+// Process-wide texture registry. Images are keyed by the hash and size of
+// their file content, so every image is decoded and uploaded once no matter
+// how many materials, models or paths (relative, "./", symlinks) refer to
+// it. The hash of a canonical path is remembered while the file's size and
+// mtime stay the same, so repeated requests do not read the file again.
+// A fresh cooked texture next to the image (see texturecook.h) is used
+// instead of decoding it when the context can sample its format.
+struct TextureEntry;
+typedef TextureEntry *TextureHandle;
+
+// Take a reference to the image at path and queue it on the decode pool
+// unless it is already known; returns at once. The file is read and hashed
+// on the calling thread. Safe to call from any thread. Returns NULL if the
+// file cannot be read. stbi_set_flip_vertically_on_load() is global state,
+// set it once beforehand.
+TextureHandle textureCacheRequest(const std::string &path);
+
+// Block until a requested image is decoded. Returns false if it failed, the
+// reference still has to be released then.
+bool textureCacheWait(TextureHandle handle);
+
+// textureCacheRequest plus textureCacheWait; NULL if the image cannot be
+// read or decoded
+TextureHandle textureCacheAcquire(const std::string &path);
+
+// Size of the decode pool, 0 (the default) for one thread per core. Waits
+// for the queued decodes first.
+void textureCacheSetDecodeThreads(int threads);
+
+// Bit (1 << CookedFormat) per block-compressed format the context can
+// sample. 0, the default, always decodes the source images.
+void textureCacheUseCooked(unsigned formats);
+
+// Build the mip chains on the decode threads and upload every level (the
+// default), or leave them to glGenerateMipmap. Waits for the queued
+// decodes first.
+void textureCacheUseCpuMips(bool enabled);
+
+// Stream the uploads of decoded images through textureupload.h, a frame
+// budget at a time, rather than uploading every level on first use (the
+// default). The caller runs textureUploadUpdate once per frame. Images
+// decoded without a CPU mip chain are uploaded at once either way.
+void textureCacheUseStreaming(bool enabled);
+
+// GL thread: the texture object of a decoded image, uploaded on first use.
+// While streamed, the texture shows its coarser levels until the finer
+// ones arrive.
+GLuint textureCacheTexture(TextureHandle handle);
+
+// GL thread: upload every image decoded since the last call, in the order
+// the decodes finished. Returns the number of images uploaded.
+int textureCacheUploadDecoded();
+
+// GPU bytes of an image's texture with its mips, 0 until it is uploaded
+size_t textureCacheGpuBytes(TextureHandle handle);
+
+// Drop a reference; the last one frees the pixels and deletes the texture,
+// so it has to come from the GL thread once the image was uploaded.
+void textureCacheRelease(TextureHandle handle);
+
+struct TextureCacheStats
+{
+	int requests;           // requests of images that decoded
+	int decodes;            // images actually decoded
+	int cooked;             // images served by a cooked texture, no decode
+	int textures;           // images currently referenced
+	size_t decoded_bytes;   // RGBA8 pixels of every decode
+	double mip_ms;          // building mip chains, summed over the decode threads
+	size_t saved_bytes;     // GPU bytes (with mips) the shared requests did not upload again
+	size_t resident_bytes;  // GPU bytes of the uploaded textures still referenced
+};
+
+TextureCacheStats textureCacheStats();
+
+// GPU bytes of an RGBA8 texture with its mip chain
+size_t textureBytes(int width, int height);
@@ -0,0 +1,872 @@
+#include "texturecook.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <STB/stb_image.h>
+
+using namespace std;
+
+const char *COOKED_FORMAT_NAMES[COOKED_FORMAT_COUNT] = { "bc1", "bc3", "bc7" };
+
+static const int BLOCK_BYTES[COOKED_FORMAT_COUNT] = { 8, 16, 16 };
+
+/* ---------- DDS container ---------- */
+
+#define DDS_FOURCC(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+struct DdsPixelFormat
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t fourcc;
+	uint32_t rgb_bit_count;
+	uint32_t masks[4];
+};
+
+struct DdsHeader
+{
+	uint32_t magic;         // "DDS "
+	uint32_t size;          // 124, the header without the magic
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t linear_size;
+	uint32_t depth;
+	uint32_t mip_count;
+	uint32_t reserved1[11]; // the cook stamp, see CookStamp
+	DdsPixelFormat format;
+	uint32_t caps[4];
+	uint32_t reserved2;
+};
+
+// DX10 extension, needed for BC7
+struct DdsHeaderDx10
+{
+	uint32_t dxgi_format;
+	uint32_t dimension;
+	uint32_t misc_flags;
+	uint32_t array_size;
+	uint32_t misc_flags2;
+};
+
+// what the texture was cooked from, in DdsHeader::reserved1
+struct CookStamp
+{
+	uint32_t tag;           // "COOK"
+	uint32_t version;
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t source_hash;
+};
+
+#define DDSD_CAPS 0x1
+#define DDSD_HEIGHT 0x2
+#define DDSD_WIDTH 0x4
+#define DDSD_PIXELFORMAT 0x1000
+#define DDSD_MIPMAPCOUNT 0x20000
+#define DDSD_LINEARSIZE 0x80000
+#define DDPF_FOURCC 0x4
+#define DDSCAPS_COMPLEX 0x8
+#define DDSCAPS_TEXTURE 0x1000
+#define DDSCAPS_MIPMAP 0x400000
+#define DXGI_FORMAT_BC7_UNORM 98
+#define D3D10_RESOURCE_DIMENSION_TEXTURE2D 3
+
+static const uint32_t FORMAT_FOURCC[COOKED_FORMAT_COUNT] = { DDS_FOURCC('D', 'X', 'T', '1'), DDS_FOURCC('D', 'X', 'T', '5'), DDS_FOURCC('D', 'X', '1', '0') };
+
+static size_t LevelBytes(CookedFormat format, int width, int height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * BLOCK_BYTES[format];
+}
+
+// FNV-1a over 64-bit words, the shift carries high bits back down. Byte
+// by byte it took four times as long as reading the images.
+uint64_t hashTextureContent(const unsigned char *data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * 1099511628211ULL;
+		hash ^= hash >> 32;
+	}
+	for (; i < size; i++) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static bool StatFile(const char *path, uint64_t *size, int64_t *mtime)
+{
+	struct stat st;
+	if (stat(path, &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG)
+		return false;
+	*size = (uint64_t)st.st_size;
+	*mtime = (int64_t)st.st_mtime;
+	return true;
+}
+
+static bool ReadWholeFile(const char *path, vector<unsigned char> &content)
+{
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL)
+		return false;
+
+	fseek(fp, 0, SEEK_END);
+	long count = ftell(fp);
+	rewind(fp);
+
+	content.resize(count > 0 ? count : 0);
+	size_t read = count > 0 ? fread(&content[0], 1, count, fp) : 0;
+	fclose(fp);
+	return read == content.size();
+}
+
+static bool MapFile(const char *path, CookedTexture *texture)
+{
+#ifdef _WIN32
+	HANDLE fh = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fh == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(fh, &size) || size.QuadPart == 0) {
+		CloseHandle(fh);
+		return false;
+	}
+
+	HANDLE mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+	void *base = mh ? MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (base == NULL) {
+		if (mh)
+			CloseHandle(mh);
+		CloseHandle(fh);
+		return false;
+	}
+
+	texture->base = base;
+	texture->size = (size_t)size.QuadPart;
+	texture->file_handle = fh;
+	texture->mapping_handle = mh;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return false;
+
+	texture->base = base;
+	texture->size = (size_t)st.st_size;
+	texture->file_handle = NULL;
+	texture->mapping_handle = NULL;
+#endif
+	return true;
+}
+
+void cookedTextureClose(CookedTexture *texture)
+{
+	if (texture->base == NULL)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(texture->base);
+	CloseHandle((HANDLE)texture->mapping_handle);
+	CloseHandle((HANDLE)texture->file_handle);
+#else
+	munmap(texture->base, texture->size);
+#endif
+	memset(texture, 0, sizeof(*texture));
+}
+
+// Same rule as the mesh cache: the size has to match, an unchanged mtime is
+// trusted, otherwise the content hash decides.
+static bool SourceIsFresh(const char *source_path, const CookStamp &stamp)
+{
+	uint64_t size;
+	int64_t mtime;
+	if (!StatFile(source_path, &size, &mtime) || size != stamp.source_size)
+		return false;
+	if (mtime == stamp.source_mtime)
+		return true;
+
+	vector<unsigned char> content;
+	if (!ReadWholeFile(source_path, content))
+		return false;
+	return hashTextureContent(content.data(), content.size()) == stamp.source_hash;
+}
+
+bool cookedTextureOpen(const char *source_path, const char *cooked_path, CookedTexture *texture)
+{
+	memset(texture, 0, sizeof(*texture));
+	if (!MapFile(cooked_path, texture))
+		return false;
+
+	const DdsHeader *header = (const DdsHeader *)texture->base;
+	CookStamp stamp;
+	bool ok = texture->size >= sizeof(DdsHeader)
+		&& header->magic == DDS_FOURCC('D', 'D', 'S', ' ')
+		&& header->size == sizeof(DdsHeader) - 4
+		&& (header->format.flags & DDPF_FOURCC) != 0
+		&& header->mip_count > 0 && header->mip_count <= COOKED_MAX_LEVELS;
+	if (ok) {
+		memcpy(&stamp, header->reserved1, sizeof(stamp));
+		ok = stamp.tag == DDS_FOURCC('C', 'O', 'O', 'K') && stamp.version == COOKED_TEXTURE_VERSION;
+	}
+
+	size_t offset = sizeof(DdsHeader);
+	if (ok) {
+		int format = 0;
+		while (format < COOKED_FORMAT_COUNT && FORMAT_FOURCC[format] != header->format.fourcc)
+			format++;
+		ok = format < COOKED_FORMAT_COUNT;
+		if (ok && format == COOKED_BC7) {
+			const DdsHeaderDx10 *dx10 = (const DdsHeaderDx10 *)((const char *)texture->base + offset);
+			offset += sizeof(DdsHeaderDx10);
+			ok = texture->size >= offset && dx10->dxgi_format == DXGI_FORMAT_BC7_UNORM;
+		}
+		texture->format = (CookedFormat)format;
+	}
+
+	if (ok) {
+		texture->width = header->width;
+		texture->height = header->height;
+		texture->level_count = header->mip_count;
+		int width = texture->width, height = texture->height;
+		for (int level = 0; ok && level < texture->level_count; level++) {
+			size_t bytes = LevelBytes(texture->format, width, height);
+			ok = offset + bytes <= texture->size;
+			texture->levels[level] = (const unsigned char *)texture->base + offset;
+			texture->level_sizes[level] = bytes;
+			offset += bytes;
+			width = max(1, width / 2);
+			height = max(1, height / 2);
+		}
+		texture->source_hash = stamp.source_hash;
+		texture->source_size = stamp.source_size;
+	}
+
+	ok = ok && SourceIsFresh(source_path, stamp);
+	if (!ok)
+		cookedTextureClose(texture);
+	return ok;
+}
+
+/* ---------- block encoders ---------- */
+
+// The 4x4 texels of a block, edges replicated past the image
+static void LoadBlock(const unsigned char *pixels, int width, int height, int bx, int by, unsigned char block[16][4])
+{
+	for (int y = 0; y < 4; y++) {
+		int sy = min(by * 4 + y, height - 1);
+		for (int x = 0; x < 4; x++) {
+			int sx = min(bx * 4 + x, width - 1);
+			memcpy(block[y * 4 + x], pixels + ((size_t)sy * width + sx) * 4, 4);
+		}
+	}
+}
+
+// Principal axis of the texels over the first `channels` channels, by power
+// iteration on their covariance. Returns false for a flat block.
+static bool PrincipalAxis(const unsigned char block[16][4], int channels, float mean[4], float axis[4])
+{
+	for (int c = 0; c < channels; c++) {
+		mean[c] = 0.0f;
+		for (int i = 0; i < 16; i++)
+			mean[c] += block[i][c];
+		mean[c] /= 16.0f;
+	}
+	float cov[4][4] = { { 0 } };
+	for (int i = 0; i < 16; i++) {
+		for (int a = 0; a < channels; a++) {
+			for (int b = 0; b < channels; b++)
+				cov[a][b] += (block[i][a] - mean[a]) * (block[i][b] - mean[b]);
+		}
+	}
+
+	for (int c = 0; c < channels; c++)
+		axis[c] = 1.0f;
+	for (int iteration = 0; iteration < 8; iteration++) {
+		float next[4] = { 0, 0, 0, 0 }, length = 0.0f;
+		for (int a = 0; a < channels; a++) {
+			for (int b = 0; b < channels; b++)
+				next[a] += cov[a][b] * axis[b];
+			length = max(length, fabsf(next[a]));
+		}
+		if (length < 1e-6f)
+			return false;
+		for (int c = 0; c < channels; c++)
+			axis[c] = next[c] / length;
+	}
+	return true;
+}
+
+// Endpoints at the extreme projections of the texels on the principal axis
+static void FitEndpoints(const unsigned char block[16][4], int channels, float e0[4], float e1[4])
+{
+	float mean[4], axis[4];
+	if (!PrincipalAxis(block, channels, mean, axis)) {
+		for (int c = 0; c < channels; c++)
+			e0[c] = e1[c] = mean[c];
+		return;
+	}
+	float length2 = 0.0f;
+	for (int c = 0; c < channels; c++)
+		length2 += axis[c] * axis[c];
+	float lo = 1e30f, hi = -1e30f;
+	for (int i = 0; i < 16; i++) {
+		float t = 0.0f;
+		for (int c = 0; c < channels; c++)
+			t += (block[i][c] - mean[c]) * axis[c];
+		lo = min(lo, t);
+		hi = max(hi, t);
+	}
+	for (int c = 0; c < channels; c++) {
+		e0[c] = max(0.0f, min(255.0f, mean[c] + axis[c] * hi / length2));
+		e1[c] = max(0.0f, min(255.0f, mean[c] + axis[c] * lo / length2));
+	}
+}
+
+// Least-squares endpoints for fixed indices; weights[i] is the share of e0
+// in texel i. Returns false if the system is singular.
+static bool RefineEndpoints(const unsigned char block[16][4], int channels, const float weights[16], float e0[4], float e1[4])
+{
+	float aa = 0, ab = 0, bb = 0, ax[4] = { 0, 0, 0, 0 }, bx[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		float a = weights[i], b = 1.0f - a;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < channels; c++) {
+			ax[c] += a * block[i][c];
+			bx[c] += b * block[i][c];
+		}
+	}
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-4f)
+		return false;
+	for (int c = 0; c < channels; c++) {
+		e0[c] = max(0.0f, min(255.0f, (ax[c] * bb - bx[c] * ab) / det));
+		e1[c] = max(0.0f, min(255.0f, (bx[c] * aa - ax[c] * ab) / det));
+	}
+	return true;
+}
+
+static uint16_t Pack565(const float c[3])
+{
+	int r = (int)(c[0] * 31.0f / 255.0f + 0.5f), g = (int)(c[1] * 63.0f / 255.0f + 0.5f), b = (int)(c[2] * 31.0f / 255.0f + 0.5f);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void Unpack565(uint16_t c, int out[3])
+{
+	int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+	out[0] = (r << 3) | (r >> 2);
+	out[1] = (g << 2) | (g >> 4);
+	out[2] = (b << 3) | (b >> 2);
+}
+
+// The four colours of a BC1 block in four-colour mode (c0 > c1)
+static void Bc1Palette(uint16_t c0, uint16_t c1, int palette[4][3])
+{
+	Unpack565(c0, palette[0]);
+	Unpack565(c1, palette[1]);
+	for (int c = 0; c < 3; c++) {
+		if (c0 > c1) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else {
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+}
+
+// Nearest palette entry of every texel; returns the squared error
+static int Bc1Indices(const unsigned char block[16][4], uint16_t c0, uint16_t c1, int indices[16])
+{
+	int palette[4][3];
+	Bc1Palette(c0, c1, palette);
+	int total = 0;
+	for (int i = 0; i < 16; i++) {
+		int best = 0, best_error = INT_MAX;
+		for (int p = 0; p < 4; p++) {
+			int error = 0;
+			for (int c = 0; c < 3; c++)
+				error += (block[i][c] - palette[p][c]) * (block[i][c] - palette[p][c]);
+			if (error < best_error) {
+				best_error = error;
+				best = p;
+			}
+		}
+		indices[i] = best;
+		total += best_error;
+	}
+	return total;
+}
+
+static void EncodeBc1Color(const unsigned char block[16][4], unsigned char out[8])
+{
+	static const float SHARE_OF_C0[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+	float e0[4], e1[4];
+	FitEndpoints(block, 3, e0, e1);
+	uint16_t c0 = Pack565(e0), c1 = Pack565(e1);
+	if (c0 < c1)
+		swap(c0, c1);
+	int indices[16];
+	int error = Bc1Indices(block, c0, c1, indices);
+
+	// one least-squares pass over the chosen indices
+	if (c0 != c1) {
+		float weights[16];
+		for (int i = 0; i < 16; i++)
+			weights[i] = SHARE_OF_C0[indices[i]];
+		if (RefineEndpoints(block, 3, weights, e0, e1)) {
+			uint16_t r0 = Pack565(e0), r1 = Pack565(e1);
+			if (r0 < r1)
+				swap(r0, r1);
+			int refined[16];
+			int refined_error = r0 != r1 ? Bc1Indices(block, r0, r1, refined) : INT_MAX;
+			if (refined_error < error) {
+				c0 = r0;
+				c1 = r1;
+				error = refined_error;
+				memcpy(indices, refined, sizeof(indices));
+			}
+		}
+	}
+	// c0 == c1 decodes in three-colour mode, where index 0 is still c0
+	if (c0 == c1)
+		memset(indices, 0, sizeof(indices));
+
+	uint32_t bits = 0;
+	for (int i = 0; i < 16; i++)
+		bits |= (uint32_t)indices[i] << (2 * i);
+	out[0] = c0 & 0xff;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xff;
+	out[3] = c1 >> 8;
+	memcpy(out + 4, &bits, 4);
+}
+
+static void Bc3AlphaPalette(int a0, int a1, int palette[8])
+{
+	palette[0] = a0;
+	palette[1] = a1;
+	if (a0 > a1) {
+		for (int k = 1; k < 7; k++)
+			palette[k + 1] = ((7 - k) * a0 + k * a1) / 7;
+	}
+	else {
+		for (int k = 1; k < 5; k++)
+			palette[k + 1] = ((5 - k) * a0 + k * a1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+static void EncodeBc3Alpha(const unsigned char block[16][4], unsigned char out[8])
+{
+	int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; i++) {
+		a0 = max(a0, (int)block[i][3]);
+		a1 = min(a1, (int)block[i][3]);
+	}
+	int palette[8];
+	Bc3AlphaPalette(a0, a1, palette);
+
+	uint64_t bits = 0;
+	for (int i = 0; i < 16 && a0 != a1; i++) {
+		int best = 0;
+		for (int p = 1; p < 8; p++) {
+			if (abs(block[i][3] - palette[p]) < abs(block[i][3] - palette[best]))
+				best = p;
+		}
+		bits |= (uint64_t)best << (3 * i);
+	}
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+	for (int b = 0; b < 6; b++)
+		out[2 + b] = (unsigned char)(bits >> (8 * b));
+}
+
+static const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Mode 6 endpoints: 7 bits per channel plus a p-bit shared by the endpoint
+struct Bc7Endpoints
+{
+	int q[2][4];
+	int p[2];
+};
+
+static void Bc7Palette(const Bc7Endpoints &e, int palette[16][4])
+{
+	for (int c = 0; c < 4; c++) {
+		int v0 = (e.q[0][c] << 1) | e.p[0], v1 = (e.q[1][c] << 1) | e.p[1];
+		for (int k = 0; k < 16; k++)
+			palette[k][c] = ((64 - BC7_WEIGHTS4[k]) * v0 + BC7_WEIGHTS4[k] * v1 + 32) >> 6;
+	}
+}
+
+static int Bc7Indices(const unsigned char block[16][4], const Bc7Endpoints &e, int indices[16])
+{
+	int palette[16][4];
+	Bc7Palette(e, palette);
+	int total = 0;
+	for (int i = 0; i < 16; i++) {
+		int best = 0, best_error = INT_MAX;
+		for (int k = 0; k < 16; k++) {
+			int error = 0;
+			for (int c = 0; c < 4; c++)
+				error += (block[i][c] - palette[k][c]) * (block[i][c] - palette[k][c]);
+			if (error < best_error) {
+				best_error = error;
+				best = k;
+			}
+		}
+		indices[i] = best;
+		total += best_error;
+	}
+	return total;
+}
+
+// Quantize float endpoints trying all four p-bit pairs; returns the error
+static int Bc7Quantize(const unsigned char block[16][4], const float e0[4], const float e1[4], Bc7Endpoints &best, int indices[16])
+{
+	int best_error = INT_MAX;
+	for (int pbits = 0; pbits < 4; pbits++) {
+		Bc7Endpoints e;
+		e.p[0] = pbits & 1;
+		e.p[1] = pbits >> 1;
+		for (int c = 0; c < 4; c++) {
+			e.q[0][c] = max(0, min(127, (int)floorf((e0[c] - e.p[0]) / 2.0f + 0.5f)));
+			e.q[1][c] = max(0, min(127, (int)floorf((e1[c] - e.p[1]) / 2.0f + 0.5f)));
+		}
+		int candidate[16];
+		int error = Bc7Indices(block, e, candidate);
+		if (error < best_error) {
+			best_error = error;
+			best = e;
+			memcpy(indices, candidate, sizeof(candidate));
+		}
+	}
+	return best_error;
+}
+
+// 128-bit little-endian bit writer
+static void PutBits(unsigned char out[16], int &position, uint32_t value, int count)
+{
+	for (int b = 0; b < count; b++, position++) {
+		if (value & (1u << b))
+			out[position >> 3] |= (unsigned char)(1 << (position & 7));
+	}
+}
+
+static void EncodeBc7Mode6(const unsigned char block[16][4], unsigned char out[16])
+{
+	float e0[4], e1[4];
+	FitEndpoints(block, 4, e0, e1);
+	Bc7Endpoints endpoints;
+	int indices[16];
+	int error = Bc7Quantize(block, e0, e1, endpoints, indices);
+
+	float weights[16];
+	for (int i = 0; i < 16; i++)
+		weights[i] = (64 - BC7_WEIGHTS4[indices[i]]) / 64.0f;
+	if (RefineEndpoints(block, 4, weights, e0, e1)) {
+		Bc7Endpoints refined;
+		int refined_indices[16];
+		if (Bc7Quantize(block, e0, e1, refined, refined_indices) < error) {
+			endpoints = refined;
+			memcpy(indices, refined_indices, sizeof(indices));
+		}
+	}
+
+	// the anchor (first) index is stored without its top bit
+	if (indices[0] & 8) {
+		swap(endpoints.q[0], endpoints.q[1]);
+		swap(endpoints.p[0], endpoints.p[1]);
+		for (int i = 0; i < 16; i++)
+			indices[i] = 15 - indices[i];
+	}
+
+	memset(out, 0, 16);
+	int position = 0;
+	PutBits(out, position, 1 << 6, 7);
+	for (int c = 0; c < 4; c++) {
+		PutBits(out, position, endpoints.q[0][c], 7);
+		PutBits(out, position, endpoints.q[1][c], 7);
+	}
+	PutBits(out, position, endpoints.p[0], 1);
+	PutBits(out, position, endpoints.p[1], 1);
+	for (int i = 0; i < 16; i++)
+		PutBits(out, position, indices[i], i == 0 ? 3 : 4);
+}
+
+static void EncodeBlock(CookedFormat format, const unsigned char block[16][4], unsigned char *out)
+{
+	switch (format) {
+	case COOKED_BC1:
+		EncodeBc1Color(block, out);
+		break;
+	case COOKED_BC3:
+		EncodeBc3Alpha(block, out);
+		EncodeBc1Color(block, out + 8);
+		break;
+	default:
+		EncodeBc7Mode6(block, out);
+		break;
+	}
+}
+
+void encodeBlocks(CookedFormat format, const unsigned char *pixels, int width, int height, int threads, vector<unsigned char> &out)
+{
+	int blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+	int block_bytes = BLOCK_BYTES[format];
+	out.assign(LevelBytes(format, width, height), 0);
+
+	auto encode_rows = [&](int first, int last) {
+		unsigned char block[16][4];
+		for (int by = first; by < last; by++) {
+			for (int bx = 0; bx < blocks_x; bx++) {
+				LoadBlock(pixels, width, height, bx, by, block);
+				EncodeBlock(format, block, &out[((size_t)by * blocks_x + bx) * block_bytes]);
+			}
+		}
+	};
+
+	threads = max(1, min(threads, blocks_y));
+	vector<thread> workers;
+	for (int t = 1; t < threads; t++)
+		workers.push_back(thread(encode_rows, blocks_y * t / threads, blocks_y * (t + 1) / threads));
+	encode_rows(0, blocks_y / threads);
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+}
+
+/* ---------- block decoders ---------- */
+
+static uint32_t GetBits(const unsigned char in[16], int &position, int count)
+{
+	uint32_t value = 0;
+	for (int b = 0; b < count; b++, position++)
+		value |= (uint32_t)((in[position >> 3] >> (position & 7)) & 1) << b;
+	return value;
+}
+
+static void DecodeBlock(CookedFormat format, const unsigned char *in, unsigned char block[16][4])
+{
+	if (format == COOKED_BC7) {
+		int position = 0;
+		if (GetBits(in, position, 7) != 1 << 6) {
+			// only mode 6 is ever written
+			for (int i = 0; i < 16; i++) {
+				block[i][0] = block[i][2] = block[i][3] = 255;
+				block[i][1] = 0;
+			}
+			return;
+		}
+		Bc7Endpoints e;
+		for (int c = 0; c < 4; c++) {
+			e.q[0][c] = GetBits(in, position, 7);
+			e.q[1][c] = GetBits(in, position, 7);
+		}
+		e.p[0] = GetBits(in, position, 1);
+		e.p[1] = GetBits(in, position, 1);
+		int palette[16][4];
+		Bc7Palette(e, palette);
+		for (int i = 0; i < 16; i++) {
+			int k = GetBits(in, position, i == 0 ? 3 : 4);
+			for (int c = 0; c < 4; c++)
+				block[i][c] = (unsigned char)palette[k][c];
+		}
+		return;
+	}
+
+	const unsigned char *color = format == COOKED_BC3 ? in + 8 : in;
+	uint16_t c0 = color[0] | (color[1] << 8), c1 = color[2] | (color[3] << 8);
+	int palette[4][3];
+	Bc1Palette(c0, c1, palette);
+	uint32_t bits;
+	memcpy(&bits, color + 4, 4);
+	for (int i = 0; i < 16; i++) {
+		int k = (bits >> (2 * i)) & 3;
+		for (int c = 0; c < 3; c++)
+			block[i][c] = (unsigned char)palette[k][c];
+		block[i][3] = format == COOKED_BC1 && c0 <= c1 && k == 3 ? 0 : 255;
+	}
+
+	if (format == COOKED_BC3) {
+		int alpha[8];
+		Bc3AlphaPalette(in[0], in[1], alpha);
+		uint64_t alpha_bits = 0;
+		for (int b = 0; b < 6; b++)
+			alpha_bits |= (uint64_t)in[2 + b] << (8 * b);
+		for (int i = 0; i < 16; i++)
+			block[i][3] = (unsigned char)alpha[(alpha_bits >> (3 * i)) & 7];
+	}
+}
+
+void decodeBlocks(CookedFormat format, const unsigned char *blocks, int width, int height, vector<unsigned char> &pixels)
+{
+	int blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+	pixels.assign((size_t)width * height * 4, 0);
+	unsigned char block[16][4];
+	for (int by = 0; by < blocks_y; by++) {
+		for (int bx = 0; bx < blocks_x; bx++) {
+			DecodeBlock(format, blocks + ((size_t)by * blocks_x + bx) * BLOCK_BYTES[format], block);
+			for (int y = 0; y < 4 && by * 4 + y < height; y++) {
+				for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+					memcpy(&pixels[((size_t)(by * 4 + y) * width + bx * 4 + x) * 4], block[y * 4 + x], 4);
+			}
+		}
+	}
+}
+
+/* ---------- cooking ---------- */
+
+// Squared error and sample count over the first `channels` channels
+static void AddError(int channels, const vector<unsigned char> &a, const unsigned char *b, double *error, double *samples)
+{
+	for (size_t i = 0; i < a.size(); i += 4) {
+		for (int c = 0; c < channels; c++) {
+			double d = (double)a[i + c] - b[i + c];
+			*error += d * d;
+		}
+		*samples += channels;
+	}
+}
+
+static double Psnr(double error, double samples)
+{
+	if (error == 0.0)
+		return 99.0;
+	return 10.0 * log10(255.0 * 255.0 / (error / samples));
+}
+
+bool cookTexture(const char *source_path, const char *cooked_path, int format, int threads, CookResult *result)
+{
+	CookStamp stamp;
+	memset(&stamp, 0, sizeof(stamp));
+	vector<unsigned char> content;
+	if (!StatFile(source_path, &stamp.source_size, &stamp.source_mtime) || !ReadWholeFile(source_path, content))
+		return false;
+	stamp.tag = DDS_FOURCC('C', 'O', 'O', 'K');
+	stamp.version = COOKED_TEXTURE_VERSION;
+	stamp.source_hash = hashTextureContent(content.data(), content.size());
+
+	int width, height, source_channels;
+	unsigned char *pixels = stbi_load_from_memory(content.data(), (int)content.size(), &width, &height, &source_channels, 4);
+	if (pixels == NULL)
+		return false;
+
+	bool opaque = true;
+	for (size_t i = 3; i < (size_t)width * height * 4 && opaque; i += 4)
+		opaque = pixels[i] == 255;
+	if (format < 0)
+		format = opaque ? COOKED_BC1 : COOKED_BC3;
+	// alpha counts only where the image has some and the format keeps it
+	int channels = opaque || format == COOKED_BC1 ? 3 : 4;
+
+	auto start = chrono::steady_clock::now();
+	MipChain chain;
+	buildMipChain(pixels, width, height, chain, threads);
+	int level_count = (int)chain.levels.size() + 1;
+	vector<const unsigned char *> levels(1, pixels);
+	vector<int> widths(1, width), heights(1, height);
+	for (int level = 0; level < level_count - 1; level++) {
+		levels.push_back(chain.levels[level].data());
+		widths.push_back(chain.widths[level]);
+		heights.push_back(chain.heights[level]);
+	}
+	vector<vector<unsigned char> > encoded(level_count);
+	for (int level = 0; level < level_count; level++)
+		encodeBlocks((CookedFormat)format, levels[level], widths[level], heights[level], threads, encoded[level]);
+	double encode_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	double error = 0.0, samples = 0.0, chain_error = 0.0, chain_samples = 0.0;
+	size_t cooked_bytes = 0;
+	for (int level = 0; level < level_count; level++) {
+		vector<unsigned char> decoded;
+		decodeBlocks((CookedFormat)format, encoded[level].data(), widths[level], heights[level], decoded);
+		if (level == 0)
+			AddError(channels, decoded, pixels, &error, &samples);
+		AddError(channels, decoded, levels[level], &chain_error, &chain_samples);
+		cooked_bytes += encoded[level].size();
+	}
+	stbi_image_free(pixels);
+
+	DdsHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = DDS_FOURCC('D', 'D', 'S', ' ');
+	header.size = sizeof(DdsHeader) - 4;
+	header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+	header.height = height;
+	header.width = width;
+	header.linear_size = (uint32_t)encoded[0].size();
+	header.mip_count = (uint32_t)level_count;
+	memcpy(header.reserved1, &stamp, sizeof(stamp));
+	header.format.size = sizeof(DdsPixelFormat);
+	header.format.flags = DDPF_FOURCC;
+	header.format.fourcc = FORMAT_FOURCC[format];
+	header.caps[0] = DDSCAPS_TEXTURE | DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+
+	DdsHeaderDx10 dx10;
+	memset(&dx10, 0, sizeof(dx10));
+	dx10.dxgi_format = DXGI_FORMAT_BC7_UNORM;
+	dx10.dimension = D3D10_RESOURCE_DIMENSION_TEXTURE2D;
+	dx10.array_size = 1;
+
+	FILE *fp = fopen(cooked_path, "wb");
+	if (fp == NULL)
+		return false;
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	if (ok && format == COOKED_BC7)
+		ok = fwrite(&dx10, sizeof(dx10), 1, fp) == 1;
+	for (size_t level = 0; ok && level < encoded.size(); level++)
+		ok = fwrite(encoded[level].data(), 1, encoded[level].size(), fp) == encoded[level].size();
+	fclose(fp);
+	if (!ok) {
+		remove(cooked_path);
+		return false;
+	}
+
+	result->format = (CookedFormat)format;
+	result->width = width;
+	result->height = height;
+	result->level_count = level_count;
+	result->cooked_bytes = cooked_bytes;
+	result->psnr = Psnr(error, samples);
+	result->chain_psnr = Psnr(chain_error, chain_samples);
+	result->encode_ms = encode_ms;
+	return true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "mipchain.h"
+
+// Offline texture cooking: a source image is decoded once, given a full
+// gamma-correct mip chain and block-compressed into a DDS file next to it
+// ("bricks.png" -> "bricks.png.dds"). At runtime the texture cache maps the
+// DDS and uploads its levels as they are, with no decode and no
+// glGenerateMipmap. The source's size, mtime and content hash are stamped
+// into the DDS header so that a stale file is ignored, like the mesh cache.
+// Bump COOKED_TEXTURE_VERSION whenever the encoders or the filter change.
+#define COOKED_TEXTURE_VERSION 2
+#define COOKED_MAX_LEVELS 16
+
+enum CookedFormat
+{
+	COOKED_BC1,     // RGB, 8 bytes per 4x4 block, alpha dropped
+	COOKED_BC3,     // RGBA, 16 bytes per block: BC1 colour plus 8-bit interpolated alpha
+	COOKED_BC7,     // RGBA, 16 bytes per block, mode 6 only
+	COOKED_FORMAT_COUNT
+};
+
+extern const char *COOKED_FORMAT_NAMES[COOKED_FORMAT_COUNT];
+
+struct CookedTexture
+{
+	CookedFormat format;
+	int width, height;
+	int level_count;
+	const unsigned char *levels[COOKED_MAX_LEVELS];
+	size_t level_sizes[COOKED_MAX_LEVELS];
+	uint64_t source_hash;   // content key of the source image, see texturecache.cpp
+	uint64_t source_size;
+
+	void *base;     // the mapping
+	size_t size;
+	void *file_handle;
+	void *mapping_handle;
+};
+
+// Content hash of an image file, shared with the texture cache so a cooked
+// texture and its source resolve to the same cache entry
+uint64_t hashTextureContent(const unsigned char *data, size_t size);
+
+// Map the cooked texture of source_path and check it against the source.
+// Returns false if it is missing, from another version or stale.
+bool cookedTextureOpen(const char *source_path, const char *cooked_path, CookedTexture *texture);
+void cookedTextureClose(CookedTexture *texture);
+
+// Block-compress one level, splitting the block rows over threads
+void encodeBlocks(CookedFormat format, const unsigned char *pixels, int width, int height, int threads, std::vector<unsigned char> &out);
+
+// Decode blocks back to RGBA8, for the quality check
+void decodeBlocks(CookedFormat format, const unsigned char *blocks, int width, int height, std::vector<unsigned char> &pixels);
+
+struct CookResult
+{
+	CookedFormat format;
+	int width, height, level_count;
+	size_t cooked_bytes;    // compressed mip chain
+	double psnr;            // level 0 against the source, dB; RGB plus alpha if the image has any
+	double chain_psnr;      // every level against the uncompressed chain, dB
+	double encode_ms;
+};
+
+// Decode source_path, build the mip chain, encode it and write cooked_path.
+// The image is decoded with the current stbi flip setting; the viewer's is
+// on, rows bottom-up as GL takes them. format < 0 picks BC1 for opaque
+// images and BC3 otherwise.
+// Returns false if the source cannot be decoded or the file cannot be written.
+bool cookTexture(const char *source_path, const char *cooked_path, int format, int threads, CookResult *result);
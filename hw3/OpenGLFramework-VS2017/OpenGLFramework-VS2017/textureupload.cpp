@@ -0,0 +1,285 @@
+#include "textureupload.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <utility>
+
+#include <STB/stb_image.h>
+
+using namespace std;
+
+// levels up to this size are uploaded by textureUploadStart itself, so a
+// texture has something to show before its first streamed row
+#define UPLOAD_DIRECT_BYTES (64 * 64 * 4)
+
+struct UploadJob
+{
+	GLuint texture = 0;
+	TextureImage image;
+	int level = 0;  // level being copied, counting down to 0
+	int row = 0;    // next row of it
+};
+
+// a part of the ring the GPU may still read from
+struct RingRange
+{
+	size_t begin, end;
+	GLsync fence;   // NULL until the end of the frame that filled it
+};
+
+static size_t ring_bytes = 16 << 20;
+static size_t frame_bytes = 4 << 20;
+
+static GLuint ring = 0;
+static size_t ring_size = 0;
+static size_t ring_head = 0;
+static deque<RingRange> in_flight;  // oldest first
+static deque<UploadJob> jobs;
+
+static int LevelWidth(const TextureImage &image, int level)
+{
+	return level == 0 ? image.width : image.mips.widths[level - 1];
+}
+
+static int LevelHeight(const TextureImage &image, int level)
+{
+	return level == 0 ? image.height : image.mips.heights[level - 1];
+}
+
+static const unsigned char *LevelPixels(const TextureImage &image, int level)
+{
+	return level == 0 ? image.pixels : image.mips.levels[level - 1].data();
+}
+
+static void FreeJob(UploadJob &job)
+{
+	stbi_image_free(job.image.pixels);
+	job.image.pixels = NULL;
+	job.image.mips = MipChain();
+}
+
+void textureUploadConfigure(size_t ring_capacity, size_t frame_budget)
+{
+	// a row of the largest texture GL takes has to fit
+	ring_bytes = max(ring_capacity, (size_t)1 << 20);
+	frame_bytes = frame_budget;
+}
+
+// Contiguous ring space for size bytes; false while the GPU may still read
+// all the space there is
+static bool Allocate(size_t size, size_t *offset)
+{
+	if (in_flight.empty())
+	{
+		ring_head = 0;
+		if (size > ring_size)
+			return false;
+		*offset = 0;
+	}
+	else
+	{
+		size_t tail = in_flight.front().begin;
+		if (ring_head > tail && ring_size - ring_head >= size)
+			*offset = ring_head;
+		else if (ring_head > tail && tail >= size)
+			*offset = 0;    // wrap, the end of the ring stays unused this time round
+		else if (ring_head <= tail && tail - ring_head >= size)
+			*offset = ring_head;
+		else
+			return false;
+	}
+	ring_head = *offset + size;
+	RingRange range = { *offset, ring_head, NULL };
+	in_flight.push_back(range);
+	return true;
+}
+
+// Fence the ranges filled since the last fence
+static void Fence()
+{
+	if (in_flight.empty() || in_flight.back().fence != NULL)
+		return;
+	GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	for (deque<RingRange>::reverse_iterator it = in_flight.rbegin(); it != in_flight.rend() && it->fence == NULL; ++it)
+		it->fence = fence;
+}
+
+// Free the ranges the GPU is done with; with wait, block until the oldest is
+static void Retire(bool wait)
+{
+	while (!in_flight.empty() && in_flight.front().fence != NULL)
+	{
+		GLsync fence = in_flight.front().fence;
+		GLenum status = glClientWaitSync(fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000 : 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			return;
+		wait = false;
+		// one fence covers every range of its frame
+		while (!in_flight.empty() && in_flight.front().fence == fence)
+			in_flight.pop_front();
+		glDeleteSync(fence);
+	}
+}
+
+// Copy rows of the job's current level through the ring, at least one and
+// otherwise up to budget bytes. Returns the bytes copied, 0 if the ring is
+// full. The job's texture has to be bound.
+static size_t CopyRows(UploadJob &job, size_t budget)
+{
+	int width = LevelWidth(job.image, job.level), height = LevelHeight(job.image, job.level);
+	size_t row_bytes = (size_t)width * 4;
+	int rows = (int)min((size_t)(height - job.row), max((size_t)1, budget / row_bytes));
+	size_t offset = 0;
+	while (rows > 0 && !Allocate(rows * row_bytes, &offset))
+		rows /= 2;
+	if (rows == 0)
+		return 0;
+
+	const unsigned char *src = LevelPixels(job.image, job.level) + job.row * row_bytes;
+	void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, rows * row_bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (dst != NULL)
+	{
+		// the fences keep the GPU off this range, no need for GL to sync
+		memcpy(dst, src, rows * row_bytes);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glTexSubImage2D(GL_TEXTURE_2D, job.level, 0, job.row, width, rows, GL_RGBA, GL_UNSIGNED_BYTE, (const void *)offset);
+	}
+	else
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glTexSubImage2D(GL_TEXTURE_2D, job.level, 0, job.row, width, rows, GL_RGBA, GL_UNSIGNED_BYTE, src);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+	}
+
+	job.row += rows;
+	if (job.row == height)
+	{
+		// sampling may reach down to the level now complete
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, job.level);
+		job.level--;
+		job.row = 0;
+	}
+	return rows * row_bytes;
+}
+
+// Copy queued rows up to budget bytes, only those of texture unless it is
+// 0. With wait, block on the GPU when the ring is full instead of leaving
+// the rest to the next call. Returns whether it bound a texture, which it
+// does even when the ring turns out to be full.
+static bool Pump(size_t budget, GLuint texture, bool wait)
+{
+	if (jobs.empty())
+		return false;
+	if (ring != 0 && ring_size != ring_bytes && in_flight.empty())
+	{
+		glDeleteBuffers(1, &ring);
+		ring = 0;
+	}
+	if (ring == 0)
+	{
+		glGenBuffers(1, &ring);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, ring_bytes, NULL, GL_STREAM_DRAW);
+		ring_size = ring_bytes;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+	Retire(false);
+
+	size_t spent = 0;
+	GLuint bound = 0;
+	for (size_t j = 0; j < jobs.size() && spent < budget; )
+	{
+		UploadJob &job = jobs[j];
+		if (texture != 0 && job.texture != texture)
+		{
+			j++;
+			continue;
+		}
+		if (bound != job.texture)
+		{
+			glBindTexture(GL_TEXTURE_2D, job.texture);
+			bound = job.texture;
+		}
+		size_t bytes = CopyRows(job, budget - spent);
+		if (bytes == 0)
+		{
+			if (!wait)
+				break;
+			Fence();
+			Retire(true);
+			continue;
+		}
+		spent += bytes;
+		if (job.level < 0)
+		{
+			FreeJob(job);
+			jobs.erase(jobs.begin() + j);
+		}
+	}
+	Fence();
+	// client-memory uploads elsewhere must not read from the ring
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return bound != 0;
+}
+
+GLuint textureUploadStart(TextureImage &image)
+{
+	if (image.pixels == NULL || image.mips.levels.empty())
+		return createTexture(image);
+
+	jobs.push_back(UploadJob());
+	UploadJob &job = jobs.back();
+	swap(job.image, image);
+	glGenTextures(1, &job.texture);
+	glBindTexture(GL_TEXTURE_2D, job.texture);
+	int level_count = (int)job.image.mips.levels.size() + 1;
+	job.level = level_count - 1;
+	for (int level = 0; level < level_count; level++)
+	{
+		int width = LevelWidth(job.image, level), height = LevelHeight(job.image, level);
+		bool direct = (size_t)width * height * 4 <= UPLOAD_DIRECT_BYTES;
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, direct ? LevelPixels(job.image, level) : NULL);
+		if (direct)
+			job.level = min(job.level, level - 1);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, job.level + 1);
+
+	GLuint texture = job.texture;
+	if (job.level < 0)
+	{
+		FreeJob(job);
+		jobs.pop_back();
+	}
+	return texture;
+}
+
+bool textureUploadUpdate()
+{
+	return Pump(frame_bytes, 0, false);
+}
+
+void textureUploadFinish(GLuint texture)
+{
+	Pump(SIZE_MAX, texture, true);
+}
+
+void textureUploadCancel(GLuint texture)
+{
+	for (size_t j = 0; j < jobs.size(); j++)
+	{
+		if (jobs[j].texture == texture)
+		{
+			FreeJob(jobs[j]);
+			jobs.erase(jobs.begin() + j);
+			return;
+		}
+	}
+}
+
+int textureUploadPending()
+{
+	return (int)jobs.size();
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <stddef.h>
+
+#include "texturecache.h"
+
+// Streaming texture uploads. A texture is created with every level
+// allocated, the small levels uploaded at once, and the rest queued. Each
+// frame, textureUploadUpdate copies up to a byte budget of queued rows into
+// a ring of pixel unpack buffer memory and issues glTexSubImage2D from it,
+// so the driver reads the pixels with the GPU instead of copying them on
+// the call. A fence per frame tells when a part of the ring is free again.
+// Levels go coarsest first and GL_TEXTURE_BASE_LEVEL follows the finest
+// complete one, so a large texture is usable at once and sharpens over a
+// few frames. GL thread only; changes the GL_TEXTURE_2D binding of the
+// active unit.
+
+// Ring size and bytes copied per frame; takes effect when the ring is next
+// created, i.e. with no upload in flight
+void textureUploadConfigure(size_t ring_bytes, size_t frame_bytes);
+
+// Start streaming an image with its CPU mip chain; takes its pixels and
+// mips. An image without mips is uploaded at once with createTexture.
+// Returns -1 if the image has no pixels.
+GLuint textureUploadStart(TextureImage &image);
+
+// Once per frame: retire the finished parts of the ring and copy the next
+// frame budget. Returns whether it changed the texture binding, whether or
+// not the ring had room for any rows.
+bool textureUploadUpdate();
+
+// Upload the rest of a texture, or of every texture for 0, waiting on the
+// GPU for ring space where needed
+void textureUploadFinish(GLuint texture);
+
+// Drop what is left of a texture's upload, before deleting it
+void textureUploadCancel(GLuint texture);
+
+// Textures with levels still queued
+int textureUploadPending();
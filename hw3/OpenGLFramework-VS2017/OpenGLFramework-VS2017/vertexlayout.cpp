@@ -0,0 +1,178 @@
+#include "vertexlayout.h"
+
+#include <math.h>
+#include <string.h>
+
+using namespace std;
+
+const VertexLayout VERTEX_LAYOUTS[] = {
+	// 44 bytes: everything in 32-bit float
+	{ "float", 44, {
+		{ ATTRIB_POSITION, ATTRIB_FLOAT, 3, 0 },
+		{ ATTRIB_COLOR, ATTRIB_FLOAT, 3, 12 },
+		{ ATTRIB_NORMAL, ATTRIB_FLOAT, 3, 24 },
+		{ ATTRIB_TEXCOORD, ATTRIB_FLOAT, 2, 36 } } },
+	// 20 bytes
+	{ "compact", 20, {
+		{ ATTRIB_POSITION, ATTRIB_SNORM16, 4, 0 },
+		{ ATTRIB_COLOR, ATTRIB_UNORM8, 4, 16 },
+		{ ATTRIB_NORMAL, ATTRIB_INT_2_10_10_10, 4, 8 },
+		{ ATTRIB_TEXCOORD, ATTRIB_HALF, 2, 12 } } },
+	// 20 bytes, texcoords in unorm16: more precision, but only for [0, 1]
+	{ "compact-unorm-uv", 20, {
+		{ ATTRIB_POSITION, ATTRIB_SNORM16, 4, 0 },
+		{ ATTRIB_COLOR, ATTRIB_UNORM8, 4, 16 },
+		{ ATTRIB_NORMAL, ATTRIB_INT_2_10_10_10, 4, 8 },
+		{ ATTRIB_TEXCOORD, ATTRIB_UNORM16, 2, 12 } } },
+};
+const int VERTEX_LAYOUT_COUNT = sizeof(VERTEX_LAYOUTS) / sizeof(VERTEX_LAYOUTS[0]);
+
+const VertexLayout *findVertexLayout(const char *name)
+{
+	for (int i = 0; i < VERTEX_LAYOUT_COUNT; i++) {
+		if (strcmp(VERTEX_LAYOUTS[i].name, name) == 0)
+			return &VERTEX_LAYOUTS[i];
+	}
+	return NULL;
+}
+
+// Round to nearest even, flushing values too small for a half denormal to zero
+static uint16_t FloatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+	uint32_t abs_bits = bits & 0x7fffffff;
+
+	if (abs_bits >= 0x7f800000)                 // inf or nan
+		return sign | 0x7c00 | (abs_bits > 0x7f800000 ? 0x200 : 0);
+	if (abs_bits >= 0x477ff000)                 // overflows to inf
+		return sign | 0x7c00;
+	if (abs_bits < 0x33000001)                  // below half of the smallest denormal
+		return sign;
+
+	int exponent = (int)(abs_bits >> 23) - 127 + 15;
+	uint32_t mantissa = (abs_bits & 0x7fffff) | 0x800000;
+	int shift = exponent > 0 ? 13 : 14 - exponent;   // denormals shift further
+	uint32_t half = mantissa >> shift;
+	uint32_t rest = mantissa & ((1u << shift) - 1);
+	uint32_t halfway = 1u << (shift - 1);
+	if (rest > halfway || (rest == halfway && (half & 1)))
+		half++;
+	if (exponent > 0)
+		half = ((uint32_t)exponent << 10) + (half - 0x400);  // carry may bump the exponent
+	return sign | (uint16_t)half;
+}
+
+static float Clamp(float value, float lo, float hi)
+{
+	return value < lo ? lo : (value > hi ? hi : value);
+}
+
+// Pack one attribute; src holds src_components floats
+static bool PackAttrib(const VertexAttrib &attrib, const float *src, int src_components, unsigned char *dst)
+{
+	float v[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int c = 0; c < src_components && c < 4; c++)
+		v[c] = src[c];
+	// opaque alpha for colors, w stays 0 otherwise (unused by the shader)
+	if (attrib.location == ATTRIB_COLOR)
+		v[3] = 1.0f;
+
+	switch (attrib.format) {
+	case ATTRIB_FLOAT:
+		memcpy(dst, v, attrib.components * sizeof(float));
+		return true;
+	case ATTRIB_HALF:
+		for (int c = 0; c < attrib.components; c++) {
+			uint16_t h = FloatToHalf(v[c]);
+			memcpy(dst + c * 2, &h, 2);
+		}
+		return true;
+	case ATTRIB_SNORM16:
+		for (int c = 0; c < attrib.components; c++) {
+			if (v[c] < -1.0001f || v[c] > 1.0001f)
+				return false;
+			int16_t s = (int16_t)lroundf(Clamp(v[c], -1.0f, 1.0f) * 32767.0f);
+			memcpy(dst + c * 2, &s, 2);
+		}
+		return true;
+	case ATTRIB_UNORM16:
+		for (int c = 0; c < attrib.components; c++) {
+			if (v[c] < 0.0f || v[c] > 1.0f)
+				return false;
+			uint16_t u = (uint16_t)lroundf(v[c] * 65535.0f);
+			memcpy(dst + c * 2, &u, 2);
+		}
+		return true;
+	case ATTRIB_UNORM8:
+		for (int c = 0; c < attrib.components; c++)
+			dst[c] = (unsigned char)lroundf(Clamp(v[c], 0.0f, 1.0f) * 255.0f);
+		return true;
+	case ATTRIB_INT_2_10_10_10: {
+		// only used for directions: renormalize, the shader normalizes anyway
+		float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		float scale = length > 0.0f ? 1.0f / length : 0.0f;
+		uint32_t packed = 0;
+		for (int c = 0; c < 3; c++) {
+			int32_t s = (int32_t)lroundf(Clamp(v[c] * scale, -1.0f, 1.0f) * 511.0f);
+			packed |= ((uint32_t)s & 0x3ff) << (c * 10);
+		}
+		memcpy(dst, &packed, 4);
+		return true;
+	}
+	}
+	return false;
+}
+
+bool packVertices(const VertexLayout &layout, const MeshCacheData &data, vector<unsigned char> &out)
+{
+	const float *streams[ATTRIB_LOCATION_COUNT] = { data.positions, data.colors, data.normals, data.texcoords };
+	const int stream_components[ATTRIB_LOCATION_COUNT] = { 3, 3, 3, 2 };
+
+	out.assign((size_t)data.vertex_count * layout.stride, 0);
+	for (uint32_t v = 0; v < data.vertex_count; v++) {
+		unsigned char *vertex = &out[(size_t)v * layout.stride];
+		for (int a = 0; a < ATTRIB_LOCATION_COUNT; a++) {
+			const VertexAttrib &attrib = layout.attribs[a];
+			const float *src = streams[attrib.location];
+			if (src == NULL)
+				continue;
+			int n = stream_components[attrib.location];
+			if (!PackAttrib(attrib, src + (size_t)v * n, n, vertex + attrib.offset)) {
+				out.clear();
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void setupVertexAttribs(const VertexLayout &layout)
+{
+	for (int a = 0; a < ATTRIB_LOCATION_COUNT; a++) {
+		const VertexAttrib &attrib = layout.attribs[a];
+		const void *offset = (const void *)(size_t)attrib.offset;
+		switch (attrib.format) {
+		case ATTRIB_FLOAT:
+			glVertexAttribPointer(attrib.location, attrib.components, GL_FLOAT, GL_FALSE, layout.stride, offset);
+			break;
+		case ATTRIB_HALF:
+			glVertexAttribPointer(attrib.location, attrib.components, GL_HALF_FLOAT, GL_FALSE, layout.stride, offset);
+			break;
+		case ATTRIB_SNORM16:
+			glVertexAttribPointer(attrib.location, attrib.components, GL_SHORT, GL_TRUE, layout.stride, offset);
+			break;
+		case ATTRIB_UNORM16:
+			glVertexAttribPointer(attrib.location, attrib.components, GL_UNSIGNED_SHORT, GL_TRUE, layout.stride, offset);
+			break;
+		case ATTRIB_UNORM8:
+			glVertexAttribPointer(attrib.location, attrib.components, GL_UNSIGNED_BYTE, GL_TRUE, layout.stride, offset);
+			break;
+		case ATTRIB_INT_2_10_10_10:
+			glVertexAttribPointer(attrib.location, 4, GL_INT_2_10_10_10_REV, GL_TRUE, layout.stride, offset);
+			break;
+		}
+		glEnableVertexAttribArray(attrib.location);
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <vector>
+
+#include "meshcache.h"
+
+// Component formats an attribute can be stored in
+enum VertexAttribFormat
+{
+	ATTRIB_FLOAT,           // 32-bit float
+	ATTRIB_HALF,            // 16-bit float
+	ATTRIB_SNORM16,         // int16 mapped to [-1, 1]
+	ATTRIB_UNORM16,         // uint16 mapped to [0, 1]
+	ATTRIB_UNORM8,          // uint8 mapped to [0, 1]
+	ATTRIB_INT_2_10_10_10,  // GL_INT_2_10_10_10_REV mapped to [-1, 1], always 4 components
+};
+
+// Shader inputs, see shader.vs.glsl
+enum VertexAttribLocation
+{
+	ATTRIB_POSITION = 0,
+	ATTRIB_COLOR = 1,
+	ATTRIB_NORMAL = 2,
+	ATTRIB_TEXCOORD = 3,
+	ATTRIB_LOCATION_COUNT
+};
+
+struct VertexAttrib
+{
+	VertexAttribLocation location;
+	VertexAttribFormat format;
+	GLint components;       // stored components, missing ones are padded
+	GLuint offset;          // byte offset inside a vertex
+};
+
+// Interleaved vertex layout; both the packing and the glVertexAttribPointer
+// setup are generated from it.
+struct VertexLayout
+{
+	const char *name;
+	GLsizei stride;
+	VertexAttrib attribs[ATTRIB_LOCATION_COUNT];
+};
+
+extern const VertexLayout VERTEX_LAYOUTS[];
+extern const int VERTEX_LAYOUT_COUNT;
+
+// NULL if there is no layout with that name
+const VertexLayout *findVertexLayout(const char *name);
+
+// Interleave the float streams of a mesh into the layout. Positions are
+// expected inside [-1, 1], which normalization() guarantees.
+// Returns false if a value does not fit the layout (e.g. texcoords outside
+// [0, 1] for a unorm16 layout); out is left empty then.
+bool packVertices(const VertexLayout &layout, const MeshCacheData &data, std::vector<unsigned char> &out);
+
+// glVertexAttribPointer/glEnableVertexAttribArray for every attribute of the
+// layout, sourcing from the buffer bound to GL_ARRAY_BUFFER at offset 0
+void setupVertexAttribs(const VertexLayout &layout);